@@ -27,19 +27,44 @@
  * @return the number of addresses stored in the buffer
  */
 MYS_PUBLIC int mys_backtrace(void **addrs, int max_depth);
+/**
+ * @brief Resolve source locations and symbols of addresses in batch into a global cache.
+ * 
+ * Addresses already in the cache and duplicated addresses are skipped. The rest are grouped by the
+ * object file they belong to (according to /proc/self/maps, parsed once), and each object file is
+ * resolved by a single `addr2line` call. Later `mys_backtrace_source()` and `mys_backtrace_symbol()`
+ * on these addresses are served from the cache.
+ * 
+ * @param addrs the addresses to resolve
+ * @param naddrs the number of addresses
+ */
+MYS_PUBLIC void mys_backtrace_resolve(void **addrs, int naddrs);
+/**
+ * @brief Drop all cached symbols and process maps, e.g., after libraries are unloaded.
+ */
+MYS_PUBLIC void mys_backtrace_cache_clear();
 /**
  * @brief Get the source file and line number of a given address.
  * 
  * @param addr the address to look up
  * @param source the buffer to store the source file and line number
  * @param max_size the maximum size of the source buffer
+ * 
+ * @note Results are cached, see `mys_backtrace_resolve()`.
  */
 MYS_PUBLIC void mys_backtrace_source(void *addr, char *source, size_t max_size);
 /**
  * @brief Get the symbol name of a given address.
  * 
+ * The symbol is the demangled function name reported by `addr2line -f -C`, e.g. `where_am_i`,
+ * which also names static functions. Only if addr2line cannot name the function, it is the
+ * `backtrace_symbols()` string, e.g. `./a.out(func+0x12) [0x401234]`, which was the format of
+ * all symbols before the cache was added.
+ * 
  * @param addr the address to look up
  * @param symbol the buffer to store the symbol name
  * @param max_size the maximum size of the symbol buffer
+ * 
+ * @note Results are cached, see `mys_backtrace_resolve()`.
  */
 MYS_PUBLIC void mys_backtrace_symbol(void *addr, char *symbol, size_t max_size);
@@ -20,15 +20,47 @@
 #include <stdarg.h>
 
 #include "os.h"
+#include "atomic.h"
 #include "hrtime.h"
 #include "log.h"
 
 MYS_PUBLIC void mys_checkpoint_init();
-MYS_PUBLIC void mys_checkpoint_reset();
+MYS_PUBLIC void mys_checkpoint_reset(); // drop recorded checkpoints, keep interned names
 MYS_PUBLIC void mys_checkpoint(const char *name_format, ...);
 MYS_PUBLIC int mys_checkpoint_dump(const char *file_format, ...);
+/**
+ * @brief Intern a checkpoint name once, and get a handle for mys_checkpoint_at()
+ * @return The handle (>= 0). The same name always gets the same handle.
+ */
+MYS_ATTR_PRINTF(1, 2) MYS_PUBLIC int mys_checkpoint_intern(const char *name_format, ...);
+/**
+ * @brief Record a checkpoint of an interned name
+ *
+ * Appends to a buffer of the calling thread without any lock. Thread ids are never reused, and
+ * threads beyond the first 4096 share one buffer under a lock. mys_checkpoint_dump() merges
+ * buffers of all threads in time order, and should not run concurrently with recording.
+ */
+MYS_PUBLIC void mys_checkpoint_at(int handle);
+/**
+ * @brief Dump min, mean and max over ranks of the time each checkpoint name is first reached (Collective call)
+ *
+ * Rank 0 writes one CSV for all ranks: name,ranks,count,min,mean,max,loc_min,loc_max.
+ * `ranks` is the number of ranks that reached the checkpoint, and the statistics are over those ranks.
+ * `count` is the total number of records of the name.
+ */
+MYS_ATTR_PRINTF(1, 2) MYS_PUBLIC int mys_checkpoint_dump_aggregate(const char *file_format, ...);
 
 #define CHECKPOINT(name_format, ...) mys_checkpoint(name_format, ##__VA_ARGS__)
+// Same as CHECKPOINT("%s", name), but the name is interned once per call site
+#define CHECKPOINT_FAST(name) do {                                             \
+    static int _mys_chk_handle = -1;                                           \
+    int _mys_chk_h = mys_atomic_load_n(&_mys_chk_handle, MYS_ATOMIC_RELAXED);  \
+    if (MYS_UNLIKELY(_mys_chk_h < 0)) {                                        \
+        _mys_chk_h = mys_checkpoint_intern("%s", (name));                     \
+        mys_atomic_store_n(&_mys_chk_handle, _mys_chk_h, MYS_ATOMIC_RELAXED);  \
+    }                                                                          \
+    mys_checkpoint_at(_mys_chk_h);                                             \
+} while (0)
 
 /**
  * @example
@@ -41,7 +73,10 @@ int main()
     CHECKPOINT("zzz-%06d", 2);
     CHECKPOINT("zzz-%06d", 3);
     CHECKPOINT("zzz-%06d", 4);
+    for (int i = 0; i < 1000; i++)
+        CHECKPOINT_FAST("loop");
     mys_checkpoint_dump("./CHK/checkpoint.%06d.csv", MYRANK());
+    mys_checkpoint_dump_aggregate("./CHK/checkpoint.csv");
     return 0;
 }
 
@@ -15,6 +15,7 @@
 #include "_config.h"
 #include "os.h"
 #include "log.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -69,6 +70,18 @@ MYS_PUBLIC int mys_debug_clear_signal(int signo);
  */
 MYS_PUBLIC void mys_debug_set_message(const char *fmt, ...);
 MYS_PUBLIC void mys_debug_clear_message();
+/**
+ * @brief Dump the latest events of a trace when a signal or timeout is caught.
+ * 
+ * @param trace The trace to dump, typically a flight recorder from `mys_trace_create_ring()`. NULL to disable.
+ * @param max_events Dump at most this many latest events, 0 for all.
+ * 
+ * @note The trace must stay alive until it is unset (or `mys_debug_fini()`).
+ *       The dump itself does not allocate memory, but it formats text with snprintf(), and
+ *       the backtrace printed before it calls malloc(). So the handler is best effort and
+ *       may hang if the signal interrupted malloc().
+ */
+MYS_PUBLIC void mys_debug_set_trace(mys_trace_t *trace, size_t max_events);
 
 // To enable this functionality, you have to
 // 1) Add `#define MYS_ENABLE_DEBUG_TIMEOUT` before `#include mys.h`
@@ -98,6 +98,54 @@ MYS_PUBLIC void mys_hrreset();
  */
 MYS_PUBLIC void mys_hrsync(mys_MPI_Comm comm);
 
+/**
+ * @brief Get raw ticks of the cheapest process-wide counter
+ * 
+ * Unlike `mys_hrtick()`, no per-thread offset is applied and no conversion is done, so values read by
+ * different threads are directly comparable. Use it to timestamp many events and convert them later with
+ * `mys_hrfreq_raw()`. The counter is CNTVCT_EL0 on AArch64, the invariant TSC on x86-64 (if the CPU
+ * advertises one), and CLOCK_MONOTONIC nanoseconds otherwise.
+ * 
+ * @return The counter value. Its epoch is unspecified.
+ * 
+ * @see mys_hrfreq_raw, mys_hrname_raw, mys_hrcalibrate
+ */
+MYS_PUBLIC uint64_t mys_hrtick_raw();
+
+/**
+ * @brief Get the frequency of `mys_hrtick_raw()` in ticks per second
+ * 
+ * @note For the TSC the frequency is measured against CLOCK_MONOTONIC (about 10ms) at the first call.
+ */
+MYS_PUBLIC uint64_t mys_hrfreq_raw();
+
+/**
+ * @brief Get the name of the counter behind `mys_hrtick_raw()`
+ */
+MYS_PUBLIC const char *mys_hrname_raw();
+
+typedef struct mys_hrcalib_t {
+    uint64_t freq;     // ticks per second of mys_hrtick_raw()
+    double resolution; // smallest step observed between two reads (seconds)
+    double overhead;   // average cost of one mys_hrtick_raw() call (seconds)
+    double skew;       // largest offset between the counters of two cores (seconds)
+    double drift;      // relative rate error against CLOCK_MONOTONIC during calibration
+    int ncpus;         // number of cores compared for skew
+} mys_hrcalib_t;
+
+/**
+ * @brief Measure the quality of `mys_hrtick_raw()` on this machine
+ * 
+ * Reports the effective resolution and read overhead, and checks the counter across all cores the calling
+ * thread may run on (the thread is migrated to each of them and restored afterwards). A skew much larger
+ * than the resolution means events recorded on different cores can be ordered wrongly.
+ * 
+ * @note Cores are only compared on Linux with `_GNU_SOURCE` defined, otherwise `ncpus` is 1.
+ * 
+ * @return The calibration result. Takes a few milliseconds per core.
+ */
+MYS_PUBLIC mys_hrcalib_t mys_hrcalibrate();
+
 #if defined(ARCH_AARCH64)
 #define MYS_HRTIMER_HAVE_AARCH64
 MYS_PUBLIC const char *mys_hrname_aarch64();
@@ -12,12 +12,16 @@
 #include "../memory.h"
 #include "../pmparser.h"
 #include "../os.h"
+#include "../string.h"
+#include "../thread.h"
+#include "uthash_hash.h"
 
 #include <execinfo.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 MYS_PUBLIC int mys_backtrace(void **addrs, int max_depth)
 {
@@ -31,42 +35,231 @@ MYS_PUBLIC int mys_backtrace(void **addrs, int max_depth)
     return depth - 1;
 }
 
-MYS_PUBLIC void mys_backtrace_source(void *addr, char *source, size_t max_size)
+/*
+    Symbolization cache
+    - Resolved addresses are kept in a global hash, so each address goes to addr2line once.
+    - mys_backtrace_resolve() looks up all uncached addresses of a batch in the process maps,
+      then runs a single `addr2line -f -C` per object file (in chunks of MYS_SYMCACHE_CHUNK).
+    - Process maps are parsed once, and parsed again only when an address is not covered
+      (e.g., a library was loaded by dlopen() later).
+*/
+#define MYS_SYMCACHE_CHUNK 256
+
+typedef struct _mys_symbol_t {
+    void *addr;
+    char *source; // "file:line"
+    char *symbol; // function name
+    const char *_object; // object file during resolving
+    void *_relative; // address relative to the object file during resolving
+    _mys_UT_hash_handle hh;
+} _mys_symbol_t;
+
+typedef struct _mys_symcache_G_t {
+    mys_mutex_t lock;
+    _mys_symbol_t *symbols;
+    mys_procmaps_t *maps;
+} _mys_symcache_G_t;
+
+static _mys_symcache_G_t _mys_symcache_G = {
+    .lock = MYS_MUTEX_INITIALIZER,
+    .symbols = NULL,
+    .maps = NULL,
+};
+
+MYS_STATIC mys_procmap_t *_mys_symcache_find_map(void *addr)
 {
-    const char *self_exe = mys_procname();
-    struct stat self_st;
-    stat(self_exe, &self_st);
-
-    const char *target = self_exe;
-    void *relative = addr;
-    mys_procmaps_t *self = mys_pmparser_self();
-    mys_procmap_t *map = self->head;
-    while (map) {
-        if (addr >= map->addr_start && addr < map->addr_end) {
-            struct stat st;
-            if (stat(map->pathname, &st) == 0) {
-                bool is_self_exe = (st.st_ino == self_st.st_ino && st.st_dev == self_st.st_dev);
-                if (!is_self_exe) {
-                    target = map->pathname;
-                    relative = (void *)((uintptr_t)addr - (uintptr_t)map->addr_start);
-                }
-            }
+    for (mys_procmap_t *map = _mys_symcache_G.maps->head; map != NULL; map = map->next) {
+        if (addr >= map->addr_start && addr < map->addr_end)
+            return map;
+    }
+    return NULL;
+}
+
+// Executables that are not position independent (ET_EXEC) are resolved with absolute addresses
+MYS_STATIC bool _mys_symcache_is_fixed_exe(const char *object)
+{
+    unsigned char ehdr[18];
+    int fd = open(object, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, ehdr, sizeof(ehdr));
+    close(fd);
+    if (n != (ssize_t)sizeof(ehdr) || memcmp(ehdr, "\x7f" "ELF", 4) != 0)
+        return false;
+    uint16_t e_type;
+    memcpy(&e_type, ehdr + 16, sizeof(e_type));
+    return e_type == 2; // ET_EXEC
+}
+
+MYS_STATIC char *_mys_symcache_next_line(char **cursor)
+{
+    char *line = *cursor;
+    if (line == NULL || *line == '\0')
+        return NULL;
+    char *end = strchr(line, '\n');
+    if (end != NULL) {
+        *end = '\0';
+        *cursor = end + 1;
+    } else {
+        *cursor = line + strlen(line);
+    }
+    return line;
+}
+
+// Run addr2line once for symbols[0..n) that share the same object file
+MYS_STATIC void _mys_symcache_addr2line(_mys_symbol_t **symbols, size_t n)
+{
+    mys_string_t *cmd = mys_string_create();
+    mys_string_fmt(cmd, "addr2line -f -C -e '%s'", symbols[0]->_object);
+    for (size_t i = 0; i < n; i++)
+        mys_string_fmt(cmd, " %p", symbols[i]->_relative);
+    mys_prun_t run = mys_prun_create2("%s", cmd->text);
+    char *cursor = run.out;
+    for (size_t i = 0; i < n; i++) {
+        char *func = _mys_symcache_next_line(&cursor);
+        char *source = _mys_symcache_next_line(&cursor);
+        if (func != NULL && strcmp(func, "??") != 0)
+            symbols[i]->symbol = strdup(func);
+        if (source != NULL)
+            symbols[i]->source = strdup(source);
+    }
+    mys_prun_destroy(&run);
+    mys_string_destroy(&cmd);
+}
+
+// Resolve placeholders just inserted by mys_backtrace_resolve(). Caller holds the cache lock.
+MYS_STATIC void _mys_symcache_resolve_pending(_mys_symbol_t **pending, size_t npending)
+{
+    // Locate object files, parse maps again if some address is not covered
+    bool fresh = false;
+    for (;;) {
+        if (_mys_symcache_G.maps == NULL) {
+            _mys_symcache_G.maps = mys_pmparser_parse(-1);
+            fresh = true;
+        }
+        if (_mys_symcache_G.maps == NULL)
+            break;
+        bool missing = false;
+        for (size_t i = 0; i < npending; i++) {
+            mys_procmap_t *map = _mys_symcache_find_map(pending[i]->addr);
+            pending[i]->_object = NULL;
+            if (map == NULL)
+                missing = true;
+            if (map == NULL || map->pathname == NULL || map->pathname[0] != '/')
+                continue; // anonymous, [vdso], ...
+            pending[i]->_object = map->pathname;
+            pending[i]->_relative = (void *)((uintptr_t)pending[i]->addr - ((uintptr_t)map->addr_start - (uintptr_t)map->offset));
+        }
+        if (!missing || fresh)
             break;
+        mys_pmparser_free(_mys_symcache_G.maps);
+        _mys_symcache_G.maps = NULL;
+    }
+
+    // One addr2line per object file
+    _mys_symbol_t **group = (_mys_symbol_t **)malloc(sizeof(_mys_symbol_t *) * MYS_SYMCACHE_CHUNK);
+    for (size_t i = 0; i < npending; i++) {
+        const char *object = pending[i]->_object;
+        if (object == NULL)
+            continue;
+        bool fixed = _mys_symcache_is_fixed_exe(object);
+        size_t ngroup = 0;
+        for (size_t j = i; j < npending; j++) {
+            if (pending[j]->_object == NULL || strcmp(pending[j]->_object, object) != 0)
+                continue;
+            if (fixed)
+                pending[j]->_relative = pending[j]->addr;
+            group[ngroup++] = pending[j];
+            if (ngroup == MYS_SYMCACHE_CHUNK) {
+                _mys_symcache_addr2line(group, ngroup);
+                ngroup = 0;
+            }
+        }
+        if (ngroup > 0)
+            _mys_symcache_addr2line(group, ngroup);
+        for (size_t j = i; j < npending; j++) {
+            if (pending[j]->_object != NULL && strcmp(pending[j]->_object, object) == 0)
+                pending[j]->_object = NULL;
         }
-        map = map->next;
     }
+    free(group);
 
-    static char bufcmd[1024];
-    snprintf(bufcmd, sizeof(bufcmd), "addr2line -e %s %p", target, relative);
-    mys_prun_t run = mys_prun_create(bufcmd, source, max_size, NULL, 0);
-    mys_prun_destroy(&run);
+    // Fallbacks for what addr2line cannot resolve
+    for (size_t i = 0; i < npending; i++) {
+        _mys_symbol_t *sym = pending[i];
+        sym->_object = NULL;
+        if (sym->source == NULL)
+            sym->source = strdup("??:0");
+        if (sym->symbol == NULL) {
+            char **bsyms = backtrace_symbols(&sym->addr, 1);
+            sym->symbol = strdup((bsyms != NULL) ? bsyms[0] : "??");
+            free(bsyms);
+        }
+    }
+}
+
+MYS_PUBLIC void mys_backtrace_resolve(void **addrs, int naddrs)
+{
+    if (addrs == NULL || naddrs <= 0)
+        return;
+    mys_mutex_lock(&_mys_symcache_G.lock);
+    // Insert placeholders for new addresses, which also deduplicates the batch
+    _mys_symbol_t **pending = (_mys_symbol_t **)malloc(sizeof(_mys_symbol_t *) * (size_t)naddrs);
+    size_t npending = 0;
+    for (int i = 0; i < naddrs; i++) {
+        void *addr = addrs[i];
+        _mys_symbol_t *sym = NULL;
+        _HASH_FIND_PTR(_mys_symcache_G.symbols, &addr, sym);
+        if (sym != NULL)
+            continue;
+        sym = (_mys_symbol_t *)calloc(1, sizeof(_mys_symbol_t));
+        sym->addr = addr;
+        _HASH_ADD_PTR(_mys_symcache_G.symbols, addr, sym);
+        pending[npending++] = sym;
+    }
+    if (npending > 0)
+        _mys_symcache_resolve_pending(pending, npending);
+    free(pending);
+    mys_mutex_unlock(&_mys_symcache_G.lock);
+}
+
+MYS_PUBLIC void mys_backtrace_cache_clear()
+{
+    mys_mutex_lock(&_mys_symcache_G.lock);
+    _mys_symbol_t *sym = NULL;
+    _mys_symbol_t *tmp = NULL;
+    _HASH_ITER(hh, _mys_symcache_G.symbols, sym, tmp) {
+        _HASH_DEL(_mys_symcache_G.symbols, sym);
+        free(sym->source);
+        free(sym->symbol);
+        free(sym);
+    }
+    if (_mys_symcache_G.maps != NULL) {
+        mys_pmparser_free(_mys_symcache_G.maps);
+        _mys_symcache_G.maps = NULL;
+    }
+    mys_mutex_unlock(&_mys_symcache_G.lock);
+}
+
+MYS_STATIC void _mys_backtrace_lookup(void *addr, char *source, char *symbol, size_t max_size)
+{
+    mys_backtrace_resolve(&addr, 1);
+    mys_mutex_lock(&_mys_symcache_G.lock);
+    _mys_symbol_t *sym = NULL;
+    _HASH_FIND_PTR(_mys_symcache_G.symbols, &addr, sym);
+    const char *text = (sym == NULL) ? "??" : (source != NULL) ? sym->source : sym->symbol;
+    char *out = (source != NULL) ? source : symbol;
+    strncpy(out, text, max_size - 1);
+    out[max_size - 1] = '\0';
+    mys_mutex_unlock(&_mys_symcache_G.lock);
+}
+
+MYS_PUBLIC void mys_backtrace_source(void *addr, char *source, size_t max_size)
+{
+    _mys_backtrace_lookup(addr, source, NULL, max_size);
 }
 
 MYS_PUBLIC void mys_backtrace_symbol(void *addr, char *symbol, size_t max_size)
 {
-    // use backtrace_symbols()
-    char **bsyms = backtrace_symbols(&addr, 1);
-    strncpy(symbol, bsyms[0], max_size - 1);
-    symbol[max_size - 1] = '\0';
-    free(bsyms);
+    _mys_backtrace_lookup(addr, NULL, symbol, max_size);
 }
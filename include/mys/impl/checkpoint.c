@@ -12,20 +12,28 @@
 #include "../errno.h"
 #include "../mpistubs.h"
 #include "../checkpoint.h"
+#include "../thread.h"
+#include "../misc.h"
+#include "../statistic.h"
 #include "uthash_hash.h"
 
 // extern char *strndup(const char *s, size_t n) __THROW;
 
+#define _MYS_CHK_MAX_THREADS 4096
+#define _MYS_CHK_BLOCK 4096 // records per block
+
 // https://troydhanson.github.io/uthash/userguide.html#_string_keys
 typedef struct _mys_chk_name_t {
     char *name;
+    int handle;
     _mys_UT_hash_handle hh;
 } _mys_chk_name_t;
 
-static _mys_chk_name_t *checkpoint_name_insert(_mys_chk_name_t **head, const char *name)
+static _mys_chk_name_t *checkpoint_name_insert(_mys_chk_name_t **head, const char *name, int handle)
 {
     _mys_chk_name_t *s = (_mys_chk_name_t *)malloc(sizeof(_mys_chk_name_t));
     s->name = strndup(name, 4096);
+    s->handle = handle;
     _HASH_ADD_KEYPTR(hh, *head, s->name, strlen(s->name), s);
     return s;
 }
@@ -48,28 +56,48 @@ static _mys_chk_name_t *checkpoint_name_find(_mys_chk_name_t *head, const char *
 }
 
 typedef struct _mys_chk_t {
-    char *name;
-    double time;
+    uint64_t tick; // mys_hrtick_raw()
+    int handle;
 } _mys_chk_t;
 
+typedef struct _mys_chk_block_t {
+    struct _mys_chk_block_t *next;
+    size_t size;
+    _mys_chk_t arr[_MYS_CHK_BLOCK];
+} _mys_chk_block_t;
+
+typedef struct _mys_chk_thread_t { // written by its owner thread only
+    _mys_chk_block_t *head;
+    _mys_chk_block_t *tail;
+} _mys_chk_thread_t;
+
 typedef struct _mys_chk_G_t {
     bool inited;
     mys_mutex_t lock;
-    double offset;
-    size_t size;
-    size_t capacity;
-    _mys_chk_t *arr;
+    uint64_t tick0; // mys_hrtick_raw() at reset
+    double freq; // mys_hrfreq_raw()
     _mys_chk_name_t *nameset;
+    char **names; // names[handle]
+    int nnames;
+    int capacity;
+    // threads[mys_thread_id()], and threads[_MYS_CHK_MAX_THREADS] is shared by all threads beyond it
+    _mys_chk_thread_t *threads[_MYS_CHK_MAX_THREADS + 1];
+    uint32_t nthreads; // 1 + largest index of threads with a buffer
+    mys_mutex_t shared_lock; // protects appends to the shared buffer
 } _mys_chk_G_t;
 
 static _mys_chk_G_t _mys_chk_G = {
     .inited = false,
     .lock = MYS_MUTEX_INITIALIZER,
-    .offset = 0,
-    .size = 0,
-    .capacity = 0,
-    .arr = NULL,
+    .tick0 = 0,
+    .freq = 1,
     .nameset = NULL,
+    .names = NULL,
+    .nnames = 0,
+    .capacity = 0,
+    .threads = { NULL },
+    .nthreads = 0,
+    .shared_lock = MYS_MUTEX_INITIALIZER,
 };
 
 MYS_PUBLIC void mys_checkpoint_init()
@@ -77,33 +105,37 @@ MYS_PUBLIC void mys_checkpoint_init()
     if (_mys_chk_G.inited == true)
         return;
     mys_mutex_lock(&_mys_chk_G.lock);
-    if (_mys_chk_G.inited == true)
-        return;
-    _mys_chk_G.offset = mys_hrtime();
-    _mys_chk_G.size = 0;
-    _mys_chk_G.capacity = 0;
-    _mys_chk_G.arr = NULL;
-    _mys_chk_G.nameset = NULL;
-    _mys_chk_G.inited = true;
+    if (_mys_chk_G.inited == false) {
+        _mys_chk_G.freq = (double)mys_hrfreq_raw();
+        _mys_chk_G.tick0 = mys_hrtick_raw();
+        _mys_chk_G.nameset = NULL;
+        _mys_chk_G.names = NULL;
+        _mys_chk_G.nnames = 0;
+        _mys_chk_G.capacity = 0;
+        _mys_chk_G.nthreads = 0;
+        _mys_chk_G.inited = true;
+    }
     mys_mutex_unlock(&_mys_chk_G.lock);
 }
 
-
 MYS_PUBLIC void mys_checkpoint_reset()
 {
     mys_checkpoint_init();
     mys_mutex_lock(&_mys_chk_G.lock);
-    _mys_chk_G.offset = mys_hrtime();
-    _mys_chk_G.size = 0;
-    _mys_chk_G.capacity = 0;
-    if (_mys_chk_G.arr != NULL) free(_mys_chk_G.arr);
-    if (_mys_chk_G.nameset != NULL) checkpoint_name_clear(&_mys_chk_G.nameset);
-    _mys_chk_G.arr = NULL;
-    _mys_chk_G.nameset = NULL;
+    _mys_chk_G.tick0 = mys_hrtick_raw();
+    // Handles stay valid, so names are kept. Blocks are kept for reuse.
+    for (uint32_t tid = 0; tid < _mys_chk_G.nthreads; tid++) {
+        _mys_chk_thread_t *thread = _mys_chk_G.threads[tid];
+        if (thread == NULL)
+            continue;
+        for (_mys_chk_block_t *block = thread->head; block != NULL; block = block->next)
+            block->size = 0;
+        thread->tail = thread->head;
+    }
     mys_mutex_unlock(&_mys_chk_G.lock);
 }
 
-MYS_PUBLIC void mys_checkpoint(const char *name_format, ...)
+MYS_PUBLIC int mys_checkpoint_intern(const char *name_format, ...)
 {
     mys_checkpoint_init();
     char name[4096];
@@ -113,22 +145,151 @@ MYS_PUBLIC void mys_checkpoint(const char *name_format, ...)
     va_end(args);
 
     mys_mutex_lock(&_mys_chk_G.lock);
-
     _mys_chk_name_t *child = checkpoint_name_find(_mys_chk_G.nameset, name);
-    if (child == NULL)
-        child = checkpoint_name_insert(&_mys_chk_G.nameset, name);
-
-    if (_mys_chk_G.size == _mys_chk_G.capacity) {
-        _mys_chk_G.capacity = (_mys_chk_G.capacity == 0) ? 128 : _mys_chk_G.capacity * 2;
-        size_t bytes = sizeof(_mys_chk_t) * _mys_chk_G.capacity;
-        _mys_chk_G.arr = (_mys_chk_t *)realloc(_mys_chk_G.arr, bytes);
+    if (child == NULL) {
+        if (_mys_chk_G.nnames == _mys_chk_G.capacity) {
+            _mys_chk_G.capacity = (_mys_chk_G.capacity == 0) ? 128 : _mys_chk_G.capacity * 2;
+            _mys_chk_G.names = (char **)realloc(_mys_chk_G.names, sizeof(char *) * _mys_chk_G.capacity);
+        }
+        child = checkpoint_name_insert(&_mys_chk_G.nameset, name, _mys_chk_G.nnames);
+        _mys_chk_G.names[_mys_chk_G.nnames++] = child->name;
     }
+    int handle = child->handle;
+    mys_mutex_unlock(&_mys_chk_G.lock);
+    return handle;
+}
 
-    double current = mys_hrtime() - _mys_chk_G.offset;
-    _mys_chk_G.arr[_mys_chk_G.size].time = current;
-    _mys_chk_G.arr[_mys_chk_G.size].name = child->name;
-    _mys_chk_G.size += 1;
+MYS_ATTR_NOINLINE
+MYS_STATIC _mys_chk_block_t *_mys_checkpoint_expand(uint32_t tid)
+{
+    _mys_chk_thread_t *thread = _mys_chk_G.threads[tid];
+    if (thread != NULL && thread->tail->next != NULL) // reuse blocks kept by reset
+        return thread->tail = thread->tail->next;
+    _mys_chk_block_t *block = (_mys_chk_block_t *)malloc(sizeof(_mys_chk_block_t));
+    if (block == NULL)
+        return NULL;
+    block->next = NULL;
+    block->size = 0;
+    if (thread != NULL) {
+        thread->tail->next = block;
+        thread->tail = block;
+        return block;
+    }
+    thread = (_mys_chk_thread_t *)malloc(sizeof(_mys_chk_thread_t));
+    if (thread == NULL) {
+        free(block);
+        return NULL;
+    }
+    thread->head = block;
+    thread->tail = block;
+    mys_mutex_lock(&_mys_chk_G.lock);
+    {
+        _mys_chk_G.threads[tid] = thread;
+        if (tid + 1 > _mys_chk_G.nthreads)
+            _mys_chk_G.nthreads = tid + 1;
+    }
     mys_mutex_unlock(&_mys_chk_G.lock);
+    return block;
+}
+
+// Thread ids are never reused, so threads beyond the table share one buffer under a lock
+MYS_ATTR_NOINLINE
+MYS_STATIC void _mys_checkpoint_at_shared(uint64_t tick, int handle)
+{
+    mys_mutex_lock(&_mys_chk_G.shared_lock);
+    _mys_chk_thread_t *thread = _mys_chk_G.threads[_MYS_CHK_MAX_THREADS];
+    _mys_chk_block_t *block = (thread != NULL) ? thread->tail : NULL;
+    if (block == NULL || block->size == _MYS_CHK_BLOCK)
+        block = _mys_checkpoint_expand(_MYS_CHK_MAX_THREADS);
+    if (block != NULL) {
+        block->arr[block->size].tick = tick;
+        block->arr[block->size].handle = handle;
+        block->size += 1;
+    }
+    mys_mutex_unlock(&_mys_chk_G.shared_lock);
+}
+
+MYS_PUBLIC void mys_checkpoint_at(int handle)
+{
+    uint64_t tick = mys_hrtick_raw();
+    uint32_t tid = mys_thread_id();
+    _mys_chk_thread_t *thread = (tid < _MYS_CHK_MAX_THREADS) ? _mys_chk_G.threads[tid] : NULL;
+    _mys_chk_block_t *block = (thread != NULL) ? thread->tail : NULL;
+    if (MYS_UNLIKELY(block == NULL || block->size == _MYS_CHK_BLOCK)) {
+        if (tid >= _MYS_CHK_MAX_THREADS) {
+            _mys_checkpoint_at_shared(tick, handle);
+            return;
+        }
+        block = _mys_checkpoint_expand(tid);
+        if (block == NULL)
+            return;
+    }
+    block->arr[block->size].tick = tick;
+    block->arr[block->size].handle = handle;
+    block->size += 1;
+}
+
+MYS_PUBLIC void mys_checkpoint(const char *name_format, ...)
+{
+    char name[4096];
+    va_list args;
+    va_start(args, name_format);
+    vsnprintf(name, sizeof(name), name_format, args);
+    va_end(args);
+    mys_checkpoint_at(mys_checkpoint_intern("%s", name));
+}
+
+typedef struct _mys_chk_merge_t {
+    uint64_t tick;
+    uint32_t tid;
+    int handle;
+    size_t seq;
+} _mys_chk_merge_t;
+
+static int _mys_checkpoint_merge_cmp(const void *a, const void *b)
+{
+    const _mys_chk_merge_t *x = (const _mys_chk_merge_t *)a;
+    const _mys_chk_merge_t *y = (const _mys_chk_merge_t *)b;
+    if (x->tick != y->tick)
+        return (x->tick < y->tick) ? -1 : 1;
+    if (x->tid != y->tid)
+        return (x->tid < y->tid) ? -1 : 1;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+// Records of all threads in time order. Caller holds the lock and frees the result.
+MYS_STATIC _mys_chk_merge_t *_mys_checkpoint_merge(size_t *size)
+{
+    size_t total = 0;
+    for (uint32_t tid = 0; tid < _mys_chk_G.nthreads; tid++) {
+        _mys_chk_thread_t *thread = _mys_chk_G.threads[tid];
+        for (_mys_chk_block_t *block = (thread ? thread->head : NULL); block != NULL; block = block->next)
+            total += block->size;
+    }
+    _mys_chk_merge_t *all = (_mys_chk_merge_t *)malloc(sizeof(_mys_chk_merge_t) * (total + 1));
+    size_t n = 0;
+    for (uint32_t tid = 0; tid < _mys_chk_G.nthreads && all != NULL; tid++) {
+        _mys_chk_thread_t *thread = _mys_chk_G.threads[tid];
+        size_t seq = 0;
+        for (_mys_chk_block_t *block = (thread ? thread->head : NULL); block != NULL; block = block->next) {
+            for (size_t i = 0; i < block->size; i++, n++, seq++) {
+                all[n].tick = block->arr[i].tick;
+                all[n].tid = tid;
+                all[n].handle = block->arr[i].handle;
+                all[n].seq = seq;
+            }
+        }
+    }
+    if (all != NULL)
+        qsort(all, n, sizeof(_mys_chk_merge_t), _mys_checkpoint_merge_cmp);
+    *size = n;
+    return all;
+}
+
+MYS_STATIC double _mys_checkpoint_time(uint64_t tick)
+{
+    return (tick >= _mys_chk_G.tick0) ? (double)(tick - _mys_chk_G.tick0) / _mys_chk_G.freq
+                                      : -(double)(_mys_chk_G.tick0 - tick) / _mys_chk_G.freq;
 }
 
 MYS_PUBLIC int mys_checkpoint_dump(const char *file_format, ...)
@@ -143,17 +304,164 @@ MYS_PUBLIC int mys_checkpoint_dump(const char *file_format, ...)
     mys_mutex_lock(&_mys_chk_G.lock);
     mys_ensure_parent(file, 0777);
     FILE *fd = fopen(file, "w");
-    if (fd == NULL)
+    if (fd == NULL) {
+        mys_mutex_unlock(&_mys_chk_G.lock);
         return 1;
+    }
+    size_t size = 0;
+    _mys_chk_merge_t *all = _mys_checkpoint_merge(&size);
     fprintf(fd, "name,time\n");
-    for (size_t i = 0; i < _mys_chk_G.size; i++) {
-        const char *checkpoint_name = _mys_chk_G.arr[i].name;
-        double time = _mys_chk_G.arr[i].time;
+    for (size_t i = 0; i < size; i++) {
+        const char *checkpoint_name = _mys_chk_G.names[all[i].handle];
+        double time = _mys_checkpoint_time(all[i].tick);
         fprintf(fd, "%s,%.17e\n", checkpoint_name, time);
     }
+    free(all);
     fclose(fd);
     ILOG(0, "Checkpoints Wrote to %s", file);
     mys_mutex_unlock(&_mys_chk_G.lock);
 
     return 0;
 }
+
+MYS_PUBLIC int mys_checkpoint_dump_aggregate(const char *file_format, ...)
+{
+    mys_checkpoint_init();
+    mys_mpi_ensure_init();
+    char file[4096];
+    va_list args;
+    va_start(args, file_format);
+    vsnprintf(file, sizeof(file), file_format, args);
+    va_end(args);
+    int myrank, nranks;
+    mys_MPI_Comm_rank(mys_MPI_COMM_WORLD, &myrank);
+    mys_MPI_Comm_size(mys_MPI_COMM_WORLD, &nranks);
+
+    mys_mutex_lock(&_mys_chk_G.lock);
+    // Local count and first time of each handle
+    int nnames = _mys_chk_G.nnames;
+    double *count = (double *)calloc(nnames + 1, sizeof(double));
+    double *first = (double *)calloc(nnames + 1, sizeof(double));
+    for (uint32_t tid = 0; tid < _mys_chk_G.nthreads; tid++) {
+        _mys_chk_thread_t *thread = _mys_chk_G.threads[tid];
+        for (_mys_chk_block_t *block = (thread ? thread->head : NULL); block != NULL; block = block->next) {
+            for (size_t i = 0; i < block->size; i++) {
+                int h = block->arr[i].handle;
+                double time = _mys_checkpoint_time(block->arr[i].tick);
+                if (count[h] == 0 || time < first[h])
+                    first[h] = time;
+                count[h] += 1;
+            }
+        }
+    }
+
+    // Union of names over ranks: names of rank 0 first, then new names of rank 1, ...
+    int len = 0;
+    for (int h = 0; h < nnames; h++)
+        len += (int)strlen(_mys_chk_G.names[h]) + 1;
+    char *local = (char *)malloc(len + 1);
+    for (int h = 0, pos = 0; h < nnames; h++) {
+        size_t n = strlen(_mys_chk_G.names[h]) + 1;
+        memcpy(local + pos, _mys_chk_G.names[h], n);
+        pos += (int)n;
+    }
+    int *lens = NULL, *displs = NULL;
+    char *gathered = NULL;
+    if (myrank == 0) {
+        lens = (int *)malloc(sizeof(int) * nranks);
+        displs = (int *)malloc(sizeof(int) * nranks);
+    }
+    mys_MPI_Gather(&len, 1, mys_MPI_INT, lens, 1, mys_MPI_INT, 0, mys_MPI_COMM_WORLD);
+    int union_len = 0;
+    if (myrank == 0) {
+        int total = 0;
+        for (int rank = 0; rank < nranks; rank++) {
+            displs[rank] = total;
+            total += lens[rank];
+        }
+        gathered = (char *)malloc(total + 1);
+        union_len = total;
+    }
+    mys_MPI_Gatherv(local, len, mys_MPI_CHAR, gathered, lens, displs, mys_MPI_CHAR, 0, mys_MPI_COMM_WORLD);
+    if (myrank == 0) { // dedupe in place, keeping the first occurrence
+        _mys_chk_name_t *seen = NULL;
+        int pos = 0;
+        for (int src = 0; src < union_len; ) {
+            char *name = gathered + src;
+            int n = (int)strlen(name) + 1;
+            if (checkpoint_name_find(seen, name) == NULL) {
+                memmove(gathered + pos, name, n);
+                checkpoint_name_insert(&seen, gathered + pos, 0);
+                pos += n;
+            }
+            src += n;
+        }
+        checkpoint_name_clear(&seen);
+        union_len = pos;
+    }
+    mys_MPI_Bcast(&union_len, 1, mys_MPI_INT, 0, mys_MPI_COMM_WORLD);
+    if (myrank != 0)
+        gathered = (char *)malloc(union_len + 1);
+    mys_MPI_Bcast(gathered, union_len, mys_MPI_CHAR, 0, mys_MPI_COMM_WORLD);
+
+    int nunion = 0;
+    for (int pos = 0; pos < union_len; pos += (int)strlen(gathered + pos) + 1)
+        nunion += 1;
+    const char **unames = (const char **)malloc(sizeof(char *) * (nunion + 1));
+    int *handles = (int *)malloc(sizeof(int) * (nunion + 1));
+    double *sums = (double *)calloc(3 * nunion + 1, sizeof(double));
+    for (int i = 0, pos = 0; i < nunion; i++) {
+        unames[i] = gathered + pos;
+        pos += (int)strlen(gathered + pos) + 1;
+        _mys_chk_name_t *child = checkpoint_name_find(_mys_chk_G.nameset, unames[i]);
+        handles[i] = (child != NULL && count[child->handle] > 0) ? child->handle : -1;
+        if (handles[i] >= 0) {
+            sums[3 * i + 0] = 1;
+            sums[3 * i + 1] = count[handles[i]];
+            sums[3 * i + 2] = first[handles[i]];
+        }
+    }
+    mys_MPI_Allreduce(mys_MPI_IN_PLACE, sums, 3 * nunion, mys_MPI_DOUBLE, mys_MPI_SUM, mys_MPI_COMM_WORLD);
+
+    // Ranks that did not reach a checkpoint take the mean of the others, which changes neither min, mean nor max
+    double *values = (double *)malloc(sizeof(double) * (nunion + 1));
+    mys_aggregate_t *results = (mys_aggregate_t *)malloc(sizeof(mys_aggregate_t) * (nunion + 1));
+    for (int i = 0; i < nunion; i++) {
+        double mean = (sums[3 * i] > 0) ? sums[3 * i + 2] / sums[3 * i] : 0;
+        values[i] = (handles[i] >= 0) ? first[handles[i]] : mean;
+    }
+    mys_aggregate_analysis_array(nunion, values, results);
+
+    int ret = 0;
+    if (myrank == 0) {
+        mys_ensure_parent(file, 0777);
+        FILE *fd = fopen(file, "w");
+        if (fd != NULL) {
+            fprintf(fd, "name,ranks,count,min,mean,max,loc_min,loc_max\n");
+            for (int i = 0; i < nunion; i++) {
+                fprintf(fd, "%s,%d,%.0f,%.17e,%.17e,%.17e,%d,%d\n", unames[i], (int)sums[3 * i], sums[3 * i + 1],
+                    results[i].min, results[i].avg, results[i].max, results[i].loc_min, results[i].loc_max);
+            }
+            fclose(fd);
+        } else {
+            ret = 1;
+        }
+    }
+    mys_MPI_Bcast(&ret, 1, mys_MPI_INT, 0, mys_MPI_COMM_WORLD);
+    if (ret == 0)
+        ILOG(0, "Aggregated checkpoints of %d ranks wrote to %s", nranks, file);
+
+    free(results);
+    free(values);
+    free(sums);
+    free(handles);
+    free(unames);
+    free(gathered);
+    free(displs);
+    free(lens);
+    free(local);
+    free(first);
+    free(count);
+    mys_mutex_unlock(&_mys_chk_G.lock);
+    return ret;
+}
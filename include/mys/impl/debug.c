@@ -65,6 +65,9 @@ struct _mys_debug_G_t {
     size_t n_filters;
     size_t cap_filters;
     char **filters;
+    // flight recorder
+    mys_trace_t *trace;
+    size_t trace_max_events;
 };
 
 #pragma GCC diagnostic push
@@ -98,6 +101,8 @@ static struct _mys_debug_G_t _mys_debug_G = {
     .n_filters = 0,
     .cap_filters = 0,
     .filters = NULL,
+    .trace = NULL,
+    .trace_max_events = 0,
 };
 #pragma GCC diagnostic pop
 
@@ -191,6 +196,7 @@ MYS_PUBLIC void mys_debug_fini()
     if (_mys_debug_G.inited) {
         _mys_debug_revert_all();
         mys_free2(MYS_ARENA_DEBUG, _mys_debug_G.stack_memory, _MYS_DEBUG_STACK_SIZE);
+        _mys_debug_G.trace = NULL;
         _mys_debug_G.inited = false;
     }
     mys_mutex_unlock(&_mys_debug_G.lock);
@@ -257,6 +263,16 @@ MYS_PUBLIC void mys_debug_clear_message()
     mys_mutex_unlock(&_mys_debug_G.lock);
 }
 
+MYS_PUBLIC void mys_debug_set_trace(mys_trace_t *trace, size_t max_events)
+{
+    mys_mutex_lock(&_mys_debug_G.lock);
+    {
+        _mys_debug_G.trace = trace;
+        _mys_debug_G.trace_max_events = max_events;
+    }
+    mys_mutex_unlock(&_mys_debug_G.lock);
+}
+
 MYS_PUBLIC void mys_debug_set_max_frames(int max_frames)
 {
     // FIXME: lock
@@ -706,6 +722,8 @@ MYS_STATIC void _mys_debug_signal_handler(int signo, siginfo_t *info, void *cont
 #undef _YFMT6
     write_ret = write(_mys_debug_G.outfd, buflog, loglen);
     (void)write_ret; // do nothing, just for Werror=unused-result
+    if (_mys_debug_G.trace != NULL)
+        mys_trace_dump(_mys_debug_G.trace, _mys_debug_G.outfd, _mys_debug_G.trace_max_events);
 #ifndef MYS_DEBUG_CATCH_ABORT
 finished:
 #endif
@@ -47,7 +47,7 @@ MYS_PUBLIC void mys_fmter_destroy(mys_fmter_t **fmter)
 {
     if (fmter && *fmter) {
         for (size_t i = 0; i < (*fmter)->npass; ++i) {
-            mys_free2(MYS_ARENA_FORMAT, (*fmter)->pass_names[i], strlen((*fmter)->pass_names[i]));
+            mys_free2(MYS_ARENA_FORMAT, (*fmter)->pass_names[i], strlen((*fmter)->pass_names[i]) + 1);
         }
         mys_free2(MYS_ARENA_FORMAT, *fmter, sizeof(mys_fmter_t));
         *fmter = NULL;
@@ -180,7 +180,7 @@ MYS_PUBLIC void mys_fmtex_free(mys_fmtex_t **fmtex)
 {
     if (*fmtex) {
         for (size_t i = 0; i < (*fmtex)->nrun; ++i) {
-            mys_free2(MYS_ARENA_FORMAT, (*fmtex)->runs[i].pass_spec, strlen((*fmtex)->runs[i].pass_spec));
+            mys_free2(MYS_ARENA_FORMAT, (*fmtex)->runs[i].pass_spec, strlen((*fmtex)->runs[i].pass_spec) + 1);
         }
         mys_free2(MYS_ARENA_FORMAT, (*fmtex)->runs, sizeof(mys_fmtrun_t) * (*fmtex)->nrun);
         mys_free2(MYS_ARENA_FORMAT, *fmtex, sizeof(mys_fmtex_t));
@@ -11,6 +11,7 @@
 #include "../_config.h"
 #include "../errno.h"
 #include "../mpistubs.h"
+#include "../atomic.h"
 #include "../hrtime.h"
 
 MYS_PUBLIC const char *mys_hrname()
@@ -239,3 +240,199 @@ MYS_PUBLIC void mys_hrreset_mpi() {
     _mys_hrtime_mpi_G.inited = true;
 }
 #endif
+
+/////////////////////////
+// Raw process-wide counter
+/////////////////////////
+#if defined(POSIX_COMPLIANCE)
+#include <time.h>
+#endif
+#if defined(KERNEL_LINUX)
+#include <sched.h>
+#endif
+#if defined(ARCH_X64) && (defined(__GNUC__) || defined(__clang__))
+#define MYS_HRTIMER_HAVE_X64_TSC
+#include <cpuid.h>
+#endif
+
+enum { _MYS_HRRAW_UNKNOWN, _MYS_HRRAW_AARCH64, _MYS_HRRAW_TSC, _MYS_HRRAW_MONOTONIC };
+
+typedef struct _mys_hrtime_raw_G_t {
+    int source; // which counter mys_hrtick_raw() reads
+    uint64_t freq; // 0 until measured
+} _mys_hrtime_raw_G_t;
+
+static _mys_hrtime_raw_G_t _mys_hrtime_raw_G = {
+    .source = _MYS_HRRAW_UNKNOWN,
+    .freq = 0,
+};
+
+MYS_STATIC uint64_t _mys_hrtick_monotonic()
+{
+#if defined(POSIX_COMPLIANCE) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * (uint64_t)1000000000 + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)(mys_MPI_Wtime() * 1e9);
+#endif
+}
+
+MYS_ATTR_ALWAYS_INLINE
+MYS_STATIC uint64_t _mys_hrtick_counter()
+{
+#if defined(MYS_HRTIMER_HAVE_AARCH64)
+    uint64_t t;
+    __asm__ __volatile__("mrs %0, CNTVCT_EL0" : "=r"(t));
+    return t;
+#elif defined(MYS_HRTIMER_HAVE_X64_TSC)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return _mys_hrtick_monotonic();
+#endif
+}
+
+MYS_ATTR_NOINLINE
+MYS_STATIC int _mys_hrtick_raw_source()
+{
+    int source = _MYS_HRRAW_MONOTONIC;
+#if defined(MYS_HRTIMER_HAVE_AARCH64)
+    source = _MYS_HRRAW_AARCH64;
+#elif defined(MYS_HRTIMER_HAVE_X64_TSC)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) // invariant TSC
+        source = _MYS_HRRAW_TSC;
+#endif
+    mys_atomic_store_n(&_mys_hrtime_raw_G.source, source, MYS_ATOMIC_RELAXED);
+    return source;
+}
+
+MYS_ATTR_OPTIMIZE_O3
+MYS_PUBLIC uint64_t mys_hrtick_raw()
+{
+    int source = mys_atomic_load_n(&_mys_hrtime_raw_G.source, MYS_ATOMIC_RELAXED);
+    if (MYS_UNLIKELY(source == _MYS_HRRAW_UNKNOWN))
+        source = _mys_hrtick_raw_source();
+    if (MYS_LIKELY(source != _MYS_HRRAW_MONOTONIC))
+        return _mys_hrtick_counter();
+    return _mys_hrtick_monotonic();
+}
+
+// Count raw ticks over `nanoseconds` of CLOCK_MONOTONIC
+MYS_STATIC uint64_t _mys_hrfreq_measure(uint64_t nanoseconds)
+{
+    uint64_t m0 = _mys_hrtick_monotonic();
+    uint64_t c0 = mys_hrtick_raw();
+    uint64_t m1 = m0, c1 = c0;
+    while (m1 - m0 < nanoseconds) {
+        m1 = _mys_hrtick_monotonic();
+        c1 = mys_hrtick_raw();
+    }
+    return (uint64_t)((double)(c1 - c0) * 1e9 / (double)(m1 - m0) + 0.5);
+}
+
+MYS_PUBLIC uint64_t mys_hrfreq_raw()
+{
+    uint64_t freq = mys_atomic_load_n(&_mys_hrtime_raw_G.freq, MYS_ATOMIC_RELAXED);
+    if (MYS_LIKELY(freq != 0))
+        return freq;
+    mys_hrtick_raw(); // decide the source
+    switch (_mys_hrtime_raw_G.source) {
+#if defined(MYS_HRTIMER_HAVE_AARCH64)
+    case _MYS_HRRAW_AARCH64: freq = mys_hrfreq_aarch64(); break;
+#endif
+    case _MYS_HRRAW_TSC: freq = _mys_hrfreq_measure(10000000); break;
+    default: freq = 1000000000; break;
+    }
+    mys_atomic_store_n(&_mys_hrtime_raw_G.freq, freq, MYS_ATOMIC_RELAXED);
+    return freq;
+}
+
+MYS_PUBLIC const char *mys_hrname_raw()
+{
+    mys_hrtick_raw(); // decide the source
+    switch (_mys_hrtime_raw_G.source) {
+    case _MYS_HRRAW_AARCH64: return "CNTVCT_EL0 counter of AArch64";
+    case _MYS_HRRAW_TSC: return "Invariant TSC of x86-64 (calibrated frequency)";
+    default: return "CLOCK_MONOTONIC nanoseconds";
+    }
+}
+
+// One (counter, monotonic) pair taken with the smallest bracketing window out of a few tries.
+// Returns the counter time minus the monotonic time, in seconds.
+MYS_STATIC double _mys_hrcalib_offset(uint64_t freq, uint64_t base_tick, uint64_t base_mono)
+{
+    double best_window = 1e30;
+    double best_offset = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t m0 = _mys_hrtick_monotonic();
+        uint64_t c = mys_hrtick_raw();
+        uint64_t m1 = _mys_hrtick_monotonic();
+        double window = (double)(m1 - m0);
+        if (window < best_window) {
+            best_window = window;
+            double tc = (double)(int64_t)(c - base_tick) / (double)freq;
+            double tm = ((double)(int64_t)(m0 - base_mono) + window / 2) * 1e-9;
+            best_offset = tc - tm;
+        }
+    }
+    return best_offset;
+}
+
+MYS_PUBLIC mys_hrcalib_t mys_hrcalibrate()
+{
+    mys_hrcalib_t calib;
+    calib.freq = mys_hrfreq_raw();
+    uint64_t base_tick = mys_hrtick_raw();
+    uint64_t base_mono = _mys_hrtick_monotonic();
+
+    // Resolution and overhead of back-to-back reads
+    const int nreads = 100000;
+    uint64_t min_step = UINT64_MAX;
+    uint64_t first = mys_hrtick_raw();
+    uint64_t last = first;
+    for (int i = 0; i < nreads; i++) {
+        uint64_t t = mys_hrtick_raw();
+        if (t > last && t - last < min_step)
+            min_step = t - last;
+        last = t;
+    }
+    calib.overhead = (double)(last - first) / (double)calib.freq / (double)nreads;
+    calib.resolution = (min_step == UINT64_MAX) ? 0 : (double)min_step / (double)calib.freq;
+
+    // Skew between cores
+    double min_offset = _mys_hrcalib_offset(calib.freq, base_tick, base_mono);
+    double max_offset = min_offset;
+    calib.ncpus = 1;
+#if defined(KERNEL_LINUX) && defined(CPU_SETSIZE) // cpu_set_t needs _GNU_SOURCE
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0 && CPU_COUNT(&allowed) > 1) {
+        calib.ncpus = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed))
+                continue;
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            if (sched_setaffinity(0, sizeof(cpu_set_t), &one) != 0)
+                continue;
+            double offset = _mys_hrcalib_offset(calib.freq, base_tick, base_mono);
+            min_offset = (offset < min_offset) ? offset : min_offset;
+            max_offset = (offset > max_offset) ? offset : max_offset;
+            calib.ncpus += 1;
+        }
+        sched_setaffinity(0, sizeof(cpu_set_t), &allowed);
+    }
+#endif
+    calib.skew = max_offset - min_offset;
+
+    // Rate error against CLOCK_MONOTONIC over the whole calibration
+    uint64_t end_tick = mys_hrtick_raw();
+    uint64_t end_mono = _mys_hrtick_monotonic();
+    double elapsed_tick = (double)(end_tick - base_tick) / (double)calib.freq;
+    double elapsed_mono = (double)(end_mono - base_mono) * 1e-9;
+    calib.drift = (elapsed_mono > 0) ? (elapsed_tick / elapsed_mono - 1.0) : 0;
+    return calib;
+}
@@ -13,9 +13,56 @@
 #include "../mpistubs.h"
 #include "../log.h"
 #include "../memory.h"
+#include "../atomic.h"
+#include "../hrtime.h"
 #include "uthash_hash.h"
 
+#include <pthread.h>
+#include <sched.h>
+
 #define MYS_LOG_MAX_HANDLER 8
+#define MYS_LOG_MAX_ASYNC 64 // async loggers flushed at exit
+#define MYS_LOG_ASYNC_MAX_THREADS 4096
+#define MYS_LOG_ASYNC_MAX_DEPTH (1 << 20)
+#define MYS_LOG_ASYNC_TEXT 472
+#define MYS_LOG_RENDER_MAX 4096 // longest message rendered from a deferred record
+#define MYS_LOG_ASYNC_IDLE_NS 500000 // the background thread sleeps this long when all queues are empty
+#ifndef MYS_LOG_ORDERED_ROUND
+#define MYS_LOG_ORDERED_ROUND INT32_MAX // bytes gathered from all ranks by one MPI_Gatherv of mys_log_ordered()
+#endif
+
+typedef struct _mys_log_record_t {
+    uint64_t tick; // mys_hrtick_raw() when logged, orders records of different threads
+    int myrank;
+    int nranks;
+    int level;
+    int line;
+    const char *file;
+    const mys_log_site_t *site; // not NULL if `text` holds raw arguments of the site instead of the message
+    char text[MYS_LOG_ASYNC_TEXT]; // formatted message
+} _mys_log_record_t;
+
+typedef struct _mys_log_queue_t { // single producer (its thread) and single consumer (the holder of drain_lock)
+    uint64_t tail; // next record to write, written by the producer
+    uint64_t dropped; // written by the producer
+    uint8_t _pad1[128 - 2 * sizeof(uint64_t)];
+    uint64_t head; // next record to read, written by the consumer
+    uint8_t _pad2[128 - sizeof(uint64_t)];
+    _mys_log_record_t *records; // records[depth]
+} _mys_log_queue_t;
+
+typedef struct _mys_log_async_t {
+    struct mys_log_t *logger;
+    _mys_log_queue_t **queues; // queues[mys_thread_id()]
+    uint32_t nqueues; // 1 + largest thread id with a queue
+    uint32_t depth; // power of two
+    int policy;
+    int flush_level;
+    int stop; // asks the background thread to exit
+    mys_mutex_t lock; // protects queue creation
+    mys_mutex_t drain_lock; // one consumer at a time: the background thread or a flusher
+    pthread_t thread;
+} _mys_log_async_t;
 
 typedef struct {
     char *key;
@@ -37,6 +84,11 @@ struct mys_log_t {
     } handlers[MYS_LOG_MAX_HANDLER];
     int handler_id_counter;
     int num_handlers;
+    _mys_log_async_t *async; // NULL in synchronous mode
+    bool ordered_batch; // between mys_log_ordered_batch_begin() and mys_log_ordered_batch_end()
+    char *ordered_buf; // ordered messages of this rank waiting for the collective
+    size_t ordered_len;
+    size_t ordered_cap;
 };
 
 mys_log_t mys_predefined_logger = {
@@ -52,8 +104,27 @@ mys_log_t mys_predefined_logger = {
     },
     .handler_id_counter = 101,
     .num_handlers = 1,
+    .async = NULL,
+    .ordered_batch = false,
+    .ordered_buf = NULL,
+    .ordered_len = 0,
+    .ordered_cap = 0,
 };
 
+typedef struct _mys_log_G_t {
+    mys_mutex_t lock;
+    bool atexit_registered;
+    mys_log_t *async_loggers[MYS_LOG_MAX_ASYNC];
+} _mys_log_G_t;
+
+static _mys_log_G_t _mys_log_G = {
+    .lock = MYS_MUTEX_INITIALIZER,
+    .atexit_registered = false,
+    .async_loggers = { NULL },
+};
+
+MYS_STATIC void _mys_log_async_stop(mys_log_t *logger, bool release);
+
 MYS_PUBLIC mys_log_t *mys_log_create(const char *name)
 {
     mys_log_t *logger = (mys_log_t *)mys_calloc2(MYS_ARENA_LOG, sizeof(mys_log_t), 1);
@@ -67,6 +138,11 @@ MYS_PUBLIC mys_log_t *mys_log_create(const char *name)
     logger->once_map = NULL;
     logger->handler_id_counter = 100;
     logger->num_handlers = 0;
+    logger->async = NULL;
+    logger->ordered_batch = false;
+    logger->ordered_buf = NULL;
+    logger->ordered_len = 0;
+    logger->ordered_cap = 0;
     mys_mutex_unlock(&logger->lock);
     return logger;
 }
@@ -76,6 +152,7 @@ MYS_PUBLIC void mys_log_destroy(mys_log_t **_logger)
     if (_logger == NULL || *_logger == NULL || *_logger == &mys_predefined_logger)
         return;
     mys_log_t *logger = *_logger;
+    _mys_log_async_stop(logger, true);
     mys_mutex_lock(&logger->lock);
     _mys_log_once_t *entry, *tmp;
     _HASH_ITER(hh, logger->once_map, entry, tmp) {
@@ -84,6 +161,8 @@ MYS_PUBLIC void mys_log_destroy(mys_log_t **_logger)
         free(entry);
     }
     free((char *)(void *)logger->name);
+    if (logger->ordered_buf != NULL)
+        mys_free2(MYS_ARENA_LOG, logger->ordered_buf, logger->ordered_cap);
     mys_mutex_unlock(&logger->lock);
     mys_mutex_destroy(&logger->lock);
     mys_free2(MYS_ARENA_LOG, logger, sizeof(mys_log_t));
@@ -99,9 +178,538 @@ MYS_PUBLIC const char *mys_log_get_name(mys_log_t *logger)
     return name;
 }
 
+/////////////////////////
+// Deferred formatting
+/////////////////////////
+
+enum {
+    _MYS_LOG_ARG_INT, // also char, short (promoted)
+    _MYS_LOG_ARG_LONG,
+    _MYS_LOG_ARG_LLONG,
+    _MYS_LOG_ARG_SIZE,
+    _MYS_LOG_ARG_INTMAX,
+    _MYS_LOG_ARG_PTRDIFF,
+    _MYS_LOG_ARG_DOUBLE,
+    _MYS_LOG_ARG_LDOUBLE,
+    _MYS_LOG_ARG_PTR,
+    _MYS_LOG_ARG_STR,
+    _MYS_LOG_ARG_BAD, // cannot be deferred, e.g., %n, %ls, %1$d
+};
+
+// Slot of each argument kind in a record, 8-byte aligned. Strings take their bytes instead.
+#define _MYS_LOG_SLOT(kind) (((kind) == _MYS_LOG_ARG_LDOUBLE) ? ((sizeof(long double) + 7) / 8 * 8) : 8)
+
+// mys_log_site_t::precisions of a "%s" argument: 0 for none, N + 1 for "%.Ns", or the one below for "%.*s"
+#define _MYS_LOG_PREC_STAR UINT16_MAX
+
+typedef struct _mys_log_spec_t {
+    const char *start; // '%'
+    size_t len; // "%-08.3lf" -> 8
+    int nstars; // '*' of width and precision, each takes an int argument before the value
+    int kind; // _MYS_LOG_ARG_*, or -1 for "%%"
+    int precision; // -1 for none, -2 for '*'
+} _mys_log_spec_t;
+
+// Parse the conversion at p ('%'), returns the character after it
+MYS_STATIC const char *_mys_log_parse_spec(const char *p, _mys_log_spec_t *spec)
+{
+    spec->start = p++;
+    spec->nstars = 0;
+    spec->kind = _MYS_LOG_ARG_BAD;
+    spec->precision = -1;
+    if (*p == '%') {
+        spec->kind = -1;
+        spec->len = 2;
+        return p + 1;
+    }
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'')
+        p++;
+    if (*p == '*') {
+        spec->nstars += 1;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        spec->precision = 0;
+        if (*p == '*') {
+            spec->nstars += 1;
+            spec->precision = -2;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            spec->precision = spec->precision * 10 + (*p - '0');
+            if (spec->precision > 65533) // larger than any record anyway
+                spec->precision = 65533;
+            p++;
+        }
+    }
+    int length = 0; // 'H' for hh, 'l', 'q' for ll, 'L', 'z', 'j', 't', 'h'
+    if (p[0] == 'h' && p[1] == 'h') { length = 'H'; p += 2; }
+    else if (p[0] == 'l' && p[1] == 'l') { length = 'q'; p += 2; }
+    else if (*p == 'h' || *p == 'l' || *p == 'q' || *p == 'L' || *p == 'z' || *p == 'j' || *p == 't') { length = *p; p++; }
+    switch (*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            spec->kind =
+                (length == 'l') ? _MYS_LOG_ARG_LONG :
+                (length == 'q') ? _MYS_LOG_ARG_LLONG :
+                (length == 'z') ? _MYS_LOG_ARG_SIZE :
+                (length == 'j') ? _MYS_LOG_ARG_INTMAX :
+                (length == 't') ? _MYS_LOG_ARG_PTRDIFF :
+                (length == 'L') ? _MYS_LOG_ARG_BAD :
+                _MYS_LOG_ARG_INT;
+            break;
+        case 'c': spec->kind = (length == 0) ? _MYS_LOG_ARG_INT : _MYS_LOG_ARG_BAD; break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = (length == 'L') ? _MYS_LOG_ARG_LDOUBLE : (length == 0 || length == 'l') ? _MYS_LOG_ARG_DOUBLE : _MYS_LOG_ARG_BAD;
+            break;
+        case 'p': spec->kind = (length == 0) ? _MYS_LOG_ARG_PTR : _MYS_LOG_ARG_BAD; break;
+        case 's': spec->kind = (length == 0) ? _MYS_LOG_ARG_STR : _MYS_LOG_ARG_BAD; break;
+        default: break; // %n, %ls, %1$d, unknown or truncated
+    }
+    if (*p != '\0')
+        p++;
+    spec->len = (size_t)(p - spec->start);
+    return p;
+}
+
+MYS_STATIC void _mys_log_site_parse(mys_log_site_t *site)
+{
+    int state = 0;
+    if (!mys_atomic_compare_exchange_n(&site->state, &state, 1, MYS_ATOMIC_ACQUIRE, MYS_ATOMIC_ACQUIRE)) {
+        while (mys_atomic_load_n(&site->state, MYS_ATOMIC_ACQUIRE) == 1)
+            sched_yield(); // another thread is parsing
+        return;
+    }
+    int nargs = 0;
+    int fixed_size = 0;
+    bool ok = (site->fmt != NULL);
+    for (const char *p = site->fmt; ok && *p != '\0'; ) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        _mys_log_spec_t spec;
+        p = _mys_log_parse_spec(p, &spec);
+        if (spec.kind == -1)
+            continue;
+        ok = (spec.kind != _MYS_LOG_ARG_BAD) && (spec.len < 64) && (nargs + spec.nstars + 1 <= MYS_LOG_SITE_MAX_ARGS);
+        for (int i = 0; ok && i < spec.nstars; i++) {
+            site->kinds[nargs++] = _MYS_LOG_ARG_INT;
+            fixed_size += 8;
+        }
+        if (ok) {
+            site->precisions[nargs] = (spec.precision == -2) ? _MYS_LOG_PREC_STAR : (uint16_t)(spec.precision + 1);
+            site->kinds[nargs++] = (uint8_t)spec.kind;
+            fixed_size += (spec.kind == _MYS_LOG_ARG_STR) ? 8 : (int)_MYS_LOG_SLOT(spec.kind); // at least "" and its padding
+        }
+    }
+    ok = ok && (fixed_size <= MYS_LOG_ASYNC_TEXT);
+    site->nargs = nargs;
+    site->fixed_size = fixed_size;
+    mys_atomic_store_n(&site->state, ok ? 2 : 3, MYS_ATOMIC_RELEASE);
+}
+
+// Copy the arguments of a parsed site into buffer. Strings are truncated to share the space left by other arguments,
+// and never read beyond their precision, as "%.Ns" may print a buffer that is not null-terminated.
+MYS_ATTR_OPTIMIZE_O3
+MYS_STATIC void _mys_log_site_encode(const mys_log_site_t *site, uint8_t *buffer, size_t size, va_list vargs)
+{
+    size_t used = 0;
+    size_t reserved = (size_t)site->fixed_size; // bytes still needed by arguments after the current one
+    for (int i = 0; i < site->nargs; i++) {
+        int kind = site->kinds[i];
+        uint8_t *slot = buffer + used;
+        switch (kind) {
+            case _MYS_LOG_ARG_INT:     { int v = va_arg(vargs, int); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_LONG:    { long v = va_arg(vargs, long); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_LLONG:   { long long v = va_arg(vargs, long long); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_SIZE:    { size_t v = va_arg(vargs, size_t); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_INTMAX:  { intmax_t v = va_arg(vargs, intmax_t); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_PTRDIFF: { ptrdiff_t v = va_arg(vargs, ptrdiff_t); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_DOUBLE:  { double v = va_arg(vargs, double); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_LDOUBLE: { long double v = va_arg(vargs, long double); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_PTR:     { void *v = va_arg(vargs, void *); memcpy(slot, &v, sizeof(v)); break; }
+            case _MYS_LOG_ARG_STR: {
+                const char *v = va_arg(vargs, const char *);
+                if (v == NULL)
+                    v = "(null)";
+                size_t room = (size - used - (reserved - 8)) / 8 * 8; // keep room for the arguments after this one
+                size_t max_len = room - 1;
+                int precision = (int)site->precisions[i] - 1;
+                if (site->precisions[i] == _MYS_LOG_PREC_STAR) // the int argument just encoded before
+                    memcpy(&precision, slot - 8, sizeof(int));
+                if (precision >= 0 && (size_t)precision < max_len) // a negative precision is taken as omitted
+                    max_len = (size_t)precision;
+                size_t len = strnlen(v, max_len);
+                memcpy(slot, v, len);
+                slot[len] = '\0';
+                used += (len + 1 + 7) / 8 * 8;
+                reserved -= 8;
+                continue;
+            }
+            default: break;
+        }
+        used += _MYS_LOG_SLOT(kind);
+        reserved -= _MYS_LOG_SLOT(kind);
+    }
+}
+
+// Format the raw arguments of a deferred record, one conversion at a time
+MYS_STATIC size_t _mys_log_site_render(const mys_log_site_t *site, const uint8_t *args, char *out, size_t size)
+{
+    size_t len = 0;
+    int index = 0;
+    const char *p = site->fmt;
+    while (*p != '\0' && len + 1 < size) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        _mys_log_spec_t spec;
+        p = _mys_log_parse_spec(p, &spec);
+        if (spec.kind == -1) {
+            out[len++] = '%';
+            continue;
+        }
+        char conv[64];
+        memcpy(conv, spec.start, spec.len);
+        conv[spec.len] = '\0';
+        int stars[2] = { 0, 0 };
+        for (int i = 0; i < spec.nstars && i < 2; i++) {
+            memcpy(&stars[i], args, sizeof(int));
+            args += 8;
+            index += 1;
+        }
+        char *dst = out + len;
+        size_t room = size - len;
+        int n = 0;
+#define _MYS_LOG_RENDER(type) do {                                                  \
+            type v;                                                                 \
+            memcpy(&v, args, sizeof(type));                                         \
+            n = (spec.nstars == 0) ? snprintf(dst, room, conv, v) :                 \
+                (spec.nstars == 1) ? snprintf(dst, room, conv, stars[0], v) :       \
+                                     snprintf(dst, room, conv, stars[0], stars[1], v); \
+        } while (0)
+        switch (site->kinds[index]) {
+            case _MYS_LOG_ARG_INT:     _MYS_LOG_RENDER(int); break;
+            case _MYS_LOG_ARG_LONG:    _MYS_LOG_RENDER(long); break;
+            case _MYS_LOG_ARG_LLONG:   _MYS_LOG_RENDER(long long); break;
+            case _MYS_LOG_ARG_SIZE:    _MYS_LOG_RENDER(size_t); break;
+            case _MYS_LOG_ARG_INTMAX:  _MYS_LOG_RENDER(intmax_t); break;
+            case _MYS_LOG_ARG_PTRDIFF: _MYS_LOG_RENDER(ptrdiff_t); break;
+            case _MYS_LOG_ARG_DOUBLE:  _MYS_LOG_RENDER(double); break;
+            case _MYS_LOG_ARG_LDOUBLE: _MYS_LOG_RENDER(long double); break;
+            case _MYS_LOG_ARG_PTR:     _MYS_LOG_RENDER(void *); break;
+            case _MYS_LOG_ARG_STR: {
+                const char *v = (const char *)args;
+                n = (spec.nstars == 0) ? snprintf(dst, room, conv, v) :
+                    (spec.nstars == 1) ? snprintf(dst, room, conv, stars[0], v) :
+                                         snprintf(dst, room, conv, stars[0], stars[1], v);
+                args += (strlen(v) + 1 + 7) / 8 * 8;
+                break;
+            }
+            default: break;
+        }
+#undef _MYS_LOG_RENDER
+        if (site->kinds[index] != _MYS_LOG_ARG_STR)
+            args += _MYS_LOG_SLOT(site->kinds[index]);
+        index += 1;
+        len += (n < 0) ? 0 : ((size_t)n < room) ? (size_t)n : room - 1;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/////////////////////////
+// Asynchronous mode
+/////////////////////////
+
+// Handlers take a va_list, but queued records are already formatted
+MYS_STATIC void _mys_log_invoke_text(mys_log_t *logger, mys_log_event_t *event, const char *text, ...)
+{
+    va_list vargs;
+    va_start(vargs, text);
+    mys_log_invoke_handlers(logger, event, text, vargs);
+    va_end(vargs);
+}
+
+// Pass queued records to handlers in time order. The caller holds drain_lock. Returns the number of records passed.
+MYS_STATIC size_t _mys_log_async_drain(_mys_log_async_t *async)
+{
+    mys_log_t *logger = async->logger;
+    uint32_t nqueues = mys_atomic_load_n(&async->nqueues, MYS_ATOMIC_ACQUIRE);
+    size_t count = 0;
+    while (true) {
+        _mys_log_queue_t *oldest = NULL;
+        _mys_log_record_t *record = NULL;
+        for (uint32_t i = 0; i < nqueues; i++) {
+            _mys_log_queue_t *queue = mys_atomic_load_n(&async->queues[i], MYS_ATOMIC_ACQUIRE);
+            if (queue == NULL || queue->head == mys_atomic_load_n(&queue->tail, MYS_ATOMIC_ACQUIRE))
+                continue;
+            _mys_log_record_t *head = &queue->records[queue->head & (async->depth - 1)];
+            if (record == NULL || head->tick < record->tick) {
+                oldest = queue;
+                record = head;
+            }
+        }
+        if (oldest == NULL)
+            return count;
+
+        mys_log_event_t event;
+        event.myrank = record->myrank;
+        event.nranks = record->nranks;
+        event.level = record->level;
+        event.file = record->file;
+        event.line = record->line;
+        event.no_vargs = true;
+        const char *text = record->text;
+        char rendered[MYS_LOG_RENDER_MAX];
+        if (record->site != NULL) {
+            _mys_log_site_render(record->site, (const uint8_t *)record->text, rendered, sizeof(rendered));
+            text = rendered;
+        }
+        mys_mutex_lock(&logger->lock);
+        _mys_log_invoke_text(logger, &event, text);
+        mys_mutex_unlock(&logger->lock);
+        mys_atomic_store_n(&oldest->head, oldest->head + 1, MYS_ATOMIC_RELEASE);
+        count += 1;
+    }
+}
+
+MYS_STATIC void *_mys_log_async_main(void *arg)
+{
+    _mys_log_async_t *async = (_mys_log_async_t *)arg;
+    while (mys_atomic_load_n(&async->stop, MYS_ATOMIC_ACQUIRE) == 0) {
+        mys_mutex_lock(&async->drain_lock);
+        size_t count = _mys_log_async_drain(async);
+        mys_mutex_unlock(&async->drain_lock);
+        if (count == 0) {
+            struct timespec idle = { 0, MYS_LOG_ASYNC_IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+MYS_ATTR_NOINLINE
+MYS_STATIC _mys_log_queue_t *_mys_log_async_create_queue(_mys_log_async_t *async, uint32_t tid)
+{
+    if (tid >= MYS_LOG_ASYNC_MAX_THREADS)
+        return NULL;
+    _mys_log_queue_t *queue = (_mys_log_queue_t *)mys_aligned_alloc2(MYS_ARENA_LOG, 128, sizeof(_mys_log_queue_t));
+    if (queue == NULL)
+        return NULL;
+    memset(queue, 0, sizeof(_mys_log_queue_t));
+    queue->records = (_mys_log_record_t *)mys_malloc2(MYS_ARENA_LOG, sizeof(_mys_log_record_t) * async->depth);
+    if (queue->records == NULL) {
+        mys_free2(MYS_ARENA_LOG, queue, sizeof(_mys_log_queue_t));
+        return NULL;
+    }
+    mys_mutex_lock(&async->lock);
+    {
+        mys_atomic_store_n(&async->queues[tid], queue, MYS_ATOMIC_RELEASE);
+        if (tid + 1 > async->nqueues)
+            mys_atomic_store_n(&async->nqueues, tid + 1, MYS_ATOMIC_RELEASE);
+    }
+    mys_mutex_unlock(&async->lock);
+    return queue;
+}
+
+// Returns false if the record could not be queued and should be logged synchronously
+MYS_ATTR_OPTIMIZE_O3
+MYS_STATIC bool _mys_log_async_post(_mys_log_async_t *async, const mys_log_site_t *site, mys_log_event_t *event, const char *fmt, va_list vargs)
+{
+    uint32_t tid = mys_thread_id();
+    _mys_log_queue_t *queue = MYS_LIKELY(tid < MYS_LOG_ASYNC_MAX_THREADS) ? async->queues[tid] : NULL;
+    if (MYS_UNLIKELY(queue == NULL)) {
+        queue = _mys_log_async_create_queue(async, tid);
+        if (queue == NULL)
+            return false;
+    }
+
+    uint64_t tail = queue->tail;
+    while (MYS_UNLIKELY(tail - mys_atomic_load_n(&queue->head, MYS_ATOMIC_ACQUIRE) >= async->depth)) {
+        int ret = (async->policy == MYS_LOG_ASYNC_BLOCK) ? mys_mutex_trylock(&async->drain_lock) : EDEADLK;
+        if (ret == 0) { // backpressure: drain on behalf of the background thread
+            _mys_log_async_drain(async);
+            mys_mutex_unlock(&async->drain_lock);
+        } else if (ret == EBUSY) {
+            sched_yield();
+        } else { // MYS_LOG_ASYNC_DROP, or a handler of this logger is logging into it
+            mys_atomic_store_n(&queue->dropped, queue->dropped + 1, MYS_ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    _mys_log_record_t *record = &queue->records[tail & (async->depth - 1)];
+    record->tick = mys_hrtick_raw();
+    record->myrank = event->myrank;
+    record->nranks = event->nranks;
+    record->level = event->level;
+    record->line = event->line;
+    record->file = event->file;
+    record->site = NULL;
+    if (event->no_vargs) {
+        snprintf(record->text, sizeof(record->text), "%s", fmt);
+    } else if (site != NULL && site->state == 2) {
+        record->site = site;
+        _mys_log_site_encode(site, (uint8_t *)record->text, sizeof(record->text), vargs);
+    } else {
+        vsnprintf(record->text, sizeof(record->text), fmt, vargs);
+    }
+    mys_atomic_store_n(&queue->tail, tail + 1, MYS_ATOMIC_RELEASE);
+
+    if (MYS_UNLIKELY(event->level >= async->flush_level && event->level != MYS_LOG_RAW))
+        mys_log_flush(async->logger);
+    return true;
+}
+
+MYS_STATIC void _mys_log_async_atexit()
+{
+    mys_mutex_lock(&_mys_log_G.lock);
+    for (int i = 0; i < MYS_LOG_MAX_ASYNC; i++) {
+        if (_mys_log_G.async_loggers[i] != NULL)
+            _mys_log_async_stop(_mys_log_G.async_loggers[i], false); // other threads may still be logging
+    }
+    mys_mutex_unlock(&_mys_log_G.lock);
+}
 
-MYS_STATIC void _mys_log_impl(mys_log_t *logger, int rank, int level, const char *file, int line, const char *fmt, va_list vargs)
+// Join the background thread, flush, and go back to synchronous mode. Keep the queues if `release` is false.
+MYS_STATIC void _mys_log_async_stop(mys_log_t *logger, bool release)
 {
+    _mys_log_async_t *async = mys_atomic_load_n(&logger->async, MYS_ATOMIC_ACQUIRE);
+    if (async == NULL)
+        return;
+    mys_atomic_store_n(&async->stop, 1, MYS_ATOMIC_RELEASE);
+    pthread_join(async->thread, NULL);
+    mys_log_flush(logger);
+    mys_atomic_store_n(&logger->async, (_mys_log_async_t *)NULL, MYS_ATOMIC_RELEASE);
+    if (release) {
+        mys_mutex_lock(&_mys_log_G.lock);
+        for (int i = 0; i < MYS_LOG_MAX_ASYNC; i++) {
+            if (_mys_log_G.async_loggers[i] == logger)
+                _mys_log_G.async_loggers[i] = NULL;
+        }
+        mys_mutex_unlock(&_mys_log_G.lock);
+        for (uint32_t tid = 0; tid < async->nqueues; tid++) {
+            _mys_log_queue_t *queue = async->queues[tid];
+            if (queue == NULL)
+                continue;
+            mys_free2(MYS_ARENA_LOG, queue->records, sizeof(_mys_log_record_t) * async->depth);
+            mys_free2(MYS_ARENA_LOG, queue, sizeof(_mys_log_queue_t));
+        }
+        mys_free2(MYS_ARENA_LOG, async->queues, sizeof(_mys_log_queue_t *) * MYS_LOG_ASYNC_MAX_THREADS);
+        mys_free2(MYS_ARENA_LOG, async, sizeof(_mys_log_async_t));
+    }
+}
+
+MYS_PUBLIC int mys_log_set_async(mys_log_t *logger, size_t depth, int policy, int flush_level)
+{
+    MYS_RETIF(logger == NULL, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(depth > MYS_LOG_ASYNC_MAX_DEPTH, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(policy != MYS_LOG_ASYNC_DROP && policy != MYS_LOG_ASYNC_BLOCK, MYS_EINVAL, MYS_EINVAL);
+    _mys_log_async_stop(logger, true);
+    if (depth == 0)
+        return 0;
+
+    _mys_log_async_t *async = (_mys_log_async_t *)mys_calloc2(MYS_ARENA_LOG, 1, sizeof(_mys_log_async_t));
+    MYS_RETIF(async == NULL, MYS_ENOMEM, MYS_ENOMEM);
+    async->queues = (_mys_log_queue_t **)mys_calloc2(MYS_ARENA_LOG, MYS_LOG_ASYNC_MAX_THREADS, sizeof(_mys_log_queue_t *));
+    if (async->queues == NULL) {
+        mys_free2(MYS_ARENA_LOG, async, sizeof(_mys_log_async_t));
+        MYS_RETIF(true, MYS_ENOMEM, MYS_ENOMEM);
+    }
+    async->logger = logger;
+    async->nqueues = 0;
+    async->depth = 1;
+    while (async->depth < depth)
+        async->depth *= 2;
+    async->policy = policy;
+    async->flush_level = flush_level;
+    async->stop = 0;
+    mys_mutex_init(&async->lock);
+    mys_mutex_init(&async->drain_lock);
+    if (pthread_create(&async->thread, NULL, _mys_log_async_main, async) != 0) {
+        mys_free2(MYS_ARENA_LOG, async->queues, sizeof(_mys_log_queue_t *) * MYS_LOG_ASYNC_MAX_THREADS);
+        mys_free2(MYS_ARENA_LOG, async, sizeof(_mys_log_async_t));
+        MYS_RETIF(true, MYS_EAGAIN, MYS_EAGAIN);
+    }
+
+    mys_mutex_lock(&_mys_log_G.lock);
+    {
+        if (!_mys_log_G.atexit_registered)
+            _mys_log_G.atexit_registered = (atexit(_mys_log_async_atexit) == 0);
+        for (int i = 0; i < MYS_LOG_MAX_ASYNC; i++) {
+            if (_mys_log_G.async_loggers[i] == NULL) {
+                _mys_log_G.async_loggers[i] = logger;
+                break;
+            }
+        }
+    }
+    mys_mutex_unlock(&_mys_log_G.lock);
+    mys_atomic_store_n(&logger->async, async, MYS_ATOMIC_RELEASE);
+    return 0;
+}
+
+MYS_PUBLIC void mys_log_flush(mys_log_t *logger)
+{
+    _mys_log_async_t *async = mys_atomic_load_n(&logger->async, MYS_ATOMIC_ACQUIRE);
+    if (async == NULL)
+        return;
+    if (mys_mutex_lock(&async->drain_lock) != 0)
+        return; // called by a handler of this logger
+    _mys_log_async_drain(async);
+    mys_mutex_unlock(&async->drain_lock);
+}
+
+MYS_PUBLIC size_t mys_log_dropped(mys_log_t *logger)
+{
+    _mys_log_async_t *async = mys_atomic_load_n(&logger->async, MYS_ATOMIC_ACQUIRE);
+    if (async == NULL)
+        return 0;
+    size_t dropped = 0;
+    uint32_t nqueues = mys_atomic_load_n(&async->nqueues, MYS_ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < nqueues; i++) {
+        _mys_log_queue_t *queue = mys_atomic_load_n(&async->queues[i], MYS_ATOMIC_ACQUIRE);
+        if (queue != NULL)
+            dropped += mys_atomic_load_n(&queue->dropped, MYS_ATOMIC_RELAXED);
+    }
+    return dropped;
+}
+
+/////////////////////////
+// Logging
+/////////////////////////
+
+MYS_STATIC void _mys_log_impl(mys_log_t *logger, const mys_log_site_t *site, int rank, int level, const char *file, int line, const char *fmt, va_list vargs)
+{
+    _mys_log_async_t *async = mys_atomic_load_n(&logger->async, MYS_ATOMIC_ACQUIRE);
+    if (async != NULL) { // check without the logger lock, it is taken by handlers
+        if (logger->silent == true || level < logger->level)
+            return;
+        int myrank, nranks;
+        mys_MPI_Comm_rank(logger->comm, &myrank);
+        if (rank != myrank)
+            return;
+        mys_MPI_Comm_size(logger->comm, &nranks);
+        mys_log_event_t event;
+        event.myrank = myrank;
+        event.nranks = nranks;
+        event.level = level;
+        event.file = (strrchr(file, '/') ? strrchr(file, '/') + 1 : file);
+        event.line = line;
+        event.no_vargs = false;
+        if (fmt == NULL) {
+            event.level = MYS_LOG_FATAL;
+            fmt = "Calling mys_log with NULL format string. Do you call LOG_SELF(0, \"...\") or LOG(rank, NULL)?";
+            event.no_vargs = true;
+        }
+        if (_mys_log_async_post(async, site, &event, fmt, vargs))
+            return;
+    }
+
     mys_mutex_lock(&logger->lock);
     if (logger->silent == true) {
         mys_mutex_unlock(&logger->lock);
@@ -160,6 +768,19 @@ MYS_PUBLIC void mys_log_once(mys_log_t *logger, int level, const char *file, int
     va_end(vargs);
 }
 
+MYS_PUBLIC void mys_log_once_site(mys_log_t *logger, int *fired, int level, const char *file, int line, const char *fmt, ...)
+{
+    int expected = 0;
+    if (!mys_atomic_compare_exchange_n(fired, &expected, 1, MYS_ATOMIC_RELAXED, MYS_ATOMIC_RELAXED))
+        return; // another thread won
+    int myrank;
+    mys_MPI_Comm_rank(logger->comm, &myrank);
+    va_list vargs;
+    va_start(vargs, fmt);
+    _mys_log_impl(logger, NULL, myrank, level, file, line, fmt, vargs);
+    va_end(vargs);
+}
+
 MYS_PUBLIC void mys_log_ordered(mys_log_t *logger, int level, const char *file, int line, const char *fmt, ...)
 {
     va_list vargs;
@@ -168,9 +789,19 @@ MYS_PUBLIC void mys_log_ordered(mys_log_t *logger, int level, const char *file,
     va_end(vargs);
 }
 
+MYS_PUBLIC void mys_log_deferred(mys_log_t *logger, mys_log_site_t *site, int rank, ...)
+{
+    if (MYS_UNLIKELY(mys_atomic_load_n(&site->state, MYS_ATOMIC_ACQUIRE) < 2))
+        _mys_log_site_parse(site);
+    va_list vargs;
+    va_start(vargs, rank);
+    _mys_log_impl(logger, site, rank, site->level, site->file, site->line, site->fmt, vargs);
+    va_end(vargs);
+}
+
 MYS_PUBLIC void mys_log_rank_v(mys_log_t *logger, int rank, int level, const char *file, int line, const char *fmt, va_list vargs)
 {
-    _mys_log_impl(logger, rank, level, file, line, fmt, vargs);
+    _mys_log_impl(logger, NULL, rank, level, file, line, fmt, vargs);
 }
 
 MYS_PUBLIC void mys_log_when_v(mys_log_t *logger, int when, int level, const char *file, int line, const char *fmt, va_list vargs)
@@ -179,106 +810,199 @@ MYS_PUBLIC void mys_log_when_v(mys_log_t *logger, int when, int level, const cha
         return;
     int myrank;
     mys_MPI_Comm_rank(logger->comm, &myrank);
-    _mys_log_impl(logger, myrank, level, file, line, fmt, vargs);
+    _mys_log_impl(logger, NULL, myrank, level, file, line, fmt, vargs);
 }
 
 MYS_PUBLIC void mys_log_self_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs)
 {
     int myrank;
     mys_MPI_Comm_rank(logger->comm, &myrank);
-    _mys_log_impl(logger, myrank, level, file, line, fmt, vargs);
+    _mys_log_impl(logger, NULL, myrank, level, file, line, fmt, vargs);
 }
 
 MYS_PUBLIC void mys_log_once_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs)
 {
-    // log only once at "file:line".
-    _mys_log_once_t *entry = NULL, *new_entry = NULL;
+    // log only once at "file:line". The *LOG_ONCE macros use a flag of their call site instead (see MYS_LOG_ONCE).
+    _mys_log_once_t *entry = NULL;
     char key[1024];
     snprintf(key, sizeof(key), "%s:%d", file, line);
     mys_mutex_lock(&logger->lock);
     {
         _HASH_FIND_STR(logger->once_map, key, entry);
+        if (entry == NULL) { // find and add under one lock, so that only one thread logs
+            entry = (_mys_log_once_t *)malloc(sizeof(_mys_log_once_t));
+            entry->key = strndup(key, sizeof(key));
+            _HASH_ADD_STR(logger->once_map, key, entry);
+            entry = NULL;
+        }
     }
     mys_mutex_unlock(&logger->lock);
 
     if (entry != NULL) // already logged
         return;
 
-    new_entry = (_mys_log_once_t *)malloc(sizeof(_mys_log_once_t));
-    new_entry->key = strndup(key, sizeof(key));
-    mys_mutex_lock(&logger->lock);
-    {
-        _HASH_ADD_STR(logger->once_map, key, new_entry);
-    }
-    mys_mutex_unlock(&logger->lock);
-
     int myrank;
     mys_MPI_Comm_rank(logger->comm, &myrank);
-    _mys_log_impl(logger, myrank, level, file, line, fmt, vargs);
+    _mys_log_impl(logger, NULL, myrank, level, file, line, fmt, vargs);
 }
 
-MYS_PUBLIC void mys_log_ordered_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs)
+/////////////////////////
+// Ordered logging
+/////////////////////////
+
+// Append a message of this rank: int level, int line, file and text (both NUL-terminated). Caller holds logger->lock.
+MYS_STATIC void _mys_log_ordered_append(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs)
 {
-    mys_mutex_lock(&logger->lock);
-    if (logger->silent == true) {
-        mys_mutex_unlock(&logger->lock);
-        return;
+    if (fmt == NULL) {
+        level = MYS_LOG_FATAL;
+        fmt = "Calling mys_log with NULL format string. Do you call LOG_SELF(0, \"...\") or LOG(rank, NULL)?";
+    }
+    file = (strrchr(file, '/') ? strrchr(file, '/') + 1 : file);
+    va_list vargs_test;
+    va_copy(vargs_test, vargs);
+    int text_len = vsnprintf(NULL, 0, fmt, vargs_test);
+    va_end(vargs_test);
+    if (text_len < 0)
+        text_len = 0;
+    size_t file_len = strlen(file);
+    size_t needed = 2 * sizeof(int) + file_len + 1 + (size_t)text_len + 1;
+    if (logger->ordered_len + needed > logger->ordered_cap) {
+        size_t cap = (logger->ordered_cap == 0) ? 4096 : logger->ordered_cap;
+        while (cap < logger->ordered_len + needed)
+            cap *= 2;
+        char *buf = (char *)mys_realloc2(MYS_ARENA_LOG, logger->ordered_buf, cap, logger->ordered_cap);
+        if (buf == NULL)
+            return;
+        logger->ordered_buf = buf;
+        logger->ordered_cap = cap;
     }
+    char *ptr = logger->ordered_buf + logger->ordered_len;
+    memcpy(ptr, &level, sizeof(int));
+    memcpy(ptr + sizeof(int), &line, sizeof(int));
+    ptr += 2 * sizeof(int);
+    memcpy(ptr, file, file_len + 1);
+    ptr += file_len + 1;
+    vsnprintf(ptr, (size_t)text_len + 1, fmt, vargs);
+    logger->ordered_len += needed;
+}
+
+// Collective. Rank 0 gathers the messages of all ranks and passes them to handlers in rank order.
+// One MPI_Allgather of sizes and one MPI_Gatherv of messages, instead of probing every rank in turn.
+// MPI counts and displacements are int, so more than 2 GiB in total is gathered in several rounds,
+// whose number all ranks know from the sizes.
+MYS_STATIC void _mys_log_ordered_flush(mys_log_t *logger)
+{
     int myrank, nranks;
     mys_MPI_Comm_rank(logger->comm, &myrank);
     mys_MPI_Comm_size(logger->comm, &nranks);
+    long long len = (long long)logger->ordered_len;
+    char dummy = '\0';
+    char *sendbuf = (logger->ordered_buf != NULL) ? logger->ordered_buf : &dummy;
 
-    const int tag = 2717; /*OpenMPI 4.1.0 on AArch64 throw invalid tag on large tag, e.g, 100000007*/
-
+    long long *lens = (long long *)mys_malloc2(MYS_ARENA_LOG, sizeof(long long) * nranks);
+    size_t *offsets = NULL;
+    int *counts = NULL;
+    int *displs = NULL;
+    char *all = NULL;
+    char *round = NULL;
+    size_t total = 0;
+    size_t round_size = 0;
+    mys_MPI_Allgather(&len, 1, mys_MPI_LONG_LONG_INT, lens, 1, mys_MPI_LONG_LONG_INT, logger->comm);
+    long long max_len = 0;
+    for (int rank = 0; rank < nranks; rank++)
+        max_len = (lens[rank] > max_len) ? lens[rank] : max_len;
+    long long chunk = (MYS_LOG_ORDERED_ROUND / nranks > 0) ? MYS_LOG_ORDERED_ROUND / nranks : 1; // bytes of each rank per round
+    long long nrounds = (max_len + chunk - 1) / chunk;
     if (myrank == 0) {
-        mys_log_event_t event;
-        event.myrank = myrank;
-        event.nranks = nranks;
-        event.level = level;
-        event.file = (strrchr(file, '/') ? strrchr(file, '/') + 1 : file);
-        event.line = line;
-        event.no_vargs = false;
-        bool broken = false;
-        if (fmt == NULL) {
-            event.level = MYS_LOG_FATAL;
-            fmt = "Calling mys_log with NULL format string. Do you call LOG_SELF(0, \"...\") or LOG(rank, NULL)?";
-            event.no_vargs = true;
-            broken = true;
+        offsets = (size_t *)mys_malloc2(MYS_ARENA_LOG, sizeof(size_t) * nranks);
+        counts = (int *)mys_malloc2(MYS_ARENA_LOG, sizeof(int) * nranks);
+        displs = (int *)mys_malloc2(MYS_ARENA_LOG, sizeof(int) * nranks);
+    }
+    if (myrank == 0) {
+        for (int rank = 0; rank < nranks; rank++) {
+            offsets[rank] = total;
+            total += (size_t)lens[rank];
         }
-        mys_log_invoke_handlers(logger, &event, fmt, vargs);
-        char buffer[4096];
-        for (int rank = 1; rank < nranks; rank++) {
-            mys_MPI_Status status;
-            int needed = 0;
-            mys_MPI_Probe(rank, tag, logger->comm, &status);
-            mys_MPI_Get_count(&status, mys_MPI_CHAR, &needed);
-            char *ptr = (needed > 4096) ? (char *)mys_malloc2(MYS_ARENA_LOG, needed) : buffer;
-            mys_MPI_Recv(ptr, needed, mys_MPI_CHAR, rank, tag, logger->comm, mys_MPI_STATUS_IGNORE);
-
-            if (!broken) {
+        all = (char *)mys_malloc2(MYS_ARENA_LOG, total + 1);
+        // A single round lands in place, more rounds go through a buffer of one round
+        round_size = (nrounds > 1) ? (size_t)chunk * (size_t)nranks : 0;
+        round = (nrounds > 1) ? (char *)mys_malloc2(MYS_ARENA_LOG, round_size) : all;
+    }
+    for (long long r = 0; r < nrounds; r++) {
+        long long begin = r * chunk;
+        int count = (len > begin) ? (int)((len - begin < chunk) ? len - begin : chunk) : 0;
+        if (myrank == 0) {
+            int displ = 0;
+            for (int rank = 0; rank < nranks; rank++) {
+                counts[rank] = (lens[rank] > begin) ? (int)((lens[rank] - begin < chunk) ? lens[rank] - begin : chunk) : 0;
+                displs[rank] = displ;
+                displ += counts[rank];
+            }
+        }
+        mys_MPI_Gatherv((count != 0) ? sendbuf + begin : sendbuf, count, mys_MPI_CHAR, round, counts, displs, mys_MPI_CHAR, 0, logger->comm);
+        if (myrank == 0 && round != all) {
+            for (int rank = 0; rank < nranks; rank++)
+                memcpy(all + offsets[rank] + begin, round + displs[rank], (size_t)counts[rank]);
+        }
+    }
+
+    if (myrank == 0) {
+        for (int rank = 0; rank < nranks; rank++) {
+            const char *ptr = all + offsets[rank];
+            const char *end = ptr + lens[rank];
+            while (ptr < end) {
+                mys_log_event_t event;
+                memcpy(&event.level, ptr, sizeof(int));
+                memcpy(&event.line, ptr + sizeof(int), sizeof(int));
+                ptr += 2 * sizeof(int);
+                event.file = ptr;
+                ptr += strlen(ptr) + 1;
                 event.myrank = rank;
-                fmt = ptr;
+                event.nranks = nranks;
                 event.no_vargs = true;
-                mys_log_invoke_handlers(logger, &event, fmt, vargs);
+                _mys_log_invoke_text(logger, &event, ptr);
+                ptr += strlen(ptr) + 1;
             }
-            if (ptr != buffer)
-                mys_free2(MYS_ARENA_LOG, ptr, needed);
         }
-        mys_MPI_Barrier(logger->comm);
-    } else {
-        char buffer[4096];
-        va_list vargs_test;
-        va_copy(vargs_test, vargs);
-        int needed = vsnprintf(NULL, 0, fmt, vargs_test) + 1;
-        va_end(vargs_test);
-        char *ptr = (needed > 4096) ? (char *)mys_malloc2(MYS_ARENA_LOG, needed) : buffer;
-        vsnprintf(ptr, needed, fmt, vargs);
-        mys_MPI_Send(ptr, needed, mys_MPI_CHAR, 0, tag, logger->comm);
-        if (ptr != buffer)
-            mys_free2(MYS_ARENA_LOG, ptr, needed);
-        mys_MPI_Barrier(logger->comm); // We don't expect logging increase processes' nondeterministic
+        if (round != all)
+            mys_free2(MYS_ARENA_LOG, round, round_size);
+        mys_free2(MYS_ARENA_LOG, all, total + 1);
+        mys_free2(MYS_ARENA_LOG, displs, sizeof(int) * nranks);
+        mys_free2(MYS_ARENA_LOG, counts, sizeof(int) * nranks);
+        mys_free2(MYS_ARENA_LOG, offsets, sizeof(size_t) * nranks);
     }
+    mys_free2(MYS_ARENA_LOG, lens, sizeof(long long) * nranks);
+    logger->ordered_len = 0;
+    mys_MPI_Barrier(logger->comm); // We don't expect logging increase processes' nondeterministic
+}
 
+MYS_PUBLIC void mys_log_ordered_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs)
+{
+    mys_log_flush(logger); // keep the order with records still queued
+    mys_mutex_lock(&logger->lock);
+    if (logger->silent == true) {
+        mys_mutex_unlock(&logger->lock);
+        return;
+    }
+    _mys_log_ordered_append(logger, level, file, line, fmt, vargs);
+    if (!logger->ordered_batch)
+        _mys_log_ordered_flush(logger);
+    mys_mutex_unlock(&logger->lock);
+}
+
+MYS_PUBLIC void mys_log_ordered_batch_begin(mys_log_t *logger)
+{
+    mys_mutex_lock(&logger->lock);
+    logger->ordered_batch = true;
+    mys_mutex_unlock(&logger->lock);
+}
+
+MYS_PUBLIC void mys_log_ordered_batch_end(mys_log_t *logger)
+{
+    mys_log_flush(logger);
+    mys_mutex_lock(&logger->lock);
+    logger->ordered_batch = false;
+    _mys_log_ordered_flush(logger);
     mys_mutex_unlock(&logger->lock);
 }
 
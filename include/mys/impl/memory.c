@@ -11,14 +11,26 @@
 #include "../_config.h"
 #include "../errno.h"
 #include "../assert.h"
+#include "../backtrace.h"
+#include "../atomic.h"
 #include "../mpistubs.h"
 #include "../pmparser.h"
 #include "../os.h"
 #include "../string.h"
+#include "../math.h"
+#include "../thread.h"
 #include "../memory.h"
+#include "../commgroup.h"
 #include "uthash_hash.h"
 
+#include <pthread.h>
 #include <sys/stat.h>
+#ifdef POSIX_COMPLIANCE
+#include <sys/mman.h>
+#endif
+#if defined(KERNEL_LINUX)
+#include <sys/syscall.h>
+#endif
 
 mys_arena_t mys_predefined_arena_log = MYS_ARENA_INITIALIZER("mys_log");
 mys_arena_t mys_predefined_arena_pool = MYS_ARENA_INITIALIZER("mys_pool");
@@ -39,46 +51,50 @@ struct mys_arena_debugger_t {
     size_t size;
     void *backtrace[MYS_MAX_ARENA_TRACE];
     int ntrace;
+    double weight; // allocations represented by this record, 1 if not sampled
     _mys_UT_hash_handle hh;
 };
 
 MYS_STATIC void _mys_arena_debug_get_stack(mys_arena_debugger_t *node, mys_string_t *str)
 {
-    const char *self_exe = mys_procname();
-    struct stat self_st;
-    stat(self_exe, &self_st);
-
-    mys_string_fmt(str, "    %p (%zu bytes):\n", node->ptr, node->size);
+    if (node->weight != 1.0)
+        mys_string_fmt(str, "    %p (%zu bytes, sampled, stands for ~%.1f allocations):\n", node->ptr, node->size, node->weight);
+    else
+        mys_string_fmt(str, "    %p (%zu bytes):\n", node->ptr, node->size);
 
+    // Frames 0-1 are inside mys_arena itself and never printed
+    if (node->ntrace > 2)
+        mys_backtrace_resolve(node->backtrace + 2, node->ntrace - 2); // no-op if resolved in batch already
     for (int i = 2; i < node->ntrace; i++) {
-        const char *target = self_exe;
-        void *relative = node->backtrace[i];
-        mys_procmaps_t *self = mys_pmparser_self();
-        mys_procmap_t *map = self->head;
-        while (map) {
-            if (node->backtrace[i] >= map->addr_start && node->backtrace[i] < map->addr_end) {
-                struct stat st;
-                if (stat(map->pathname, &st) == 0) {
-                    bool is_self_exe = (st.st_ino == self_st.st_ino && st.st_dev == self_st.st_dev);
-                    if (!is_self_exe) {
-                        target = map->pathname;
-                        relative = (void *)((uintptr_t)node->backtrace[i] - (uintptr_t)map->addr_start);
-                    }
-                }
-                break;
-            }
-            map = map->next;
-        }
-        mys_prun_t run = mys_prun_create2("addr2line -e %s %p", target, relative);
-        // DLOG(0, "cmd: %s", run.cmd);
-        // mys_string_fmt(str, " %s;", run.out);
-        mys_string_fmt(str, "        %s", run.out);
+        char source[512];
+        mys_backtrace_source(node->backtrace[i], source, sizeof(source));
+        mys_string_fmt(str, "        %s", source);
         if (i < node->ntrace - 1)
             mys_string_fmt(str, "\n");
-        mys_prun_destroy(&run);
     }
 }
 
+// Resolve frames of the first `max_nodes` records in one batch
+MYS_STATIC void _mys_arena_debug_resolve(mys_arena_debugger_t *head, size_t max_nodes)
+{
+    size_t nnodes = (size_t)_HASH_COUNT(head);
+    if (nnodes > max_nodes)
+        nnodes = max_nodes;
+    void **addrs = (void **)malloc(sizeof(void *) * MYS_MAX_ARENA_TRACE * (nnodes + 1));
+    int naddrs = 0;
+    size_t count = 0;
+    mys_arena_debugger_t *node = NULL;
+    mys_arena_debugger_t *tmp = NULL;
+    _HASH_ITER(hh, head, node, tmp) {
+        if (count++ >= nnodes)
+            break;
+        for (int i = 2; i < node->ntrace; i++)
+            addrs[naddrs++] = node->backtrace[i];
+    }
+    mys_backtrace_resolve(addrs, naddrs);
+    free(addrs);
+}
+
 MYS_STATIC mys_arena_debugger_t *_mys_arena_debug_find(mys_arena_debugger_t **head, void *ptr)
 {
     mys_arena_debugger_t *node = NULL;
@@ -92,6 +108,7 @@ MYS_STATIC mys_arena_debugger_t *_mys_arena_debug_insert(mys_arena_debugger_t **
     node->ptr = ptr;
     node->size = size;
     node->ntrace = backtrace(node->backtrace, MYS_MAX_ARENA_TRACE);
+    node->weight = 1.0;
     _HASH_ADD_PTR(*head, ptr, node);
     return node;
 }
@@ -141,10 +158,10 @@ static _mys_memory_G_t _mys_memory_G = {
 MYS_STATIC void _mys_ensure_register_arena(mys_arena_t *arena)
 {
     AS_NE_PTR(arena, NULL);
-    if (arena->_registered)
+    if (MYS_LIKELY(mys_atomic_load_n(&arena->_registered, MYS_ATOMIC_ACQUIRE)))
         return;
     mys_mutex_lock(&_mys_memory_G.lock);
-    {
+    if (!arena->_registered) {
         ASX_NE_SIZET(_mys_memory_G.arena_size, _mys_memory_G.arena_capacity,
             "mys_memory_G support maximum %zu arenas only", _mys_memory_G.arena_capacity);
         // if (_mys_memory_G.arena_size == _mys_memory_G.arena_capacity) {
@@ -156,7 +173,7 @@ MYS_STATIC void _mys_ensure_register_arena(mys_arena_t *arena)
         // }
         _mys_memory_G.registered_arenas[_mys_memory_G.arena_size] = arena;
         _mys_memory_G.arena_size += 1;
-        arena->_registered = true;
+        mys_atomic_store_n(&arena->_registered, true, MYS_ATOMIC_RELEASE);
     }
     mys_mutex_unlock(&_mys_memory_G.lock);
 }
@@ -185,6 +202,774 @@ MYS_STATIC void _mys_deregister_arena(mys_arena_t *arena)
     mys_mutex_unlock(&_mys_memory_G.lock);
 }
 
+/*
+    Arena statistics
+    - Each thread takes a stat slot in [0, MYS_ARENA_STAT_SHARDS) on first use and gives it back
+      when it exits (pthread key destructor), so a slot has at most one live owner. The owner is
+      the only writer of shard `slot` in every arena and updates it with plain relaxed load/store.
+      Release/acquire on the slot bitmap orders the stores of a dead owner before those of the next.
+    - Threads that find no free slot, and threads that already gave their slot back, use the extra
+      shard MYS_ARENA_STAT_SHARED, which is only updated with atomic RMW.
+    - Shards are padded to their own cache lines. mys_arena_sync() sums all shards into the public
+      fields of mys_arena_t.
+    - peak is estimated: once the alive bytes of a shard moved more than MYS_ARENA_STAT_FOLD away
+      from what it folded last time, the difference is folded into `alive_estimate`, and arena->peak
+      is raised with a CAS loop.
+*/
+#define MYS_ARENA_STAT_SHARDS 64
+#define MYS_ARENA_STAT_SHARED MYS_ARENA_STAT_SHARDS
+#define MYS_ARENA_STAT_FOLD (64 * 1024)
+#define MYS_ARENA_STAT_ALIGN 128
+
+typedef struct mys_arena_stat_shard_t {
+    size_t total;
+    size_t freed;
+    size_t total_count;
+    size_t freed_count;
+    size_t folded; // total - freed when it was last folded into alive_estimate
+    uint8_t _padding[MYS_ARENA_STAT_ALIGN - 5 * sizeof(size_t)];
+} mys_arena_stat_shard_t;
+
+typedef struct mys_arena_stats_t {
+    mys_arena_stat_shard_t shards[MYS_ARENA_STAT_SHARDS + 1];
+    int64_t alive_estimate;
+} mys_arena_stats_t;
+
+static uint64_t _mys_stat_slot_bits = 0; // bit i is set if slot i is owned by a live thread
+static pthread_key_t _mys_stat_slot_key;
+static pthread_once_t _mys_stat_slot_once = PTHREAD_ONCE_INIT;
+static bool _mys_stat_slot_key_ok = false;
+static mys_thread_local int _mys_stat_slot = -1; // -1 if not taken yet
+
+MYS_STATIC void _mys_stat_slot_exit(void *value)
+{
+    int slot = (int)((uintptr_t)value - 1);
+    // Frees made by later key destructors of this thread go to the shared shard
+    _mys_stat_slot = MYS_ARENA_STAT_SHARED;
+    mys_atomic_fetch_and(&_mys_stat_slot_bits, ~((uint64_t)1 << slot), MYS_ATOMIC_RELEASE);
+}
+
+MYS_STATIC void _mys_stat_slot_key_init()
+{
+    _mys_stat_slot_key_ok = (pthread_key_create(&_mys_stat_slot_key, _mys_stat_slot_exit) == 0);
+}
+
+MYS_STATIC int _mys_stat_slot_take()
+{
+    pthread_once(&_mys_stat_slot_once, _mys_stat_slot_key_init);
+    int slot = MYS_ARENA_STAT_SHARED;
+    uint64_t bits = mys_atomic_load_n(&_mys_stat_slot_bits, MYS_ATOMIC_RELAXED);
+    while (_mys_stat_slot_key_ok && bits != UINT64_MAX) {
+        int free_slot = __builtin_ctzll(~bits);
+        uint64_t taken = bits | ((uint64_t)1 << free_slot);
+        if (mys_atomic_compare_exchange_n(&_mys_stat_slot_bits, &bits, taken, MYS_ATOMIC_ACQUIRE, MYS_ATOMIC_RELAXED)) {
+            slot = free_slot;
+            if (pthread_setspecific(_mys_stat_slot_key, (void *)(uintptr_t)(slot + 1)) != 0) {
+                mys_atomic_fetch_and(&_mys_stat_slot_bits, ~((uint64_t)1 << slot), MYS_ATOMIC_RELEASE);
+                slot = MYS_ARENA_STAT_SHARED;
+            }
+            break;
+        }
+    }
+    _mys_stat_slot = slot;
+    return slot;
+}
+
+static inline int _mys_stat_slot_get()
+{
+    int slot = _mys_stat_slot;
+    return MYS_LIKELY(slot >= 0) ? slot : _mys_stat_slot_take();
+}
+
+// Only the owner of a slot writes its shard, so it can skip the lock prefix. Return the new value.
+static inline size_t _mys_arena_stat_add(bool exclusive, size_t *ptr, size_t val)
+{
+    if (MYS_LIKELY(exclusive)) {
+        size_t sum = mys_atomic_load_n(ptr, MYS_ATOMIC_RELAXED) + val;
+        mys_atomic_store_n(ptr, sum, MYS_ATOMIC_RELAXED);
+        return sum;
+    }
+    return mys_atomic_add_fetch(ptr, val, MYS_ATOMIC_RELAXED);
+}
+
+MYS_STATIC mys_arena_stats_t *_mys_arena_stats_get(mys_arena_t *arena)
+{
+    mys_arena_stats_t *stats = (mys_arena_stats_t *)mys_atomic_load_n(&arena->_stats, MYS_ATOMIC_ACQUIRE);
+    if (MYS_LIKELY(stats != NULL))
+        return stats;
+    mys_arena_stats_t *fresh = NULL;
+    AS_EQ_I32(posix_memalign((void **)&fresh, MYS_ARENA_STAT_ALIGN, sizeof(mys_arena_stats_t)), 0);
+    memset(fresh, 0, sizeof(mys_arena_stats_t));
+    void *expected = NULL;
+    if (mys_atomic_compare_exchange_n(&arena->_stats, &expected, (void *)fresh, MYS_ATOMIC_ACQ_REL, MYS_ATOMIC_ACQUIRE))
+        return fresh;
+    free(fresh); // another thread won the race
+    return (mys_arena_stats_t *)expected;
+}
+
+MYS_STATIC void _mys_arena_stat_raise_peak(mys_arena_t *arena, size_t alive)
+{
+    size_t peak = mys_atomic_load_n(&arena->peak, MYS_ATOMIC_RELAXED);
+    while (peak < alive && !mys_atomic_compare_exchange_n(&arena->peak, &peak, alive, MYS_ATOMIC_RELAXED, MYS_ATOMIC_RELAXED)) {}
+}
+
+static MYS_ATTR_ALWAYS_INLINE void _mys_arena_stat_update(mys_arena_t *arena, size_t alloc_bytes, size_t freed_bytes, size_t alloc_count, size_t freed_count)
+{
+    mys_arena_stats_t *stats = _mys_arena_stats_get(arena);
+    int slot = _mys_stat_slot_get();
+    mys_arena_stat_shard_t *shard = &stats->shards[slot];
+    bool exclusive = (slot != MYS_ARENA_STAT_SHARED);
+    if (alloc_count != 0)
+        _mys_arena_stat_add(exclusive, &shard->total_count, alloc_count);
+    if (freed_count != 0)
+        _mys_arena_stat_add(exclusive, &shard->freed_count, freed_count);
+    if (alloc_bytes == 0 && freed_bytes == 0)
+        return;
+    size_t total = (alloc_bytes != 0) ? _mys_arena_stat_add(exclusive, &shard->total, alloc_bytes)
+                                      : mys_atomic_load_n(&shard->total, MYS_ATOMIC_RELAXED);
+    size_t freed = (freed_bytes != 0) ? _mys_arena_stat_add(exclusive, &shard->freed, freed_bytes)
+                                      : mys_atomic_load_n(&shard->freed, MYS_ATOMIC_RELAXED);
+    // Alive bytes of a shard wrap around if it frees memory allocated through other shards,
+    // only differences of them are meaningful.
+    size_t now = total - freed;
+    size_t folded = mys_atomic_load_n(&shard->folded, MYS_ATOMIC_RELAXED);
+    int64_t delta = (int64_t)(now - folded);
+    if (MYS_LIKELY(delta < MYS_ARENA_STAT_FOLD && delta > -MYS_ARENA_STAT_FOLD))
+        return;
+    // alive_estimate always equals the sum of `folded` over shards, so no delta is counted twice
+    if (exclusive)
+        mys_atomic_store_n(&shard->folded, now, MYS_ATOMIC_RELAXED);
+    else if (!mys_atomic_compare_exchange_n(&shard->folded, &folded, now, MYS_ATOMIC_RELAXED, MYS_ATOMIC_RELAXED))
+        return; // another thread of the shared shard folded it
+    int64_t alive = mys_atomic_add_fetch(&stats->alive_estimate, delta, MYS_ATOMIC_RELAXED);
+    if (alive > 0)
+        _mys_arena_stat_raise_peak(arena, (size_t)alive);
+}
+
+/*
+    Sampled debug tracking (mys_arena_set_debug_sampling)
+    - Each stat slot keeps a countdown of bytes until the next sampled allocation. Threads on the
+      shared slot may race on its countdown, which only perturbs when they sample. After a
+      sample, the countdown is redrawn from an exponential distribution with mean `interval`,
+      so every allocated byte has the same chance 1/interval to trigger a sample (Poisson).
+    - A sampled allocation of s bytes is recorded with weight 1/(1-exp(-s/interval)), the
+      inverse of its probability to be sampled. Reports sum the weights for unbiased estimates.
+    - Frees check a counting filter of sampled pointers first, so most of them skip the lock
+      and the hash lookup.
+*/
+#define MYS_SAMPLER_FILTER_BITS 12
+
+typedef struct mys_arena_sampler_slot_t {
+    int64_t countdown; // bytes until next sample
+    uint64_t rng; // splitmix64 state, do not disturb the user's mys_rand_* stream
+    uint8_t _padding[MYS_ARENA_STAT_ALIGN - sizeof(int64_t) - sizeof(uint64_t)];
+} mys_arena_sampler_slot_t;
+
+typedef struct mys_arena_sampler_t {
+    mys_arena_sampler_slot_t slots[MYS_ARENA_STAT_SHARDS + 1]; // indexed by stat slot, like shards
+    size_t interval; // mean bytes between samples, 0 to record every allocation
+    mys_mutex_t lock; // protects arena->_debug_trace
+    uint32_t filter[1 << MYS_SAMPLER_FILTER_BITS]; // number of records hashed to each bucket
+} mys_arena_sampler_t;
+
+MYS_STATIC uint64_t _mys_sampler_splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+MYS_STATIC int64_t _mys_sampler_next_interval(mys_arena_sampler_slot_t *slot, size_t interval)
+{
+    uint64_t rng = mys_atomic_load_n(&slot->rng, MYS_ATOMIC_RELAXED);
+    double u = (double)((_mys_sampler_splitmix64(&rng) >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+    mys_atomic_store_n(&slot->rng, rng, MYS_ATOMIC_RELAXED);
+    return (int64_t)(-mys_math_log(u) * (double)interval) + 1;
+}
+
+MYS_STATIC size_t _mys_sampler_bucket(void *ptr)
+{
+    return (size_t)(((uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ull) >> (64 - MYS_SAMPLER_FILTER_BITS));
+}
+
+// Lock debug records of an arena, only needed in sampled mode
+MYS_STATIC void _mys_arena_debug_lock(mys_arena_t *arena)
+{
+    mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)mys_atomic_load_n(&arena->_sampler, MYS_ATOMIC_ACQUIRE);
+    if (sampler != NULL)
+        mys_mutex_lock(&sampler->lock);
+}
+
+MYS_STATIC void _mys_arena_debug_unlock(mys_arena_t *arena)
+{
+    mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)mys_atomic_load_n(&arena->_sampler, MYS_ATOMIC_ACQUIRE);
+    if (sampler != NULL)
+        mys_mutex_unlock(&sampler->lock);
+}
+
+// Drop a record found by iterating the hash. Caller holds the debug lock.
+MYS_STATIC void _mys_arena_debug_forget(mys_arena_t *arena, mys_arena_debugger_t *node)
+{
+    mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)arena->_sampler;
+    if (sampler != NULL)
+        mys_atomic_fetch_sub(&sampler->filter[_mys_sampler_bucket(node->ptr)], 1, MYS_ATOMIC_RELAXED);
+    _mys_arena_stat_update(arena, 0, 0, 0, 1);
+    _HASH_DEL(*(mys_arena_debugger_t **)&arena->_debug_trace, node);
+    free(node);
+}
+
+MYS_STATIC void _mys_arena_sample_insert(mys_arena_t *arena, mys_arena_sampler_t *sampler, void *ptr, size_t size)
+{
+    size_t interval = mys_atomic_load_n(&sampler->interval, MYS_ATOMIC_RELAXED);
+    double weight = 1.0;
+    if (interval > 0) {
+        mys_arena_sampler_slot_t *slot = &sampler->slots[_mys_stat_slot_get()];
+        int64_t countdown = mys_atomic_load_n(&slot->countdown, MYS_ATOMIC_RELAXED) - (int64_t)size;
+        if (MYS_LIKELY(countdown > 0)) {
+            mys_atomic_store_n(&slot->countdown, countdown, MYS_ATOMIC_RELAXED);
+            return;
+        }
+        mys_atomic_store_n(&slot->countdown, _mys_sampler_next_interval(slot, interval), MYS_ATOMIC_RELAXED);
+        double p = 1.0 - mys_math_pow(2.718281828459045, -(double)size / (double)interval);
+        weight = (p > 0) ? 1.0 / p : (double)interval;
+    }
+    mys_mutex_lock(&sampler->lock);
+    mys_arena_debugger_t *node = _mys_arena_debug_insert((mys_arena_debugger_t **)&arena->_debug_trace, ptr, size);
+    node->weight = weight;
+    mys_atomic_fetch_add(&sampler->filter[_mys_sampler_bucket(ptr)], 1, MYS_ATOMIC_RELAXED);
+    _mys_arena_stat_update(arena, 0, 0, 1, 0);
+    mys_mutex_unlock(&sampler->lock);
+}
+
+MYS_STATIC void _mys_arena_sample_delete(mys_arena_t *arena, mys_arena_sampler_t *sampler, void *ptr, size_t size)
+{
+    if (MYS_LIKELY(mys_atomic_load_n(&sampler->filter[_mys_sampler_bucket(ptr)], MYS_ATOMIC_RELAXED) == 0))
+        return;
+    mys_mutex_lock(&sampler->lock);
+    mys_arena_debugger_t *node = _mys_arena_debug_find((mys_arena_debugger_t **)&arena->_debug_trace, ptr);
+    if (node != NULL) {
+        _mys_arena_debug_delete((mys_arena_debugger_t **)&arena->_debug_trace, ptr, size);
+        mys_atomic_fetch_sub(&sampler->filter[_mys_sampler_bucket(ptr)], 1, MYS_ATOMIC_RELAXED);
+        _mys_arena_stat_update(arena, 0, 0, 0, 1);
+    }
+    mys_mutex_unlock(&sampler->lock);
+}
+
+/*
+    Slab backend (MYS_ARENA_BACKEND_SLAB)
+    - 40 size classes: 16..128 by 16, then 4 classes per doubling up to MYS_SLAB_MAX_SIZE.
+    - Each class owns a free list (linked through the first word of free objects) and a
+      bump-carved span of MYS_SLAB_SPAN_SIZE bytes. Spans are cut from regions mmap'd
+      MYS_SLAB_REGION_SIZE at a time and aligned to MYS_SLAB_SPAN_SIZE, so an object of
+      class c is aligned to the lowest set bit of c.
+    - mys_free2() computes the class from its size argument and pushes the object back
+      to that class. No per-object header is stored or looked up.
+    - mys_aligned_alloc2() whose alignment cannot be met by the class of its size is served
+      by libc and remembered in `foreign`, which is only consulted for page-aligned pointers.
+    - Each stat slot (see Arena statistics) owns a cache of up to MYS_SLAB_CACHE_BYTES per class,
+      touched without locking. An empty cache is refilled and an overfull cache is spilled by
+      half of its limit under slab->lock. A recycled slot inherits the cache of its dead owner,
+      so cached objects are never stranded. Threads on the shared slot always take the lock.
+*/
+#define MYS_SLAB_NUM_CLASSES 40
+#define MYS_SLAB_MAX_SIZE (32 * 1024)
+#define MYS_SLAB_SPAN_SIZE (64 * 1024)
+#define MYS_SLAB_REGION_SIZE (4 * 1024 * 1024)
+#define MYS_SLAB_FOREIGN_ALIGN 4096
+#define MYS_SLAB_CACHE_BYTES (16 * 1024)
+#define MYS_SLAB_CACHE_MAX_COUNT 64
+
+typedef struct mys_slab_region_t {
+    void *base;
+    size_t size;
+    struct mys_slab_region_t *next;
+} mys_slab_region_t;
+
+typedef struct mys_slab_foreign_t {
+    void *ptr;
+    _mys_UT_hash_handle hh;
+} mys_slab_foreign_t;
+
+typedef struct mys_slab_cache_t {
+    void *head[MYS_SLAB_NUM_CLASSES]; // linked through the first word, like free_list
+    uint32_t count[MYS_SLAB_NUM_CLASSES];
+} mys_slab_cache_t;
+
+typedef struct mys_arena_slab_t {
+    mys_mutex_t lock;
+    mys_slab_cache_t *caches[MYS_ARENA_STAT_SHARDS]; // caches[stat slot], only touched by its owner
+    void *free_list[MYS_SLAB_NUM_CLASSES];
+    uint8_t *carve_ptr[MYS_SLAB_NUM_CLASSES];
+    uint8_t *carve_end[MYS_SLAB_NUM_CLASSES];
+    uint8_t *region_ptr;
+    uint8_t *region_end;
+    mys_slab_region_t *regions;
+    mys_slab_foreign_t *foreign;
+    size_t nforeign;
+} mys_arena_slab_t;
+
+MYS_STATIC int _mys_slab_class_of(size_t size)
+{
+    if (size <= 128)
+        return (size == 0) ? 0 : (int)((size + 15) / 16) - 1;
+    int lg = 63 - __builtin_clzll((unsigned long long)(size - 1)); // size in (2^lg, 2^(lg+1)]
+    return 8 + (lg - 7) * 4 + (int)((size - 1) >> (lg - 2)) - 4;
+}
+
+MYS_STATIC size_t _mys_slab_class_size(int cls)
+{
+    if (cls < 8)
+        return (size_t)(cls + 1) * 16;
+    int k = cls - 8;
+    int lg = 7 + k / 4;
+    return (size_t)(4 + k % 4 + 1) << (lg - 2);
+}
+
+MYS_STATIC mys_arena_slab_t *_mys_slab_get(mys_arena_t *arena)
+{
+    mys_arena_slab_t *slab = (mys_arena_slab_t *)mys_atomic_load_n(&arena->_backend_state, MYS_ATOMIC_ACQUIRE);
+    if (MYS_LIKELY(slab != NULL))
+        return slab;
+    mys_arena_slab_t *fresh = (mys_arena_slab_t *)calloc(1, sizeof(mys_arena_slab_t));
+    AS_NE_PTR(fresh, NULL);
+    mys_mutex_init(&fresh->lock);
+    void *expected = NULL;
+    if (mys_atomic_compare_exchange_n(&arena->_backend_state, &expected, (void *)fresh, MYS_ATOMIC_ACQ_REL, MYS_ATOMIC_ACQUIRE))
+        return fresh;
+    free(fresh); // another thread won the race
+    return (mys_arena_slab_t *)expected;
+}
+
+// Cut a span from current region, mapping a new region if needed. Caller holds slab->lock.
+MYS_STATIC uint8_t *_mys_slab_new_span(mys_arena_slab_t *slab)
+{
+    if (slab->region_ptr == NULL || slab->region_ptr + MYS_SLAB_SPAN_SIZE > slab->region_end) {
+        size_t map_size = MYS_SLAB_REGION_SIZE + MYS_SLAB_SPAN_SIZE;
+        void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return NULL;
+        mys_slab_region_t *region = (mys_slab_region_t *)malloc(sizeof(mys_slab_region_t));
+        if (region == NULL) {
+            munmap(base, map_size);
+            return NULL;
+        }
+        region->base = base;
+        region->size = map_size;
+        region->next = slab->regions;
+        slab->regions = region;
+        slab->region_ptr = (uint8_t *)MYS_ALIGN_UP((uintptr_t)base, (uintptr_t)MYS_SLAB_SPAN_SIZE);
+        slab->region_end = (uint8_t *)base + map_size;
+    }
+    uint8_t *span = slab->region_ptr;
+    slab->region_ptr += MYS_SLAB_SPAN_SIZE;
+    return span;
+}
+
+// Pop an object of class `cls` from the free list or carve a new one. Caller holds slab->lock.
+MYS_STATIC void *_mys_slab_take_locked(mys_arena_slab_t *slab, int cls)
+{
+    void *p = NULL;
+    if (slab->free_list[cls] != NULL) {
+        p = slab->free_list[cls];
+        slab->free_list[cls] = *(void **)p;
+    } else {
+        size_t csize = _mys_slab_class_size(cls);
+        if (slab->carve_ptr[cls] == NULL || slab->carve_ptr[cls] + csize > slab->carve_end[cls]) {
+            uint8_t *span = _mys_slab_new_span(slab);
+            if (span != NULL) {
+                slab->carve_ptr[cls] = span;
+                slab->carve_end[cls] = span + MYS_SLAB_SPAN_SIZE;
+            }
+        }
+        if (slab->carve_ptr[cls] != NULL && slab->carve_ptr[cls] + csize <= slab->carve_end[cls]) {
+            p = slab->carve_ptr[cls];
+            slab->carve_ptr[cls] += csize;
+        }
+    }
+    return p;
+}
+
+MYS_STATIC uint32_t _mys_slab_cache_limit(int cls)
+{
+    size_t limit = MYS_SLAB_CACHE_BYTES / _mys_slab_class_size(cls);
+    return (limit < 2) ? 2 : (limit > MYS_SLAB_CACHE_MAX_COUNT) ? MYS_SLAB_CACHE_MAX_COUNT : (uint32_t)limit;
+}
+
+// Cache of the calling thread, or NULL if it is on the shared stat slot
+MYS_STATIC mys_slab_cache_t *_mys_slab_cache_get(mys_arena_slab_t *slab)
+{
+    int slot = _mys_stat_slot_get();
+    if (slot == MYS_ARENA_STAT_SHARED)
+        return NULL;
+    mys_slab_cache_t *cache = slab->caches[slot];
+    if (MYS_UNLIKELY(cache == NULL)) {
+        cache = (mys_slab_cache_t *)calloc(1, sizeof(mys_slab_cache_t));
+        slab->caches[slot] = cache;
+    }
+    return cache;
+}
+
+MYS_STATIC void *_mys_slab_alloc_class(mys_arena_slab_t *slab, int cls)
+{
+    void *p = NULL;
+    mys_slab_cache_t *cache = _mys_slab_cache_get(slab);
+    if (MYS_LIKELY(cache != NULL && cache->head[cls] != NULL)) {
+        p = cache->head[cls];
+        cache->head[cls] = *(void **)p;
+        cache->count[cls] -= 1;
+        return p;
+    }
+    mys_mutex_lock(&slab->lock);
+    p = _mys_slab_take_locked(slab, cls);
+    if (cache != NULL && p != NULL) {
+        uint32_t refill = _mys_slab_cache_limit(cls) / 2;
+        while (cache->count[cls] < refill) {
+            void *q = _mys_slab_take_locked(slab, cls);
+            if (q == NULL)
+                break;
+            *(void **)q = cache->head[cls];
+            cache->head[cls] = q;
+            cache->count[cls] += 1;
+        }
+    }
+    mys_mutex_unlock(&slab->lock);
+    return p;
+}
+
+MYS_STATIC void *_mys_slab_malloc(mys_arena_t *arena, size_t size)
+{
+    if (size > MYS_SLAB_MAX_SIZE)
+        return malloc(size);
+    return _mys_slab_alloc_class(_mys_slab_get(arena), _mys_slab_class_of(size));
+}
+
+MYS_STATIC void *_mys_slab_aligned_alloc(mys_arena_t *arena, size_t alignment, size_t size)
+{
+    void *p = NULL;
+    if (size > MYS_SLAB_MAX_SIZE) {
+        if (posix_memalign(&p, alignment < sizeof(void *) ? sizeof(void *) : alignment, size) != 0)
+            p = NULL;
+        return p;
+    }
+    int cls = _mys_slab_class_of(size);
+    size_t csize = _mys_slab_class_size(cls);
+    if (alignment <= (csize & (~csize + 1))) // natural alignment of class
+        return _mys_slab_alloc_class(_mys_slab_get(arena), cls);
+    // Alignment cannot be met by this class, fallback to libc and remember it
+    mys_arena_slab_t *slab = _mys_slab_get(arena);
+    if (posix_memalign(&p, alignment < MYS_SLAB_FOREIGN_ALIGN ? MYS_SLAB_FOREIGN_ALIGN : alignment, size) != 0)
+        return NULL;
+    mys_slab_foreign_t *node = (mys_slab_foreign_t *)malloc(sizeof(mys_slab_foreign_t));
+    AS_NE_PTR(node, NULL);
+    node->ptr = p;
+    mys_mutex_lock(&slab->lock);
+    _HASH_ADD_PTR(slab->foreign, ptr, node);
+    mys_atomic_store_n(&slab->nforeign, slab->nforeign + 1, MYS_ATOMIC_RELAXED);
+    mys_mutex_unlock(&slab->lock);
+    return p;
+}
+
+MYS_STATIC void _mys_slab_free(mys_arena_t *arena, void *ptr, size_t size)
+{
+    if (size > MYS_SLAB_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+    mys_arena_slab_t *slab = _mys_slab_get(arena);
+    int cls = _mys_slab_class_of(size);
+    bool maybe_foreign = mys_atomic_load_n(&slab->nforeign, MYS_ATOMIC_RELAXED) > 0
+                      && ((uintptr_t)ptr & (MYS_SLAB_FOREIGN_ALIGN - 1)) == 0;
+    mys_slab_cache_t *cache = maybe_foreign ? NULL : _mys_slab_cache_get(slab);
+    if (MYS_LIKELY(cache != NULL)) {
+        *(void **)ptr = cache->head[cls];
+        cache->head[cls] = ptr;
+        cache->count[cls] += 1;
+        uint32_t limit = _mys_slab_cache_limit(cls);
+        if (MYS_LIKELY(cache->count[cls] <= limit))
+            return;
+        // Spill down to half of the limit
+        mys_mutex_lock(&slab->lock);
+        while (cache->count[cls] > limit / 2) {
+            void *p = cache->head[cls];
+            cache->head[cls] = *(void **)p;
+            cache->count[cls] -= 1;
+            *(void **)p = slab->free_list[cls];
+            slab->free_list[cls] = p;
+        }
+        mys_mutex_unlock(&slab->lock);
+        return;
+    }
+    mys_mutex_lock(&slab->lock);
+    if (maybe_foreign) {
+        mys_slab_foreign_t *node = NULL;
+        _HASH_FIND_PTR(slab->foreign, &ptr, node);
+        if (node != NULL) {
+            _HASH_DEL(slab->foreign, node);
+            mys_atomic_store_n(&slab->nforeign, slab->nforeign - 1, MYS_ATOMIC_RELAXED);
+            mys_mutex_unlock(&slab->lock);
+            free(node);
+            free(ptr);
+            return;
+        }
+    }
+    *(void **)ptr = slab->free_list[cls];
+    slab->free_list[cls] = ptr;
+    mys_mutex_unlock(&slab->lock);
+}
+
+MYS_STATIC void *_mys_slab_realloc(mys_arena_t *arena, void *ptr, size_t size, size_t old_size)
+{
+    if (ptr == NULL)
+        return _mys_slab_malloc(arena, size);
+    if (size > MYS_SLAB_MAX_SIZE && old_size > MYS_SLAB_MAX_SIZE)
+        return realloc(ptr, size);
+    if (size <= MYS_SLAB_MAX_SIZE && old_size <= MYS_SLAB_MAX_SIZE && _mys_slab_class_of(size) == _mys_slab_class_of(old_size))
+        return ptr;
+    void *new_ptr = _mys_slab_malloc(arena, size);
+    if (new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    _mys_slab_free(arena, ptr, old_size);
+    return new_ptr;
+}
+
+MYS_STATIC void _mys_slab_destroy(mys_arena_t *arena)
+{
+    mys_arena_slab_t *slab = (mys_arena_slab_t *)arena->_backend_state;
+    if (slab == NULL)
+        return;
+    mys_slab_region_t *region = slab->regions;
+    while (region != NULL) {
+        mys_slab_region_t *next = region->next;
+        munmap(region->base, region->size);
+        free(region);
+        region = next;
+    }
+    mys_slab_foreign_t *node = NULL;
+    mys_slab_foreign_t *tmp = NULL;
+    _HASH_ITER(hh, slab->foreign, node, tmp) {
+        _HASH_DEL(slab->foreign, node);
+        free(node);
+    }
+    for (int i = 0; i < MYS_ARENA_STAT_SHARDS; i++)
+        free(slab->caches[i]);
+    free(slab);
+    arena->_backend_state = NULL;
+}
+
+/*
+    Region backend (MYS_ARENA_BACKEND_REGION)
+    - Memory is bump-allocated from chunks of `chunk_bytes` (or a dedicated larger chunk
+      for oversized requests). Chunks are linked newest first.
+    - mys_free2() only updates accounting, except that freeing the most recent allocation
+      pops it from the bump pointer.
+    - mys_arena_rewind() moves the bump pointer back to a mark, and mys_arena_reset() back
+      to the very beginning. Chunks released by them are kept as spares for reuse.
+    - The region state is not locked, a region arena is used by one thread at a time.
+*/
+#define MYS_REGION_ALIGN 16
+
+typedef struct mys_region_chunk_t {
+    struct mys_region_chunk_t *next; // older chunk (or next spare)
+    size_t capacity;
+    size_t used;
+    uint8_t *data;
+} mys_region_chunk_t;
+
+typedef struct mys_arena_region_t {
+    size_t chunk_bytes;
+    mys_region_chunk_t *chunks; // current chunk is the head
+    mys_region_chunk_t *spares;
+    void *last_ptr; // most recent allocation, can be popped by mys_free2
+    size_t last_used; // chunk->used before last allocation
+} mys_arena_region_t;
+
+MYS_STATIC mys_region_chunk_t *_mys_region_new_chunk(mys_arena_region_t *region, size_t need)
+{
+    mys_region_chunk_t **prev = &region->spares;
+    while (*prev != NULL) {
+        if ((*prev)->capacity >= need) {
+            mys_region_chunk_t *chunk = *prev;
+            *prev = chunk->next;
+            chunk->used = 0;
+            return chunk;
+        }
+        prev = &(*prev)->next;
+    }
+    size_t capacity = (need > region->chunk_bytes) ? need : region->chunk_bytes;
+    size_t header = MYS_ALIGN_UP(sizeof(mys_region_chunk_t), MYS_REGION_ALIGN);
+    mys_region_chunk_t *chunk = (mys_region_chunk_t *)malloc(header + capacity);
+    if (chunk == NULL)
+        return NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    chunk->data = (uint8_t *)chunk + header;
+    return chunk;
+}
+
+MYS_STATIC void *_mys_region_alloc(mys_arena_t *arena, size_t alignment, size_t size)
+{
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    if (alignment < MYS_REGION_ALIGN)
+        alignment = MYS_REGION_ALIGN;
+    mys_region_chunk_t *chunk = region->chunks;
+    uintptr_t begin = 0;
+    if (chunk != NULL) {
+        begin = MYS_ALIGN_UP((uintptr_t)chunk->data + chunk->used, (uintptr_t)alignment);
+        if (begin + size > (uintptr_t)chunk->data + chunk->capacity)
+            chunk = NULL;
+    }
+    if (chunk == NULL) {
+        chunk = _mys_region_new_chunk(region, size + alignment);
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = region->chunks;
+        region->chunks = chunk;
+        begin = MYS_ALIGN_UP((uintptr_t)chunk->data, (uintptr_t)alignment);
+    }
+    region->last_ptr = (void *)begin;
+    region->last_used = chunk->used;
+    chunk->used = (size_t)(begin + size - (uintptr_t)chunk->data);
+    return (void *)begin;
+}
+
+MYS_STATIC void _mys_region_free(mys_arena_t *arena, void *ptr)
+{
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    if (ptr == region->last_ptr) {
+        region->chunks->used = region->last_used;
+        region->last_ptr = NULL;
+    }
+}
+
+MYS_STATIC void *_mys_region_realloc(mys_arena_t *arena, void *ptr, size_t size, size_t old_size)
+{
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    if (ptr != NULL && ptr == region->last_ptr) { // grow or shrink the top allocation in place
+        mys_region_chunk_t *chunk = region->chunks;
+        if ((uintptr_t)ptr + size <= (uintptr_t)chunk->data + chunk->capacity) {
+            chunk->used = (size_t)((uintptr_t)ptr + size - (uintptr_t)chunk->data);
+            return ptr;
+        }
+    }
+    void *new_ptr = _mys_region_alloc(arena, MYS_REGION_ALIGN, size);
+    if (new_ptr != NULL && ptr != NULL)
+        memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    return new_ptr;
+}
+
+// Move chunks newer than `keep` to spares, and rewind `keep` to `used`
+MYS_STATIC void _mys_region_rewind_to(mys_arena_region_t *region, mys_region_chunk_t *keep, size_t used)
+{
+    while (region->chunks != NULL && region->chunks != keep) {
+        mys_region_chunk_t *chunk = region->chunks;
+        region->chunks = chunk->next;
+        chunk->next = region->spares;
+        region->spares = chunk;
+    }
+    if (keep != NULL)
+        keep->used = used;
+    region->last_ptr = NULL;
+}
+
+// Whether ptr was allocated after the bump position (keep, used)
+MYS_STATIC bool _mys_region_is_after(mys_arena_region_t *region, mys_region_chunk_t *keep, size_t used, void *ptr)
+{
+    for (mys_region_chunk_t *chunk = region->chunks; chunk != NULL; chunk = chunk->next) {
+        bool inside = (uint8_t *)ptr >= chunk->data && (uint8_t *)ptr < chunk->data + chunk->capacity;
+        if (chunk == keep)
+            return inside && (uint8_t *)ptr >= chunk->data + used;
+        if (inside)
+            return true;
+    }
+    return false;
+}
+
+MYS_STATIC void _mys_region_destroy(mys_arena_t *arena)
+{
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    if (region == NULL)
+        return;
+    _mys_region_rewind_to(region, NULL, 0);
+    while (region->spares != NULL) {
+        mys_region_chunk_t *chunk = region->spares;
+        region->spares = chunk->next;
+        free(chunk);
+    }
+    free(region);
+    arena->_backend_state = NULL;
+}
+
+/*
+    Placement policies (mys_arena_set_policy)
+    - Allocations of at least MYS_ARENA_POLICY_MIN_SIZE bytes get their own anonymous mapping,
+      so their pages are not shared with other objects and carry their own NUMA policy (mbind)
+      and page size (madvise or MAP_HUGETLB). Fresh pages are placed when first touched.
+    - The mapping of such an allocation is always [ptr, ptr + MYS_ALIGN_UP(size, granule)),
+      so mys_free2() unmaps it from its size argument.
+    - Smaller allocations fall through to the backend of the arena.
+*/
+#define MYS_ARENA_POLICY_MIN_SIZE (64 * 1024)
+#define MYS_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MYS_MAX_NUMA_NODES 1024
+
+typedef struct mys_arena_policy_t {
+    int numa;
+    int node;
+    int pages;
+    size_t granule; // page size of the mappings
+    unsigned long nodemask[MYS_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+} mys_arena_policy_t;
+
+#if defined(KERNEL_LINUX)
+#define _MYS_MPOL_BIND 2
+#define _MYS_MPOL_INTERLEAVE 3
+#define _MYS_MPOL_F_MEMS_ALLOWED (1 << 2)
+
+MYS_STATIC void *_mys_policy_alloc(mys_arena_t *arena, size_t alignment, size_t size)
+{
+    mys_arena_policy_t *policy = (mys_arena_policy_t *)arena->_policy;
+    size_t length = MYS_ALIGN_UP(size, policy->granule);
+    if (alignment < policy->granule)
+        alignment = policy->granule;
+    uint8_t *p = NULL;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    if (policy->pages == MYS_ARENA_PAGE_HUGETLB && alignment == MYS_HUGE_PAGE_SIZE) {
+        void *q = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        if (q != MAP_FAILED)
+            p = (uint8_t *)q; // aligned to the huge page size by the kernel
+    }
+#endif
+    if (p == NULL) { // over-map and trim to the alignment
+        size_t map_size = length + alignment;
+        void *q = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (q == MAP_FAILED)
+            return NULL;
+        uint8_t *base = (uint8_t *)q;
+        p = (uint8_t *)MYS_ALIGN_UP((uintptr_t)base, (uintptr_t)alignment);
+        if (p > base)
+            munmap(base, (size_t)(p - base));
+        if (base + map_size > p + length)
+            munmap(p + length, (size_t)(base + map_size - (p + length)));
+        if (policy->pages != MYS_ARENA_PAGE_DEFAULT)
+            madvise(p, length, MADV_HUGEPAGE); // also the fallback of MYS_ARENA_PAGE_HUGETLB
+    }
+    if (policy->numa == MYS_ARENA_NUMA_INTERLEAVE || policy->numa == MYS_ARENA_NUMA_BIND) {
+        int mode = (policy->numa == MYS_ARENA_NUMA_BIND) ? _MYS_MPOL_BIND : _MYS_MPOL_INTERLEAVE;
+        // Best effort, e.g., mbind may be forbidden in containers
+        syscall(SYS_mbind, p, length, mode, policy->nodemask, (unsigned long)MYS_MAX_NUMA_NODES, 0);
+    }
+    return p;
+}
+
+MYS_STATIC void _mys_policy_free(mys_arena_t *arena, void *ptr, size_t size)
+{
+    mys_arena_policy_t *policy = (mys_arena_policy_t *)arena->_policy;
+    munmap(ptr, MYS_ALIGN_UP(size, policy->granule));
+}
+#endif
+
 MYS_PUBLIC mys_arena_t *mys_arena_create(const char *name)
 {
     mys_arena_t *arena = (mys_arena_t *)malloc(sizeof(mys_arena_t));
@@ -202,20 +987,165 @@ MYS_PUBLIC mys_arena_t *mys_arena_create(const char *name)
     arena->_total_count = 0;
     arena->_alive_count = 0;
     arena->_freed_count = 0;
+    arena->_backend = MYS_ARENA_BACKEND_LIBC;
+    arena->_backend_state = NULL;
+    arena->_stats = NULL;
+    arena->_sampler = NULL;
+    arena->_policy = NULL;
     _mys_ensure_register_arena(arena);
     return arena;
 }
 
+MYS_PUBLIC mys_arena_t *mys_arena_create_slab(const char *name)
+{
+    mys_arena_t *arena = mys_arena_create(name);
+    if (arena != NULL)
+        arena->_backend = MYS_ARENA_BACKEND_SLAB;
+    return arena;
+}
+
+MYS_PUBLIC mys_arena_t *mys_arena_create_region(const char *name, size_t chunk_bytes)
+{
+    MYS_RETIF(chunk_bytes == 0, MYS_EINVAL, NULL);
+    mys_arena_region_t *region = (mys_arena_region_t *)calloc(1, sizeof(mys_arena_region_t));
+    MYS_RETIF(region == NULL, MYS_ENOMEM, NULL);
+    region->chunk_bytes = chunk_bytes;
+    mys_arena_t *arena = mys_arena_create(name);
+    if (arena == NULL) {
+        free(region);
+        return NULL;
+    }
+    arena->_backend = MYS_ARENA_BACKEND_REGION;
+    arena->_backend_state = region;
+    return arena;
+}
+
+MYS_PUBLIC mys_arena_mark_t mys_arena_mark(mys_arena_t *arena)
+{
+    AS_NE_PTR(arena, NULL);
+    ASX_EQ_I32(arena->_backend, MYS_ARENA_BACKEND_REGION, "arena %s is not a region arena", arena->name);
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    mys_arena_sync(arena);
+    mys_arena_mark_t mark;
+    mark._chunk = region->chunks;
+    mark._used = (region->chunks != NULL) ? region->chunks->used : 0;
+    mark._alive = arena->alive;
+    region->last_ptr = NULL; // never pop below the mark
+    return mark;
+}
+
+MYS_PUBLIC void mys_arena_rewind(mys_arena_t *arena, mys_arena_mark_t mark)
+{
+    AS_NE_PTR(arena, NULL);
+    ASX_EQ_I32(arena->_backend, MYS_ARENA_BACKEND_REGION, "arena %s is not a region arena", arena->name);
+    mys_arena_region_t *region = (mys_arena_region_t *)arena->_backend_state;
+    mys_region_chunk_t *keep = (mys_region_chunk_t *)mark._chunk;
+    if (arena->_enable_debug) {
+        mys_arena_debugger_t **head = (mys_arena_debugger_t **)&arena->_debug_trace;
+        mys_arena_debugger_t *node = NULL;
+        mys_arena_debugger_t *tmp = NULL;
+        _mys_arena_debug_lock(arena);
+        _HASH_ITER(hh, *head, node, tmp) {
+            if (_mys_region_is_after(region, keep, mark._used, node->ptr))
+                _mys_arena_debug_forget(arena, node);
+        }
+        _mys_arena_debug_unlock(arena);
+    }
+    _mys_region_rewind_to(region, keep, mark._used);
+    mys_arena_sync(arena);
+    if (arena->alive > mark._alive)
+        mys_free_record(arena, arena->alive - mark._alive);
+}
+
+MYS_PUBLIC void mys_arena_reset(mys_arena_t *arena)
+{
+    mys_arena_mark_t mark;
+    mark._chunk = NULL;
+    mark._used = 0;
+    mark._alive = 0;
+    mys_arena_rewind(arena, mark);
+}
+
+MYS_PUBLIC int mys_arena_set_backend(mys_arena_t *arena, int backend)
+{
+    AS_NE_PTR(arena, NULL);
+    MYS_RETIF(backend != MYS_ARENA_BACKEND_LIBC && backend != MYS_ARENA_BACKEND_SLAB, MYS_EINVAL, MYS_EINVAL);
+    mys_arena_sync(arena);
+    MYS_RETIF(arena->alive != 0 || arena->_backend == MYS_ARENA_BACKEND_REGION, MYS_EBUSY, MYS_EBUSY);
+    arena->_backend = backend;
+    return 0;
+}
+
+MYS_PUBLIC int mys_arena_set_policy(mys_arena_t *arena, int numa, int node, int pages)
+{
+    AS_NE_PTR(arena, NULL);
+#if defined(KERNEL_LINUX)
+    MYS_RETIF(numa < MYS_ARENA_NUMA_DEFAULT || numa > MYS_ARENA_NUMA_BIND, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(pages < MYS_ARENA_PAGE_DEFAULT || pages > MYS_ARENA_PAGE_HUGETLB, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(arena->_backend == MYS_ARENA_BACKEND_REGION, MYS_EINVAL, MYS_EINVAL);
+    mys_arena_sync(arena);
+    MYS_RETIF(arena->alive != 0, MYS_EBUSY, MYS_EBUSY);
+    mys_arena_policy_t *policy = NULL;
+    if (numa != MYS_ARENA_NUMA_DEFAULT || pages != MYS_ARENA_PAGE_DEFAULT) {
+        policy = (mys_arena_policy_t *)calloc(1, sizeof(mys_arena_policy_t));
+        MYS_RETIF(policy == NULL, MYS_ENOMEM, MYS_ENOMEM);
+        policy->numa = numa;
+        policy->node = node;
+        policy->pages = pages;
+        policy->granule = (pages == MYS_ARENA_PAGE_DEFAULT) ? (size_t)sysconf(_SC_PAGESIZE) : MYS_HUGE_PAGE_SIZE;
+        const size_t nbits = 8 * sizeof(unsigned long);
+        if (numa == MYS_ARENA_NUMA_BIND) {
+            MYS_GOTOIF(node < 0 || node >= MYS_MAX_NUMA_NODES, MYS_EINVAL, failed);
+            policy->nodemask[node / nbits] = 1ul << (node % nbits);
+        } else if (numa == MYS_ARENA_NUMA_INTERLEAVE) {
+            int mode = 0;
+            if (syscall(SYS_get_mempolicy, &mode, policy->nodemask, (unsigned long)MYS_MAX_NUMA_NODES, NULL, _MYS_MPOL_F_MEMS_ALLOWED) != 0)
+                policy->nodemask[0] = 1ul; // only node 0 is known to exist
+        }
+    }
+    free(arena->_policy);
+    arena->_policy = policy;
+    return 0;
+failed:
+    free(policy);
+    return mys_errno;
+#else
+    (void)numa; (void)node; (void)pages;
+    MYS_RETIF(true, MYS_EINVAL, MYS_EINVAL); // not supported on this platform
+#endif
+}
+
+// Syncs the counters of an arena that no thread is using, and catches over-frees (double frees or wrong sizes),
+// which mys_arena_sync() clamps because it may also run while other threads allocate and free.
+MYS_STATIC void _mys_arena_check_balance(mys_arena_t *arena)
+{
+    mys_arena_sync(arena);
+    ASX_LE_SIZET(arena->freed, arena->total, "arena %s freed more bytes than allocated", arena->name);
+    ASX_LE_SIZET(arena->_freed_count, arena->_total_count, "arena %s freed more pointers than allocated", arena->name);
+}
+
 MYS_PUBLIC void mys_arena_destroy(mys_arena_t **arena)
 {
     AS_NE_PTR(arena, NULL);
     if (*arena == NULL)
         return;
+    _mys_arena_check_balance(*arena);
     if ((*arena)->_enable_debug) {
         mys_arena_debugger_t **head = (mys_arena_debugger_t **)&(*arena)->_debug_trace;
         _mys_arena_debug_delete_all(head);
     }
+    if ((*arena)->_sampler != NULL) {
+        mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)(*arena)->_sampler;
+        mys_mutex_destroy(&sampler->lock);
+        free(sampler);
+    }
+    if ((*arena)->_backend == MYS_ARENA_BACKEND_SLAB)
+        _mys_slab_destroy(*arena);
+    else if ((*arena)->_backend == MYS_ARENA_BACKEND_REGION)
+        _mys_region_destroy(*arena);
     _mys_deregister_arena(*arena);
+    free((*arena)->_policy);
+    free((*arena)->_stats);
     free(*arena);
     *arena = NULL;
 }
@@ -228,21 +1158,92 @@ MYS_PUBLIC void mys_arena_set_debug(mys_arena_t *arena, bool val)
     arena->_enable_debug = val;
 }
 
+MYS_PUBLIC void mys_arena_set_debug_sampling(mys_arena_t *arena, size_t sample_bytes)
+{
+    AS_NE_PTR(arena, NULL);
+    mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)mys_atomic_load_n(&arena->_sampler, MYS_ATOMIC_ACQUIRE);
+    if (sampler == NULL) {
+        mys_arena_sampler_t *fresh = NULL;
+        AS_EQ_I32(posix_memalign((void **)&fresh, MYS_ARENA_STAT_ALIGN, sizeof(mys_arena_sampler_t)), 0);
+        memset(fresh, 0, sizeof(mys_arena_sampler_t));
+        mys_mutex_init(&fresh->lock);
+        for (int i = 0; i <= MYS_ARENA_STAT_SHARDS; i++)
+            fresh->slots[i].rng = (uint64_t)(uintptr_t)arena + (uint64_t)i * 0x9E3779B97F4A7C15ull;
+        // records inserted before sampling get into the filter too
+        mys_arena_debugger_t *node = NULL;
+        mys_arena_debugger_t *tmp = NULL;
+        _HASH_ITER(hh, (mys_arena_debugger_t *)arena->_debug_trace, node, tmp) {
+            fresh->filter[_mys_sampler_bucket(node->ptr)] += 1;
+        }
+        void *expected = NULL;
+        if (mys_atomic_compare_exchange_n(&arena->_sampler, &expected, (void *)fresh, MYS_ATOMIC_ACQ_REL, MYS_ATOMIC_ACQUIRE)) {
+            sampler = fresh;
+        } else {
+            mys_mutex_destroy(&fresh->lock);
+            free(fresh); // another thread won the race
+            sampler = (mys_arena_sampler_t *)expected;
+        }
+    }
+    mys_mutex_lock(&sampler->lock);
+    mys_atomic_store_n(&sampler->interval, sample_bytes, MYS_ATOMIC_RELAXED);
+    for (int i = 0; i <= MYS_ARENA_STAT_SHARDS; i++) {
+        int64_t countdown = (sample_bytes > 0) ? _mys_sampler_next_interval(&sampler->slots[i], sample_bytes) : 0;
+        mys_atomic_store_n(&sampler->slots[i].countdown, countdown, MYS_ATOMIC_RELAXED);
+    }
+    mys_mutex_unlock(&sampler->lock);
+}
+
+MYS_PUBLIC void mys_arena_debug_estimate(mys_arena_t *arena, size_t *count, size_t *bytes)
+{
+    AS_NE_PTR(arena, NULL);
+    double est_count = 0;
+    double est_bytes = 0;
+    mys_arena_debugger_t *node = NULL;
+    mys_arena_debugger_t *tmp = NULL;
+    _mys_arena_debug_lock(arena);
+    _HASH_ITER(hh, (mys_arena_debugger_t *)arena->_debug_trace, node, tmp) {
+        est_count += node->weight;
+        est_bytes += node->weight * (double)node->size;
+    }
+    _mys_arena_debug_unlock(arena);
+    if (count != NULL)
+        *count = (size_t)(est_count + 0.5);
+    if (bytes != NULL)
+        *bytes = (size_t)(est_bytes + 0.5);
+}
+
 MYS_PUBLIC void mys_arena_print_leaked(mys_arena_t *arena, size_t max_print)
 {
     mys_string_t *str = mys_string_create();
+    _mys_arena_check_balance(arena);
 
     if (arena->_enable_debug) {
+        _mys_arena_debug_lock(arena);
         mys_arena_debugger_t *head = (mys_arena_debugger_t *)arena->_debug_trace;
         mys_arena_debugger_t *node = NULL;
         mys_arena_debugger_t *tmp = NULL;
+        mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)arena->_sampler;
         size_t num_hash;
         num_hash = (size_t)_HASH_COUNT(head);
         AS_EQ_SIZET(num_hash, arena->_alive_count);
-        mys_string_fmt(str, "arena %s alloc %zu, freed %zu, leaked %zu pointers:\n",
-            arena->name, arena->_total_count, arena->_freed_count, arena->_alive_count);
+        if (sampler != NULL && sampler->interval > 0) {
+            double est_count = 0;
+            double est_bytes = 0;
+            _HASH_ITER(hh, head, node, tmp) {
+                est_count += node->weight;
+                est_bytes += node->weight * (double)node->size;
+            }
+            mys_string_fmt(str, "arena %s sampled every %zu bytes, alloc %zu, freed %zu, leaked %zu sampled pointers, "
+                "estimated %.0f pointers (%.0f bytes) leaked:\n",
+                arena->name, sampler->interval, arena->_total_count, arena->_freed_count, arena->_alive_count,
+                est_count, est_bytes);
+        } else {
+            mys_string_fmt(str, "arena %s alloc %zu, freed %zu, leaked %zu pointers:\n",
+                arena->name, arena->_total_count, arena->_freed_count, arena->_alive_count);
+        }
         size_t count = 0;
 
+        _mys_arena_debug_resolve(head, max_print + 1);
         _HASH_ITER(hh, head, node, tmp) {
             _mys_arena_debug_get_stack(node, str);
             mys_string_fmt(str, "\n");
@@ -262,6 +1263,7 @@ MYS_PUBLIC void mys_arena_print_leaked(mys_arena_t *arena, size_t max_print)
                 mys_string_fmt(str, "    no leak pointer is found, %zu byte alive.", arena->alive);
             }
         }
+        _mys_arena_debug_unlock(arena);
     } else {
         mys_string_fmt(str, "arena %s is not set to debug mode", arena->name);
     }
@@ -279,6 +1281,7 @@ MYS_PUBLIC mys_arena_t *mys_arena_next_leaked(mys_arena_t *pivot)
         bool passed_pivot = (pivot == NULL) ? true : false;
         for (size_t i = 0; i < _mys_memory_G.arena_size; i++) {
             mys_arena_t *arena = _mys_memory_G.registered_arenas[i];
+            mys_arena_sync(arena);
             bool leaked = arena->alive != 0;
             if (passed_pivot && leaked) {
                 leaked_arena = arena;
@@ -293,36 +1296,56 @@ MYS_PUBLIC mys_arena_t *mys_arena_next_leaked(mys_arena_t *pivot)
     return leaked_arena;
 }
 
-#define MAKE_GCC_HAPPY_ALLOC_RECORD(arena, size) do {       \
-    _mys_ensure_register_arena(arena);                      \
-    arena->alive += (size);                                 \
-    arena->total += (size);                                 \
-    AS_EQ_SIZET(arena->total, arena->alive + arena->freed); \
-    if (arena->peak < arena->alive)                         \
-        arena->peak = arena->alive;                         \
+#if defined(KERNEL_LINUX)
+#define _MYS_ARENA_USE_POLICY(arena, size) MYS_UNLIKELY((arena)->_policy != NULL && (size) >= MYS_ARENA_POLICY_MIN_SIZE)
+#else
+#define _MYS_ARENA_USE_POLICY(arena, size) false
+#define _mys_policy_alloc(arena, alignment, size) NULL
+#define _mys_policy_free(arena, ptr, size) do {} while (0)
+#endif
+
+#define MAKE_GCC_HAPPY_ALLOC_RECORD(arena, size) do { \
+    _mys_ensure_register_arena(arena);                \
+    _mys_arena_stat_update(arena, (size), 0, 0, 0);   \
 } while (0)
 
 #define DEBUG_INSERT(arena, ptr, size) do {                                      \
     mys_arena_debugger_t **head = (mys_arena_debugger_t **)&arena->_debug_trace; \
     if (arena->_enable_debug) {                                                  \
-        arena->_total_count += 1;                                                \
-        arena->_alive_count += 1;                                                \
-        _mys_arena_debug_insert(head, ptr, size);                                \
+        mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)arena->_sampler;   \
+        if (sampler != NULL) {                                                   \
+            _mys_arena_sample_insert(arena, sampler, ptr, size);                 \
+        } else {                                                                 \
+            _mys_arena_stat_update(arena, 0, 0, 1, 0);                           \
+            _mys_arena_debug_insert(head, ptr, size);                            \
+        }                                                                        \
     }                                                                            \
 } while (0)
 
 #define DEBUG_DELETE(arena, ptr, size) do {                                      \
     mys_arena_debugger_t **head = (mys_arena_debugger_t **)&arena->_debug_trace; \
     if (arena->_enable_debug) {                                                  \
-        arena->_alive_count -= 1;                                                \
-        arena->_freed_count += 1;                                                \
-        _mys_arena_debug_delete(head, ptr, size);                                \
+        mys_arena_sampler_t *sampler = (mys_arena_sampler_t *)arena->_sampler;   \
+        if (sampler != NULL) {                                                   \
+            _mys_arena_sample_delete(arena, sampler, ptr, size);                 \
+        } else {                                                                 \
+            _mys_arena_stat_update(arena, 0, 0, 0, 1);                           \
+            _mys_arena_debug_delete(head, ptr, size);                            \
+        }                                                                        \
     }                                                                            \
 } while (0)
 
 MYS_PUBLIC void* mys_malloc2(mys_arena_t *arena, size_t size)
 {
-    void *p = malloc(size);
+    void *p = NULL;
+    if (_MYS_ARENA_USE_POLICY(arena, size))
+        p = _mys_policy_alloc(arena, 0, size);
+    else if (arena->_backend == MYS_ARENA_BACKEND_SLAB)
+        p = _mys_slab_malloc(arena, size);
+    else if (arena->_backend == MYS_ARENA_BACKEND_REGION)
+        p = _mys_region_alloc(arena, MYS_REGION_ALIGN, size);
+    else
+        p = malloc(size);
     if (p != NULL) {
         MAKE_GCC_HAPPY_ALLOC_RECORD(arena, size);
         DEBUG_INSERT(arena, p, size);
@@ -332,7 +1355,18 @@ MYS_PUBLIC void* mys_malloc2(mys_arena_t *arena, size_t size)
 
 MYS_PUBLIC void* mys_calloc2(mys_arena_t *arena, size_t count, size_t size)
 {
-    void *p = calloc(count, size);
+    void *p = NULL;
+    if (_MYS_ARENA_USE_POLICY(arena, count * size)) {
+        p = _mys_policy_alloc(arena, 0, count * size); // fresh pages are zeroed
+    } else if (arena->_backend == MYS_ARENA_BACKEND_SLAB) {
+        p = _mys_slab_malloc(arena, count * size);
+        if (p != NULL) memset(p, 0, count * size);
+    } else if (arena->_backend == MYS_ARENA_BACKEND_REGION) {
+        p = _mys_region_alloc(arena, MYS_REGION_ALIGN, count * size);
+        if (p != NULL) memset(p, 0, count * size);
+    } else {
+        p = calloc(count, size);
+    }
     if (p != NULL) {
         MAKE_GCC_HAPPY_ALLOC_RECORD(arena, count * size);
         DEBUG_INSERT(arena, p, count * size);
@@ -343,6 +1377,16 @@ MYS_PUBLIC void* mys_calloc2(mys_arena_t *arena, size_t count, size_t size)
 MYS_PUBLIC void* mys_aligned_alloc2(mys_arena_t *arena, size_t alignment, size_t size)
 {
     void *p = NULL;
+    if (_MYS_ARENA_USE_POLICY(arena, size)) {
+        p = _mys_policy_alloc(arena, alignment, size);
+        goto record;
+    } else if (arena->_backend == MYS_ARENA_BACKEND_SLAB) {
+        p = _mys_slab_aligned_alloc(arena, alignment, size);
+        goto record;
+    } else if (arena->_backend == MYS_ARENA_BACKEND_REGION) {
+        p = _mys_region_alloc(arena, alignment, size);
+        goto record;
+    }
 #if defined(_ISOC11_SOURCE) || (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)) // C11
     p = aligned_alloc(alignment, size);
 #elif defined(_MSC_VER) // Microsoft
@@ -353,6 +1397,7 @@ MYS_PUBLIC void* mys_aligned_alloc2(mys_arena_t *arena, size_t alignment, size_t
 #else
     #error Unsupported
 #endif
+record:
     if (p != NULL) {
         MAKE_GCC_HAPPY_ALLOC_RECORD(arena, size);
         DEBUG_INSERT(arena, p, size);
@@ -362,8 +1407,23 @@ MYS_PUBLIC void* mys_aligned_alloc2(mys_arena_t *arena, size_t alignment, size_t
 
 MYS_PUBLIC void* mys_realloc2(mys_arena_t *arena, void* ptr, size_t size, size_t _old_size)
 {
+    if (_MYS_ARENA_USE_POLICY(arena, size) || _MYS_ARENA_USE_POLICY(arena, _old_size)) {
+        // crossing mappings, copy with full accounting
+        void *new_ptr = mys_malloc2(arena, size);
+        if (new_ptr != NULL && ptr != NULL) {
+            memcpy(new_ptr, ptr, (size < _old_size) ? size : _old_size);
+            mys_free2(arena, ptr, _old_size);
+        }
+        return new_ptr;
+    }
     DEBUG_DELETE(arena, ptr, _old_size); // [debug] delete old record before realloc to make intel compiler happy
-    void *new_ptr = realloc(ptr, size);
+    void *new_ptr = NULL;
+    if (arena->_backend == MYS_ARENA_BACKEND_SLAB)
+        new_ptr = _mys_slab_realloc(arena, ptr, size, _old_size);
+    else if (arena->_backend == MYS_ARENA_BACKEND_REGION)
+        new_ptr = _mys_region_realloc(arena, ptr, size, _old_size);
+    else
+        new_ptr = realloc(ptr, size);
     if (new_ptr != NULL) {
         DEBUG_INSERT(arena, new_ptr, size); // [debug] insert new record after realloc
         mys_free_record(arena, _old_size); // record freed size
@@ -379,6 +1439,16 @@ MYS_PUBLIC void mys_free2(mys_arena_t *arena, void* ptr, size_t size)
     if (ptr != NULL) {
         mys_free_record(arena, size);
         DEBUG_DELETE(arena, ptr, size);
+        if (_MYS_ARENA_USE_POLICY(arena, size)) {
+            _mys_policy_free(arena, ptr, size);
+            return;
+        } else if (arena->_backend == MYS_ARENA_BACKEND_SLAB) {
+            _mys_slab_free(arena, ptr, size);
+            return;
+        } else if (arena->_backend == MYS_ARENA_BACKEND_REGION) {
+            _mys_region_free(arena, ptr);
+            return;
+        }
     }
     free(ptr);
 }
@@ -392,10 +1462,32 @@ MYS_PUBLIC void mys_free_record(mys_arena_t *arena, size_t size)
 {
     AS_NE_PTR(arena, NULL);
     _mys_ensure_register_arena(arena);
-    AS_GE_SIZET(arena->alive, size);
-    arena->alive -= size;
-    arena->freed += size;
-    AS_EQ_SIZET(arena->total, arena->alive + arena->freed);
+    _mys_arena_stat_update(arena, 0, size, 0, 0);
+}
+
+MYS_PUBLIC void mys_arena_sync(mys_arena_t *arena)
+{
+    AS_NE_PTR(arena, NULL);
+    mys_arena_stats_t *stats = (mys_arena_stats_t *)mys_atomic_load_n(&arena->_stats, MYS_ATOMIC_ACQUIRE);
+    if (stats == NULL)
+        return;
+    size_t total = 0, freed = 0, total_count = 0, freed_count = 0;
+    for (int i = 0; i <= MYS_ARENA_STAT_SHARDS; i++) {
+        mys_arena_stat_shard_t *shard = &stats->shards[i];
+        total += mys_atomic_load_n(&shard->total, MYS_ATOMIC_RELAXED);
+        freed += mys_atomic_load_n(&shard->freed, MYS_ATOMIC_RELAXED);
+        total_count += mys_atomic_load_n(&shard->total_count, MYS_ATOMIC_RELAXED);
+        freed_count += mys_atomic_load_n(&shard->freed_count, MYS_ATOMIC_RELAXED);
+    }
+    // shards are read one by one, so a concurrent free may be seen without its allocation
+    size_t alive = (total > freed) ? total - freed : 0;
+    mys_atomic_store_n(&arena->total, total, MYS_ATOMIC_RELAXED);
+    mys_atomic_store_n(&arena->freed, freed, MYS_ATOMIC_RELAXED);
+    mys_atomic_store_n(&arena->alive, alive, MYS_ATOMIC_RELAXED);
+    mys_atomic_store_n(&arena->_total_count, total_count, MYS_ATOMIC_RELAXED);
+    mys_atomic_store_n(&arena->_freed_count, freed_count, MYS_ATOMIC_RELAXED);
+    mys_atomic_store_n(&arena->_alive_count, (total_count > freed_count) ? total_count - freed_count : 0, MYS_ATOMIC_RELAXED);
+    _mys_arena_stat_raise_peak(arena, alive);
 }
 
 // MYS_PUBLIC void* mys_malloc(size_t size)
@@ -462,7 +1554,7 @@ static void _mys_shm_G_init()
     {
         if (myrank == 0)
             _mys_shm_G.program_id = getpid();
-        _mys_MPI_Bcast(&_mys_shm_G.program_id, 1, mys_MPI_INT, 0, mys_MPI_COMM_WORLD);
+        mys_MPI_Bcast(&_mys_shm_G.program_id, 1, mys_MPI_INT, 0, mys_MPI_COMM_WORLD);
     }
     _mys_shm_G.inited = true;
     mys_mutex_unlock(&_mys_shm_G.lock);
@@ -480,13 +1572,17 @@ MYS_PUBLIC mys_shm_t mys_alloc_shared_memory(int owner_rank, size_t size)
     if (myrank == owner_rank) {
         shm._fd = shm_open(shm._name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
         shm._size = size;
-        ftruncate(shm._fd, shm._size);
+        if (ftruncate(shm._fd, shm._size) != 0)
+            shm._size = 0;
         shm.mem = mmap(NULL, shm._size, PROT_READ | PROT_WRITE, MAP_SHARED, shm._fd, 0);
         memset(shm.mem, 0, shm._size);
-        mys_memory_smp_mb();
+        mys_atomic_fence(MYS_ATOMIC_SEQ_CST);
         mys_MPI_Barrier(mys_MPI_COMM_WORLD);
     } else {
         mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    }
+    mys_MPI_Bcast(&shm._size, sizeof(size_t), mys_MPI_BYTE, owner_rank, mys_MPI_COMM_WORLD);
+    if (myrank != owner_rank) {
         shm._fd = shm_open(shm._name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
         shm.mem = mmap(NULL, shm._size, PROT_READ | PROT_WRITE, MAP_SHARED, shm._fd, 0);
     }
@@ -507,6 +1603,248 @@ MYS_PUBLIC void mys_free_shared_memory(mys_shm_t *shm)
     mys_mutex_unlock(&_mys_shm_G.lock);
 }
 
+/*
+    Node-shared arena (mys_shm_arena_t)
+    - One POSIX shm segment per node communicator, mapped by every rank of the node.
+      The segment is unlinked right after all ranks mapped it, so nothing is left in
+      /dev/shm if the program dies.
+    - Blocks are addressed by offsets from the start of the segment, because each rank
+      maps it at a different address. Free blocks form an address-ordered list that is
+      coalesced on free, protected by a spinlock that lives in the segment itself.
+*/
+#define MYS_SHM_ARENA_ALIGN 64
+#define MYS_SHM_ARENA_SPLIT (2 * MYS_SHM_ARENA_ALIGN) // don't split off blocks smaller than this
+#define MYS_SHM_ARENA_USED ((uint64_t)0x6d79735f75736564) // "mys_used"
+#define MYS_SHM_ARENA_FREE ((uint64_t)0x6d79735f66726565) // "mys_free"
+
+typedef struct _mys_shm_block_t {
+    uint64_t size;  // bytes of the block including this header
+    uint64_t next;  // offset of the next free block, 0 for none (free blocks only)
+    uint64_t magic; // MYS_SHM_ARENA_USED or MYS_SHM_ARENA_FREE
+    uint8_t _pad[MYS_SHM_ARENA_ALIGN - 3 * sizeof(uint64_t)];
+} _mys_shm_block_t;
+
+typedef struct _mys_shm_header_t {
+    uint32_t lock;
+    uint32_t _pad0;
+    uint64_t size; // bytes of the segment
+    uint64_t free_head; // offset of the first free block, 0 for none
+    uint64_t alive;
+    uint64_t peak;
+    uint8_t _pad[MYS_SHM_ARENA_ALIGN - 5 * sizeof(uint64_t)];
+} _mys_shm_header_t;
+
+struct mys_shm_arena_t {
+    uint8_t *base;
+    size_t size;
+    mys_commgroup_t *group;
+    char name[NAME_MAX];
+};
+
+MYS_STATIC void _mys_shm_arena_lock(_mys_shm_header_t *header)
+{
+    uint32_t oval = 0;
+    while (!mys_atomic_compare_exchange_n(&header->lock, &oval, 1, MYS_ATOMIC_ACQUIRE, MYS_ATOMIC_RELAXED)) {
+        oval = 0;
+        sched_yield(); // ranks are often oversubscribed
+    }
+}
+
+MYS_STATIC void _mys_shm_arena_unlock(_mys_shm_header_t *header)
+{
+    mys_atomic_store_n(&header->lock, 0, MYS_ATOMIC_RELEASE);
+}
+
+#define _MYS_SHM_BLOCK(arena, offset) ((_mys_shm_block_t *)((arena)->base + (offset)))
+
+MYS_PUBLIC mys_shm_arena_t *mys_shm_arena_create(mys_MPI_Comm comm, size_t capacity)
+{
+    static size_t counter = 0;
+    mys_shm_arena_t *arena = (mys_shm_arena_t *)calloc(1, sizeof(mys_shm_arena_t));
+    AS_NE_PTR(arena, NULL);
+    arena->group = mys_commgroup_create_node(comm);
+    mys_MPI_Comm node_comm = arena->group->local_comm;
+    int fd = -1;
+    uint64_t meta[2] = {0, 0}; // {size, ok}
+    if (arena->group->local_myrank == 0) {
+        size_t size = sizeof(_mys_shm_header_t) + sizeof(_mys_shm_block_t) + MYS_ALIGN_UP(capacity, MYS_SHM_ARENA_ALIGN);
+        size = MYS_ALIGN_UP(size, (size_t)sysconf(_SC_PAGESIZE));
+        snprintf(arena->name, sizeof(arena->name), "/mys_arena_%d_%zu", (int)getpid(), mys_atomic_fetch_add(&counter, 1, MYS_ATOMIC_RELAXED));
+        fd = shm_open(arena->name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+        if (fd >= 0 && ftruncate(fd, size) == 0) {
+            void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                arena->base = (uint8_t *)p;
+                _mys_shm_header_t *header = (_mys_shm_header_t *)arena->base;
+                header->lock = 0;
+                header->size = size;
+                header->free_head = sizeof(_mys_shm_header_t);
+                header->alive = 0;
+                header->peak = 0;
+                _mys_shm_block_t *block = _MYS_SHM_BLOCK(arena, header->free_head);
+                block->size = size - sizeof(_mys_shm_header_t);
+                block->next = 0;
+                block->magic = MYS_SHM_ARENA_FREE;
+                meta[0] = size;
+                meta[1] = 1;
+            }
+        }
+    }
+    mys_MPI_Bcast(meta, 2, mys_MPI_UINT64_T, 0, node_comm);
+    mys_MPI_Bcast(arena->name, sizeof(arena->name), mys_MPI_CHAR, 0, node_comm);
+    arena->size = meta[0];
+    int failed = (meta[1] == 1) ? 0 : 1;
+    if (!failed && arena->group->local_myrank != 0) {
+        fd = shm_open(arena->name, O_RDWR, S_IRUSR | S_IWUSR);
+        void *p = (fd >= 0) ? mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (p != MAP_FAILED)
+            arena->base = (uint8_t *)p;
+        else
+            failed = 1;
+    }
+    if (fd >= 0)
+        close(fd); // the mapping keeps the segment alive
+    int nfailed = 0;
+    mys_MPI_Allreduce(&failed, &nfailed, 1, mys_MPI_INT, mys_MPI_SUM, node_comm);
+    if (arena->group->local_myrank == 0 && arena->name[0] != '\0')
+        shm_unlink(arena->name);
+    if (nfailed != 0) {
+        if (arena->base != NULL)
+            munmap(arena->base, arena->size);
+        mys_commgroup_release(arena->group);
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+MYS_PUBLIC void mys_shm_arena_destroy(mys_shm_arena_t **arena)
+{
+    if (arena == NULL || *arena == NULL)
+        return;
+    mys_MPI_Barrier((*arena)->group->local_comm);
+    munmap((*arena)->base, (*arena)->size);
+    mys_commgroup_release((*arena)->group);
+    free(*arena);
+    *arena = NULL;
+}
+
+MYS_PUBLIC void *mys_shm_arena_alloc(mys_shm_arena_t *arena, size_t size)
+{
+    _mys_shm_header_t *header = (_mys_shm_header_t *)arena->base;
+    uint64_t need = sizeof(_mys_shm_block_t) + MYS_ALIGN_UP((size == 0) ? 1 : size, MYS_SHM_ARENA_ALIGN);
+    uint64_t found = 0;
+    _mys_shm_arena_lock(header);
+    uint64_t *link = &header->free_head;
+    while (*link != 0) { // first fit
+        _mys_shm_block_t *block = _MYS_SHM_BLOCK(arena, *link);
+        if (block->size >= need) {
+            found = *link;
+            if (block->size - need >= MYS_SHM_ARENA_SPLIT) {
+                _mys_shm_block_t *rest = _MYS_SHM_BLOCK(arena, found + need);
+                rest->size = block->size - need;
+                rest->next = block->next;
+                rest->magic = MYS_SHM_ARENA_FREE;
+                block->size = need;
+                *link = found + need;
+            } else {
+                *link = block->next;
+            }
+            block->next = 0;
+            block->magic = MYS_SHM_ARENA_USED;
+            header->alive += block->size;
+            if (header->alive > header->peak)
+                header->peak = header->alive;
+            break;
+        }
+        link = &block->next;
+    }
+    _mys_shm_arena_unlock(header);
+    return (found == 0) ? NULL : arena->base + found + sizeof(_mys_shm_block_t);
+}
+
+MYS_PUBLIC void mys_shm_arena_free(mys_shm_arena_t *arena, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    _mys_shm_header_t *header = (_mys_shm_header_t *)arena->base;
+    uint8_t *first = arena->base + sizeof(_mys_shm_header_t) + sizeof(_mys_shm_block_t);
+    ASX_GE_PTR((void *)ptr, (void *)first, "free of %p outside shm arena", ptr);
+    ASX_LT_PTR((void *)ptr, (void *)(arena->base + arena->size), "free of %p outside shm arena", ptr);
+    uint64_t offset = (uint64_t)((uint8_t *)ptr - arena->base) - sizeof(_mys_shm_block_t);
+    _mys_shm_block_t *block = _MYS_SHM_BLOCK(arena, offset);
+    _mys_shm_arena_lock(header);
+    uint64_t magic = block->magic; // read under the lock, so only one of two racing frees sees it used
+    if (magic != MYS_SHM_ARENA_USED)
+        _mys_shm_arena_unlock(header); // don't leave other ranks spinning on the lock
+    ASX_EQ_U64(magic, MYS_SHM_ARENA_USED, "invalid or double free of %p in shm arena", ptr);
+    header->alive -= block->size;
+    block->magic = MYS_SHM_ARENA_FREE;
+    uint64_t prev = 0;
+    uint64_t next = header->free_head;
+    while (next != 0 && next < offset) {
+        prev = next;
+        next = _MYS_SHM_BLOCK(arena, next)->next;
+    }
+    block->next = next;
+    if (next != 0 && offset + block->size == next) { // merge with the following block
+        _mys_shm_block_t *nblock = _MYS_SHM_BLOCK(arena, next);
+        block->size += nblock->size;
+        block->next = nblock->next;
+    }
+    if (prev == 0) {
+        header->free_head = offset;
+    } else {
+        _mys_shm_block_t *pblock = _MYS_SHM_BLOCK(arena, prev);
+        if (prev + pblock->size == offset) { // merge into the preceding block
+            pblock->size += block->size;
+            pblock->next = block->next;
+        } else {
+            pblock->next = offset;
+        }
+    }
+    _mys_shm_arena_unlock(header);
+}
+
+MYS_PUBLIC void *mys_shm_arena_alloc_shared(mys_shm_arena_t *arena, size_t size)
+{
+    uint64_t offset = 0;
+    if (arena->group->local_myrank == 0) {
+        void *p = mys_shm_arena_alloc(arena, size);
+        offset = (p == NULL) ? 0 : mys_shm_arena_offset(arena, p);
+    }
+    mys_MPI_Bcast(&offset, 1, mys_MPI_UINT64_T, 0, arena->group->local_comm);
+    return (offset == 0) ? NULL : mys_shm_arena_ptr(arena, offset);
+}
+
+MYS_PUBLIC void mys_shm_arena_free_shared(mys_shm_arena_t *arena, void *ptr)
+{
+    mys_MPI_Barrier(arena->group->local_comm); // nobody reads it any more
+    if (arena->group->local_myrank == 0)
+        mys_shm_arena_free(arena, ptr);
+}
+
+MYS_PUBLIC size_t mys_shm_arena_offset(mys_shm_arena_t *arena, const void *ptr)
+{
+    return (size_t)((const uint8_t *)ptr - arena->base);
+}
+
+MYS_PUBLIC void *mys_shm_arena_ptr(mys_shm_arena_t *arena, size_t offset)
+{
+    return arena->base + offset;
+}
+
+MYS_PUBLIC void mys_shm_arena_usage(mys_shm_arena_t *arena, size_t *alive, size_t *peak)
+{
+    _mys_shm_header_t *header = (_mys_shm_header_t *)arena->base;
+    _mys_shm_arena_lock(header);
+    if (alive != NULL)
+        *alive = header->alive;
+    if (peak != NULL)
+        *peak = header->peak;
+    _mys_shm_arena_unlock(header);
+}
+
 #endif
 
 MYS_PUBLIC mys_bits_t mys_bits(const void *data, size_t size)
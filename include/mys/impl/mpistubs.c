@@ -245,6 +245,14 @@ MYS_PUBLIC int mys_MPI_Gather(void *sendbuf, int sendcount, mys_MPI_Datatype sen
     return mys_MPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
 }
 
+MYS_PUBLIC int mys_MPI_Gatherv(void *sendbuf, int sendcount, mys_MPI_Datatype sendtype, void *recvbuf, const int *recvcounts, const int *displs, mys_MPI_Datatype recvtype, int root, mys_MPI_Comm comm)
+{
+    (void)root;
+    if (displs[0] != 0)
+        THROW_NOT_IMPL();
+    return mys_MPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcounts[0], recvtype, comm);
+}
+
 MYS_PUBLIC int mys_MPI_Allreduce(void *sendbuf, void *recvbuf, int count, mys_MPI_Datatype datatype, mys_MPI_Op op, mys_MPI_Comm comm)
 {
    // FIXME: support MPI_MAX, MPI_MIN and other op. Throw error if not implemented
@@ -787,6 +795,15 @@ MYS_PUBLIC int mys_MPI_Gather(void *sendbuf, int sendcount, mys_MPI_Datatype sen
 #endif
 }
 
+MYS_PUBLIC int mys_MPI_Gatherv(void *sendbuf, int sendcount, mys_MPI_Datatype sendtype, void *recvbuf, const int *recvcounts, const int *displs, mys_MPI_Datatype recvtype, int root, mys_MPI_Comm comm)
+{
+#ifdef MYS_USE_PMPI
+   return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+#else
+   return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+#endif
+}
+
 MYS_PUBLIC int mys_MPI_Allreduce(void *sendbuf, void *recvbuf, int count, mys_MPI_Datatype datatype, mys_MPI_Op op, mys_MPI_Comm comm)
 {
 #ifdef MYS_USE_PMPI
@@ -13,11 +13,15 @@
 #include "../mpistubs.h"
 #include "../pool.h"
 #include "../memory.h"
+#include "../thread.h"
+
+#include <pthread.h>
 
 struct mys_pool_object_meta_t;
 struct mys_pool_object_t;
 struct mys_pool_olist_t; // object list
 struct mys_pool_block_t;
+struct mys_pool_magazine_t;
 struct mys_pool_t;
 
 typedef struct mys_pool_object_meta_t {
@@ -36,6 +40,15 @@ typedef struct mys_pool_object_meta_t {
         mobj_size
     Meta data comes with object is because in mys_pool_release, it returns object address.
     If you separate meta data and object, then you have to search for meta data
+
+    With MYS_POOL_INTRUSIVE, there is no per-object meta or olist node. Each block lives in
+    its own region whose size and alignment are both pool->region_size (a power of two):
+    +--------------+--------+--------+-----+--------+
+    | Block header | Object | Object | ... | Object |
+    +--------------+--------+--------+-----+--------+
+     ^ address of object & ~(region_size - 1)
+    The owning block is found by masking the object address, and free objects are linked
+    through their first word (free_chunk_head), so mobj_size == pobj_size.
 */
 typedef struct mys_pool_object_t {
     // uint8_t object[];
@@ -55,20 +68,54 @@ typedef struct mys_pool_block_t {
     uint8_t* memory;
     struct mys_pool_olist_t* objects;
     struct mys_pool_olist_t* free_object_head;
+    void* free_chunk_head; // MYS_POOL_INTRUSIVE: free objects linked through their first word
     struct mys_pool_block_t* prev;
     struct mys_pool_block_t* next;
 } mys_pool_block_t;
 
+#define MYS_POOL_REGION_MIN (64 * 1024)
+#define MYS_POOL_REGION_HEADER MYS_ALIGN_UP(sizeof(mys_pool_block_t), 64)
+
+#define MYS_POOL_MAGAZINE_CAPACITY 64
+#define MYS_POOL_MAGAZINE_BATCH (MYS_POOL_MAGAZINE_CAPACITY / 2)
+#define MYS_POOL_MAGAZINE_ALIGN 128
+
+/*
+    Per-thread cache of free objects used by MYS_POOL_CONCURRENT.
+    Each magazine is stored in a pthread key of its pool and only touched by that thread,
+    so acquire/release hit it without locking. When the magazine runs empty (full),
+    MYS_POOL_MAGAZINE_BATCH objects are refilled from (spilled to) the central block
+    lists under pool->lock. An object released by another thread simply lands in
+    that thread's magazine, since objects always know their owner block via meta
+    (or via address masking with MYS_POOL_INTRUSIVE).
+    When a thread exits, the key destructor flushes its magazine back to the central
+    lists and frees it, so objects are not stranded by dead threads.
+*/
+typedef struct mys_pool_magazine_t {
+    struct mys_pool_t* pool;
+    struct mys_pool_magazine_t* prev;
+    struct mys_pool_magazine_t* next;
+    size_t count;
+    void* objects[MYS_POOL_MAGAZINE_CAPACITY];
+} mys_pool_magazine_t;
+
 struct mys_pool_t {
     size_t robj_size;
     size_t pobj_size;
     size_t mobj_size;
+    size_t mobj_shift; // mobj_size == odd << mobj_shift
+    size_t mobj_inverse; // inverse of that odd factor modulo 2^64, see _mys_pool_index_object
     size_t block_capacity;
+    size_t region_size; // MYS_POOL_INTRUSIVE: size and alignment of each block region
     int strategy;
     struct mys_pool_block_t* free_block_head;
     struct mys_pool_block_t* free_block_tail;
     struct mys_pool_block_t* full_block_head;
     struct mys_pool_block_t* full_block_tail;
+    mys_mutex_t lock; // guard block lists and magazine list in MYS_POOL_CONCURRENT
+    bool use_magazines; // MYS_POOL_CONCURRENT and magazine_key is created
+    pthread_key_t magazine_key; // per-thread magazine of this pool
+    struct mys_pool_magazine_t* magazines; // all live magazines, to free them in mys_pool_destroy
 };
 
 static mys_pool_object_t* _mys_pool_get_object(mys_pool_t* pool, mys_pool_block_t* block, size_t i)
@@ -77,10 +124,11 @@ static mys_pool_object_t* _mys_pool_get_object(mys_pool_t* pool, mys_pool_block_
     return (mys_pool_object_t*)(block->memory + pool->mobj_size * i);
 }
 
+// Object offsets are exact multiples of mobj_size, so the division is a shift and a multiply by the inverse
 static size_t _mys_pool_index_object(mys_pool_t* pool, mys_pool_block_t* block, mys_pool_object_t* object)
 {
     MYS_RETIF(pool == NULL || block == NULL || object == NULL, MYS_EINVAL, 0);
-    return ((uint8_t*)object - block->memory) / pool->mobj_size;
+    return ((size_t)((uint8_t*)object - block->memory) >> pool->mobj_shift) * pool->mobj_inverse;
 }
 
 static mys_pool_object_meta_t* _mys_pool_get_object_meta(mys_pool_t* pool, mys_pool_object_t* object)
@@ -91,6 +139,29 @@ static mys_pool_object_meta_t* _mys_pool_get_object_meta(mys_pool_t* pool, mys_p
     return meta;
 }
 
+static mys_pool_block_t* _mys_pool_get_object_block(mys_pool_t* pool, mys_pool_object_t* object)
+{
+    if (pool->strategy & MYS_POOL_INTRUSIVE)
+        return (mys_pool_block_t*)MYS_ALIGN_DOWN((uintptr_t)object, (uintptr_t)pool->region_size);
+    return _mys_pool_get_object_meta(pool, object)->block;
+}
+
+static void _mys_pool_release_central_n(mys_pool_t* pool, void** objs, size_t n);
+
+// pthread key destructor: flush the magazine of an exiting thread back to central lists
+static void _mys_pool_magazine_exit(void* arg)
+{
+    mys_pool_magazine_t* mag = (mys_pool_magazine_t*)arg;
+    mys_pool_t* pool = mag->pool;
+    mys_mutex_lock(&pool->lock);
+    _mys_pool_release_central_n(pool, mag->objects, mag->count);
+    if (mag->prev != NULL) mag->prev->next = mag->next;
+    else pool->magazines = mag->next;
+    if (mag->next != NULL) mag->next->prev = mag->prev;
+    mys_mutex_unlock(&pool->lock);
+    mys_free2(MYS_ARENA_POOL, mag, sizeof(mys_pool_magazine_t));
+}
+
 MYS_PUBLIC mys_pool_t* mys_pool_create(size_t object_size)
 {
     return mys_pool_create2(object_size, 64, MYS_POOL_DEFAULT);
@@ -107,17 +178,81 @@ MYS_PUBLIC mys_pool_t* mys_pool_create2(size_t object_size, size_t initial_capac
     pool->pobj_size = MYS_ALIGN_UP(pool->robj_size, 8);
     pool->mobj_size = pool->pobj_size + MYS_ALIGN_UP(sizeof(mys_pool_object_meta_t), 8);
     pool->block_capacity = initial_capacity;
+    pool->region_size = 0;
     pool->strategy = pool_strategy;
+
+    if (pool_strategy & MYS_POOL_INTRUSIVE) {
+        pool->pobj_size = MYS_ALIGN_UP(pool->robj_size < sizeof(void*) ? sizeof(void*) : pool->robj_size, 8);
+        pool->mobj_size = pool->pobj_size;
+        size_t need = MYS_POOL_REGION_HEADER + initial_capacity * pool->mobj_size;
+        pool->region_size = MYS_POOL_REGION_MIN;
+        while (pool->region_size < need)
+            pool->region_size *= 2;
+        pool->block_capacity = (pool->region_size - MYS_POOL_REGION_HEADER) / pool->mobj_size;
+    }
+    {
+        size_t odd = pool->mobj_size;
+        pool->mobj_shift = 0;
+        while ((odd & 1) == 0) {
+            odd >>= 1;
+            pool->mobj_shift++;
+        }
+        size_t inverse = odd; // correct to 3 bits, each Newton step doubles that
+        for (int i = 0; i < 5; i++)
+            inverse *= 2 - odd * inverse;
+        pool->mobj_inverse = inverse;
+    }
     pool->free_block_head = NULL;
     pool->free_block_tail = NULL;
     pool->full_block_head = NULL;
     pool->full_block_tail = NULL;
+    mys_mutex_init(&pool->lock);
+    pool->use_magazines = false;
+    pool->magazines = NULL;
+
+    // If the process runs out of pthread keys, every thread uses the locked path
+    if (pool_strategy & MYS_POOL_CONCURRENT)
+        pool->use_magazines = (pthread_key_create(&pool->magazine_key, _mys_pool_magazine_exit) == 0);
 
     return pool;
 }
 
+static void allocate_region_block(mys_pool_t* pool)
+{
+    uint8_t* region = (uint8_t*)mys_aligned_alloc2(MYS_ARENA_POOL, pool->region_size, pool->region_size);
+    MYS_RETIF(region == NULL, MYS_ENOMEM);
+    mys_pool_block_t* block = (mys_pool_block_t*)region;
+    // DLOG(0, "    Allocate region block %p", block);
+
+    block->capacity = pool->block_capacity;
+    block->free = pool->block_capacity;
+    block->acquired_count = 0;
+    block->memory = region + MYS_POOL_REGION_HEADER;
+    block->objects = NULL;
+    block->free_object_head = NULL;
+
+    block->free_chunk_head = NULL;
+    for (size_t i = block->capacity; i > 0; i--) {
+        void** chunk = (void**)_mys_pool_get_object(pool, block, i - 1);
+        *chunk = block->free_chunk_head;
+        block->free_chunk_head = (void*)chunk;
+    }
+
+    mys_pool_block_t *next_block = pool->free_block_head;
+    pool->free_block_head = block;
+    block->prev = NULL;
+    block->next = next_block;
+    if (next_block != NULL) next_block->prev = block;
+    if (pool->free_block_tail == NULL) pool->free_block_tail = block;
+}
+
 static void allocate_block(mys_pool_t* pool)
 {
+    if (pool->strategy & MYS_POOL_INTRUSIVE) {
+        allocate_region_block(pool);
+        return;
+    }
+
     mys_pool_block_t* block = (mys_pool_block_t*)mys_malloc2(MYS_ARENA_POOL, sizeof(mys_pool_block_t));
     MYS_RETIF(block == NULL, MYS_ENOMEM);
     // DLOG(0, "    Allocate block %p", block);
@@ -125,6 +260,7 @@ static void allocate_block(mys_pool_t* pool)
     block->capacity = pool->block_capacity;
     block->free = pool->block_capacity;
     block->acquired_count = 0;
+    block->free_chunk_head = NULL;
 
     block->memory = (uint8_t*)mys_aligned_alloc2(MYS_ARENA_POOL, sysconf(_SC_PAGE_SIZE), block->capacity * pool->mobj_size);
     MYS_GOTOIF(block->memory == NULL, MYS_ENOMEM, failed);
@@ -175,6 +311,10 @@ MYS_STATIC void deallocate_block(mys_pool_t* pool, mys_pool_block_t* block)
     if (block->next != NULL) block->next->prev = block->prev;
 
     // DLOG(0, "    Deallocate block %p", block);
+    if (pool->strategy & MYS_POOL_INTRUSIVE) {
+        mys_free2(MYS_ARENA_POOL, block, pool->region_size);
+        return;
+    }
     mys_free2(MYS_ARENA_POOL, block->objects, block->capacity * sizeof(mys_pool_olist_t));
     mys_free2(MYS_ARENA_POOL, block->memory, block->capacity * pool->mobj_size);
     mys_free2(MYS_ARENA_POOL, block, sizeof(mys_pool_block_t));
@@ -197,107 +337,381 @@ MYS_PUBLIC void mys_pool_destroy(mys_pool_t* *pool)
         deallocate_block((*pool), block);
         block = next_block;
     }
+    if ((*pool)->use_magazines) {
+        // Deleted key runs no more destructors, so magazines of live threads are freed here
+        pthread_key_delete((*pool)->magazine_key);
+        mys_pool_magazine_t* mag = (*pool)->magazines;
+        while (mag != NULL) {
+            mys_pool_magazine_t* next_mag = mag->next;
+            mys_free2(MYS_ARENA_POOL, mag, sizeof(mys_pool_magazine_t));
+            mag = next_mag;
+        }
+    }
+    mys_mutex_destroy(&(*pool)->lock);
     mys_free2(MYS_ARENA_POOL, *pool, sizeof(mys_pool_t));
     *pool = NULL;
 }
 
-MYS_PUBLIC void* mys_pool_acquire(mys_pool_t* pool)
+static void _mys_pool_move_to_full_list(mys_pool_t* pool, mys_pool_block_t* block)
 {
-    // DLOG(0, "Acquiring");
-    MYS_RETIF(pool == NULL, MYS_EINVAL, NULL);
+    // DLOG(0, "    Block %p is full, move to full list", block);
+    // Remove block from free list (block is always the free list head)
+    mys_pool_block_t *next_block = block->next;
+    if (next_block != NULL) next_block->prev = NULL;
 
+    pool->free_block_head = next_block;
+    // DLOG(0, "    free_block_head is set to %p", next_block);
+    if (pool->free_block_head == NULL) {
+        pool->free_block_tail = NULL;
+    }
+
+    // Move block to full list
+    block->next = NULL;
+    if (pool->full_block_tail == NULL) {
+        pool->full_block_head = block;
+        block->prev = NULL;
+    } else {
+        pool->full_block_tail->next = block;
+        block->prev = pool->full_block_tail;
+    }
+    pool->full_block_tail = block;
+    // DLOG(0, "    full_block_tail is set to %p", block);
+}
+
+static void _mys_pool_move_to_free_list(mys_pool_t* pool, mys_pool_block_t* block)
+{
+    // DLOG(0, "    Block %p is free, move to free list", block);
+    // Remove block from full list
+    // Handle left to right relationship
+    if (block->prev == NULL) {
+        pool->full_block_head = block->next;
+    } else {
+        block->prev->next = block->next;
+    }
+    // Handle right to left relationship
+    if (block->next == NULL) {
+        pool->full_block_tail = block->prev;
+    } else {
+        block->next->prev = block->prev;
+    }
+
+    // Move block to free list
+    // Handle left to right relationship
+    block->next = pool->free_block_head;
+    // DLOG(0, "    Block %p->next is set to %p", block, pool->free_block_head);
+    // Handle right to left relationship
+    block->prev = NULL;
+    if (pool->free_block_head == NULL) {
+        pool->free_block_tail = block;
+    } else {
+        pool->free_block_head->prev = block;
+    }
+    pool->free_block_head = block;
+    // DLOG(0, "    free_block_head is set to %p", block);
+}
+
+// Link the free-list node of `object` in front of `next`, and return that node.
+// The node is the olist entry of object by default, or the object itself with MYS_POOL_INTRUSIVE.
+static void* _mys_pool_link_node(mys_pool_t* pool, mys_pool_block_t* block, mys_pool_object_t* object, void* next)
+{
+    if (pool->strategy & MYS_POOL_INTRUSIVE) {
+        *(void**)object = next;
+        return (void*)object;
+    }
+    mys_pool_olist_t* llist_node = &block->objects[_mys_pool_index_object(pool, block, object)];
+    llist_node->next = (mys_pool_olist_t*)next;
+    return (void*)llist_node;
+}
+
+// Splice a chain of `count` nodes (head...tail) that belong to the same block back to it
+static void _mys_pool_splice_back(mys_pool_t* pool, mys_pool_block_t* block, void* head, void* tail, size_t count)
+{
+    size_t old_free = block->free;
+    if (pool->strategy & MYS_POOL_INTRUSIVE) {
+        *(void**)tail = block->free_chunk_head;
+        block->free_chunk_head = head;
+    } else {
+        ((mys_pool_olist_t*)tail)->next = block->free_object_head;
+        block->free_object_head = (mys_pool_olist_t*)head;
+    }
+    block->free += count;
+
+    // Keep the last free block, otherwise a steady acquire/release loop reallocates a block every cycle
+    bool last_free = pool->free_block_head == NULL || (pool->free_block_head == block && block->next == NULL);
+    if (block->acquired_count > block->capacity && block->free == block->capacity && !last_free) {
+        deallocate_block(pool, block);
+    } else if (old_free == 0) { // Block is free to use
+        _mys_pool_move_to_free_list(pool, block);
+    }
+}
+
+static void* _mys_pool_acquire_central(mys_pool_t* pool)
+{
     if (pool->free_block_head == NULL) {
         allocate_block(pool);
         MYS_RETIF(pool->free_block_head == NULL, MYS_ENOMEM, NULL);
     }
 
     mys_pool_block_t* block = pool->free_block_head;
-    MYS_RETIF(block->free_object_head == NULL, MYS_ENOMEM, NULL);
-
-    mys_pool_olist_t* llist_node = block->free_object_head;
-    block->free_object_head = llist_node->next;
-    llist_node->next = NULL;
+    void* object = NULL;
+    if (pool->strategy & MYS_POOL_INTRUSIVE) {
+        MYS_RETIF(block->free_chunk_head == NULL, MYS_ENOMEM, NULL);
+        object = block->free_chunk_head;
+        block->free_chunk_head = *(void**)object;
+    } else {
+        MYS_RETIF(block->free_object_head == NULL, MYS_ENOMEM, NULL);
+        mys_pool_olist_t* llist_node = block->free_object_head;
+        block->free_object_head = llist_node->next;
+        llist_node->next = NULL;
+        object = llist_node->self;
+    }
 
     block->free--;
     block->acquired_count++;
 
     if (block->free == 0) {
-        // DLOG(0, "    Block %p is full, move to full list", block);
-        // Remove block from free list
-        mys_pool_block_t *next_block = block->next;
-        if (next_block != NULL) next_block->prev = NULL;
+        _mys_pool_move_to_full_list(pool, block);
+    }
 
-        pool->free_block_head = next_block;
-        // DLOG(0, "    free_block_head is set to %p", next_block);
+    // DLOG(0, "    Acquired %p", object);
+    return object;
+}
+
+static size_t _mys_pool_acquire_central_n(mys_pool_t* pool, void** out, size_t n)
+{
+    size_t got = 0;
+    while (got < n) {
         if (pool->free_block_head == NULL) {
-            pool->free_block_tail = NULL;
+            allocate_block(pool);
+            MYS_RETIF(pool->free_block_head == NULL, MYS_ENOMEM, got);
         }
 
-        // Move block to full list
-        block->next = NULL;
-        if (pool->full_block_tail == NULL) {
-            pool->full_block_head = block;
-            block->prev = NULL;
+        // Detach min(free, remaining) nodes from the head block at once
+        mys_pool_block_t* block = pool->free_block_head;
+        size_t take = (block->free < n - got) ? block->free : n - got;
+        if (pool->strategy & MYS_POOL_INTRUSIVE) {
+            void* chunk = block->free_chunk_head;
+            for (size_t i = 0; i < take; i++) {
+                out[got + i] = chunk;
+                chunk = *(void**)chunk;
+            }
+            block->free_chunk_head = chunk;
         } else {
-            pool->full_block_tail->next = block;
-            block->prev = pool->full_block_tail;
+            mys_pool_olist_t* llist_node = block->free_object_head;
+            for (size_t i = 0; i < take; i++) {
+                out[got + i] = llist_node->self;
+                llist_node = llist_node->next;
+            }
+            block->free_object_head = llist_node;
+        }
+        block->free -= take;
+        block->acquired_count += take;
+        got += take;
+
+        if (block->free == 0) {
+            _mys_pool_move_to_full_list(pool, block);
         }
-        pool->full_block_tail = block;
-        // DLOG(0, "    full_block_tail is set to %p", block);
     }
+    return got;
+}
 
-    // DLOG(0, "    Acquired %p", llist_node->self);
-    return (void* )llist_node->self;
+static void _mys_pool_release_central(mys_pool_t* pool, void* object_)
+{
+    mys_pool_object_t* object = (mys_pool_object_t*)object_;
+    mys_pool_block_t* block = _mys_pool_get_object_block(pool, object);
+    void* node = _mys_pool_link_node(pool, block, object, NULL);
+    _mys_pool_splice_back(pool, block, node, node, 1);
+    // DLOG(0, "    Released %p", object_);
 }
 
-MYS_PUBLIC void mys_pool_release(mys_pool_t* pool, void* object_)
+#define MYS_POOL_RELEASE_CHAINS 4
+
+typedef struct mys_pool_chain_t {
+    struct mys_pool_block_t* block;
+    void* head;
+    void* tail;
+    size_t count;
+} mys_pool_chain_t;
+
+static void _mys_pool_release_central_n(mys_pool_t* pool, void** objs, size_t n)
 {
-    // DLOG(0, "Releasing %p", object_);
-    MYS_RETIF(pool == NULL, MYS_EINVAL);
+    // Keep one open chain per recently seen block, so objects of interleaved blocks are still
+    // spliced back once per block. The chain being extended lives in locals, and is parked in
+    // `chains` when the owner block changes. A parked chain is spliced when its slot is reused.
+    mys_pool_chain_t chains[MYS_POOL_RELEASE_CHAINS];
+    size_t nchains = 0;
+    size_t victim = 0;
+    size_t cur = 0;
+    mys_pool_block_t* block = NULL;
+    void* head = NULL;
+    void* tail = NULL;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        mys_pool_object_t* object = (mys_pool_object_t*)objs[i];
+        mys_pool_block_t* owner = _mys_pool_get_object_block(pool, object);
+        if (MYS_UNLIKELY(owner != block)) {
+            if (block != NULL) {
+                chains[cur].head = head;
+                chains[cur].tail = tail;
+                chains[cur].count = count;
+            }
+            size_t c = 0;
+            while (c < nchains && chains[c].block != owner)
+                c++;
+            if (c == nchains) {
+                if (nchains < MYS_POOL_RELEASE_CHAINS) {
+                    nchains++;
+                } else {
+                    c = victim;
+                    victim = (victim + 1) % MYS_POOL_RELEASE_CHAINS;
+                    _mys_pool_splice_back(pool, chains[c].block, chains[c].head, chains[c].tail, chains[c].count);
+                }
+                chains[c].block = owner;
+                chains[c].head = NULL;
+                chains[c].tail = NULL;
+                chains[c].count = 0;
+            }
+            cur = c;
+            block = owner;
+            head = chains[c].head;
+            tail = chains[c].tail;
+            count = chains[c].count;
+        }
+        head = _mys_pool_link_node(pool, block, object, head);
+        if (tail == NULL) tail = head;
+        count += 1;
+    }
+    if (block != NULL) {
+        chains[cur].head = head;
+        chains[cur].tail = tail;
+        chains[cur].count = count;
+    }
+    for (size_t c = 0; c < nchains; c++)
+        _mys_pool_splice_back(pool, chains[c].block, chains[c].head, chains[c].tail, chains[c].count);
+}
 
-    mys_pool_object_t* object = (mys_pool_object_t*)object_;
-    mys_pool_object_meta_t* meta = _mys_pool_get_object_meta(pool, object);
-    mys_pool_block_t* block = meta->block;
-    size_t index = _mys_pool_index_object(pool, block, object);
-    mys_pool_olist_t* llist_node = &block->objects[index];
+// Return the magazine of calling thread, or NULL if magazines are unavailable (fallback to locked path)
+static mys_pool_magazine_t* _mys_pool_get_magazine(mys_pool_t* pool)
+{
+    if (!pool->use_magazines)
+        return NULL;
+    mys_pool_magazine_t* mag = (mys_pool_magazine_t*)pthread_getspecific(pool->magazine_key);
+    if (MYS_UNLIKELY(mag == NULL)) {
+        mag = (mys_pool_magazine_t*)mys_aligned_alloc2(MYS_ARENA_POOL, MYS_POOL_MAGAZINE_ALIGN, sizeof(mys_pool_magazine_t));
+        MYS_RETIF(mag == NULL, MYS_ENOMEM, NULL);
+        mag->pool = pool;
+        mag->prev = NULL;
+        mag->count = 0;
+        mys_mutex_lock(&pool->lock);
+        mag->next = pool->magazines;
+        if (pool->magazines != NULL) pool->magazines->prev = mag;
+        pool->magazines = mag;
+        mys_mutex_unlock(&pool->lock);
+        if (pthread_setspecific(pool->magazine_key, mag) != 0) {
+            _mys_pool_magazine_exit(mag);
+            return NULL;
+        }
+    }
+    return mag;
+}
 
-    // Add to free list
-    llist_node->next = block->free_object_head;
-    block->free_object_head = llist_node;
+static void* _mys_pool_acquire_concurrent(mys_pool_t* pool)
+{
+    mys_pool_magazine_t* mag = _mys_pool_get_magazine(pool);
+    if (MYS_LIKELY(mag != NULL && mag->count > 0)) {
+        mag->count--;
+        return mag->objects[mag->count];
+    }
 
-    block->free++;
+    void* object = NULL;
+    mys_mutex_lock(&pool->lock);
+    {
+        object = _mys_pool_acquire_central(pool);
+        if (mag != NULL && object != NULL)
+            mag->count = _mys_pool_acquire_central_n(pool, mag->objects, MYS_POOL_MAGAZINE_BATCH);
+    }
+    mys_mutex_unlock(&pool->lock);
+    return object;
+}
 
-    if (block->acquired_count > block->capacity && block->free == block->capacity) {
-        deallocate_block(pool, block);
-    } else if (block->free == 1) { // Block is free to use
-        // DLOG(0, "    Block %p is free, move to free list", block);
-        // Remove block from full list
-        // Handle left to right relationship
-        if (block->prev == NULL) {
-            pool->full_block_head = block->next;
-        } else {
-            block->prev->next = block->next;
+static void _mys_pool_release_concurrent(mys_pool_t* pool, void* object)
+{
+    mys_pool_magazine_t* mag = _mys_pool_get_magazine(pool);
+    if (MYS_LIKELY(mag != NULL && mag->count < MYS_POOL_MAGAZINE_CAPACITY)) {
+        mag->objects[mag->count++] = object;
+        return;
+    }
+
+    mys_mutex_lock(&pool->lock);
+    {
+        _mys_pool_release_central(pool, object);
+        if (mag != NULL && mag->count > MYS_POOL_MAGAZINE_BATCH) {
+            _mys_pool_release_central_n(pool, mag->objects + MYS_POOL_MAGAZINE_BATCH, mag->count - MYS_POOL_MAGAZINE_BATCH);
+            mag->count = MYS_POOL_MAGAZINE_BATCH;
         }
-        // Handle right to left relationship
-        if (block->next == NULL) {
-            pool->full_block_tail = block->prev;
-        } else {
-            block->next->prev = block->prev;
+    }
+    mys_mutex_unlock(&pool->lock);
+}
+
+MYS_PUBLIC void* mys_pool_acquire(mys_pool_t* pool)
+{
+    // DLOG(0, "Acquiring");
+    MYS_RETIF(pool == NULL, MYS_EINVAL, NULL);
+    if (pool->strategy & MYS_POOL_CONCURRENT)
+        return _mys_pool_acquire_concurrent(pool);
+    return _mys_pool_acquire_central(pool);
+}
+
+MYS_PUBLIC void mys_pool_release(mys_pool_t* pool, void* object_)
+{
+    // DLOG(0, "Releasing %p", object_);
+    MYS_RETIF(pool == NULL, MYS_EINVAL);
+    if (pool->strategy & MYS_POOL_CONCURRENT)
+        _mys_pool_release_concurrent(pool, object_);
+    else
+        _mys_pool_release_central(pool, object_);
+}
+
+MYS_PUBLIC size_t mys_pool_acquire_n(mys_pool_t* pool, void** out, size_t n)
+{
+    MYS_RETIF(pool == NULL || (out == NULL && n > 0), MYS_EINVAL, 0);
+    if (!(pool->strategy & MYS_POOL_CONCURRENT))
+        return _mys_pool_acquire_central_n(pool, out, n);
+
+    size_t got = 0;
+    mys_pool_magazine_t* mag = _mys_pool_get_magazine(pool);
+    if (mag != NULL) {
+        while (got < n && mag->count > 0) {
+            mag->count--;
+            out[got++] = mag->objects[mag->count];
         }
+    }
+    if (got < n) {
+        mys_mutex_lock(&pool->lock);
+        got += _mys_pool_acquire_central_n(pool, out + got, n - got);
+        mys_mutex_unlock(&pool->lock);
+    }
+    return got;
+}
 
-        // Move block to free list
-        // Handle left to right relationship
-        block->next = pool->free_block_head;
-        // DLOG(0, "    Block %p->next is set to %p", block, pool->free_block_head);
-        // Handle right to left relationship
-        block->prev = NULL;
-        if (pool->free_block_head == NULL) {
-            pool->free_block_tail = block;
-        } else {
-            pool->free_block_head->prev = block;
+MYS_PUBLIC void mys_pool_release_n(mys_pool_t* pool, void** objs, size_t n)
+{
+    MYS_RETIF(pool == NULL || (objs == NULL && n > 0), MYS_EINVAL);
+    if (!(pool->strategy & MYS_POOL_CONCURRENT)) {
+        _mys_pool_release_central_n(pool, objs, n);
+        return;
+    }
+
+    size_t put = 0;
+    mys_pool_magazine_t* mag = _mys_pool_get_magazine(pool);
+    if (mag != NULL) {
+        while (put < n && mag->count < MYS_POOL_MAGAZINE_CAPACITY) {
+            mag->objects[mag->count++] = objs[put++];
         }
-        pool->free_block_head = block;
-        // DLOG(0, "    free_block_head is set to %p", block);
     }
-    // DLOG(0, "    Released %p", llist_node->self);
+    if (put < n) {
+        mys_mutex_lock(&pool->lock);
+        _mys_pool_release_central_n(pool, objs + put, n - put);
+        mys_mutex_unlock(&pool->lock);
+    }
 }
@@ -13,10 +13,17 @@
 #include "../mpistubs.h"
 #include "../log.h"
 #include "../memory.h"
+#include "../os.h"
+#include "../commgroup.h"
 #include "uthash_hash.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 #define _MYS_FNAME_MAX 256
 #define _MYS_RANK_LOG_DEST_NUM 8
+#define _MYS_RANK_LOG_SINK_NUM 64
 
 typedef struct {
     bool inited;
@@ -28,6 +35,8 @@ typedef struct {
         size_t tot_wrote;
         size_t cur_wrote;
     } dests[_MYS_RANK_LOG_DEST_NUM];
+    bool atexit_registered;
+    mys_ranklog_sink_t *sinks[_MYS_RANK_LOG_SINK_NUM]; // flushed at exit
 } _mys_rank_log_G_t;
 
 static _mys_rank_log_G_t _mys_rank_log_G = {
@@ -37,6 +46,8 @@ static _mys_rank_log_G_t _mys_rank_log_G = {
     .dests = {
         { .file = NULL, .folder = { '\0' }, .tot_wrote = 0, .cur_wrote = 0 },
     },
+    .atexit_registered = false,
+    .sinks = { NULL },
 };
 
 MYS_STATIC void _mys_rank_log_init()
@@ -172,3 +183,301 @@ MYS_PUBLIC void mys_ranklog_close_old(const char *callfile, int callline, const
 _finished:
     mys_mutex_unlock(&_mys_rank_log_G.lock);
 }
+
+/////////////////////////
+// Per-rank file sink
+/////////////////////////
+
+struct mys_ranklog_sink_t {
+    mys_mutex_t lock;
+    int fd;
+    char path[4096];
+    size_t max_bytes;
+    int max_files;
+    int flush_level;
+    size_t file_bytes; // bytes of the current file, written or buffered
+    char *buffer;
+    size_t buffer_size;
+    size_t buffer_len;
+    struct {
+        int level, myrank, nranks, line;
+        char file[192]; // a copy, event->file may not outlive the call (e.g., ordered logging)
+        int len;
+        char text[256];
+    } label; // the last label, reused while logging from the same line
+};
+
+MYS_STATIC bool _mys_ranklog_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (true) {
+        while (iovcnt > 0 && iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0)
+            return true;
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+}
+
+// Write the buffer and then `extra` with one writev. Caller holds sink->lock.
+MYS_STATIC int _mys_ranklog_sink_write(mys_ranklog_sink_t *sink, const char *extra, size_t extra_len)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = sink->buffer;
+    iov[0].iov_len = sink->buffer_len;
+    iov[1].iov_base = (void *)extra;
+    iov[1].iov_len = extra_len;
+    bool ok = (sink->fd < 0) ? false : _mys_ranklog_writev_all(sink->fd, iov, 2);
+    sink->buffer_len = 0; // drop lines that cannot be written instead of growing
+    MYS_RETIF(!ok, MYS_EIO, MYS_EIO);
+    return 0;
+}
+
+// rank.log.(max_files-2) -> rank.log.(max_files-1), ..., rank.log -> rank.log.1, then start a new rank.log
+MYS_STATIC void _mys_ranklog_sink_rotate(mys_ranklog_sink_t *sink)
+{
+    char from[sizeof(sink->path) + 16];
+    char to[sizeof(sink->path) + 16];
+    _mys_ranklog_sink_write(sink, NULL, 0);
+    if (sink->fd >= 0)
+        close(sink->fd);
+    for (int i = sink->max_files - 1; i >= 2; i--) {
+        snprintf(from, sizeof(from), "%s.%d", sink->path, i - 1);
+        snprintf(to, sizeof(to), "%s.%d", sink->path, i);
+        rename(from, to);
+    }
+    if (sink->max_files > 1) {
+        snprintf(to, sizeof(to), "%s.1", sink->path);
+        rename(sink->path, to);
+    }
+    sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    sink->file_bytes = 0;
+}
+
+MYS_STATIC void _mys_ranklog_sink_atexit()
+{
+    mys_mutex_lock(&_mys_rank_log_G.lock);
+    for (int i = 0; i < _MYS_RANK_LOG_SINK_NUM; i++) {
+        mys_ranklog_sink_t *sink = _mys_rank_log_G.sinks[i];
+        if (sink != NULL)
+            mys_ranklog_sink_flush(sink);
+    }
+    mys_mutex_unlock(&_mys_rank_log_G.lock);
+}
+
+MYS_PUBLIC mys_ranklog_sink_t *mys_ranklog_sink_create(mys_MPI_Comm comm, const char *folder, size_t max_bytes, int max_files)
+{
+    MYS_RETIF(folder == NULL || max_files < 1, MYS_EINVAL, NULL);
+    int myrank;
+    mys_MPI_Comm_rank(comm, &myrank);
+
+    // One directory per node, created by the first rank of the node
+    char dir[2048];
+    mys_commgroup_t *node = mys_commgroup_create_node(comm);
+    snprintf(dir, sizeof(dir), "%s/node.%06d", folder, node->group_id);
+    if (node->local_myrank == 0)
+        mys_ensure_dir(dir, 0777);
+    mys_MPI_Barrier(node->local_comm);
+    mys_commgroup_release(node);
+
+    mys_ranklog_sink_t *sink = (mys_ranklog_sink_t *)mys_calloc2(MYS_ARENA_LOG, sizeof(mys_ranklog_sink_t), 1);
+    MYS_RETIF(sink == NULL, MYS_ENOMEM, NULL);
+    mys_mutex_init(&sink->lock);
+    sink->label.line = -1;
+    sink->max_bytes = max_bytes;
+    sink->max_files = max_files;
+    sink->flush_level = MYS_LOG_ERROR;
+    sink->buffer_size = 1 << 20;
+    sink->buffer_len = 0;
+    sink->buffer = (char *)mys_malloc2(MYS_ARENA_LOG, sink->buffer_size);
+    if (sink->buffer == NULL) {
+        mys_free2(MYS_ARENA_LOG, sink, sizeof(mys_ranklog_sink_t));
+        MYS_RETIF(true, MYS_ENOMEM, NULL);
+    }
+    snprintf(sink->path, sizeof(sink->path), "%s/rank.%06d.log", dir, myrank);
+    sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (sink->fd < 0) {
+        mys_free2(MYS_ARENA_LOG, sink->buffer, sink->buffer_size);
+        mys_free2(MYS_ARENA_LOG, sink, sizeof(mys_ranklog_sink_t));
+        MYS_RETIF(true, MYS_EIO, NULL);
+    }
+    struct stat st;
+    sink->file_bytes = (fstat(sink->fd, &st) == 0) ? (size_t)st.st_size : 0;
+
+    mys_mutex_lock(&_mys_rank_log_G.lock);
+    for (int i = 0; i < _MYS_RANK_LOG_SINK_NUM; i++) {
+        if (_mys_rank_log_G.sinks[i] == NULL) {
+            _mys_rank_log_G.sinks[i] = sink;
+            break;
+        }
+    }
+    if (!_mys_rank_log_G.atexit_registered)
+        _mys_rank_log_G.atexit_registered = (atexit(_mys_ranklog_sink_atexit) == 0);
+    mys_mutex_unlock(&_mys_rank_log_G.lock);
+    return sink;
+}
+
+MYS_PUBLIC void mys_ranklog_sink_destroy(mys_ranklog_sink_t **sink)
+{
+    if (sink == NULL || *sink == NULL)
+        return;
+    mys_ranklog_sink_t *s = *sink;
+    mys_mutex_lock(&_mys_rank_log_G.lock);
+    for (int i = 0; i < _MYS_RANK_LOG_SINK_NUM; i++) {
+        if (_mys_rank_log_G.sinks[i] == s)
+            _mys_rank_log_G.sinks[i] = NULL;
+    }
+    mys_mutex_unlock(&_mys_rank_log_G.lock);
+    mys_ranklog_sink_flush(s);
+    if (s->fd >= 0)
+        close(s->fd);
+    mys_free2(MYS_ARENA_LOG, s->buffer, s->buffer_size);
+    mys_free2(MYS_ARENA_LOG, s, sizeof(mys_ranklog_sink_t));
+    *sink = NULL;
+}
+
+MYS_PUBLIC int mys_ranklog_sink_flush(mys_ranklog_sink_t *sink)
+{
+    MYS_RETIF(sink == NULL, MYS_EINVAL, MYS_EINVAL);
+    mys_mutex_lock(&sink->lock);
+    int ret = _mys_ranklog_sink_write(sink, NULL, 0);
+    mys_mutex_unlock(&sink->lock);
+    return ret;
+}
+
+MYS_PUBLIC int mys_ranklog_sink_set_buffer(mys_ranklog_sink_t *sink, size_t buffer_size, int flush_level)
+{
+    MYS_RETIF(sink == NULL || buffer_size == 0, MYS_EINVAL, MYS_EINVAL);
+    mys_mutex_lock(&sink->lock);
+    _mys_ranklog_sink_write(sink, NULL, 0);
+    char *buffer = (char *)mys_malloc2(MYS_ARENA_LOG, buffer_size);
+    if (buffer == NULL) {
+        mys_mutex_unlock(&sink->lock);
+        MYS_RETIF(true, MYS_ENOMEM, MYS_ENOMEM);
+    }
+    mys_free2(MYS_ARENA_LOG, sink->buffer, sink->buffer_size);
+    sink->buffer = buffer;
+    sink->buffer_size = buffer_size;
+    sink->flush_level = flush_level;
+    mys_mutex_unlock(&sink->lock);
+    return 0;
+}
+
+MYS_PUBLIC const char *mys_ranklog_sink_path(mys_ranklog_sink_t *sink)
+{
+    return sink->path;
+}
+
+// [I::000 ex01.hello-gcc.c:012] Test ILOG function
+MYS_PUBLIC void mys_ranklog_handler(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata)
+{
+    (void)logger;
+    mys_ranklog_sink_t *sink = (mys_ranklog_sink_t *)udata;
+    if (sink == NULL)
+        return;
+
+    mys_mutex_lock(&sink->lock);
+    const char *label = sink->label.text;
+    int label_len = 0;
+    if ((int)event->level < (int)MYS_LOG_RAW) {
+        if (sink->label.line != event->line || sink->label.level != event->level || sink->label.myrank != event->myrank ||
+            sink->label.nranks != event->nranks || strcmp(sink->label.file, event->file) != 0) {
+            int rank_digits = mys_math_trunc(mys_math_log10(event->nranks)) + 1;
+            int line_digits = mys_math_trunc(mys_math_log10(event->line)) + 1;
+            rank_digits = rank_digits > 3 ? rank_digits : 3;
+            line_digits = line_digits > 3 ? line_digits : 3;
+            int len = snprintf(sink->label.text, sizeof(sink->label.text), "[%c::%0*d %s:%0*d] ",
+                mys_log_level_string(event->level)[0], rank_digits, event->myrank,
+                event->file, line_digits, event->line
+            );
+            sink->label.len = len < (int)sizeof(sink->label.text) ? len : (int)sizeof(sink->label.text) - 1;
+            snprintf(sink->label.file, sizeof(sink->label.file), "%s", event->file);
+            sink->label.line = event->line;
+            sink->label.level = event->level;
+            sink->label.myrank = event->myrank;
+            sink->label.nranks = event->nranks;
+        }
+        label_len = sink->label.len;
+    }
+
+    // Format right into the buffer, so that the message is formatted once in the common case
+    size_t line_len = 0;
+    char *large = NULL;
+    for (int retry = 0; retry < 2; retry++) {
+        size_t room = sink->buffer_size - sink->buffer_len;
+        if (room <= (size_t)label_len + 1) {
+            _mys_ranklog_sink_write(sink, NULL, 0);
+            room = sink->buffer_size;
+        }
+        char *ptr = sink->buffer + sink->buffer_len;
+        size_t text_room = (room > (size_t)label_len + 1) ? room - (size_t)label_len - 1 : 0;
+        int text_len;
+        if (event->no_vargs) {
+            text_len = (int)strlen(fmt);
+            if ((size_t)text_len <= text_room)
+                memcpy(ptr + label_len, fmt, text_len);
+        } else {
+            va_list vargs_copy;
+            va_copy(vargs_copy, vargs);
+            text_len = (text_room > 0) ? vsnprintf(ptr + label_len, text_room + 1, fmt, vargs_copy) : vsnprintf(NULL, 0, fmt, vargs_copy);
+            va_end(vargs_copy);
+            text_len = (text_len < 0) ? 0 : text_len;
+        }
+        line_len = (size_t)label_len + (size_t)text_len + 1;
+        if (line_len <= room) {
+            memcpy(ptr, label, label_len);
+            ptr[line_len - 1] = '\n';
+            break;
+        }
+        if (sink->buffer_len > 0 && line_len <= sink->buffer_size) {
+            _mys_ranklog_sink_write(sink, NULL, 0); // retry in the empty buffer
+            continue;
+        }
+        large = (char *)malloc(line_len + 1); // does not fit the buffer, written right away
+        if (large != NULL) {
+            memcpy(large, label, label_len);
+            if (event->no_vargs)
+                memcpy(large + label_len, fmt, text_len);
+            else
+                vsnprintf(large + label_len, (size_t)text_len + 1, fmt, vargs);
+            large[line_len - 1] = '\n';
+        }
+        break;
+    }
+    if (large == NULL && line_len > sink->buffer_size - sink->buffer_len) { // dropped on allocation failure
+        mys_mutex_unlock(&sink->lock);
+        return;
+    }
+
+    if (sink->max_bytes > 0 && sink->file_bytes > 0 && sink->file_bytes + line_len > sink->max_bytes) {
+        // The previous lines go to the current file, this line starts the new one
+        char *ptr = sink->buffer + sink->buffer_len;
+        _mys_ranklog_sink_rotate(sink);
+        if (large == NULL)
+            memmove(sink->buffer, ptr, line_len);
+    }
+    sink->file_bytes += line_len;
+    if (large != NULL) {
+        _mys_ranklog_sink_write(sink, large, line_len);
+        free(large);
+    } else {
+        sink->buffer_len += line_len;
+        if (event->level >= sink->flush_level && event->level != MYS_LOG_RAW)
+            _mys_ranklog_sink_write(sink, NULL, 0);
+    }
+    mys_mutex_unlock(&sink->lock);
+}
@@ -12,27 +12,84 @@
 #include "../errno.h"
 #include "../mpistubs.h"
 #include "../assert.h"
+#include "../atomic.h"
 #include "../trace.h"
 #include "../memory.h"
 #include "../thread.h"
 #include "../hrtime.h"
+#include "../os.h"
 
-typedef struct mys_trace_e1block_t {
-    struct mys_trace_e1block_t *prev;
-    struct mys_trace_e1block_t *next;
-    struct mys_trace_event1_t *events;
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdarg.h>
+
+#define MYS_TRACE_MAX_THREADS 4096
+#define MYS_TRACE_SLOT_ALIGN 128 // keep slots of different threads on different cache lines
+#define MYS_TRACE_BLOCK_MIN 1024
+#define MYS_TRACE_DUMP_HEAP_MIN 32 // cursors of the first merge heap of mys_trace_dump()
+#define MYS_TRACE_DUMP_HEAPS 10 // enough doublings for MYS_TRACE_EVENT4 * MYS_TRACE_MAX_THREADS cursors
+
+typedef struct mys_trace_block_t {
+    struct mys_trace_block_t *next;
+    void *events; // mys_trace_eventN_t[capacity]
     uint32_t capacity;
-    uint32_t size;
-} mys_trace_e1block_t;
+    uint32_t size; // next index to write
+    uint64_t laps; // times a ring block wrapped around, its oldest event is at `size` if nonzero
+} mys_trace_block_t;
+
+typedef struct mys_trace_stream_t { // events of one type appended by one thread
+    mys_trace_block_t *head;
+    mys_trace_block_t *tail;
+} mys_trace_stream_t;
+
+typedef struct mys_trace_slot_t { // written by its owner thread only
+    mys_trace_stream_t streams[MYS_TRACE_EVENT4]; // streams[type - 1]
+    uint8_t _pad[MYS_TRACE_SLOT_ALIGN - MYS_TRACE_EVENT4 * sizeof(mys_trace_stream_t)];
+} mys_trace_slot_t;
+
+typedef struct mys_trace_cursor_t { // merge position in one stream
+    uint64_t tick;
+    mys_trace_block_t *block;
+    uint32_t index;
+    uint32_t remaining; // events left in block, including index
+    int type;
+    int tid;
+} mys_trace_cursor_t;
+
+typedef struct mys_trace_merge_t {
+    mys_trace_cursor_t *heap; // min-heap of cursors, ordered by (tick, tid, type)
+    int size;
+    int capacity;
+} mys_trace_merge_t;
 
 struct mys_trace_t {
-    struct mys_trace_e1block_t *e1block_head;
-    struct mys_trace_e1block_t *e1block_tail;
-    uint64_t e1_total_capacity;
-    uint64_t e1_total_size;
+    mys_trace_slot_t **slots; // slots[mys_thread_id()]
+    uint32_t nslots; // 1 + largest thread id with a slot
+    mys_mutex_t lock; // protects slot creation
+    uint64_t unslotted; // events dropped because the thread id is not below MYS_TRACE_MAX_THREADS
+    uint32_t nslots_created; // number of non-NULL slots
+    // Merge heaps of mys_trace_dump(), grown with the slots so that dumping never allocates.
+    // A heap is kept until destroy when a larger one replaces it, as a dump may still use it.
+    mys_trace_cursor_t *dump_heaps[MYS_TRACE_DUMP_HEAPS]; // dump_heaps[k] holds MYS_TRACE_DUMP_HEAP_MIN << k cursors
+    int dump_nheaps;
+    int dumping; // one dump at a time
+    uint64_t tick0; // mys_hrtick_raw() at creation
+    double time0; // mys_hrtime() at creation
+    double freq; // mys_hrfreq_raw()
+    uint32_t ring_capacity; // events per ring of a flight recorder, 0 for unbounded traces
     bool being_iter;
-    struct mys_trace_e1block_t *e1_iter_last_block;
-    uint32_t e1_iter_last_index;
+    mys_trace_merge_t merge; // state of mys_trace_start_iter()
+};
+
+// Tail of empty streams. Its size equals its capacity, so the first append takes the expanding path.
+static mys_trace_block_t _mys_trace_empty_block = { NULL, NULL, 0, 0, 0 };
+
+static const size_t _mys_trace_event_size[MYS_TRACE_EVENT4 + 1] = {
+    0,
+    sizeof(mys_trace_event1_t),
+    sizeof(mys_trace_event2_t),
+    sizeof(mys_trace_event3_t),
+    sizeof(mys_trace_event4_t),
 };
 
 typedef struct _mys_trace_G_t {
@@ -69,68 +126,84 @@ MYS_INTERNAL void mys_G_trace_fini()
     mys_mutex_unlock(&_mys_trace_G.lock);
 }
 
-MYS_STATIC mys_trace_e1block_t *_mys_expand_trace_block(mys_trace_t *trace)
+MYS_ATTR_NOINLINE
+MYS_STATIC mys_trace_block_t *_mys_expand_trace_block(mys_trace_t *trace, mys_trace_stream_t *stream, int type)
 {
-    AS_NE_PTR(trace, NULL);
-
-    mys_trace_e1block_t *block = trace->e1block_tail;
+    mys_trace_block_t *tail = stream->tail;
+    if (trace->ring_capacity != 0 && tail != &_mys_trace_empty_block) { // overwrite the oldest events
+        tail->size = 0;
+        tail->laps += 1;
+        return tail;
+    }
     uint32_t capacity =
-        (block == NULL || block->capacity == 0) ? 1024 :
-        (block->capacity < UINT32_MAX / 2) ? (block->capacity * 2) :
-        block->capacity;
+        (trace->ring_capacity != 0) ? trace->ring_capacity :
+        (tail->capacity == 0) ? MYS_TRACE_BLOCK_MIN :
+        (tail->capacity < UINT32_MAX / 2) ? (tail->capacity * 2) :
+        tail->capacity;
 
-    block = (mys_trace_e1block_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_e1block_t));
-    // DLOG(0, "Constructing block=%p cap=%u", block, capacity);
-    // DLOG(0, "    Allocating block=%p %zu", block, sizeof(mys_trace_e1block_t));
+    mys_trace_block_t *block = (mys_trace_block_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_block_t));
     if (block == NULL)
         return NULL;
-
+    block->next = NULL;
     block->capacity = capacity;
     block->size = 0;
-    block->events = (mys_trace_event1_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_event1_t) * capacity);
+    block->laps = 0;
+    block->events = mys_malloc2(MYS_ARENA_TRACE, _mys_trace_event_size[type] * capacity);
     if (block->events == NULL) {
-        mys_free2(MYS_ARENA_TRACE, block, sizeof(mys_trace_e1block_t));
+        mys_free2(MYS_ARENA_TRACE, block, sizeof(mys_trace_block_t));
         return NULL;
     }
-    // DLOG(0, "    Allocating block->events=%p %zu", block->events, sizeof(mys_trace_event1_t) * capacity);
-
-    mys_trace_e1block_t *e1block_tail = trace->e1block_tail;
-    // update self link
-    block->prev = trace->e1block_tail;
-    block->next = NULL;
-    // update tail link
-    if (e1block_tail != NULL) e1block_tail->next = block;
-    // update trace
-    trace->e1_total_capacity += capacity;
-    trace->e1block_tail = block;
-    if (trace->e1block_head == NULL) trace->e1block_head = block;
 
+    if (tail == &_mys_trace_empty_block)
+        stream->head = block;
+    else
+        tail->next = block;
+    stream->tail = block;
     return block;
 }
 
-MYS_STATIC void _mys_destroy_trace_block(mys_trace_t *trace, mys_trace_e1block_t **block)
+MYS_STATIC void _mys_destroy_trace_stream(mys_trace_stream_t *stream, int type)
 {
-    AS_NE_PTR(trace, NULL);
-
-    if (block == NULL || *block == NULL)
-        return;
-
-    mys_trace_e1block_t *prev = (*block)->prev;
-    mys_trace_e1block_t *next = (*block)->next;
-    // update prev and next link
-    if (prev != NULL) prev->next = next;
-    if (next != NULL) next->prev = prev;
-    // update trace
-    trace->e1_total_capacity -= (*block)->capacity;
-    trace->e1_total_size -= (*block)->size;
-    if (trace->e1block_head == *block) trace->e1block_head = next;
-    if (trace->e1block_tail == *block) trace->e1block_tail = prev;
+    mys_trace_block_t *block = stream->head;
+    while (block != &_mys_trace_empty_block && block != NULL) {
+        mys_trace_block_t *next = block->next;
+        mys_free2(MYS_ARENA_TRACE, block->events, _mys_trace_event_size[type] * block->capacity);
+        mys_free2(MYS_ARENA_TRACE, block, sizeof(mys_trace_block_t));
+        block = next;
+    }
+    stream->head = &_mys_trace_empty_block;
+    stream->tail = &_mys_trace_empty_block;
+}
 
-    // DLOG(0, "    Freeing block->event=%p %zu", (*block)->events, sizeof(mys_trace_event1_t) * (*block)->capacity);
-    mys_free2(MYS_ARENA_TRACE, (*block)->events, sizeof(mys_trace_event1_t) * (*block)->capacity);
-    // DLOG(0, "    Freeing block=%p %zu", (*block), sizeof(mys_trace_e1block_t));
-    mys_free2(MYS_ARENA_TRACE, (*block), sizeof(mys_trace_e1block_t));
-    *block = NULL;
+MYS_ATTR_NOINLINE
+MYS_STATIC mys_trace_slot_t *_mys_trace_create_slot(mys_trace_t *trace, uint32_t tid)
+{
+    if (tid >= MYS_TRACE_MAX_THREADS) { // thread ids are never reused, so such a thread never gets a slot
+        mys_atomic_fetch_add(&trace->unslotted, 1, MYS_ATOMIC_RELAXED);
+        return NULL;
+    }
+    mys_trace_slot_t *slot = (mys_trace_slot_t *)mys_aligned_alloc2(MYS_ARENA_TRACE, MYS_TRACE_SLOT_ALIGN, sizeof(mys_trace_slot_t));
+    if (slot == NULL)
+        return NULL;
+    for (int i = 0; i < MYS_TRACE_EVENT4; i++) {
+        slot->streams[i].head = &_mys_trace_empty_block;
+        slot->streams[i].tail = &_mys_trace_empty_block;
+    }
+    mys_mutex_lock(&trace->lock);
+    {
+        trace->nslots_created += 1;
+        int k = trace->dump_nheaps;
+        if (k < MYS_TRACE_DUMP_HEAPS && (k == 0 || (size_t)MYS_TRACE_EVENT4 * trace->nslots_created > ((size_t)MYS_TRACE_DUMP_HEAP_MIN << (k - 1)))) {
+            trace->dump_heaps[k] = (mys_trace_cursor_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_cursor_t) * (MYS_TRACE_DUMP_HEAP_MIN << k));
+            if (trace->dump_heaps[k] != NULL) // otherwise dumps skip the streams that do not fit
+                mys_atomic_store_n(&trace->dump_nheaps, k + 1, MYS_ATOMIC_RELEASE);
+        }
+        trace->slots[tid] = slot;
+        if (tid + 1 > trace->nslots)
+            trace->nslots = tid + 1;
+    }
+    mys_mutex_unlock(&trace->lock);
+    return slot;
 }
 
 MYS_PUBLIC mys_trace_t *mys_trace_create()
@@ -139,19 +212,26 @@ MYS_PUBLIC mys_trace_t *mys_trace_create()
     mys_trace_t *trace = (mys_trace_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_t));
     MYS_RETIF(trace == NULL, MYS_ENOMEM, NULL);
 
-    trace->e1block_head = NULL;
-    trace->e1block_tail = NULL;
-    trace->e1_total_capacity = 0;
-    trace->e1_total_size = 0;
+    trace->slots = (mys_trace_slot_t **)mys_calloc2(MYS_ARENA_TRACE, MYS_TRACE_MAX_THREADS, sizeof(mys_trace_slot_t *));
+    if (trace->slots == NULL) {
+        mys_free2(MYS_ARENA_TRACE, trace, sizeof(mys_trace_t));
+        MYS_RETIF(true, MYS_ENOMEM, NULL);
+    }
+    trace->nslots = 0;
+    mys_mutex_init(&trace->lock);
+    trace->unslotted = 0;
+    trace->nslots_created = 0;
+    memset(trace->dump_heaps, 0, sizeof(trace->dump_heaps));
+    trace->dump_nheaps = 0;
+    trace->dumping = 0;
+    trace->freq = (double)mys_hrfreq_raw();
+    trace->tick0 = mys_hrtick_raw();
+    trace->time0 = mys_hrtime();
+    trace->ring_capacity = 0;
     trace->being_iter = false;
-    // trace->e0_next_iter = 0;
-    trace->e1_iter_last_index = 0;
-    trace->e1_iter_last_block = NULL;
-    // trace->e2_next_iter = 0;
-    // trace->e3_next_iter = 0;
-    // trace->e4_next_iter = 0;
-    _mys_expand_trace_block(trace);
-
+    trace->merge.heap = NULL;
+    trace->merge.size = 0;
+    trace->merge.capacity = 0;
     return trace;
 }
 
@@ -159,38 +239,219 @@ MYS_PUBLIC void mys_trace_destroy(mys_trace_t **trace)
 {
     mys_G_trace_init();
     MYS_RETIF(trace == NULL || *trace == NULL, MYS_EINVAL);
-
-    mys_trace_e1block_t *block = (*trace)->e1block_head;
-    while (block != NULL) {
-        mys_trace_e1block_t *next = block->next;
-        // DLOG(0, "Destroying block=%p cap=%u", block, block->capacity);
-        _mys_destroy_trace_block(*trace, &block);
-        block = next;
+    AS_EQ_BOOL((*trace)->being_iter, false);
+
+    for (uint32_t tid = 0; tid < (*trace)->nslots; tid++) {
+        mys_trace_slot_t *slot = (*trace)->slots[tid];
+        if (slot == NULL)
+            continue;
+        for (int type = MYS_TRACE_EVENT1; type <= MYS_TRACE_EVENT4; type++)
+            _mys_destroy_trace_stream(&slot->streams[type - 1], type);
+        mys_free2(MYS_ARENA_TRACE, slot, sizeof(mys_trace_slot_t));
     }
+    for (int k = 0; k < (*trace)->dump_nheaps; k++)
+        mys_free2(MYS_ARENA_TRACE, (*trace)->dump_heaps[k], sizeof(mys_trace_cursor_t) * (MYS_TRACE_DUMP_HEAP_MIN << k));
+    mys_free2(MYS_ARENA_TRACE, (*trace)->slots, sizeof(mys_trace_slot_t *) * MYS_TRACE_MAX_THREADS);
     mys_free2(MYS_ARENA_TRACE, (*trace), sizeof(mys_trace_t));
+    *trace = NULL;
+}
+
+MYS_PUBLIC size_t mys_trace_size(mys_trace_t *trace)
+{
+    size_t size = 0;
+    for (uint32_t tid = 0; tid < trace->nslots; tid++) {
+        mys_trace_slot_t *slot = trace->slots[tid];
+        if (slot == NULL)
+            continue;
+        for (int i = 0; i < MYS_TRACE_EVENT4; i++) {
+            for (mys_trace_block_t *block = slot->streams[i].head; block != &_mys_trace_empty_block && block != NULL; block = block->next)
+                size += (block->laps != 0) ? block->capacity : block->size;
+        }
+    }
+    return size;
+}
+
+MYS_PUBLIC mys_trace_t *mys_trace_create_ring(size_t capacity)
+{
+    MYS_RETIF(capacity == 0 || capacity > UINT32_MAX / 2, MYS_EINVAL, NULL);
+    mys_trace_t *trace = mys_trace_create();
+    if (trace != NULL)
+        trace->ring_capacity = (uint32_t)capacity;
+    return trace;
+}
+
+MYS_PUBLIC size_t mys_trace_dropped(mys_trace_t *trace)
+{
+    size_t dropped = (size_t)mys_atomic_load_n(&trace->unslotted, MYS_ATOMIC_RELAXED);
+    for (uint32_t tid = 0; tid < trace->nslots; tid++) {
+        mys_trace_slot_t *slot = trace->slots[tid];
+        if (slot == NULL)
+            continue;
+        for (int i = 0; i < MYS_TRACE_EVENT4; i++) {
+            mys_trace_block_t *block = slot->streams[i].head;
+            if (block != &_mys_trace_empty_block && block->laps != 0)
+                dropped += (size_t)(block->laps - 1) * block->capacity + block->size;
+        }
+    }
+    return dropped;
+}
+
+/////////////////////////
+// Merge of per-thread streams
+/////////////////////////
+
+MYS_STATIC uint64_t _mys_trace_cursor_tick(const mys_trace_cursor_t *cursor)
+{
+    const uint8_t *event = (const uint8_t *)cursor->block->events + _mys_trace_event_size[cursor->type] * cursor->index;
+    return ((const mys_trace_event1_t *)event)->_tick; // the timestamp is the first field of all event types
 }
 
+MYS_STATIC bool _mys_trace_cursor_less(const mys_trace_cursor_t *a, const mys_trace_cursor_t *b)
+{
+    if (a->tick != b->tick)
+        return a->tick < b->tick;
+    if (a->tid != b->tid)
+        return a->tid < b->tid;
+    return a->type < b->type;
+}
+
+MYS_STATIC void _mys_trace_heap_sift_down(mys_trace_merge_t *merge, int i)
+{
+    mys_trace_cursor_t *heap = merge->heap;
+    int n = merge->size;
+    while (true) {
+        int l = 2 * i + 1;
+        int r = l + 1;
+        int min = i;
+        if (l < n && _mys_trace_cursor_less(&heap[l], &heap[min])) min = l;
+        if (r < n && _mys_trace_cursor_less(&heap[r], &heap[min])) min = r;
+        if (min == i)
+            break;
+        mys_trace_cursor_t tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+// Point the cursor at the oldest event of block, returns false if it has none
+MYS_STATIC bool _mys_trace_cursor_reset(mys_trace_cursor_t *cursor, mys_trace_block_t *block)
+{
+    cursor->block = block;
+    if (block == NULL || block == &_mys_trace_empty_block)
+        return false;
+    if (block->laps != 0) {
+        cursor->index = block->size % block->capacity;
+        cursor->remaining = block->capacity;
+    } else {
+        cursor->index = 0;
+        cursor->remaining = block->size;
+    }
+    if (cursor->remaining == 0)
+        return false;
+    cursor->tick = _mys_trace_cursor_tick(cursor);
+    return true;
+}
+
+// Fill the heap of merge (at most merge->capacity streams), returns false if the merge has no events
+MYS_STATIC bool _mys_trace_merge_fill(mys_trace_t *trace, mys_trace_merge_t *merge)
+{
+    merge->size = 0;
+    for (uint32_t tid = 0; tid < trace->nslots; tid++) {
+        mys_trace_slot_t *slot = trace->slots[tid];
+        if (slot == NULL)
+            continue;
+        for (int type = MYS_TRACE_EVENT1; type <= MYS_TRACE_EVENT4 && merge->size < merge->capacity; type++) {
+            mys_trace_cursor_t *cursor = &merge->heap[merge->size];
+            cursor->type = type;
+            cursor->tid = (int)tid;
+            if (_mys_trace_cursor_reset(cursor, slot->streams[type - 1].head))
+                merge->size += 1;
+        }
+    }
+    for (int i = merge->size / 2 - 1; i >= 0; i--)
+        _mys_trace_heap_sift_down(merge, i);
+    return merge->size != 0;
+}
+
+// Returns false if the merge has no events
+MYS_STATIC bool _mys_trace_merge_init(mys_trace_t *trace, mys_trace_merge_t *merge)
+{
+    merge->heap = NULL;
+    merge->size = 0;
+    merge->capacity = 0;
+    for (uint32_t tid = 0; tid < trace->nslots; tid++)
+        merge->capacity += (trace->slots[tid] != NULL) ? MYS_TRACE_EVENT4 : 0;
+    if (merge->capacity == 0)
+        return false;
+
+    merge->heap = (mys_trace_cursor_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_cursor_t) * merge->capacity);
+    if (merge->heap == NULL) {
+        merge->capacity = 0;
+        return false;
+    }
+    return _mys_trace_merge_fill(trace, merge);
+}
+
+// Move past the oldest event, returns false when all events are consumed
+MYS_STATIC bool _mys_trace_merge_next(mys_trace_merge_t *merge)
+{
+    mys_trace_cursor_t *top = &merge->heap[0];
+    top->remaining -= 1;
+    bool more = true;
+    if (top->remaining != 0) {
+        top->index = (top->index + 1 == top->block->capacity) ? 0 : top->index + 1;
+        top->tick = _mys_trace_cursor_tick(top);
+    } else {
+        more = _mys_trace_cursor_reset(top, top->block->next);
+    }
+    if (!more) { // stream exhausted
+        merge->size -= 1;
+        if (merge->size == 0)
+            return false;
+        merge->heap[0] = merge->heap[merge->size];
+    }
+    _mys_trace_heap_sift_down(merge, 0);
+    return true;
+}
+
+MYS_STATIC void _mys_trace_merge_fini(mys_trace_merge_t *merge)
+{
+    if (merge->heap != NULL)
+        mys_free2(MYS_ARENA_TRACE, merge->heap, sizeof(mys_trace_cursor_t) * merge->capacity);
+    merge->heap = NULL;
+    merge->size = 0;
+    merge->capacity = 0;
+}
+
+// Copy the oldest event of the merge into iter, with its time converted to seconds
+MYS_STATIC void _mys_trace_fill_iter(mys_trace_t *trace, mys_trace_merge_t *merge, mys_trace_iter_t *iter)
+{
+    mys_trace_cursor_t *top = &merge->heap[0];
+    const uint8_t *event = (const uint8_t *)top->block->events + _mys_trace_event_size[top->type] * top->index;
+    memcpy(&iter->_event, event, _mys_trace_event_size[top->type]);
+    iter->type = top->type;
+    iter->tid = top->tid;
+    iter->tick = top->tick;
+    iter->_event.time = trace->time0 + (double)(int64_t)(top->tick - trace->tick0) / trace->freq;
+    iter->e4 = &iter->_event;
+}
 
 MYS_PUBLIC mys_trace_iter_t *mys_trace_start_iter(mys_trace_t *trace)
 {
     AS_EQ_BOOL(trace->being_iter, false);
 
-    mys_trace_e1block_t *block = trace->e1block_head;
-    if (block == NULL || block->size == 0) {
+    if (!_mys_trace_merge_init(trace, &trace->merge)) {
+        _mys_trace_merge_fini(&trace->merge);
         return NULL;
     }
-
     mys_trace_iter_t *iter = (mys_trace_iter_t *)mys_malloc2(MYS_ARENA_TRACE, sizeof(mys_trace_iter_t));
     if (iter == NULL) {
+        _mys_trace_merge_fini(&trace->merge);
         return NULL;
     }
-
-    iter->type = MYS_TRACE_EVENT1;
-    iter->e1 = &block->events[0];
-
     trace->being_iter = true;
-    trace->e1_iter_last_block = block;
-    trace->e1_iter_last_index = 0;
+    _mys_trace_fill_iter(trace, &trace->merge, iter);
     return iter;
 }
 
@@ -199,36 +460,11 @@ MYS_PUBLIC mys_trace_iter_t *mys_trace_next_iter(mys_trace_t *trace, mys_trace_i
     MYS_RETIF(trace == NULL || iter == NULL, MYS_EINVAL, NULL);
     MYS_RETIF(trace->being_iter == false, MYS_EINVAL, NULL);
 
-    mys_trace_e1block_t *block = trace->e1_iter_last_block;
-    uint32_t index = trace->e1_iter_last_index + 1;
-    if (block == NULL) {
+    if (!_mys_trace_merge_next(&trace->merge)) {
         mys_trace_interrupt_iter(trace, iter);
         return NULL;
     }
-    if (index >= block->size) {
-        if (block->next == NULL) {
-            mys_trace_interrupt_iter(trace, iter);
-            return NULL;
-        } else {
-            block = block->next;
-            index = 0;
-            if (block == NULL) {
-                mys_trace_interrupt_iter(trace, iter);
-                return NULL;
-            }
-            if (index >= block->size) {
-                mys_trace_interrupt_iter(trace, iter);
-                return NULL;
-            }
-        }
-    }
-
-    iter->type = MYS_TRACE_EVENT1;
-    iter->e1 = &block->events[index];
-
-    trace->e1_iter_last_block = block;
-    trace->e1_iter_last_index = index;
-
+    _mys_trace_fill_iter(trace, &trace->merge, iter);
     return iter;
 }
 
@@ -237,31 +473,216 @@ MYS_PUBLIC void mys_trace_interrupt_iter(mys_trace_t *trace, mys_trace_iter_t *i
     if (trace == NULL || iter == NULL)
         return;
     trace->being_iter = false;
-    trace->e1_iter_last_block = NULL;
-    trace->e1_iter_last_index = 0;
+    _mys_trace_merge_fini(&trace->merge);
     mys_free2(MYS_ARENA_TRACE, iter, sizeof(mys_trace_iter_t));
 }
 
+MYS_PUBLIC int mys_trace_dump(mys_trace_t *trace, int fd, size_t max_events)
+{
+    MYS_RETIF(trace == NULL || fd < 0, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(mys_atomic_exchange_n(&trace->dumping, 1, MYS_ATOMIC_ACQUIRE) != 0, MYS_EBUSY, MYS_EBUSY);
+    char buffer[8192];
+    size_t len = 0;
+    ssize_t written = 0;
+    size_t total = mys_trace_size(trace);
+    size_t skip = (max_events != 0 && total > max_events) ? total - max_events : 0;
+
+    len += snprintf(buffer + len, sizeof(buffer) - len, "[mys_trace] %zu events (%zu dropped), showing the last %zu\n",
+        total, mys_trace_dropped(trace), total - skip);
+    // A separate merge state, so this also works from a signal handler that interrupted an iteration.
+    // Its heap was allocated along with the slots, so dumping does not call malloc.
+    mys_trace_merge_t merge;
+    mys_trace_iter_t iter;
+    memset(&iter, 0, sizeof(iter));
+    int nheaps = mys_atomic_load_n(&trace->dump_nheaps, MYS_ATOMIC_ACQUIRE);
+    merge.heap = (nheaps != 0) ? trace->dump_heaps[nheaps - 1] : NULL;
+    merge.capacity = (nheaps != 0) ? (MYS_TRACE_DUMP_HEAP_MIN << (nheaps - 1)) : 0;
+    bool more = _mys_trace_merge_fill(trace, &merge);
+    for (size_t i = 0; more; i++) {
+        if (i >= skip) {
+            _mys_trace_fill_iter(trace, &merge, &iter);
+            len += snprintf(buffer + len, sizeof(buffer) - len, "[mys_trace] %.9f tid=%d", iter.e1->time, iter.tid);
+            uint64_t words[MYS_TRACE_EVENT4] = { iter.e4->u1, iter.e4->u2, iter.e4->u3, iter.e4->u4 };
+            for (int w = 0; w < iter.type; w++)
+                len += snprintf(buffer + len, sizeof(buffer) - len, " 0x%" PRIx64, words[w]);
+            len += snprintf(buffer + len, sizeof(buffer) - len, "\n");
+            if (len > sizeof(buffer) - 256) {
+                written = write(fd, buffer, len);
+                len = 0;
+            }
+        }
+        more = _mys_trace_merge_next(&merge);
+    }
+    if (len != 0)
+        written = write(fd, buffer, len);
+    (void)written; // do nothing, just for Werror=unused-result
+    mys_atomic_store_n(&trace->dumping, 0, MYS_ATOMIC_RELEASE);
+    return 0;
+}
+
+/////////////////////////
+// Binary export
+/////////////////////////
+
+#define MYS_TRACE_FILE_MAGIC "MYSTRACE"
+#define MYS_TRACE_FILE_VERSION 1
+#define MYS_TRACE_FILE_BUFFER (1 << 20)
+#define MYS_TRACE_RECORD_MAX (1 + 10 + 10 + 8 * MYS_TRACE_EVENT4) // head, varint tid, varint dtick, payload
+
+// All fields are little-endian and naturally aligned, 192 bytes in total
+typedef struct mys_trace_file_header_t {
+    char magic[8]; // MYS_TRACE_FILE_MAGIC
+    uint32_t version;
+    int32_t rank;
+    int32_t nranks;
+    uint32_t flags; // 1: written by a flight recorder
+    uint64_t nevents;
+    uint64_t tick0; // time = time0 + (tick - tick0) / freq
+    double time0;
+    double freq;
+    char clock[64]; // mys_hrname(), the clock of `time0`
+    char counter[64]; // mys_hrname_raw(), the counter of ticks
+    uint64_t dropped;
+} mys_trace_file_header_t;
+
+MYS_STATIC size_t _mys_trace_put_varint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+MYS_STATIC bool _mys_trace_write_all(int fd, const void *buffer, size_t len)
+{
+    const uint8_t *ptr = (const uint8_t *)buffer;
+    while (len > 0) {
+        ssize_t n = write(fd, ptr, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+MYS_PUBLIC int mys_trace_export(mys_trace_t *trace, const char *file_format, ...)
+{
+    MYS_RETIF(trace == NULL || file_format == NULL, MYS_EINVAL, MYS_EINVAL);
+    MYS_RETIF(trace->being_iter, MYS_EBUSY, MYS_EBUSY);
+    char file[4096];
+    va_list args;
+    va_start(args, file_format);
+    vsnprintf(file, sizeof(file), file_format, args);
+    va_end(args);
+
+    mys_trace_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MYS_TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = MYS_TRACE_FILE_VERSION;
+    header.rank = 0;
+    header.nranks = 1;
+    int mpi_inited = 0;
+    mys_MPI_Initialized(&mpi_inited);
+    if (mpi_inited) {
+        mys_MPI_Comm_rank(mys_MPI_COMM_WORLD, &header.rank);
+        mys_MPI_Comm_size(mys_MPI_COMM_WORLD, &header.nranks);
+    }
+    header.flags = (trace->ring_capacity != 0) ? 1 : 0;
+    header.nevents = mys_trace_size(trace);
+    header.tick0 = trace->tick0;
+    header.time0 = trace->time0;
+    header.freq = trace->freq;
+    snprintf(header.clock, sizeof(header.clock), "%s", mys_hrname());
+    snprintf(header.counter, sizeof(header.counter), "%s", mys_hrname_raw());
+    header.dropped = mys_trace_dropped(trace);
+
+    uint8_t *buffer = (uint8_t *)mys_malloc2(MYS_ARENA_TRACE, MYS_TRACE_FILE_BUFFER);
+    MYS_RETIF(buffer == NULL, MYS_ENOMEM, MYS_ENOMEM);
+    mys_ensure_parent(file, 0777);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        mys_free2(MYS_ARENA_TRACE, buffer, MYS_TRACE_FILE_BUFFER);
+        MYS_RETIF(true, MYS_EIO, MYS_EIO);
+    }
+
+    // Records are written in time order, so the tick delta is never negative and usually takes 1~2 bytes.
+    // Record: head byte (type in bits 0~2, bit 3 set if tid follows), [varint tid], varint dtick, type * 8 bytes of words
+    bool ok = true;
+    size_t len = 0;
+    memcpy(buffer, &header, sizeof(header));
+    len += sizeof(header);
+    uint64_t last_tick = trace->tick0;
+    int last_tid = 0;
+    mys_trace_merge_t merge;
+    bool more = _mys_trace_merge_init(trace, &merge);
+    while (more && ok) {
+        mys_trace_cursor_t *top = &merge.heap[0];
+        const uint8_t *event = (const uint8_t *)top->block->events + _mys_trace_event_size[top->type] * top->index;
+        uint8_t *out = buffer + len;
+        bool tid_changed = (top->tid != last_tid);
+        *out++ = (uint8_t)(top->type | (tid_changed ? 0x8 : 0x0));
+        if (tid_changed)
+            out += _mys_trace_put_varint(out, (uint64_t)top->tid);
+        // Events older than the creation of the trace are impossible, but keep the file valid anyway
+        uint64_t tick = (top->tick > last_tick) ? top->tick : last_tick;
+        out += _mys_trace_put_varint(out, tick - last_tick);
+        memcpy(out, event + sizeof(uint64_t), sizeof(uint64_t) * top->type); // words follow the timestamp
+        out += sizeof(uint64_t) * top->type;
+        len = (size_t)(out - buffer);
+        last_tick = tick;
+        last_tid = top->tid;
+        if (len > MYS_TRACE_FILE_BUFFER - MYS_TRACE_RECORD_MAX) {
+            ok = _mys_trace_write_all(fd, buffer, len);
+            len = 0;
+        }
+        more = _mys_trace_merge_next(&merge);
+    }
+    _mys_trace_merge_fini(&merge);
+    if (ok && len != 0)
+        ok = _mys_trace_write_all(fd, buffer, len);
+    ok = (close(fd) == 0) && ok;
+    mys_free2(MYS_ARENA_TRACE, buffer, MYS_TRACE_FILE_BUFFER);
+    MYS_RETIF(!ok, MYS_EIO, MYS_EIO);
+    return 0;
+}
+
+/////////////////////////
+// Append
+/////////////////////////
+
+// Returns the next free event of `type` in the buffer of the calling thread, or NULL if out of memory.
 MYS_ATTR_OPTIMIZE_O3
 MYS_ATTR_ALWAYS_INLINE
-MYS_STATIC void _mys_trace_append1(mys_trace_t *trace, uint64_t data1)
+MYS_STATIC void *_mys_trace_reserve(mys_trace_t *trace, int type)
 {
     // mys_G_trace_init(); // cost 30ns~75 ns even in O3 optimization for opening it
     // ASX_EQ_BOOL(trace->being_iter, false, "Trace %p is being used for iteration", trace); // 20~50ns overhead
 
-    // This function is sensitive to latency. For O3 optimization, we get 215ns per op.
-    // The following helps to reduce latency:
-    // 1. Reduce the body size of "if (...)" statement by moving its logic to other function. Get 180ns per op.
-    // 2. Move "if (...)" to after all other code, got 100ns per op.
-
-    mys_trace_e1block_t *block = trace->e1block_tail;
-    block->events[block->size].u1 = data1;
-    block->events[block->size].time = mys_hrtime();
-    block->size += 1;
-    trace->e1_total_size += 1;
-    if (block->size == block->capacity) {
-        _mys_expand_trace_block(trace);
+    // This function is sensitive to latency. Keep the bodies of unlikely branches in other
+    // (non-inlined) functions, so that the fast path is a few loads and one compare.
+    uint32_t tid = mys_thread_id();
+    mys_trace_slot_t *slot = MYS_LIKELY(tid < MYS_TRACE_MAX_THREADS) ? trace->slots[tid] : NULL;
+    if (MYS_UNLIKELY(slot == NULL)) {
+        slot = _mys_trace_create_slot(trace, tid);
+        if (slot == NULL)
+            return NULL;
+    }
+    mys_trace_stream_t *stream = &slot->streams[type - 1];
+    mys_trace_block_t *block = stream->tail;
+    if (MYS_UNLIKELY(block->size == block->capacity)) {
+        block = _mys_expand_trace_block(trace, stream, type);
+        if (block == NULL)
+            return NULL;
     }
+    void *event = (uint8_t *)block->events + _mys_trace_event_size[type] * block->size;
+    block->size += 1;
+    return event;
 }
 
 union _mys_trace_num_t {
@@ -274,6 +695,17 @@ union _mys_trace_num_t {
     struct {        float l;        float h; } f32; // Do not change order of l and h
 };
 
+MYS_ATTR_OPTIMIZE_O3
+MYS_ATTR_ALWAYS_INLINE
+MYS_STATIC void _mys_trace_append1(mys_trace_t *trace, uint64_t data1)
+{
+    mys_trace_event1_t *event = (mys_trace_event1_t *)_mys_trace_reserve(trace, MYS_TRACE_EVENT1);
+    if (MYS_UNLIKELY(event == NULL))
+        return;
+    event->u1 = data1;
+    event->_tick = mys_hrtick_raw();
+}
+
 MYS_ATTR_OPTIMIZE_O3
 MYS_PUBLIC void mys_trace_1p(mys_trace_t *trace, void *data1)
 {
@@ -306,3 +738,38 @@ MYS_PUBLIC void mys_trace_1d(mys_trace_t *trace, double data1)
     _mys_trace_append1(trace, num.u64);
 }
 
+MYS_ATTR_OPTIMIZE_O3
+MYS_PUBLIC void mys_trace_2u(mys_trace_t *trace, uint64_t data1, uint64_t data2)
+{
+    mys_trace_event2_t *event = (mys_trace_event2_t *)_mys_trace_reserve(trace, MYS_TRACE_EVENT2);
+    if (MYS_UNLIKELY(event == NULL))
+        return;
+    event->u1 = data1;
+    event->u2 = data2;
+    event->_tick = mys_hrtick_raw();
+}
+
+MYS_ATTR_OPTIMIZE_O3
+MYS_PUBLIC void mys_trace_3u(mys_trace_t *trace, uint64_t data1, uint64_t data2, uint64_t data3)
+{
+    mys_trace_event3_t *event = (mys_trace_event3_t *)_mys_trace_reserve(trace, MYS_TRACE_EVENT3);
+    if (MYS_UNLIKELY(event == NULL))
+        return;
+    event->u1 = data1;
+    event->u2 = data2;
+    event->u3 = data3;
+    event->_tick = mys_hrtick_raw();
+}
+
+MYS_ATTR_OPTIMIZE_O3
+MYS_PUBLIC void mys_trace_4u(mys_trace_t *trace, uint64_t data1, uint64_t data2, uint64_t data3, uint64_t data4)
+{
+    mys_trace_event4_t *event = (mys_trace_event4_t *)_mys_trace_reserve(trace, MYS_TRACE_EVENT4);
+    if (MYS_UNLIKELY(event == NULL))
+        return;
+    event->u1 = data1;
+    event->u2 = data2;
+    event->u3 = data3;
+    event->u4 = data4;
+    event->_tick = mys_hrtick_raw();
+}
@@ -42,7 +42,7 @@ enum {
 #define TLOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define TLOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define TLOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define TLOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define TLOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_TRACE, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define TLOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_TRACE, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'DEBUG' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -50,7 +50,7 @@ enum {
 #define DLOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define DLOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define DLOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define DLOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define DLOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_DEBUG, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define DLOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'INFO' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -58,7 +58,7 @@ enum {
 #define ILOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define ILOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define ILOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define ILOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define ILOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_INFO, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define ILOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'WARN' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -66,7 +66,7 @@ enum {
 #define WLOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define WLOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define WLOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define WLOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define WLOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_WARN, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define WLOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'ERROR' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -74,7 +74,7 @@ enum {
 #define ELOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define ELOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define ELOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define ELOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define ELOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_ERROR, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define ELOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'FATAL' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -82,7 +82,7 @@ enum {
 #define FLOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define FLOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define FLOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define FLOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define FLOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_FATAL, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define FLOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_FATAL, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 /**
  * Print log message with 'RAW' level (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
@@ -90,7 +90,7 @@ enum {
 #define RLOG(rank, fmt, ...)      mys_log_rank(MYS_LOGGER_G, (rank), MYS_LOG_RAW, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define RLOG_WHEN(when, fmt, ...) mys_log_when(MYS_LOGGER_G, (when), MYS_LOG_RAW, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define RLOG_SELF(fmt, ...)       mys_log_self(MYS_LOGGER_G, MYS_LOG_RAW, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define RLOG_ONCE(fmt, ...)       mys_log_once(MYS_LOGGER_G, MYS_LOG_RAW, __FILE__, __LINE__, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
+#define RLOG_ONCE(fmt, ...)       MYS_LOG_ONCE(MYS_LOGGER_G, MYS_LOG_RAW, fmt, ##__VA_ARGS__) // once (__FILE__, __LINE__)
 #define RLOG_ORDERED(fmt, ...)    mys_log_ordered(MYS_LOGGER_G, MYS_LOG_RAW, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
 
 
@@ -117,6 +117,54 @@ MYS_PUBLIC void mys_log_destroy(mys_log_t **logger);
 MYS_PUBLIC const char *mys_log_get_name(mys_log_t *logger);
 
 MYS_ATTR_PRINTF(6, 7) MYS_PUBLIC void mys_log_rank(mys_log_t *logger, int rank, int level, const char *file, int line, const char *fmt, ...);
+/**
+ * Log with deferred formatting (TRACE, DEBUG, INFO, WARN, ERROR, FATAL, RAW)
+ *
+ * In async mode (see `mys_log_set_async()`), the logging thread only copies the raw arguments
+ * (and the bytes of %s strings) into its queue, and the background thread formats them. The format
+ * must be a string literal. Without async mode they are the same as TLOG(), DLOG(), ... (rank, ...)
+ */
+#define TLOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_TRACE, fmt, ##__VA_ARGS__)
+#define DLOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define ILOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_INFO, fmt, ##__VA_ARGS__)
+#define WLOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_WARN, fmt, ##__VA_ARGS__)
+#define ELOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define FLOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_FATAL, fmt, ##__VA_ARGS__)
+#define RLOG_DEFER(rank, fmt, ...) MYS_LOG_DEFER(MYS_LOGGER_G, (rank), MYS_LOG_RAW, fmt, ##__VA_ARGS__)
+
+#define MYS_LOG_DEFER(logger, rank, level, fmt, ...) do {                                  \
+    static mys_log_site_t _mys_log_site = MYS_LOG_SITE_INITIALIZER((level), fmt);        \
+    if (0) printf(fmt, ##__VA_ARGS__); /* let the compiler check arguments against fmt */ \
+    mys_log_deferred((logger), &_mys_log_site, (rank), ##__VA_ARGS__);                    \
+} while (0)
+
+#define MYS_LOG_SITE_MAX_ARGS 32
+// A call site of MYS_LOG_DEFER(). Its address identifies the site, the format is parsed at first use.
+typedef struct mys_log_site_t {
+    const char *file;
+    int line;
+    int level;
+    const char *fmt;
+    int state; // internal use: 0 not parsed, 1 being parsed, 2 deferrable, 3 formatted by the logging thread
+    int nargs; // internal use
+    int fixed_size; // internal use, bytes of arguments other than strings
+    uint8_t kinds[MYS_LOG_SITE_MAX_ARGS]; // internal use
+    uint16_t precisions[MYS_LOG_SITE_MAX_ARGS]; // internal use, of "%s" arguments
+} mys_log_site_t;
+#define MYS_LOG_SITE_INITIALIZER(level, fmt) { __FILE__, __LINE__, (level), (fmt), 0, 0, 0, { 0 }, { 0 } }
+
+MYS_PUBLIC void mys_log_deferred(mys_log_t *logger, mys_log_site_t *site, int rank, ...);
+
+// Log only the first time this call site is reached. Once fired, a call is one relaxed load of a static flag.
+#define MYS_LOG_ONCE(logger, level, fmt, ...) do {                                                          \
+    static int _mys_log_once_fired = 0;                                                                     \
+    if (MYS_UNLIKELY(mys_atomic_load_n(&_mys_log_once_fired, MYS_ATOMIC_RELAXED) == 0))                     \
+        mys_log_once_site((logger), &_mys_log_once_fired, (level), __FILE__, __LINE__, fmt, ##__VA_ARGS__); \
+} while (0)
+
+// The first caller that sets *fired from 0 to 1 logs, others return. Used by MYS_LOG_ONCE().
+MYS_ATTR_PRINTF(6, 7) MYS_PUBLIC void mys_log_once_site(mys_log_t *logger, int *fired, int level, const char *file, int line, const char *fmt, ...);
+
 MYS_ATTR_PRINTF(6, 7) MYS_PUBLIC void mys_log_when(mys_log_t *logger, int when, int level, const char *file, int line, const char *fmt, ...);
 MYS_ATTR_PRINTF(5, 6) MYS_PUBLIC void mys_log_self(mys_log_t *logger, int level, const char *file, int line, const char *fmt, ...);
 MYS_ATTR_PRINTF(5, 6) MYS_PUBLIC void mys_log_once(mys_log_t *logger, int level, const char *file, int line, const char *fmt, ...);
@@ -127,6 +175,14 @@ MYS_PUBLIC void mys_log_when_v(mys_log_t *logger, int when, int level, const cha
 MYS_PUBLIC void mys_log_self_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs);
 MYS_PUBLIC void mys_log_once_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs);
 MYS_PUBLIC void mys_log_ordered_v(mys_log_t *logger, int level, const char *file, int line, const char *fmt, va_list vargs);
+/**
+ * @brief Batch ordered logging: messages of mys_log_ordered() are kept until mys_log_ordered_batch_end()
+ *        prints all of them with one collective, rank by rank (all messages of rank 0 first).
+ *
+ * @note mys_log_ordered_batch_begin() is local, mys_log_ordered_batch_end() is collective on the comm of the logger.
+ */
+MYS_PUBLIC void mys_log_ordered_batch_begin(mys_log_t *logger);
+MYS_PUBLIC void mys_log_ordered_batch_end(mys_log_t *logger);
 
 MYS_PUBLIC int mys_log_add_handler(mys_log_t *logger, mys_log_handler_fn handler_fn, void *handler_udata);
 MYS_PUBLIC void mys_log_remove_handler(mys_log_t *logger, int handler_id);
@@ -142,6 +198,31 @@ MYS_PUBLIC int mys_log_get_level(mys_log_t *logger);
 MYS_PUBLIC const char* mys_log_level_string(int level);
 MYS_PUBLIC void mys_log_silent(mys_log_t *logger, bool silent);
 
+enum {
+    MYS_LOG_ASYNC_DROP,  // drop new records when the queue of a thread is full
+    MYS_LOG_ASYNC_BLOCK, // wait (and help draining) when the queue of a thread is full
+};
+/**
+ * @brief Move handler calls of a logger to a background thread.
+ *
+ * Each logging thread formats its message into its own queue of `depth` preallocated records
+ * (at most 471 characters each, longer messages are truncated) without taking the logger lock.
+ * A background thread passes the records to the handlers in time order. Handlers are never
+ * called concurrently, as in synchronous mode.
+ *
+ * @param logger The logger. No other thread may log through it during this call.
+ * @param depth Records per thread, rounded up to a power of two. 0 flushes and goes back to synchronous mode.
+ * @param policy MYS_LOG_ASYNC_DROP or MYS_LOG_ASYNC_BLOCK, what to do when a queue is full.
+ * @param flush_level Records of this level or above are flushed before the logging call returns,
+ *                    e.g., MYS_LOG_FATAL so that the message of a failed assertion is printed before abort.
+ * @return 0 on success, or `MYS_EINVAL`, `MYS_ENOMEM`, `MYS_EAGAIN`.
+ *
+ * @note Queued records are flushed at exit, by `mys_log_flush()`, and before `mys_log_ordered()`.
+ */
+MYS_PUBLIC int mys_log_set_async(mys_log_t *logger, size_t depth, int policy, int flush_level);
+MYS_PUBLIC void mys_log_flush(mys_log_t *logger); // pass all queued records of an async logger to its handlers
+MYS_PUBLIC size_t mys_log_dropped(mys_log_t *logger); // number of records dropped by MYS_LOG_ASYNC_DROP
+
 // [I::000 ex01.hello-gcc.c:012] Test ILOG function
 MYS_PUBLIC void mys_log_stdio_handler1(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata);
 // <mys_predefined_logger::000 ex01.hello-gcc.c:012> Test ILOG function
@@ -1,11 +1,11 @@
 /* 
  * Copyright (c) 2025 Haopeng Huang - All Rights Reserved
- * 
+ *
  * Licensed under the MIT License. You may use, distribute,
  * and modify this code under the terms of the MIT license.
  * You should have received a copy of the MIT license along
  * with this file. If not, see:
- * 
+ *
  * https://opensource.org/licenses/MIT
  */
 #pragma once
@@ -24,7 +24,9 @@
 
 #include "_config.h"
 #include "macro.h"
+#include "mpistubs.h"
 
+// mys_arena_sync(arena);
 // if (arena->alive != 0) {
 //     WLOG_SELF("Memory leaked happened in %s size %zu.", arena->name, arena->alive);
 //     mys_arena_print_leaked(arena, 10);
@@ -32,9 +34,23 @@
 
 typedef struct mys_arena_debugger_t mys_arena_debugger_t;
 
+#define MYS_ARENA_BACKEND_LIBC 0 // Forward to libc malloc/free (default)
+#define MYS_ARENA_BACKEND_SLAB 1 // Size-classed slabs carved from large mmap'd regions, cached per thread
+#define MYS_ARENA_BACKEND_REGION 2 // Pointer-bump allocation with mark/rewind/reset
+
+#define MYS_ARENA_NUMA_DEFAULT 0 // Follow the policy of the calling thread
+#define MYS_ARENA_NUMA_FIRST_TOUCH 1 // Pages land on the node of the thread that first writes them
+#define MYS_ARENA_NUMA_INTERLEAVE 2 // Pages are spread round-robin over all allowed nodes
+#define MYS_ARENA_NUMA_BIND 3 // Pages are bound to a single node
+
+#define MYS_ARENA_PAGE_DEFAULT 0 // Base pages
+#define MYS_ARENA_PAGE_THP 1 // Transparent huge pages (madvise)
+#define MYS_ARENA_PAGE_HUGETLB 2 // 2MB hugetlbfs pages, fall back to THP if none are reserved
+
+// peak/alive/freed/total are snapshots, call mys_arena_sync() before reading them
 typedef struct mys_arena_t {
     char name[32];
-    size_t peak;  // memory bytes that peak alive
+    size_t peak;  // memory bytes that peak alive (estimated, see mys_arena_sync())
     size_t alive; // memory bytes that being used
     size_t freed; // memory bytes that freed
     size_t total; // memory bytes that total allocated
@@ -44,9 +60,20 @@ typedef struct mys_arena_t {
     size_t _total_count; // internal use
     size_t _alive_count; // internal use
     size_t _freed_count; // internal use
+    int _backend; // internal use
+    void *_backend_state; // internal use
+    void *_stats; // internal use
+    void *_sampler; // internal use
+    void *_policy; // internal use
 } mys_arena_t;
 
-#define MYS_ARENA_INITIALIZER(name) { /*name=*/name, /*peak=*/0, /*alive=*/0, /*freed=*/0, /*total=*/0, /*_registered=*/false, /*_enable_debug*/false, /*_debug_trace*/NULL, /*_total_count*/0, /*_alive_count*/0, /*_freed_count*/0 }
+typedef struct mys_arena_mark_t {
+    void *_chunk; // internal use
+    size_t _used; // internal use
+    size_t _alive; // internal use
+} mys_arena_mark_t;
+
+#define MYS_ARENA_INITIALIZER(name) { /*name=*/name, /*peak=*/0, /*alive=*/0, /*freed=*/0, /*total=*/0, /*_registered=*/false, /*_enable_debug*/false, /*_debug_trace*/NULL, /*_total_count*/0, /*_alive_count*/0, /*_freed_count*/0, /*_backend*/MYS_ARENA_BACKEND_LIBC, /*_backend_state*/NULL, /*_stats*/NULL, /*_sampler*/NULL, /*_policy*/NULL }
 
 MYS_PUBVAR mys_arena_t mys_predefined_arena_log;
 MYS_PUBVAR mys_arena_t mys_predefined_arena_pool;
@@ -77,10 +104,97 @@ MYS_PUBVAR mys_arena_t mys_predefined_arena_user;
  *
  * @param name The name of the new memory arena.
  * @return A pointer to the newly created memory arena, or NULL if creation fails.
- * 
- * @note Normally, you may want to check `ASX_EQ_SIZET(arena->alive, 0, "Internal error: memory leaked happened in %s.", arena->name);`
+ *
+ * @note Normally, you may want to call `mys_arena_sync(arena)` and then check
+ *       `ASX_EQ_SIZET(arena->alive, 0, "Internal error: memory leaked happened in %s.", arena->name);`
  */
 MYS_PUBLIC mys_arena_t *mys_arena_create(const char *name);
+/**
+ * @brief Create a new memory arena that owns its memory with size-classed slabs.
+ *
+ * Requests up to 32 KiB are served from per-size-class free lists carved from large mmap'd regions.
+ * `mys_free2()` maps its size argument to the size class directly, so no header lookup is needed.
+ * Larger requests are forwarded to libc. The memory of slabs is returned to OS when the arena is destroyed.
+ *
+ * @param name The name of the new memory arena.
+ * @return A pointer to the newly created memory arena, or NULL if creation fails.
+ *
+ * @note The size passed to `mys_free2()` and `mys_realloc2()` must be exactly the allocated size.
+ */
+MYS_PUBLIC mys_arena_t *mys_arena_create_slab(const char *name);
+/**
+ * @brief Change the allocation backend of an arena that has no alive allocation.
+ *
+ * This is mainly for predefined arenas, e.g., `mys_arena_set_backend(MYS_ARENA_STR, MYS_ARENA_BACKEND_SLAB)`
+ * at the beginning of program makes mys_string allocate from slabs.
+ *
+ * @param arena The memory arena.
+ * @param backend `MYS_ARENA_BACKEND_LIBC` or `MYS_ARENA_BACKEND_SLAB`.
+ * @return 0 on success, or `MYS_EBUSY` if the arena still has alive memory.
+ */
+MYS_PUBLIC int mys_arena_set_backend(mys_arena_t *arena, int backend);
+/**
+ * @brief Set NUMA placement and page size of large allocations of an arena.
+ *
+ * Allocations of at least 64KB get their own anonymous mapping with the requested policy, smaller
+ * ones are served by the backend as usual. Pages are placed when first written, so initialize
+ * FIRST_TOUCH memory with the same threads (and schedule) that will compute on it.
+ *
+ * @param arena The memory arena, must not be a region arena.
+ * @param numa One of `MYS_ARENA_NUMA_*`.
+ * @param node The NUMA node for `MYS_ARENA_NUMA_BIND`, ignored otherwise.
+ * @param pages One of `MYS_ARENA_PAGE_*`.
+ * @return 0 on success, `MYS_EBUSY` if the arena still has alive memory, or `MYS_EINVAL` on
+ *         invalid arguments (or on platforms other than Linux).
+ *
+ * @note Binding is best effort: if the kernel refuses mbind (e.g., in containers), pages follow
+ *       the default policy.
+ */
+MYS_PUBLIC int mys_arena_set_policy(mys_arena_t *arena, int numa, int node, int pages);
+/**
+ * @brief Create a new region arena for short-lived scratch memory.
+ *
+ * Memory is allocated by bumping a pointer inside chunks of `chunk_bytes` bytes (oversized requests get
+ * a dedicated chunk). `mys_free2()` only updates accounting unless it frees the most recent allocation.
+ * Use `mys_arena_mark()`/`mys_arena_rewind()` or `mys_arena_reset()` to release memory in O(1).
+ *
+ * @param name The name of the new memory arena.
+ * @param chunk_bytes Size of each chunk requested from libc.
+ * @return A pointer to the newly created memory arena, or NULL if creation fails.
+ *
+ * @note The bump pointer and chunk list are not locked, so a region arena must be used by one thread
+ *       at a time (allocations, frees, marks, rewinds and resets alike).
+ * @note `mys_free2()` of an object is only accounted until the next `mys_arena_rewind()` or
+ *       `mys_arena_reset()` that releases it. Once released, do not free it again, or it is
+ *       counted as freed twice.
+ */
+MYS_PUBLIC mys_arena_t *mys_arena_create_region(const char *name, size_t chunk_bytes);
+/**
+ * @brief Remember current position of a region arena.
+ *
+ * @param arena A region arena created by `mys_arena_create_region()`.
+ * @return The mark to be passed to `mys_arena_rewind()`.
+ */
+MYS_PUBLIC mys_arena_mark_t mys_arena_mark(mys_arena_t *arena);
+/**
+ * @brief Release all memory allocated from a region arena after `mark`.
+ *
+ * Alive bytes of the arena go back to the value at `mark`, and the released bytes are recorded as freed.
+ * Marks taken after `mark` become invalid.
+ *
+ * @param arena A region arena created by `mys_arena_create_region()`.
+ * @param mark A mark returned by `mys_arena_mark()`.
+ *
+ * @note Objects allocated before `mark` should not be freed before rewinding, or the accounting of
+ *       this rewind will be short by their sizes (until the next `mys_arena_reset()`).
+ */
+MYS_PUBLIC void mys_arena_rewind(mys_arena_t *arena, mys_arena_mark_t mark);
+/**
+ * @brief Release all memory allocated from a region arena. Chunks are kept for reuse.
+ *
+ * @param arena A region arena created by `mys_arena_create_region()`.
+ */
+MYS_PUBLIC void mys_arena_reset(mys_arena_t *arena);
 /**
  * @brief Destroy a memory arena and free its resources.
  *
@@ -91,7 +205,48 @@ MYS_PUBLIC mys_arena_t *mys_arena_create(const char *name);
  */
 MYS_PUBLIC void mys_arena_destroy(mys_arena_t **arena);
 MYS_PUBLIC void mys_arena_set_debug(mys_arena_t *arena, bool val);
+/**
+ * @brief Track only a sample of allocations when debug mode is on.
+ *
+ * Allocated bytes are sampled as a Poisson process: on average one allocation is recorded (with its
+ * backtrace) every `sample_bytes` bytes, so larger allocations are more likely to be recorded. Each
+ * record is weighted by the inverse of its sampling probability, and leak reports show the scaled
+ * estimates. Unsampled allocations and frees only cost a few counter updates.
+ *
+ * Once called, debug records of the arena are also protected by a lock, so debug mode can be used
+ * from multiple threads. The rate can be changed at any time.
+ *
+ * @param arena The memory arena.
+ * @param sample_bytes Mean bytes between two samples. 0 records every allocation.
+ *
+ * @note Size mismatches between `mys_malloc2()` and `mys_free2()` are only detected on sampled pointers.
+ */
+MYS_PUBLIC void mys_arena_set_debug_sampling(mys_arena_t *arena, size_t sample_bytes);
+/**
+ * @brief Estimate pointers and bytes that are alive from debug records, scaled by sampling weights.
+ *
+ * @param arena The memory arena in debug mode.
+ * @param count Output estimated number of alive pointers, can be NULL.
+ * @param bytes Output estimated alive bytes, can be NULL.
+ */
+MYS_PUBLIC void mys_arena_debug_estimate(mys_arena_t *arena, size_t *count, size_t *bytes);
 MYS_PUBLIC void mys_arena_print_leaked(mys_arena_t *arena, size_t max_print);
+/**
+ * @brief Refresh statistic fields of a memory arena.
+ *
+ * Allocations and frees only update per-thread shards of the arena with relaxed atomics, so that
+ * threads do not contend on the same cache line. This function sums up the shards into `alive`,
+ * `freed`, `total` and the debug counters. It is safe to call while other threads are allocating,
+ * but the result is only exact once they have stopped.
+ *
+ * `peak` is an estimate, not the exact peak. Each thread folds its alive delta into a shared counter
+ * only after it moved by 64 KiB, so `peak` may differ from the real peak by up to 64 KiB per thread
+ * (at most 65 shards), and spikes smaller than that between two folds are not seen at all.
+ * Each call raises `peak` to the exact `alive` it computes.
+ *
+ * @param arena The memory arena to refresh.
+ */
+MYS_PUBLIC void mys_arena_sync(mys_arena_t *arena);
 /**
  * @brief Find the next leaked memory arena after a given pivot.
  *
@@ -132,6 +287,59 @@ typedef struct mys_shm_t {
 
 MYS_PUBLIC mys_shm_t mys_alloc_shared_memory(int owner_rank, size_t size);
 MYS_PUBLIC void mys_free_shared_memory(mys_shm_t *shm);
+
+/*
+    Node-shared arena: one shared memory segment per node, sub-allocated by every rank on it.
+    Use it to keep one copy of read-only data (matrices, lookup tables) per node instead of per rank:
+
+    mys_shm_arena_t *shm = mys_shm_arena_create(MPI_COMM_WORLD, 1024 * 1024 * 1024);
+    double *table = (double *)mys_shm_arena_alloc_shared(shm, n * sizeof(double));
+    if (node_myrank == 0)
+        fill(table, n);
+    MPI_Barrier(node_comm);
+    ... // all ranks of the node read table
+    mys_shm_arena_free_shared(shm, table);
+    mys_shm_arena_destroy(&shm);
+*/
+typedef struct mys_shm_arena_t mys_shm_arena_t;
+/**
+ * @brief Create a node-shared arena (collective over `comm`).
+ *
+ * @param comm The communicator, ranks are grouped by node with `mys_commgroup_create_node()`.
+ * @param capacity Usable bytes of the segment on each node (taken from the node's first rank).
+ * @return The arena, or NULL on all ranks of a node if the segment could not be created or mapped.
+ */
+MYS_PUBLIC mys_shm_arena_t *mys_shm_arena_create(mys_MPI_Comm comm, size_t capacity);
+/**
+ * @brief Unmap the segment and free the arena (collective over `comm` of creation).
+ */
+MYS_PUBLIC void mys_shm_arena_destroy(mys_shm_arena_t **arena);
+/**
+ * @brief Allocate memory from the node segment (independent, any rank).
+ *
+ * The memory is 64-byte aligned and visible to all ranks of the node, at different addresses.
+ * Pass `mys_shm_arena_offset()` to other ranks to let them find it.
+ *
+ * @return The memory, or NULL if the segment is exhausted.
+ */
+MYS_PUBLIC void *mys_shm_arena_alloc(mys_shm_arena_t *arena, size_t size);
+/**
+ * @brief Free memory from `mys_shm_arena_alloc()` (independent, any rank of the node).
+ */
+MYS_PUBLIC void mys_shm_arena_free(mys_shm_arena_t *arena, void *ptr);
+/**
+ * @brief Allocate one block for the whole node (collective over the node).
+ *
+ * @return The block mapped in the calling rank, or NULL on all ranks of the node if exhausted.
+ */
+MYS_PUBLIC void *mys_shm_arena_alloc_shared(mys_shm_arena_t *arena, size_t size);
+/**
+ * @brief Free a block from `mys_shm_arena_alloc_shared()` (collective over the node).
+ */
+MYS_PUBLIC void mys_shm_arena_free_shared(mys_shm_arena_t *arena, void *ptr);
+MYS_PUBLIC size_t mys_shm_arena_offset(mys_shm_arena_t *arena, const void *ptr); // rank-independent handle of ptr
+MYS_PUBLIC void *mys_shm_arena_ptr(mys_shm_arena_t *arena, size_t offset); // ptr of a handle in the calling rank
+MYS_PUBLIC void mys_shm_arena_usage(mys_shm_arena_t *arena, size_t *alive, size_t *peak); // bytes of the node, including block headers
 #endif
 
 
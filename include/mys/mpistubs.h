@@ -136,6 +136,7 @@ MYS_PUBLIC int mys_MPI_Waitall(int count, mys_MPI_Request *array_of_requests, my
 MYS_PUBLIC int mys_MPI_Barrier(mys_MPI_Comm comm);
 MYS_PUBLIC int mys_MPI_Bcast(void *buffer, int count, mys_MPI_Datatype datatype, int root, mys_MPI_Comm comm);
 MYS_PUBLIC int mys_MPI_Gather(void *sendbuf, int sendcount, mys_MPI_Datatype sendtype, void *recvbuf, int recvcount, mys_MPI_Datatype recvtype, int root, mys_MPI_Comm comm);
+MYS_PUBLIC int mys_MPI_Gatherv(void *sendbuf, int sendcount, mys_MPI_Datatype sendtype, void *recvbuf, const int *recvcounts, const int *displs, mys_MPI_Datatype recvtype, int root, mys_MPI_Comm comm);
 MYS_PUBLIC int mys_MPI_Allreduce(void *sendbuf, void *recvbuf, int count, mys_MPI_Datatype datatype, mys_MPI_Op op, mys_MPI_Comm comm);
 MYS_PUBLIC int mys_MPI_Allgather(void *sendbuf, int sendcount, mys_MPI_Datatype sendtype, void *recvbuf, int recvcount, mys_MPI_Datatype recvtype, mys_MPI_Comm comm);
 MYS_PUBLIC int mys_MPI_Probe(int source, int tag, mys_MPI_Comm comm, mys_MPI_Status *status);
@@ -27,6 +27,8 @@ typedef struct mys_pool_t mys_pool_t;
 #define MYS_POOL_ALIGN_TO_CACHELINE (1u << 1) // Align each object to cache line (at least 128 bytes)
 #define MYS_POOL_ALIGN_TO_PAGE (1u << 2) // Align each object to page (at leat 4096 bytes)
 #define MYS_POOL_FIXED_SIZE (1u << 3) // Fixed-size pool
+#define MYS_POOL_CONCURRENT (1u << 4) // Thread-safe pool with per-thread magazine caches
+#define MYS_POOL_INTRUSIVE (1u << 5) // No per-object meta: blocks are power-of-two aligned regions and free list is stored in free objects
 
 /**
  * @brief Creates an object pool with a specified object size.
@@ -63,6 +65,9 @@ MYS_PUBLIC void mys_pool_destroy(mys_pool_t **pool);
  * This function retrieves an object from the pool.
  * If the pool is empty, it allocates memory regions for new objects.
  * The pool size is dynamic by default unless the MYS_POOL_FIXED_SIZE strategy is used.
+ * With MYS_POOL_CONCURRENT, objects are taken from a per-thread magazine without locking,
+ * and the magazine is refilled from the shared blocks in batches.
+ * The magazine of a thread is flushed back to the shared blocks when the thread exits.
  * 
  * @param pool A pointer to the object pool.
  * @return A pointer to the acquired object, or NULL if the operation fails.
@@ -73,10 +78,41 @@ MYS_PUBLIC void *mys_pool_acquire(mys_pool_t *pool);
  * @brief Releases an object back to the object pool.
  *
  * This function returns an object to the pool, making it available for future acquisitions.
- * It may deallocate memory regions containing unused objects to reduce the internal size of the pool.
+ * It may deallocate memory regions containing unused objects to reduce the internal size of the pool,
+ * but the last region with free objects is kept for the next acquisitions.
  * The pool size is dynamic by default unless the MYS_POOL_FIXED_SIZE strategy is used.
+ * With MYS_POOL_CONCURRENT, an object may be released by a thread other than the one acquired it.
+ * It goes into the magazine of releasing thread and is spilled back to shared blocks in batches.
  * 
  * @param pool A pointer to the object pool.
  * @param object A pointer to the object to be released.
  */
 MYS_PUBLIC void mys_pool_release(mys_pool_t *pool, void *object);
+
+/**
+ * @brief Acquires `n` objects from the object pool in one call.
+ *
+ * Objects are detached from the free list of each block as a whole chain, and a block is moved
+ * between the free and full lists at most once per call. With MYS_POOL_CONCURRENT the pool lock
+ * is taken at most once. It is faster than calling `mys_pool_acquire()` `n` times, though the cost
+ * per object is still linear.
+ * 
+ * @param pool A pointer to the object pool.
+ * @param out Array of at least `n` pointers that receives the acquired objects.
+ * @param n Number of objects to acquire.
+ * @return Number of objects actually acquired. Less than `n` only if memory is exhausted.
+ */
+MYS_PUBLIC size_t mys_pool_acquire_n(mys_pool_t *pool, void **out, size_t n);
+
+/**
+ * @brief Releases `n` objects back to the object pool in one call.
+ *
+ * Objects are chained per block and each chain is spliced back at once, so a block updates
+ * the block lists once per call as long as objects of at most four blocks are interleaved.
+ * Each object is still linked one by one.
+ * 
+ * @param pool A pointer to the object pool.
+ * @param objs Array of `n` objects to be released.
+ * @param n Number of objects to release.
+ */
+MYS_PUBLIC void mys_pool_release_n(mys_pool_t *pool, void **objs, size_t n);
@@ -20,6 +20,8 @@
 
 #include "_config.h"
 #include "macro.h"
+#include "mpistubs.h"
+#include "log.h"
 
 /**
  * Print log message separately to a file named 'rank:6d.log' within the folder, like to folder/000001.log
@@ -37,3 +39,40 @@ RANKLOG_CLOSE("LOG.test");
 MYS_PUBLIC void mys_ranklog_open_old(const char *callfile, int callline, const char *folder);
 MYS_PUBLIC void mys_ranklog_close_old(const char *callfile, int callline, const char *folder);
 MYS_ATTR_PRINTF(4, 5) MYS_PUBLIC void mys_ranklog_old(const char *callfile, int callline, const char *folder, const char *fmt, ...);
+
+/**
+ * @brief Per-rank log file sink for mys_log_t, with buffered writes and size-based rotation
+ *
+ * Ranks of the same node share a directory, so that no directory holds thousands of files:
+ *   folder/node.000000/rank.000000.log, folder/node.000000/rank.000001.log, ..., folder/node.000001/...
+ * Lines are formatted like mys_log_stdio_handler1() into a user-space buffer, which is written with one
+ * writev() (O_APPEND) when it is full, when a line of `flush_level` or above (except RAW) is logged,
+ * and at destroy/exit.
+ * When a file would exceed `max_bytes`, it is renamed to rank.XXXXXX.log.1 (older ones to .2, .3, ...)
+ * and at most `max_files` files are kept, including the current one.
+```c
+mys_ranklog_sink_t *sink = mys_ranklog_sink_create(mys_MPI_COMM_WORLD, "LOG.test", 64 << 20, 4);
+int id = mys_log_add_handler(logger, mys_ranklog_handler, sink);
+...
+mys_log_remove_handler(logger, id);
+mys_ranklog_sink_destroy(&sink);
+```
+ */
+typedef struct mys_ranklog_sink_t mys_ranklog_sink_t;
+/**
+ * @brief Create the directories and open the file of this rank (Collective call)
+ *
+ * @param comm Communicator used to number ranks and to group them by node
+ * @param folder Root folder of the log files
+ * @param max_bytes Rotate when the current file would exceed it. 0 never rotates.
+ * @param max_files Files kept per rank (>= 1) when rotating
+ * @return The sink, or NULL with mys_errno set (MYS_EINVAL, MYS_ENOMEM, MYS_EIO)
+ *
+ * @note An existing file of the rank is appended to.
+ */
+MYS_PUBLIC mys_ranklog_sink_t *mys_ranklog_sink_create(mys_MPI_Comm comm, const char *folder, size_t max_bytes, int max_files);
+MYS_PUBLIC void mys_ranklog_sink_destroy(mys_ranklog_sink_t **sink); // flush and close. Not collective.
+MYS_PUBLIC int mys_ranklog_sink_flush(mys_ranklog_sink_t *sink); // write buffered lines to the file
+MYS_PUBLIC int mys_ranklog_sink_set_buffer(mys_ranklog_sink_t *sink, size_t buffer_size, int flush_level); // default 1 MiB, MYS_LOG_ERROR
+MYS_PUBLIC const char *mys_ranklog_sink_path(mys_ranklog_sink_t *sink); // path of the current file
+MYS_PUBLIC void mys_ranklog_handler(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata); // udata is a mys_ranklog_sink_t
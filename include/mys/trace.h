@@ -23,8 +23,9 @@
 //     double time;
 // } mys_trace_event0_t;
 
+// `time` is in seconds of mys_hrtime() of the thread that created the trace
 typedef struct mys_trace_event1_t {
-    double time;
+    union { double time; uint64_t _tick; }; // _tick: internal use
     union {
         uint64_t u1;
         int64_t i1;
@@ -36,21 +37,109 @@ typedef struct mys_trace_event1_t {
     };
 } mys_trace_event1_t;
 
+// One payload word of a trace event, same layout as the union in mys_trace_event1_t
+#define _MYS_TRACE_WORD(n)                                                   \
+    union {                                                                  \
+        uint64_t u##n;                                                       \
+        int64_t i##n;                                                        \
+        double d##n;                                                         \
+        void *p##n;                                                          \
+        struct {          int li##n;          int hi##n; };                  \
+        struct { unsigned int lu##n; unsigned int hu##n; };                  \
+        struct {        float lf##n;        float hf##n; };                  \
+    }
+
+typedef struct mys_trace_event2_t {
+    union { double time; uint64_t _tick; }; // _tick: internal use
+    _MYS_TRACE_WORD(1);
+    _MYS_TRACE_WORD(2);
+} mys_trace_event2_t;
+
+typedef struct mys_trace_event3_t {
+    union { double time; uint64_t _tick; }; // _tick: internal use
+    _MYS_TRACE_WORD(1);
+    _MYS_TRACE_WORD(2);
+    _MYS_TRACE_WORD(3);
+} mys_trace_event3_t;
+
+typedef struct mys_trace_event4_t {
+    union { double time; uint64_t _tick; }; // _tick: internal use
+    _MYS_TRACE_WORD(1);
+    _MYS_TRACE_WORD(2);
+    _MYS_TRACE_WORD(3);
+    _MYS_TRACE_WORD(4);
+} mys_trace_event4_t;
+
 enum { MYS_TRACE_EVENT0, MYS_TRACE_EVENT1, MYS_TRACE_EVENT2, MYS_TRACE_EVENT3, MYS_TRACE_EVENT4 };
 
 typedef struct mys_trace_iter_t {
     union {
         // mys_trace_event0_t *e0;
         mys_trace_event1_t *e1;
+        mys_trace_event2_t *e2;
+        mys_trace_event3_t *e3;
+        mys_trace_event4_t *e4;
     };
-    int type;
+    int type; // MYS_TRACE_EVENT1 ~ MYS_TRACE_EVENT4, tells which of e1~e4 is valid
+    int tid; // mys_thread_id() of the thread that appended the event
+    uint64_t tick; // raw timestamp of the event, see mys_hrtick_raw()
+    mys_trace_event4_t _event; // internal use, e1~e4 point here
 } mys_trace_iter_t;
 
+/*
+    Each thread appends into its own buffers of the trace (no locks or atomics on the
+    hot path), so a trace can be shared by all OpenMP/pthread workers. Iteration merges
+    the buffers of all threads into one time-ordered stream, and must not run
+    concurrently with appends.
 
+    Events are stamped with raw mys_hrtick_raw() ticks and converted to seconds only
+    when iterated. mys_hrcalibrate() tells whether the counter agrees across cores.
+*/
 typedef struct mys_trace_t mys_trace_t;
 
 MYS_PUBLIC mys_trace_t *mys_trace_create();
+/**
+ * @brief Create a flight recorder: a trace with constant memory that keeps only the latest events.
+ *
+ * Each thread keeps a ring of `capacity` events per event type (allocated at its first event of that
+ * type), and overwrites its oldest events when the ring is full. Dump it with `mys_trace_dump()`, or
+ * register it with `mys_debug_set_trace()` to get the last events when the program crashes or hangs.
+ *
+ * @param capacity Events kept per thread and event type.
+ * @return The trace, or NULL if capacity is 0 or too large.
+ */
+MYS_PUBLIC mys_trace_t *mys_trace_create_ring(size_t capacity);
 MYS_PUBLIC void mys_trace_destroy(mys_trace_t **trace);
+MYS_PUBLIC size_t mys_trace_size(mys_trace_t *trace); // number of events of all threads (retained ones for flight recorders)
+MYS_PUBLIC size_t mys_trace_dropped(mys_trace_t *trace); // number of events overwritten by flight recorders, or appended by threads beyond the first 4096
+/**
+ * @brief Write events of a trace as text lines "time tid=N words...", oldest first.
+ *
+ * @param trace The trace.
+ * @param fd Output file descriptor, e.g., STDERR_FILENO.
+ * @param max_events Write only the latest `max_events` events, 0 for all.
+ * @return 0 on success, or `MYS_EINVAL`, or `MYS_EBUSY` if another dump of the trace is running.
+ *
+ * @note Does not use the iteration state of the trace, so it can be called while iterating.
+ *       It does not allocate memory: its merge heap is allocated when threads append their first event.
+ *       Events being appended by other threads at the same time may be garbled.
+ */
+MYS_PUBLIC int mys_trace_dump(mys_trace_t *trace, int fd, size_t max_events);
+/**
+ * @brief Write all events of a trace to a compact binary file, oldest first.
+ *
+ * The file starts with a 192-byte header (magic "MYSTRACE", version, rank, number of ranks, clock names
+ * and the tick-to-seconds conversion), followed by one record per event: a type byte, the thread id when
+ * it changes, the varint-encoded tick delta to the previous event, and the payload words. Merge the files
+ * of all ranks into Chrome/Perfetto JSON with `python3 -m mys.TraceDumpper out.json trace.*.bin`.
+ *
+ * @param trace The trace, not being iterated.
+ * @param file_format Path of the output file in printf format, e.g., "trace/rank.%06d.bin" with the rank.
+ * @return 0 on success, or `MYS_EINVAL`, `MYS_EBUSY`, `MYS_ENOMEM`, `MYS_EIO`.
+ *
+ * @note Call `mys_hrsync()` before recording to align the clocks of all ranks.
+ */
+MYS_ATTR_PRINTF(2, 3) MYS_PUBLIC int mys_trace_export(mys_trace_t *trace, const char *file_format, ...);
 
 MYS_PUBLIC mys_trace_iter_t *mys_trace_start_iter(mys_trace_t *trace);
 MYS_PUBLIC mys_trace_iter_t *mys_trace_next_iter(mys_trace_t *trace, mys_trace_iter_t *iter);
@@ -60,3 +149,6 @@ MYS_PUBLIC void mys_trace_1p(mys_trace_t *trace, void *data1);
 MYS_PUBLIC void mys_trace_1u(mys_trace_t *trace, uint64_t data1);
 MYS_PUBLIC void mys_trace_1i(mys_trace_t *trace, int64_t data1);
 MYS_PUBLIC void mys_trace_1d(mys_trace_t *trace, double data1);
+MYS_PUBLIC void mys_trace_2u(mys_trace_t *trace, uint64_t data1, uint64_t data2); // e.g., event id, bytes
+MYS_PUBLIC void mys_trace_3u(mys_trace_t *trace, uint64_t data1, uint64_t data2, uint64_t data3); // e.g., event id, bytes, peer rank
+MYS_PUBLIC void mys_trace_4u(mys_trace_t *trace, uint64_t data1, uint64_t data2, uint64_t data3, uint64_t data4);
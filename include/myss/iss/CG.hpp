@@ -31,8 +31,9 @@ public:
 
         intermediate_t bnorm, rnorm, alpha, beta, gamma, gammaold, delta;
         bnorm = (b, b);
-        r = b - A * x;
-        u = B * r;
+        A.Apply(x, r);
+        r = b - r;
+        B.Apply(r, u);
         p = u;
 
         do {
@@ -41,12 +42,12 @@ public:
                 break;
 
             gammaold = this->iter == 0 ? (intermediate_t)(r, u) : gamma;
-            s = A * p;
+            A.Apply(p, s);
             delta = (s, p);
             alpha = gammaold / delta;
-            x = x + alpha * p;
-            r = r - alpha * s;
-            u = B * r;
+            x += alpha * p;
+            r -= alpha * s;
+            B.Apply(r, u);
             gamma = (r, u);
             beta = gamma / gammaold;
             p = u + beta * p;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include "../pc/PCBase.hpp"
 #include "../pc/PCNone.hpp"
 #include "../util/AsyncProxy.hpp"
@@ -30,6 +31,7 @@ protected:
     mutable IType iter = 0, stopiter = 0;
     mutable DType stopabs = 0, stoprel = 0;
     mutable StopReason stopreason = StopReason::NoRunning;
+    mutable double vecbytes = 0, vectime = 0; /* Traffic and seconds of the vector kernels that report it */
     mutable ConvergeTestFunction convergetest = &ISSBase::DefaultConvergeTest;
     mutable const MType *A = nullptr;
     mutable const PType *P = nullptr;
@@ -62,6 +64,8 @@ public:
 
     IType GetNumIterations() const { return this->iter; }
     StopReason GetStopReason() const { return this->stopreason; }
+    double GetVectorBytes() const { return this->vecbytes; }
+    double GetVectorSeconds() const { return this->vectime; }
     const MType &GetMatrix() const { return *this->A; }
     const PType &GetPreconditioner() const { return this->P == nullptr ? *this->defaultP : *this->P; }
     void SetMatrix(const MType &A) { this->A = &A; }
@@ -121,6 +125,13 @@ public:
             buffer += strformat("  %s rel %.17g (rtol %.17g dtol %.17g)\n", rmark, (double)stoprel, (double)rtol, (double)dtol);
             buffer += strformat("  %s iter %d (maxiter %d)\n", imark, (int)stopiter, (int)maxiter);
         }
+        if (this->vecbytes > 0 && this->stopiter > 0) {
+            buffer += strformat(
+                "  Vector kernels: %.3f MB/iter %.3f us/iter %.2f GB/s\n",
+                this->vecbytes / this->stopiter / 1e6, this->vectime / this->stopiter * 1e6,
+                this->vectime > 0 ? this->vecbytes / this->vectime / 1e9 : 0.0
+            );
+        }
         PRINTF(0, "%s", buffer.c_str());
     }
 
@@ -130,6 +141,12 @@ public:
         this->stopabs = 0;
         this->stoprel = 0;
         this->stopreason = StopReason::NoRunning;
+        this->vecbytes = 0;
+        this->vectime = 0;
+    }
+
+    static double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
     }
 
     static StopReason DefaultConvergeTest(
@@ -40,31 +40,27 @@ public:
         IntermediateType bnorm = 0, alpha = 1, beta = 1, gammaold = 0;
         PipeIntermediateType rnorm = 0, delta = 0, gamma = 0;
         bnorm = (b, b);
-        r = b - A * x;
-        u = B * r;
-        w = A * u;
+        A.Apply(x, r);
+        r = b - r;
+        B.Apply(r, u);
+        A.Apply(u, w);
 
         do {
             gammaold = gamma;
-            rnorm = (r, r);
-            gamma = (r, u);
-            delta = (w, u);
-            m = B * w;
-            n = A * m;
+            double t0 = this->Now();
+            this->vecbytes += VType::FusedDots3(r, u, w, rnorm, gamma, delta);
+            this->vectime += this->Now() - t0;
+            B.Apply(w, m);
+            A.Apply(m, n);
 
             if (this->Converged(std::sqrt(rnorm), std::sqrt(bnorm)))
                 break;
 
             beta = this->iter == 0 ? 0 : gamma / gammaold;
             alpha = gamma / (delta - beta / alpha * gamma);
-            z = beta * z + n;
-            q = beta * q + m;
-            p = beta * p + u;
-            s = beta * s + w;
-            x += alpha * p;
-            u -= alpha * q;
-            w -= alpha * z;
-            r -= alpha * s;
+            t0 = this->Now();
+            this->vecbytes += VType::PipeCGUpdate(alpha, beta, z, q, p, s, x, u, w, r, n, m);
+            this->vectime += this->Now() - t0;
         } while (++this->iter);
     }
 
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <set>
+#include <algorithm>
+#include <utility>
 #include <mpi.h>
 #include "MBase.hpp"
 #include "../vec/VCSR.hpp"
@@ -26,311 +27,325 @@ public:
     std::vector<int> I;
     std::vector<int> J;
     std::vector<double> V;
-    std::map<int, int> external_indexs;
-    std::vector<std::vector<int>> send_others;
     guard_t guard;
 
     // communication package: for exchange halo
     int halo_total_size = 0;
-    std::vector<MPI_Datatype> send_types;
-    std::vector<MPI_Datatype> recv_types;
-    std::vector<std::vector<int>> halo_indexs;
+    std::vector<int> halo_globals; // global index of each halo entry, sorted, hence grouped by owner
+
+    // halo exchange plan: persistent requests with neighbours only, through packed buffers
+    static const int halo_tag = 0x4d43;
+    std::vector<int> recv_ranks, recv_displs; // halo[recv_displs[k]:recv_displs[k+1]] comes from recv_ranks[k]
+    std::vector<int> send_ranks, send_displs; // x[send_indexs[send_displs[k]:send_displs[k+1]]] goes to send_ranks[k]
+    std::vector<int> send_indexs;
+    std::vector<int> interior_rows;           // rows reading owned entries only, computed while the halo is in flight
+    std::vector<int> boundary_rows;           // rows reading halo entries
+    mutable std::vector<double> send_buffer;
+    mutable std::vector<double> recv_buffer;
+    mutable std::vector<MPI_Request> halo_requests; // receives, then sends
 
     MCSR() { }
 
-    MCSR(const MCSR &source) {
-        source.guard.ensure();
-        this->nranks = source.nranks;
-        this->myrank = source.myrank;
-        this->global_size = source.global_size;
-        this->local_begin = source.local_begin;
-        this->local_end = source.local_end;
-        this->local_nnz = source.local_nnz;
-        this->I.clear();
-        this->J.clear();
-        this->V.clear();
-        std::copy(source.I.begin(), source.I.end(), this->I.begin());
-        std::copy(source.J.begin(), source.J.end(), this->J.begin());
-        std::copy(source.V.begin(), source.V.end(), this->V.begin());
-        this->guard = source.guard;
-        this->halo_total_size = source.halo_total_size;
-        this->send_types = source.send_types;
-        this->recv_types = source.recv_types;
-        this->halo_indexs = source.halo_indexs;
+    static void copy(const MCSR &src, MCSR &dst) {
+        if (&src == &dst) return;
+        src.guard.ensure();
+        dst.comm = src.comm;
+        dst.nranks = src.nranks;
+        dst.myrank = src.myrank;
+        dst.global_size = src.global_size;
+        dst.local_begin = src.local_begin;
+        dst.local_end = src.local_end;
+        dst.local_nnz = src.local_nnz;
+        dst.rank_begins = src.rank_begins;
+        dst.rank_ends = src.rank_ends;
+        dst.I = src.I;
+        dst.J = src.J;
+        dst.V = src.V;
+        dst.guard = src.guard;
+        dst.halo_total_size = src.halo_total_size;
+        dst.halo_globals = src.halo_globals;
+        dst.recv_ranks = src.recv_ranks;
+        dst.recv_displs = src.recv_displs;
+        dst.send_ranks = src.send_ranks;
+        dst.send_displs = src.send_displs;
+        dst.send_indexs = src.send_indexs;
+        dst.BuildHaloPlan(); /* requests are bound to buffers, so never shared */
+    }
+    static void swap(MCSR &src, MCSR &dst) {
+        if (&src == &dst) return;
+        std::swap(src.comm, dst.comm);
+        std::swap(src.nranks, dst.nranks);
+        std::swap(src.myrank, dst.myrank);
+        std::swap(src.global_size, dst.global_size);
+        std::swap(src.local_begin, dst.local_begin);
+        std::swap(src.local_end, dst.local_end);
+        std::swap(src.local_nnz, dst.local_nnz);
+        std::swap(src.rank_begins, dst.rank_begins);
+        std::swap(src.rank_ends, dst.rank_ends);
+        std::swap(src.I, dst.I);
+        std::swap(src.J, dst.J);
+        std::swap(src.V, dst.V);
+        std::swap(src.guard, dst.guard);
+        std::swap(src.halo_total_size, dst.halo_total_size);
+        std::swap(src.halo_globals, dst.halo_globals);
+        std::swap(src.recv_ranks, dst.recv_ranks);
+        std::swap(src.recv_displs, dst.recv_displs);
+        std::swap(src.send_ranks, dst.send_ranks);
+        std::swap(src.send_displs, dst.send_displs);
+        std::swap(src.send_indexs, dst.send_indexs);
+        std::swap(src.interior_rows, dst.interior_rows);
+        std::swap(src.boundary_rows, dst.boundary_rows);
+        std::swap(src.send_buffer, dst.send_buffer);
+        std::swap(src.recv_buffer, dst.recv_buffer);
+        std::swap(src.halo_requests, dst.halo_requests);
     }
+    MCSR(const MCSR &src) { MCSR::copy(src, *this); }
+    MCSR(MCSR&& src) noexcept { MCSR::swap(src, *this); }
+    MCSR& operator=(const MCSR &src)     { MCSR::copy(src, *this); return *this; }
+    MCSR& operator=(MCSR&& src) noexcept { MCSR::swap(src, *this); return *this; }
 
+    /* Every rank passes the whole matrix, only the rows of [rank_begins[myrank], rank_ends[myrank]) are kept */
     static MCSR FromGlobalMatrix(const MPI_Comm comm, const int *Ap, const int *Aj, const double *Av, const int global_size, const std::vector<int> &rank_begins, const std::vector<int> &rank_ends)
+    {
+        int myrank, nranks;
+        MPI_Comm_rank(comm, &myrank);
+        MPI_Comm_size(comm, &nranks);
+        ASSERT_EQ(rank_begins.size(), nranks);
+        ASSERT_EQ(rank_ends.size(), nranks);
+        const int begin = rank_begins[myrank];
+        return MCSR::FromLocalRows(comm, global_size, begin, rank_ends[myrank], &Ap[begin], Aj, Av);
+    }
+
+    /* Local rows in COO, rows[k] in [local_begin, local_end) and cols[k] global */
+    static MCSR FromLocalCOO(const MPI_Comm comm, const int global_size, const int local_begin, const int local_end,
+        const int nnz, const int *rows, const int *cols, const double *vals)
+    {
+        const int local_size = local_end - local_begin;
+        std::vector<int> Ap(local_size + 1, 0);
+        std::vector<int> Aj(nnz);
+        std::vector<double> Av(nnz);
+        for (int k = 0; k < nnz; k++) {
+            ASSERT_BETWEEN_IE(local_begin, rows[k], local_end);
+            Ap[rows[k] - local_begin + 1] += 1;
+        }
+        for (int i = 0; i < local_size; i++) {
+            Ap[i + 1] += Ap[i];
+        }
+        std::vector<int> next(Ap.begin(), Ap.end() - 1);
+        for (int k = 0; k < nnz; k++) {
+            const int pos = next[rows[k] - local_begin]++;
+            Aj[pos] = cols[k];
+            Av[pos] = vals[k];
+        }
+        return MCSR::FromLocalRows(comm, global_size, local_begin, local_end, Ap.data(), Aj.data(), Av.data());
+    }
+
+    /* Local rows in CSR: row local_begin + i is Aj/Av[Ap[i]:Ap[i+1]] with global columns, Ap[0] need not be 0.
+     * Collective, but only an allgather of the row ranges and messages between neighbours. */
+    static MCSR FromLocalRows(const MPI_Comm comm, const int global_size, const int local_begin, const int local_end,
+        const int *Ap, const int *Aj, const double *Av)
     {
         MCSR res;
         res.comm = comm;
-        MPI_Comm_rank(MPI_COMM_WORLD, &res.myrank);
-        MPI_Comm_size(MPI_COMM_WORLD, &res.nranks);
+        MPI_Comm_rank(comm, &res.myrank);
+        MPI_Comm_size(comm, &res.nranks);
         res.global_size = global_size;
-        ASSERT_EQ(rank_begins.size(), res.nranks);
-        ASSERT_EQ(rank_ends.size(), res.nranks);
+        res.local_begin = local_begin;
+        res.local_end = local_end;
+        const int local_size = local_end - local_begin; // without halo
+        res.local_nnz = Ap[local_size] - Ap[0];
+
+        int range[2] = {local_begin, local_end};
+        std::vector<int> ranges(2 * res.nranks);
+        MPI_Allgather(range, 2, MPI_TYPE<int>(), ranges.data(), 2, MPI_TYPE<int>(), comm);
         res.rank_begins.resize(res.nranks);
         res.rank_ends.resize(res.nranks);
-        std::copy(rank_begins.begin(), rank_begins.end(), res.rank_begins.begin());
-        std::copy(rank_ends.begin(), rank_ends.end(), res.rank_ends.begin());
-        res.local_begin = rank_begins[res.myrank];
-        res.local_end = rank_ends[res.myrank];
-
-        std::vector<std::set<int>> halo_indexs(res.nranks);
-        res.I.resize(res.local_end - res.local_begin + 1, 0);
-        int test_icount = 0;
-        int test_ecount = 0;
-        for (int gi = res.local_begin; gi < res.local_end; gi++) {
-            const int rowstart = Ap[gi];
-            const int rowstop = Ap[gi + 1];
-            res.I[gi + 1 - res.local_begin] = res.I[gi - res.local_begin];
-            for (int jj = rowstart; jj < rowstop; jj++) {
-                const int gj = Aj[jj];
-                const double v = Av[jj];
-                ASSERT_BETWEEN_IE(0, gj, global_size);
-                res.I[gi + 1 - res.local_begin] += 1;
-                if (gj >= res.local_begin && gj < res.local_end) {
-                    res.J.push_back(gj);
-                    res.V.push_back(v);
-                    test_icount += 1;
-                } else {
-                    // find who maintain this index
-                    auto upper = std::upper_bound(rank_begins.begin(), rank_begins.end(), gj);
-                    // if (lower == rank_begins.end()) {
-                    //     DEBUG(res.myrank, "ERROR: %d lower %p end %p", gj, lower, rank_begins.end());
-                    // }
-                    // ASSERT_NE(lower, rank_begins.end());
-                    int maintainer = (upper - 1) - rank_begins.begin();
-                    ASSERT_BETWEEN_IE(0, maintainer, res.nranks);
-                    halo_indexs[maintainer].insert(gj);
-                    res.J.push_back(gj);
-                    res.V.push_back(v);
-                    test_ecount += 1;
-                }
-            }
-        }
-        // for (int i = 1; i < res.I.size(); i++) {
-        //     res.I[i] += res.I[i - 1];
-        // }
-        ASSERT_EQ(res.I.back(), Ap[res.local_end] - Ap[res.local_begin]);
-        res.halo_indexs.resize(res.nranks);
         for (int rank = 0; rank < res.nranks; rank++) {
-            res.halo_indexs[rank].resize(0);
-            for (auto &gj : halo_indexs[rank]) {
-                res.halo_indexs[rank].push_back(gj);
-                res.external_indexs[gj] = res.local_end - res.local_begin + res.halo_total_size;
-                res.halo_total_size += 1;
-            }
-        }
-        std::vector<int> send_count(res.nranks);
-        for (int rank = 0; rank < res.nranks; rank++) {
-            int need = res.halo_indexs[rank].size();
-            MPI_Gather(&need, 1, MPI_TYPE<int>(), send_count.data(), 1, MPI_TYPE<int>(), rank, res.comm);
-            // for (int i = 0; i < res.nranks; i++)
-            //     DEBUG(rank, "%d will send to %d %d values", this->myrank, i, send_count[i]);
+            res.rank_begins[rank] = ranges[2 * rank];
+            res.rank_ends[rank] = ranges[2 * rank + 1];
+            ASSERT_EQ(res.rank_begins[rank], rank == 0 ? 0 : res.rank_ends[rank - 1]);
         }
+        ASSERT_EQ(res.rank_ends.back(), global_size);
 
-        res.send_others.resize(res.nranks);
-        std::vector<MPI_Request> requests(res.nranks, MPI_REQUEST_NULL);
-        for (int rank = 0; rank < res.nranks; rank++) {
-            std::vector<int> &send_indexs = res.send_others[rank];
-            send_indexs.resize(send_count[rank], 0);
-            MPI_Irecv(send_indexs.data(), send_indexs.size(), MPI_TYPE<int>(), rank, RMIDX(rank, res.myrank, res.nranks, res.nranks), res.comm, &requests[rank]);
-            MPI_Send(res.halo_indexs[rank].data(), res.halo_indexs[rank].size(), MPI_TYPE<int>(), rank, RMIDX(res.myrank, rank, res.nranks, res.nranks), res.comm);
+        res.I.resize(local_size + 1);
+        for (int i = 0; i <= local_size; i++) {
+            res.I[i] = Ap[i] - Ap[0];
         }
-        MPI_Waitall(res.nranks, requests.data(), MPI_STATUSES_IGNORE);
-
-        for (int rank = 0; rank < res.nranks; rank++) {
-            for (int i = 0; i < res.nranks; i++) {
-                // DEBUG(rank, "%d rely on %d for %d values", this->myrank, i, res.halo_indexs[i].size());
-                for (int j = 0; j < res.halo_indexs[i].size(); j++) {
-                    // DEBUG(rank, "    for example, rely on global index %d", res.halo_indexs[i][j]);
-                }
+        res.J.assign(Aj + Ap[0], Aj + Ap[local_size]);
+        res.V.assign(Av + Ap[0], Av + Ap[local_size]);
+        res.halo_globals.clear();
+        for (int jj = 0; jj < res.local_nnz; jj++) {
+            const int gj = res.J[jj];
+            ASSERT_BETWEEN_IE(0, gj, global_size);
+            if (gj < local_begin || gj >= local_end)
+                res.halo_globals.push_back(gj);
+        }
+        std::sort(res.halo_globals.begin(), res.halo_globals.end());
+        res.halo_globals.erase(std::unique(res.halo_globals.begin(), res.halo_globals.end()), res.halo_globals.end());
+        res.halo_total_size = res.halo_globals.size();
+        for (int jj = 0; jj < res.local_nnz; jj++) {
+            const int gj = res.J[jj];
+            if (gj >= local_begin && gj < local_end) {
+                res.J[jj] = gj - local_begin;
+            } else {
+                auto pos = std::lower_bound(res.halo_globals.begin(), res.halo_globals.end(), gj);
+                res.J[jj] = local_size + (int)(pos - res.halo_globals.begin());
             }
-            MPI_Barrier(res.comm);
         }
 
-        for (int rank = 0; rank < res.nranks; rank++) {
-            for (int i = 0; i < res.nranks; i++) {
-                std::vector<int> &send_indexs = res.send_others[i];
-                // DEBUG(rank, "hhh %d will send to %d %d values", this->myrank, i, send_indexs.size());
-                // for (int j = 0; j < send_indexs.size(); j++) {
-                //     DEBUG(rank, "    for example, send global index %d", (int)send_indexs[j]);
-                // }
+        // Owners of the sorted halo entries come in rank order
+        res.recv_ranks.clear();
+        res.recv_displs.assign(1, 0);
+        for (int k = 0; k < res.halo_total_size; k++) {
+            const int gj = res.halo_globals[k];
+            const int owner = (std::upper_bound(res.rank_begins.begin(), res.rank_begins.end(), gj) - 1) - res.rank_begins.begin();
+            ASSERT_BETWEEN_IE(0, owner, res.nranks);
+            if (res.recv_ranks.empty() || res.recv_ranks.back() != owner) {
+                res.recv_ranks.push_back(owner);
+                res.recv_displs.push_back(k);
             }
-            MPI_Barrier(res.comm);
+            res.recv_displs.back() = k + 1;
         }
 
-        int halostart = res.local_end - res.local_begin;
-        int localsize = halostart + res.halo_total_size;
-        res.send_types.resize(res.nranks, MPI_DATATYPE_NULL);
-        res.recv_types.resize(res.nranks, MPI_DATATYPE_NULL);
-        for (int rank = 0; rank < res.nranks; rank++) {
-            std::vector<int> &send_indexs = res.send_others[rank];
-            for (int i = 0; i < send_indexs.size(); i++) {
-                send_indexs[i] -= res.local_begin;
-                ASSERT_BETWEEN_IE(0, send_indexs[i], res.local_end - res.local_begin);
+        res.DiscoverSends();
+        res.guard.set();
+        res.BuildHaloPlan();
+        return res;
+    }
+
+    /* Sends each owner the global indexes needed from it, and receives the indexes other ranks need from this one.
+     * Nonblocking consensus (NBX): synchronous sends, probing until an ibarrier entered after they were matched completes.
+     * A duplicated communicator keeps the probes away from other traffic and from a following construction. */
+    void DiscoverSends()
+    {
+        MPI_Comm setup;
+        MPI_Comm_dup(this->comm, &setup);
+        const int tag = 0;
+        const int nrecvs = this->recv_ranks.size();
+        std::vector<MPI_Request> requests(nrecvs, MPI_REQUEST_NULL);
+        for (int k = 0; k < nrecvs; k++) {
+            const int disp = this->recv_displs[k];
+            MPI_Issend(&this->halo_globals[disp], this->recv_displs[k + 1] - disp, MPI_TYPE<int>(), this->recv_ranks[k], tag, setup, &requests[k]);
+        }
+        std::vector<std::pair<int, std::vector<int>>> needs;
+        MPI_Request barrier = MPI_REQUEST_NULL;
+        bool barrier_active = false;
+        int done = 0;
+        while (!done) {
+            int flag = 0;
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, tag, setup, &flag, &status);
+            if (flag) {
+                int count = 0;
+                MPI_Get_count(&status, MPI_TYPE<int>(), &count);
+                needs.emplace_back(status.MPI_SOURCE, std::vector<int>(count));
+                MPI_Recv(needs.back().second.data(), count, MPI_TYPE<int>(), status.MPI_SOURCE, tag, setup, MPI_STATUS_IGNORE);
+            }
+            if (barrier_active) {
+                MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+            } else {
+                int sent = 0;
+                MPI_Testall(nrecvs, requests.data(), &sent, MPI_STATUSES_IGNORE);
+                if (sent) {
+                    MPI_Ibarrier(setup, &barrier);
+                    barrier_active = true;
+                }
             }
-            std::vector<int> array_of_blocklengths(send_indexs.size(), 1);
-            CHKRET(MPI_Type_indexed(send_indexs.size(), array_of_blocklengths.data(), send_indexs.data(), MPI_TYPE<double>(), &res.send_types[rank]));
-            int halosize = res.halo_indexs[rank].size();
-            CHKRET(MPI_Type_create_subarray(1, &localsize, &halosize, &halostart, MPI_ORDER_C, MPI_TYPE<double>(), &res.recv_types[rank]));
-            // DEBUG_ORDERED("%d recv from %d -> x[%d:%d](%d)", res.myrank, rank, halostart, halostart + halosize, localsize);
-            // DEBUG_ORDERED("(%d) <-> %d, send %d recv %d", res.myrank, rank, send_indexs.size(), halosize);
-            halostart += halosize;
         }
+        MPI_Comm_free(&setup);
 
-        int local_size = res.local_end - res.local_begin; // without halo
-        int icount = 0;
-        int ecount = 0;
-        for (int i = 0; i < local_size; i++) {
-            const int rowstart = res.I[i];
-            const int rowstop = res.I[i + 1];
-            for (int jj = rowstart; jj < rowstop; jj++) {
-                const int gj = res.J[jj];
-                const double v = res.V[jj];
-                // DEBUG(0, "@@ %d %f", gj, v);
-                if (gj >= res.local_begin && gj < res.local_end) {
-                    res.J[jj] = gj - res.local_begin;
-                    ASSERT_BETWEEN_IE(0, res.J[jj], local_size);
-                    icount += 1;
-                } else {
-                    res.J[jj] = res.external_indexs[gj];
-                    ASSERT_BETWEEN_IE(local_size, res.J[jj], local_size + res.halo_total_size);
-                    ecount += 1;
-                }
+        std::sort(needs.begin(), needs.end());
+        this->send_ranks.clear();
+        this->send_displs.assign(1, 0);
+        this->send_indexs.clear();
+        for (auto &need : needs) {
+            this->send_ranks.push_back(need.first);
+            for (int gj : need.second) {
+                ASSERT_BETWEEN_IE(this->local_begin, gj, this->local_end);
+                this->send_indexs.push_back(gj - this->local_begin);
             }
+            this->send_displs.push_back(this->send_indexs.size());
         }
-        // ASSERT_EQ(icount, local_size);
-        // ASSERT_EQ(ecount, res.halo_total_size);
+    }
 
-        // DEBUG_ORDERED("local: %d %d halo: %d", res.local_begin, res.local_end, res.halo_total_size);
+    /* Packs the entries the neighbours need and starts the persistent requests */
+    void StartHalo(const VCSR &x) const
+    {
+        for (size_t i = 0; i < this->send_indexs.size(); i++) {
+            this->send_buffer[i] = x.values[this->send_indexs[i]];
+        }
+        if (!this->halo_requests.empty())
+            CHKRET(MPI_Startall(this->halo_requests.size(), this->halo_requests.data()));
+    }
 
-        res.guard.set();
-        return res;
+    /* After this the halo is in recv_buffer, in the order of the halo part of the vectors */
+    void FinishHalo() const
+    {
+        if (!this->halo_requests.empty())
+            CHKRET(MPI_Waitall(this->halo_requests.size(), this->halo_requests.data(), MPI_STATUSES_IGNORE));
     }
 
-    void ExchangeHalo(VCSR &x)
+    void ExchangeHalo(VCSR &x) const
     {
-        // DEBUG_ORDERED("local: %d %d halo: %d", this->local_begin, this->local_end, this->halo_total_size);
         ASSERT_EQ(this->local_end - this->local_begin + this->halo_total_size, x.values.size());
         this->guard.ensure();
         x.guard.ensure();
-        ASSERT_EQ(this->send_types.size(), this->nranks);
-        ASSERT_EQ(this->recv_types.size(), this->nranks);
-        std::vector<MPI_Request> send_requests(this->nranks, MPI_REQUEST_NULL);
-        std::vector<MPI_Request> recv_requests(this->nranks, MPI_REQUEST_NULL);
-        int halostart = this->local_end - this->local_begin;
-        int localsize = halostart + this->halo_total_size;
-        for (int rank = 0; rank < this->nranks; rank++) {
-            int halosize = this->halo_indexs[rank].size();
-            // DEBUG_ORDERED("%d recv from %d: 1 block, x size %d halo size %d halo start %d (%p)", this->myrank, rank, localsize, halosize, halostart, this->recv_types[rank]);
-            const MPI_Datatype &send_type = this->send_types[rank];
-            const MPI_Datatype &recv_type = this->recv_types[rank];
-            int send_tag = RMIDX(this->myrank, rank, this->nranks, this->nranks);
-            int recv_tag = RMIDX(rank, this->myrank, this->nranks, this->nranks);
-            // DEBUG_ORDERED("%d send to %d with tag %d", this->myrank, rank, send_tag);
-            // DEBUG_ORDERED("%d recv from %d with tag %d", this->myrank, rank, recv_tag);
-            int ret = MPI_Isend(x.values.data(), 1, send_type, rank, send_tag, this->comm, &send_requests[rank]);
-            if (ret != 0) {
-                printf("xxxxxxxxxx-------xxxxx---x-x-x--x-x-x-x\n");
-            }
-            CHKRET(MPI_Irecv(x.values.data(), 1, recv_type, rank, recv_tag, this->comm, &recv_requests[rank]));
-            // CHKRET(MPI_Isend(x.values.data(), 1, send_type, rank, send_tag, this->comm, &requests[rank]));
-            // CHKRET(MPI_Recv(x.values.data(), 1, recv_type, rank, recv_tag, this->comm, MPI_STATUS_IGNORE));
-            // MPI_Wait(&requests[rank], MPI_STATUS_IGNORE);
-            // DEBUG_ORDERED("OK");
+        this->StartHalo(x);
+        this->FinishHalo();
+        std::copy(this->recv_buffer.begin(), this->recv_buffer.end(), x.values.begin() + (this->local_end - this->local_begin));
+    }
+
+    void FreeHaloPlan()
+    {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        for (auto &request : this->halo_requests) {
+            if (request != MPI_REQUEST_NULL && !finalized)
+                MPI_Request_free(&request);
         }
-        MPI_Waitall(send_requests.size(), send_requests.data(), MPI_STATUSES_IGNORE);
-        MPI_Waitall(recv_requests.size(), recv_requests.data(), MPI_STATUSES_IGNORE);
+        this->halo_requests.clear();
+    }
 
-        
+    /* Builds the buffers and persistent requests from the neighbour lists, and splits the rows into interior and
+     * boundary ones. Local, no communication. */
+    void BuildHaloPlan()
+    {
+        this->FreeHaloPlan();
+        const int local_size = this->local_end - this->local_begin; // without halo
+        ASSERT_EQ(this->recv_displs.back(), this->halo_total_size);
+        this->send_buffer.assign(this->send_indexs.size(), 0);
+        this->recv_buffer.assign(this->halo_total_size, 0);
 
+        const int nrecvs = this->recv_ranks.size();
+        const int nsends = this->send_ranks.size();
+        this->halo_requests.assign(nrecvs + nsends, MPI_REQUEST_NULL);
+        for (int k = 0; k < nrecvs; k++) {
+            const int disp = this->recv_displs[k];
+            CHKRET(MPI_Recv_init(&this->recv_buffer[disp], this->recv_displs[k + 1] - disp, MPI_TYPE<double>(),
+                this->recv_ranks[k], halo_tag, this->comm, &this->halo_requests[k]));
+        }
+        for (int k = 0; k < nsends; k++) {
+            const int disp = this->send_displs[k];
+            CHKRET(MPI_Send_init(&this->send_buffer[disp], this->send_displs[k + 1] - disp, MPI_TYPE<double>(),
+                this->send_ranks[k], halo_tag, this->comm, &this->halo_requests[nrecvs + k]));
+        }
 
+        this->interior_rows.clear();
+        this->boundary_rows.clear();
+        for (int i = 0; i < local_size; i++) {
+            bool boundary = false;
+            for (int jj = this->I[i]; jj < this->I[i + 1] && !boundary; jj++) {
+                boundary = this->J[jj] >= local_size;
+            }
+            if (boundary)
+                this->boundary_rows.push_back(i);
+            else
+                this->interior_rows.push_back(i);
+        }
     }
 
-    // MCSR(const MPI_Comm comm, const int global_size, const int local_begin, const int local_size, const std::vector<int> &coo_rows, const std::vector<int> &coo_cols, const std::vector<double> &coo_data)
-    // {
-    //     ASSERT_EQ(coo_rows.size(), coo_cols.size());
-    //     ASSERT_EQ(coo_rows.size(), coo_data.size());
-    //     this->comm = comm;
-    //     MPI_Comm_rank(MPI_COMM_WORLD, &this->myrank);
-    //     MPI_Comm_size(MPI_COMM_WORLD, &this->nranks);
-    //     this->global_size = global_size;
-    //     this->local_begin = local_begin;
-    //     this->local_size = local_size;
-    //     this->local_nnz = coo_data.size();
-    //     this->rank_begins.resize(this->nranks + 1);
-    //     this->rank_ends.resize(this->nranks);
-    //     this->rank_nnzs.resize(this->nranks);
-    //     MPI_Allgather(&this->local_begin, 1, MPI_TYPE<int>(), this->rank_begins.data(), 1, MPI_TYPE<int>(), this->comm);
-    //     MPI_Allgather(&this->local_size, 1, MPI_TYPE<int>(), this->rank_ends.data(), 1, MPI_TYPE<int>(), this->comm);
-    //     MPI_Allgather(&this->local_nnz, 1, MPI_TYPE<int>(), this->rank_nnzs.data(), 1, MPI_TYPE<int>(), this->comm);
-    //     for (int rank = 0; rank < nranks; rank++) {
-    //         int disp = this->rank_begins[rank];
-    //         int size = this->rank_ends[rank];
-    //         ASSERT_LE(disp, 0);
-    //         ASSERT_LE(size, 0);
-    //         ASSERT_BETWEEN_IE(0, disp + size, this->global_size);
-    //         if (rank < nranks - 1)
-    //             ASSERT_EQ(disp + size, this->rank_begins[rank + 1]);
-    //     }
-    //     this->rank_begins.back() = this->global_size;
-    //     int nrows, ncols, Istart, Jstart;
-    //     int *Ap = NULL;
-    //     int *Aj = NULL;
-    //     double *Av = NULL;
-    //     matconvert(this->local_nnz, coo_rows.data(), coo_cols.data(), coo_data.data(), &nrows, &ncols, &Istart, &Jstart, &Ap, &Aj, &Av, MatrixType::COO, MatrixType::CSR);
-    //     ASSERT_EQ(nrows, this->local_size);
-    //     ASSERT_EQ(nrows, ncols);
-    //     ASSERT_EQ(Istart, local_begin);
-    //     // rebase
-    //     this->I.resize(this->local_size);
-    //     this->J.resize(this->local_nnz);
-    //     this->V.resize(this->local_nnz);
-    //     std::copy(Ap, Ap + this->local_size, this->I.begin());
-    //     std::copy(Aj, Aj + this->local_nnz, this->J.begin());
-    //     std::copy(Av, Av + this->local_nnz, this->V.begin());
-    //     free(Ap);
-    //     free(Aj);
-    //     free(Av);
-    //     // 构造this->external_indexs，它装的是向量后面那段external的数据，各自在全局里是什么下标
-    //     std::vector<int> recv_count(this->nranks); // how much I have to recv from these other ranks
-    //     std::vector<int> send_count(this->nranks); // how much I have to send to these other ranks
-    //     MPI_Alltoall(recv_count.data(), 1, MPI_TYPE<int>(), send_count.data(), 1, MPI_TYPE<int>(), this->comm);
-    //     {
-    //         this->send_others.resize(this->nranks);
-    //         size_t begin = 0;
-    //         std::vector<MPI_Request> requests(this->nranks, MPI_REQUEST_NULL);
-    //         for (int rank = 0; rank < this->nranks; rank++) {
-    //             size_t end = recv_count[rank];
-    //             size_t size = end - begin;
-    //             MPI_Isend(&this->external_indexs[begin], size, MPI_TYPE<int>(), rank, 0, this->comm, &requests[rank]);
-    //         }
-    //         for (int rank = 0; rank < this->nranks; rank++) {
-    //             std::vector<int> &sendto = send_others[rank];
-    //             sendto.resize(send_count[rank]);
-    //             MPI_Recv(sendto.data(), sendto.size(), MPI_TYPE<int>(), rank, 0, this->comm, MPI_STATUS_IGNORE);
-    //         }
-    //         MPI_Waitall(this->nranks, requests.data(), MPI_STATUSES_IGNORE);
-    //         for (int i = 0; i < send_others.size(); i++) {
-    //             for (int j = 0; j < send_others[i].size(); j++)
-    //                 send_others[i][j] -= this->local_begin;
-    //         }
-    //     }
-    //     // FIXME: Get the index list to send each rank.
-    //     std::vector<std::vector<int>> recv_index(this->nranks);
-    //     std::vector<MPI_Request> init_requests(this->nranks, MPI_REQUEST_NULL);
-    //     std::vector<MPI_Request> isend_requests(this->nranks, MPI_REQUEST_NULL);
-    //     for (size_t rank = 0; rank < this->nranks; rank++) {
-    //         std::vector<int> &rf = recv_index[rank];
-    //         MPI_Isend(rf.data(), rf.size(), MPI_TYPE<int>(), rank, 0, this->comm, &isend_requests[rank]);
-    //         MPI_Irecv(rf.data(), rf.size(), MPI_TYPE<int>(), rank, 0, this->comm, &isend_requests[rank]);
-    //     }
-    //     MPI_Waitall(this->nranks, isend_requests.data(), MPI_STATUS_IGNORE);
-    //     this->guard.set();
-    // }
-
     ~MCSR() {
+        this->FreeHaloPlan();
         this->comm = MPI_COMM_NULL;
         this->global_size = -1;
         this->local_begin = -1;
@@ -389,6 +404,7 @@ public:
         return std::sqrt(norm);
     }
 
+    /* y = A x: interior rows are computed while the halo of x is in flight, boundary rows read it from recv_buffer */
     virtual void Apply(const VCSR &x, VCSR &y, bool xzero = false) const {
         this->guard.ensure();
         x.guard.ensure();
@@ -396,15 +412,27 @@ public:
         ASSERT_EQ(x.values.size(), y.values.size());
 
         int local_size = this->local_end - this->local_begin; // without halo
-        for (int i = 0; i < local_size; i++) {
-            const int rowstart = this->I[i];
-            const int rowstop = this->I[i + 1];
-            y.values[i] = 0;
-            for (int jj = rowstart; jj < rowstop; jj++) {
+        const double *xv = x.values.data();
+        const double *halo = this->recv_buffer.data();
+        double *yv = y.values.data();
+        this->StartHalo(x);
+        for (size_t k = 0; k < this->interior_rows.size(); k++) {
+            const int i = this->interior_rows[k];
+            double sum = 0;
+            for (int jj = this->I[i]; jj < this->I[i + 1]; jj++) {
+                sum += this->V[jj] * xv[this->J[jj]];
+            }
+            yv[i] = sum;
+        }
+        this->FinishHalo();
+        for (size_t k = 0; k < this->boundary_rows.size(); k++) {
+            const int i = this->boundary_rows[k];
+            double sum = 0;
+            for (int jj = this->I[i]; jj < this->I[i + 1]; jj++) {
                 const int j = this->J[jj];
-                const double v = this->V[jj];
-                y.values[i] += v * x.values[j];
+                sum += this->V[jj] * (j < local_size ? xv[j] : halo[j - local_size]);
             }
+            yv[i] = sum;
         }
     }
     virtual VCSR GetDiagonals() const {
@@ -430,7 +458,7 @@ public:
             }
         }
         ASSERT_EQ(count, local_size);
-        VCSR diag(this->global_size, local_size, this->local_begin, values.data());
+        VCSR diag(this->global_size, local_size, this->local_begin, values.data(), this->comm);
         this->ResizeVectorForHalo(&diag, NULL);
         return diag;
     }
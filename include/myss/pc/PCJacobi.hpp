@@ -32,7 +32,9 @@ public:
     }
 
     virtual void Apply(const VType &b, VType &x, bool xzero = false) const {
-        x = b * this->diags;
+        if (&x != &b)
+            VType::copy(b, x); /* sizes x like b, without reallocating once it has the capacity */
+        VType::ElementWiseOp(x, this->diags, ElementOp::Scale);
     }
     virtual const char *GetName() const {
         return "PCJacobi";
@@ -2,8 +2,9 @@
 
 #include "../util/AsyncProxy.hpp"
 
-template<typename vector_t> class AX;
-template<typename vector_t> class AXPBY;
+template<typename vector_t, int N> class LinearCombination;
+template<typename vector_t> using AX = LinearCombination<vector_t, 1>;
+template<typename vector_t> using AXPBY = LinearCombination<vector_t, 2>;
 
 enum class ElementOp : int {
     Replace,    /* y[i] = x[i]        or y[i] = alpha        */
@@ -23,28 +24,23 @@ public:
 
     VBase(const VType &src)     { VType::copy(src, static_cast<VType&>(*this)); }
     VBase(VType&& src) noexcept { VType::swap(src, static_cast<VType&>(*this)); }
-    VType& operator=(const AX<VType> &src)     { return static_cast<VType&>(*this).operator=(src.eval()); }
-    VType& operator=(const AXPBY<VType> &src)  { return static_cast<VType&>(*this).operator=(src.eval()); }
-    VType& operator=(AX<VType>&& src) noexcept    { return static_cast<VType&>(*this).operator=(src.eval()); }
-    VType& operator=(AXPBY<VType>&& src) noexcept { return static_cast<VType&>(*this).operator=(src.eval()); }
+    template<int N>
+    VType& operator=(const LinearCombination<VType, N> &src) { src.EvalInto(static_cast<VType&>(*this)); return static_cast<VType&>(*this); }
     VType& operator=(DType alpha) noexcept { VType::ElementWiseOp(static_cast<VType&>(*this), alpha, ElementOp::Replace); return static_cast<VType&>(*this); }
 
+    /* In place: self is the first term, so x += alpha * p is a single pass over x and p */
     VType& operator+=(const VType &x) {
         VType &self = static_cast<VType&>(*this);
         self = self + x;
         return self;
     }
-    VType& operator+=(const AX<VType> &x) {
+    template<int N>
+    VType& operator+=(const LinearCombination<VType, N> &x) {
         VType &self = static_cast<VType&>(*this);
         self = self + x;
         return self;
     }
-    VType& operator+=(const AXPBY<VType> &x) {
-        VType &self = static_cast<VType&>(*this);
-        self = self + x;
-        return self;
-    }
-    friend VType operator+(const VType &x, const VType& y) {
+    friend AXPBY<VType> operator+(const VType &x, const VType& y) {
         return AXPBY<VType>(static_cast<DType>(1), x, static_cast<DType>(1), y);
     }
     friend VType operator+(const VType &x, DType alpha) {
@@ -58,17 +54,13 @@ public:
         self = self - x;
         return self;
     }
-    VType& operator-=(const AX<VType> &x) {
-        VType &self = static_cast<VType&>(*this);
-        self = self - x;
-        return self;
-    }
-    VType& operator-=(const AXPBY<VType> &x) {
+    template<int N>
+    VType& operator-=(const LinearCombination<VType, N> &x) {
         VType &self = static_cast<VType&>(*this);
         self = self - x;
         return self;
     }
-    friend VType operator-(VType x, const VType& y) {
+    friend AXPBY<VType> operator-(const VType &x, const VType& y) {
         return AXPBY<VType>(static_cast<DType>(1), x, static_cast<DType>(-1), y);
     }
 
@@ -90,7 +82,7 @@ public:
         return w;
     }
     friend AX<VType> operator/(const VType &x, DType alpha) {
-        return AX<VType>(static_cast<DType>(-1) / alpha, x);
+        return AX<VType>(static_cast<DType>(1) / alpha, x);
     }
     friend VType operator/(DType alpha, const VType &x) {
         VType y = x;
@@ -108,87 +100,40 @@ public:
 };
 
 
-template<typename vector_t>
-class AX
+/* Lazy alpha[0] * x[0] + ... + alpha[N-1] * x[N-1], evaluated by VType::LinComb in one pass.
+ * It only keeps pointers to its vectors, so assign it before they go out of scope.
+ * The target may be one of the terms, e.g. p = u + beta * p updates p in place. */
+template<typename vector_t, int N>
+class LinearCombination
 {
+public:
     using VType = vector_t;
     using IType = typename VType::IType;
     using DType = typename VType::DType;
-    const DType alpha = static_cast<DType>(1);
-    const VType *x = nullptr;
-public:
-
-    AX(const DType &alpha, const VType &x) : alpha(alpha), x(&x) { }
-
-    VType eval() const {
-        VType w = *this->x;
-        VType::ElementWiseOp(w, this->alpha, ElementOp::Scale);
-        return w;
-    }
-
-    operator VType() const {
-        return this->eval();
-    }
-
-    friend AX<VType> operator*(const AX<VType> &lhs, const DType &scale) {
-        return AX<VType>(lhs.x, lhs.alpha * scale);
-    }
-    friend AX<VType> operator*(const AX<VType> &lhs, const AsyncProxy<DType> &ascale) {
-        DType scale = ascale.await();
-        return lhs * scale;
-    }
-    friend AX<VType> operator*(const DType &scale, const AX<VType> &rhs) {
-        return rhs * scale;
-    }
-    friend AX<VType> operator*(const AsyncProxy<DType> &ascale, const AX<VType> &rhs) {
-        return rhs * ascale;
-    }
+    DType alpha[N];
+    const VType *x[N];
 
-    friend AXPBY<VType> operator+(const VType &lhs, const AX<VType> &rhs) {
-        return AXPBY<VType>(static_cast<DType>(1), lhs, rhs.alpha, *rhs.x);
-    }
-    friend AXPBY<VType> operator+(const AX<VType> &lhs, const VType &rhs) {
-        return AXPBY<VType>(lhs.alpha, *lhs.x, static_cast<DType>(1), rhs);
-    }
-    friend AXPBY<VType> operator+(const AX<VType> &lhs, const AX<VType> &rhs) {
-        return AXPBY<VType>(lhs.alpha, *lhs.x, rhs.alpha, *rhs.x);
+    LinearCombination() { }
+    LinearCombination(const DType &alpha, const VType &x) {
+        static_assert(N == 1, "one term");
+        this->alpha[0] = alpha;
+        this->x[0] = &x;
     }
-    friend AXPBY<VType> operator+(const AX<VType> &lhs, const AXPBY<VType> &rhs) {
-        return lhs + rhs.eval();
+    LinearCombination(const DType &alpha, const VType &x, const DType &beta, const VType &y) {
+        static_assert(N == 2, "two terms");
+        this->alpha[0] = alpha;
+        this->x[0] = &x;
+        this->alpha[1] = beta;
+        this->x[1] = &y;
     }
 
-    friend AXPBY<VType> operator-(const AX<VType> &lhs, const VType &rhs) {
-        return AXPBY<VType>(lhs.alpha, *lhs.x, static_cast<DType>(-1), rhs);
-    }
-    friend AXPBY<VType> operator-(const VType &lhs, const AX<VType> &rhs) {
-        return AXPBY<VType>(static_cast<DType>(1), lhs, -rhs.alpha, *rhs.x);
-    }
-    friend AXPBY<VType> operator-(const AX<VType> &lhs, const AX<VType> &rhs) {
-        return AXPBY<VType>(lhs.alpha, *lhs.x, rhs.alpha, *rhs.x);
-    }
-    friend AXPBY<VType> operator-(const AX<VType> &lhs, const AXPBY<VType> &rhs) {
-        return lhs - rhs.eval();
+    void EvalInto(VType &w) const {
+        VType::LinComb(w, this->alpha, this->x);
     }
-};
-
-
-template<typename vector_t>
-class AXPBY
-{
-    using VType = vector_t;
-    using IType = typename VType::IType;
-    using DType = typename VType::DType;
-    const DType alpha = static_cast<DType>(1);
-    const DType beta = static_cast<DType>(1);
-    const VType *x = nullptr;
-    const VType *y = nullptr;
-public:
-
-    AXPBY(const DType &alpha, const VType &x, const DType &beta, const VType &y) : alpha(alpha), x(&x), beta(beta), y(&y) { }
 
     VType eval() const {
-        VType w = *this->x;
-        VType::AXPBY(w, this->alpha, *this->x, this->beta, *this->y);
+        VType w;
+        this->EvalInto(w);
         return w;
     }
 
@@ -196,42 +141,62 @@ public:
         return this->eval();
     }
 
-    friend AXPBY<VType> operator*(const AXPBY<VType> &lhs, const DType &scale) {
-        return AXPBY<VType>(lhs.alpha * scale, lhs.x, lhs.beta * scale, lhs.y);
+    LinearCombination Scaled(const DType &scale) const {
+        LinearCombination res = *this;
+        for (int k = 0; k < N; k++)
+            res.alpha[k] *= scale;
+        return res;
     }
-    friend AXPBY<VType> operator*(const AXPBY<VType> &lhs, const AsyncProxy<DType> &ascale) {
-        DType scale = ascale.await();
-        return lhs * scale;
+
+    template<int M>
+    LinearCombination<VType, N + M> Concat(const LinearCombination<VType, M> &rhs, const DType &scale) const {
+        LinearCombination<VType, N + M> res;
+        for (int k = 0; k < N; k++) {
+            res.alpha[k] = this->alpha[k];
+            res.x[k] = this->x[k];
+        }
+        for (int k = 0; k < M; k++) {
+            res.alpha[N + k] = rhs.alpha[k] * scale;
+            res.x[N + k] = rhs.x[k];
+        }
+        return res;
     }
-    friend AXPBY<VType> operator*(const DType &scale, const AXPBY<VType> &rhs) {
-        return rhs * scale;
+
+    friend LinearCombination operator*(const LinearCombination &lhs, const DType &scale) {
+        return lhs.Scaled(scale);
     }
-    friend AXPBY<VType> operator*(const AsyncProxy<DType> &ascale, const AXPBY<VType> &rhs) {
-        return rhs * ascale;
+    friend LinearCombination operator*(const LinearCombination &lhs, const AsyncProxy<DType> &ascale) {
+        return lhs.Scaled(ascale.await());
     }
-
-    friend AXPBY<VType> operator+(const AXPBY<VType> &lhs, const VType &rhs) {
-        return lhs.eval() + rhs;
+    friend LinearCombination operator*(const DType &scale, const LinearCombination &rhs) {
+        return rhs.Scaled(scale);
     }
-    friend AXPBY<VType> operator+(const AXPBY<VType> &lhs, const AX<VType> &rhs) {
-        return lhs.eval() + rhs;
+    friend LinearCombination operator*(const AsyncProxy<DType> &ascale, const LinearCombination &rhs) {
+        return rhs.Scaled(ascale.await());
     }
-    friend AXPBY<VType> operator+(const AXPBY<VType> &lhs, const AXPBY<VType> &rhs) {
-        return lhs.eval() + rhs.eval();
+    friend LinearCombination operator-(const LinearCombination &rhs) {
+        return rhs.Scaled(static_cast<DType>(-1));
     }
 
-    friend AXPBY<VType> operator-(const AXPBY<VType> &lhs, const VType &rhs) {
-        return lhs.eval() - rhs;
+    friend LinearCombination<VType, N + 1> operator+(const VType &lhs, const LinearCombination &rhs) {
+        return AX<VType>(static_cast<DType>(1), lhs).Concat(rhs, static_cast<DType>(1));
     }
-    friend AXPBY<VType> operator-(const AXPBY<VType> &lhs, const AX<VType> &rhs) {
-        return lhs.eval() - rhs;
+    friend LinearCombination<VType, N + 1> operator+(const LinearCombination &lhs, const VType &rhs) {
+        return lhs.Concat(AX<VType>(static_cast<DType>(1), rhs), static_cast<DType>(1));
     }
-    friend AXPBY<VType> operator-(const AXPBY<VType> &lhs, const AXPBY<VType> &rhs) {
-        return lhs.eval() - rhs.eval();
+    friend LinearCombination<VType, N + 1> operator-(const VType &lhs, const LinearCombination &rhs) {
+        return AX<VType>(static_cast<DType>(1), lhs).Concat(rhs, static_cast<DType>(-1));
+    }
+    friend LinearCombination<VType, N + 1> operator-(const LinearCombination &lhs, const VType &rhs) {
+        return lhs.Concat(AX<VType>(static_cast<DType>(1), rhs), static_cast<DType>(-1));
     }
-
 };
 
-
-
-
+template<typename vector_t, int N, int M>
+LinearCombination<vector_t, N + M> operator+(const LinearCombination<vector_t, N> &lhs, const LinearCombination<vector_t, M> &rhs) {
+    return lhs.Concat(rhs, static_cast<typename vector_t::DType>(1));
+}
+template<typename vector_t, int N, int M>
+LinearCombination<vector_t, N + M> operator-(const LinearCombination<vector_t, N> &lhs, const LinearCombination<vector_t, M> &rhs) {
+    return lhs.Concat(rhs, static_cast<typename vector_t::DType>(-1));
+}
@@ -3,8 +3,10 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
+#include <utility>
 #include <stdexcept>
 #include <math.h>
+#include <mpi.h>
 #include "VBase.hpp"
 #include "mys/raii.hpp"
 
@@ -18,9 +20,24 @@ public:
     int global_size = -1;
     int local_size = -1;
     int local_disp = -1;
-    std::vector<double> values;
+    MPI_Comm comm = MPI_COMM_WORLD;
+    std::vector<double> values; /* local_size owned entries, then the halo */
     guard_t guard;
 
+    /* One in-flight MPI_Iallreduce of up to three partial sums, each awaited through an AsyncProxy
+     * whose context points to its Entry. A slot is reused once all of its sums have been awaited. */
+    struct PendingSum {
+        struct Entry {
+            PendingSum *owner;
+            int index;
+        };
+        MPI_Request request = MPI_REQUEST_NULL;
+        double sums[3];
+        Entry entries[3];
+        int refs = 0;
+    };
+    static const int max_pending_sums = 16;
+
     VCSR() { }
     ~VCSR() {
         this->global_size = -1;
@@ -30,10 +47,11 @@ public:
         this->guard.reset();
     }
 
-    VCSR(const int global_size, const int local_size, const int local_disp, const double *arr) {
+    VCSR(const int global_size, const int local_size, const int local_disp, const double *arr, MPI_Comm comm = MPI_COMM_WORLD) {
         this->global_size = global_size;
         this->local_size = local_size;
         this->local_disp = local_disp;
+        this->comm = comm;
         this->values.resize(local_size, 0);
         if (arr != NULL) {
             std::copy(arr, arr + local_size, this->values.data());
@@ -49,12 +67,13 @@ public:
     //     // DEBUG(0, "Resized from %d to %d", old, this->values.size());
     // }
 
-    static VCSR FromGlobalVector(const double *arr, const int global_size, const int local_begin, const int local_end)
+    static VCSR FromGlobalVector(const double *arr, const int global_size, const int local_begin, const int local_end, MPI_Comm comm = MPI_COMM_WORLD)
     {
         VCSR res;
         res.global_size = global_size;
         res.local_size = local_end - local_begin;
         res.local_disp = local_begin;
+        res.comm = comm;
         res.values.resize(res.local_size);
         for (int i = local_begin; i < local_end; i++) {
             res.values[i - local_begin] = arr[i];
@@ -65,12 +84,11 @@ public:
 
     static void copy(const VCSR &src, VCSR &dst) {
         if (&src == &dst) return;
-        dst.global_size = dst.global_size;
-        dst.local_size = dst.local_size;
-        dst.local_disp = dst.local_disp;
-        dst.values.clear();
-        dst.values.resize(src.values.size());
-        std::copy(src.values.begin(), src.values.end(), dst.values.begin());
+        dst.global_size = src.global_size;
+        dst.local_size = src.local_size;
+        dst.local_disp = src.local_disp;
+        dst.comm = src.comm;
+        dst.values.assign(src.values.begin(), src.values.end());
         dst.guard = src.guard;
     }
     static void swap(VCSR &src, VCSR &dst) {
@@ -78,26 +96,49 @@ public:
         std::swap(src.global_size, dst.global_size);
         std::swap(src.local_size, dst.local_size);
         std::swap(src.local_disp, dst.local_disp);
+        std::swap(src.comm, dst.comm);
         std::swap(src.values, dst.values);
         std::swap(src.guard, dst.guard);
     }
     VCSR(const VCSR &src) { VCSR::copy(src, *this); }
     VCSR(VCSR&& src) noexcept { VCSR::swap(src, *this); }
+    using BASE::operator=;
     VCSR& operator=(const VCSR &src)     { VCSR::copy(src, *this); return *this; }
     VCSR& operator=(VCSR&& src) noexcept { VCSR::swap(src, *this); return *this; }
 
-    static void AXPBY(VCSR &w, double alpha, const VCSR &x, double beta, const VCSR &y) {
+    /* w = alpha[0] * x[0] + ... + alpha[N-1] * x[N-1] in one pass, w may be any of the x[k] */
+    template<int N>
+    static void LinComb(VCSR &w, const double (&alpha)[N], const VCSR *const (&x)[N]) {
+        const double *xv[N];
+        for (int k = 0; k < N; k++) {
+            x[k]->guard.ensure();
+            ASSERT_EQ(x[k]->values.size(), x[0]->values.size());
+            xv[k] = x[k]->values.data();
+        }
+        if (w.values.size() != x[0]->values.size()) {
+            w.global_size = x[0]->global_size;
+            w.local_size = x[0]->local_size;
+            w.local_disp = x[0]->local_disp;
+            w.comm = x[0]->comm;
+            w.values.resize(x[0]->values.size());
+            w.guard = x[0]->guard;
+        }
         w.guard.ensure();
-        x.guard.ensure();
-        y.guard.ensure();
-        for (size_t i = 0; i < y.values.size(); i++) {
-            w.values[i] = alpha * x.values[i] + beta * y.values[i];
+        double *wv = w.values.data();
+        const size_t n = w.values.size();
+        for (size_t i = 0; i < n; i++) {
+            double sum = alpha[0] * xv[0][i];
+            for (int k = 1; k < N; k++) {
+                sum += alpha[k] * xv[k][i];
+            }
+            wv[i] = sum;
         }
     }
 
     static void ElementWiseOp(VCSR &y, const VCSR &x, ElementOp op) {
         x.guard.ensure();
         y.guard.ensure();
+        ASSERT_EQ(x.values.size(), y.values.size());
         if (op == ElementOp::Replace) {
             for (size_t i = 0; i < y.values.size(); i++) {
                 y.values[i] = x.values[i];
@@ -142,35 +183,127 @@ public:
         }
     }
 
+    /* Starts summing count partials over comm, each result is awaited by one of the returned proxies */
+    static void StartSum(MPI_Comm comm, const double *partials, int count, AsyncProxy<double> *results[]) {
+        static PendingSum slots[max_pending_sums];
+        PendingSum *slot = nullptr;
+        for (int k = 0; k < max_pending_sums && slot == nullptr; k++) {
+            if (slots[k].refs == 0)
+                slot = &slots[k];
+        }
+        if (slot == nullptr) {
+            /* Too many sums in flight: reduce now */
+            double sums[3];
+            MPI_Allreduce(partials, sums, count, MPI_DOUBLE, MPI_SUM, comm);
+            for (int i = 0; i < count; i++)
+                *results[i] = AsyncProxy<double>(sums[i]);
+            return;
+        }
+        std::copy(partials, partials + count, slot->sums);
+        slot->refs = count;
+        MPI_Iallreduce(MPI_IN_PLACE, slot->sums, count, MPI_DOUBLE, MPI_SUM, comm, &slot->request);
+        for (int i = 0; i < count; i++) {
+            slot->entries[i].owner = slot;
+            slot->entries[i].index = i;
+            *results[i] = AsyncProxy<double>(0, &slot->entries[i], &VCSR::AwaitSum);
+        }
+    }
+
+    static double AwaitSum(const AsyncProxy<double> *proxy) {
+        auto entry = (const PendingSum::Entry *)proxy->context();
+        PendingSum *slot = entry->owner;
+        if (slot->request != MPI_REQUEST_NULL)
+            MPI_Wait(&slot->request, MPI_STATUS_IGNORE);
+        double result = slot->sums[entry->index];
+        slot->refs -= 1;
+        return result;
+    }
+
+    /* The local partial is summed here, the global sum completes in await() */
     static AsyncProxy<double> AsyncDot(const VCSR &x, const VCSR &y) {
         x.guard.ensure();
         y.guard.ensure();
         ASSERT_EQ(x.values.size(), y.values.size());
-        auto context = new std::pair<const VCSR*, const VCSR*>(&x, &y);
-        return AsyncProxy<double>(0, context, &VCSR::AwaitDot);
+        ASSERT_EQ(x.local_size, y.local_size);
+        double partial = 0;
+        for (int i = 0; i < x.local_size; i++) {
+            partial += x.values[i] * y.values[i];
+        }
+        AsyncProxy<double> result;
+        AsyncProxy<double> *results[1] = {&result};
+        VCSR::StartSum(x.comm, &partial, 1, results);
+        return result;
     }
 
-    static double AwaitDot(const AsyncProxy<double> *proxy) {
-        auto context = (std::pair<const VCSR*, const VCSR*> *)proxy->context();
-        const VCSR *x = context->first;
-        const VCSR *y = context->second;
-        delete context;
+    /* rr = (r, r), ru = (r, u), wu = (w, u) in one sweep and one reduction, returns bytes read.
+     * proxy_t is AsyncProxy<double>, or SyncProxy<double> that awaits when assigned. */
+    template<typename proxy_t>
+    static size_t FusedDots3(const VCSR &r, const VCSR &u, const VCSR &w,
+        proxy_t &rr, proxy_t &ru, proxy_t &wu) {
+        r.guard.ensure();
+        u.guard.ensure();
+        w.guard.ensure();
+        ASSERT_EQ(r.values.size(), u.values.size());
+        ASSERT_EQ(r.values.size(), w.values.size());
+        ASSERT_EQ(r.local_size, u.local_size);
+        ASSERT_EQ(r.local_size, w.local_size);
+        const double *rv = r.values.data();
+        const double *uv = u.values.data();
+        const double *wv = w.values.data();
+        const size_t n = r.local_size;
+        double partials[3] = {0, 0, 0};
+        for (size_t i = 0; i < n; i++) {
+            const double ri = rv[i];
+            const double ui = uv[i];
+            partials[0] += ri * ri;
+            partials[1] += ri * ui;
+            partials[2] += wv[i] * ui;
+        }
+        AsyncProxy<double> sums[3];
+        AsyncProxy<double> *results[3] = {&sums[0], &sums[1], &sums[2]};
+        VCSR::StartSum(r.comm, partials, 3, results);
+        rr = std::move(sums[0]);
+        ru = std::move(sums[1]);
+        wu = std::move(sums[2]);
+        return 3 * n * sizeof(double);
+    }
 
-        double result = 0;
-        for (int i = 0; i < x->values.size(); i++) {
-            result += x->values[i] * y->values[i];
+    /* All PIPECG recurrences in one sweep, returns bytes read and written:
+     *   z = beta * z + n, q = beta * q + m, p = beta * p + u, s = beta * s + w,
+     *   x += alpha * p,   u -= alpha * q,   w -= alpha * z,   r -= alpha * s */
+    static size_t PipeCGUpdate(double alpha, double beta,
+        VCSR &z, VCSR &q, VCSR &p, VCSR &s, VCSR &x, VCSR &u, VCSR &w, VCSR &r,
+        const VCSR &n, const VCSR &m) {
+        const VCSR *all[10] = {&z, &q, &p, &s, &x, &u, &w, &r, &n, &m};
+        for (int k = 0; k < 10; k++) {
+            all[k]->guard.ensure();
+            ASSERT_EQ(all[k]->values.size(), r.values.size());
         }
-        return result;
+        double *zv = z.values.data(), *qv = q.values.data(), *pv = p.values.data(), *sv = s.values.data();
+        double *xv = x.values.data(), *uv = u.values.data(), *wv = w.values.data(), *rv = r.values.data();
+        const double *nv = n.values.data(), *mv = m.values.data();
+        const size_t size = r.values.size();
+        for (size_t i = 0; i < size; i++) {
+            const double zi = beta * zv[i] + nv[i];
+            const double qi = beta * qv[i] + mv[i];
+            const double pi = beta * pv[i] + uv[i];
+            const double si = beta * sv[i] + wv[i];
+            zv[i] = zi;
+            qv[i] = qi;
+            pv[i] = pi;
+            sv[i] = si;
+            xv[i] += alpha * pi;
+            uv[i] -= alpha * qi;
+            wv[i] -= alpha * zi;
+            rv[i] -= alpha * si;
+        }
+        return 18 * size * sizeof(double);
     }
 
     double Norm(std::string type = "2") {
         this->guard.ensure();
         if (type == "2") {
-            double result = 0;
-            for (size_t i = 0; i < this->values.size(); i++) {
-                result += this->values[i] * this->values[i];
-            }
-            return std::sqrt(result);
+            return std::sqrt(dot(*this, *this));
         } else if (type == "inf") {
             double result = 0;
             for (size_t i = 0; i < this->values.size(); i++) {
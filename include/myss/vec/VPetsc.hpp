@@ -35,18 +35,41 @@ public:
     }
     VPetsc(const VPetsc &src) { VPetsc::copy(src, *this); }
     VPetsc(VPetsc&& src) noexcept { VPetsc::swap(src, *this); }
+    using BASE::operator=;
     VPetsc& operator=(const VPetsc &src)     { VPetsc::copy(src, *this); return *this; }
     VPetsc& operator=(VPetsc&& src) noexcept { VPetsc::swap(src, *this); return *this; }
 
-    static void AXPBY(VPetsc &w, PetscScalar alpha, const VPetsc &x, PetscScalar beta, const VPetsc &y) {
+    /* w = alpha[0] * x[0] + ... + alpha[N-1] * x[N-1], terms aliasing w become one VecScale and the rest one VecMAXPY */
+    template<int N>
+    static void LinComb(VPetsc &w, const PetscScalar (&alpha)[N], const VPetsc *const (&x)[N]) {
         PetscErrorCode ierr;
-        if (&x == &y) {
-            ierr = VecAXPY(w.vec, alpha, x.vec); CHKERRV(ierr);
-            ierr = VecAXPY(w.vec, beta, y.vec); CHKERRV(ierr);
-        } else if (&w != &x && &x != &y) {
-            ierr = VecAXPBYPCZ(w.vec, alpha, beta, 0, x.vec, y.vec); CHKERRV(ierr);
-        } else {
-            FAILED("%p %p %p", &w, &x, &y);
+        if (w.vec == nullptr) {
+            ierr = VecDuplicate(x[0]->vec, &w.vec); CHKERRV(ierr);
+        }
+        PetscScalar self = 0;
+        PetscScalar coefs[N];
+        Vec vecs[N];
+        PetscInt nv = 0;
+        bool aliased = false;
+        for (int k = 0; k < N; k++) {
+            if (x[k] == &w) {
+                self += alpha[k];
+                aliased = true;
+            } else {
+                coefs[nv] = alpha[k];
+                vecs[nv] = x[k]->vec;
+                nv += 1;
+            }
+        }
+        PetscInt first = 0;
+        if (!aliased) {
+            ierr = VecAXPBY(w.vec, coefs[0], 0, vecs[0]); CHKERRV(ierr);
+            first = 1;
+        } else if (self != static_cast<PetscScalar>(1)) {
+            ierr = VecScale(w.vec, self); CHKERRV(ierr);
+        }
+        if (nv > first) {
+            ierr = VecMAXPY(w.vec, nv - first, &coefs[first], &vecs[first]); CHKERRV(ierr);
         }
     }
 
@@ -99,6 +122,36 @@ public:
     }
 
 
+    /* PETSc merges the split-phase dots into one reduction, the local part still takes five passes.
+     * proxy_t is AsyncProxy<PetscScalar>, or SyncProxy<PetscScalar> that awaits when assigned. */
+    template<typename proxy_t>
+    static size_t FusedDots3(const VPetsc &r, const VPetsc &u, const VPetsc &w,
+        proxy_t &rr, proxy_t &ru, proxy_t &wu) {
+        PetscInt n = 0;
+        VecGetLocalSize(r.vec, &n);
+        rr = VPetsc::AsyncDot(r, r);
+        ru = VPetsc::AsyncDot(r, u);
+        wu = VPetsc::AsyncDot(w, u);
+        return 5 * (size_t)n * sizeof(PetscScalar);
+    }
+
+    static size_t PipeCGUpdate(PetscScalar alpha, PetscScalar beta,
+        VPetsc &z, VPetsc &q, VPetsc &p, VPetsc &s, VPetsc &x, VPetsc &u, VPetsc &w, VPetsc &r,
+        const VPetsc &n, const VPetsc &m) {
+        PetscErrorCode ierr;
+        PetscInt size = 0;
+        ierr = VecGetLocalSize(r.vec, &size); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAYPX(z.vec, beta, n.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAYPX(q.vec, beta, m.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAYPX(p.vec, beta, u.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAYPX(s.vec, beta, w.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAXPY(x.vec, alpha, p.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAXPY(u.vec, -alpha, q.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAXPY(w.vec, -alpha, z.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        ierr = VecAXPY(r.vec, -alpha, s.vec); CHKERRABORT(PETSC_COMM_WORLD, ierr);
+        return 24 * (size_t)size * sizeof(PetscScalar);
+    }
+
     void SetValues(const PetscScalar *arr) {
         PetscErrorCode ierr;
         PetscInt Istart, Iend;
@@ -36,9 +36,7 @@ public:
     static void copy(const VSeq &src, VSeq &dst) {
         if (&src == &dst) return;
         dst.nrows = src.nrows;
-        dst.values.clear();
-        dst.values.resize(src.values.size());
-        std::copy(src.values.begin(), src.values.end(), dst.values.begin());
+        dst.values.assign(src.values.begin(), src.values.end());
         dst.guard = src.guard;
     }
     static void swap(VSeq &src, VSeq &dst) {
@@ -49,18 +47,34 @@ public:
     }
     VSeq(const VSeq &src) { VSeq::copy(src, *this); }
     VSeq(VSeq&& src) noexcept { VSeq::swap(src, *this); }
+    using BASE::operator=;
     VSeq& operator=(const VSeq &src)     { VSeq::copy(src, *this); return *this; }
     VSeq& operator=(VSeq&& src) noexcept { VSeq::swap(src, *this); return *this; }
 
-    static void AXPBY(VSeq &w, double alpha, const VSeq &x, double beta, const VSeq &y) {
+    /* w = alpha[0] * x[0] + ... + alpha[N-1] * x[N-1] in one pass, w may be any of the x[k] */
+    template<int N>
+    static void LinComb(VSeq &w, const double (&alpha)[N], const VSeq *const (&x)[N]) {
+        const double *xv[N];
+        for (int k = 0; k < N; k++) {
+            x[k]->guard.ensure();
+            ASSERT_EQ(x[k]->values.size(), x[0]->values.size());
+            xv[k] = x[k]->values.data();
+        }
+        if (w.values.size() != x[0]->values.size()) {
+            w.nrows = x[0]->nrows;
+            w.values.resize(x[0]->values.size());
+            w.guard = x[0]->guard;
+        }
         w.guard.ensure();
-        x.guard.ensure();
-        y.guard.ensure();
-        ASSERT_EQ(w.values.size(), x.values.size());
-        ASSERT_EQ(x.values.size(), y.values.size());
+        double *wv = w.values.data();
+        const size_t n = w.values.size();
         #pragma omp parallel for
-        for (size_t i = 0; i < y.values.size(); i++) {
-            w.values[i] = alpha * x.values[i] + beta * y.values[i];
+        for (size_t i = 0; i < n; i++) {
+            double sum = alpha[0] * xv[0][i];
+            for (int k = 1; k < N; k++) {
+                sum += alpha[k] * xv[k][i];
+            }
+            wv[i] = sum;
         }
     }
 
@@ -120,26 +134,79 @@ public:
         }
     }
 
+    /* Nothing to overlap locally, so the dot is done here instead of allocating an await context */
     static AsyncProxy<double> AsyncDot(const VSeq &x, const VSeq &y) {
         x.guard.ensure();
         y.guard.ensure();
         ASSERT_EQ(x.values.size(), y.values.size());
-        auto context = new std::pair<const VSeq*, const VSeq*>(&x, &y);
-        return AsyncProxy<double>(0, context, &VSeq::AwaitDot);
+        double result = 0;
+        #pragma omp parallel for reduction(+ : result)
+        for (size_t i = 0; i < x.values.size(); i++) {
+            result += x.values[i] * y.values[i];
+        }
+        return AsyncProxy<double>(result);
     }
 
-    static double AwaitDot(const AsyncProxy<double> *proxy) {
-        auto context = (std::pair<const VSeq*, const VSeq*> *)proxy->context();
-        const VSeq *x = context->first;
-        const VSeq *y = context->second;
-        delete context;
+    /* rr = (r, r), ru = (r, u), wu = (w, u) in one sweep, returns bytes read.
+     * proxy_t is AsyncProxy<double>, or SyncProxy<double> that awaits when assigned. */
+    template<typename proxy_t>
+    static size_t FusedDots3(const VSeq &r, const VSeq &u, const VSeq &w,
+        proxy_t &rr, proxy_t &ru, proxy_t &wu) {
+        r.guard.ensure();
+        u.guard.ensure();
+        w.guard.ensure();
+        ASSERT_EQ(r.values.size(), u.values.size());
+        ASSERT_EQ(r.values.size(), w.values.size());
+        const double *rv = r.values.data();
+        const double *uv = u.values.data();
+        const double *wv = w.values.data();
+        const size_t n = r.values.size();
+        double rr_ = 0, ru_ = 0, wu_ = 0;
+        #pragma omp parallel for reduction(+ : rr_, ru_, wu_)
+        for (size_t i = 0; i < n; i++) {
+            const double ri = rv[i];
+            const double ui = uv[i];
+            rr_ += ri * ri;
+            ru_ += ri * ui;
+            wu_ += wv[i] * ui;
+        }
+        rr = AsyncProxy<double>(rr_);
+        ru = AsyncProxy<double>(ru_);
+        wu = AsyncProxy<double>(wu_);
+        return 3 * n * sizeof(double);
+    }
 
-        double result = 0;
-        #pragma omp parallel for reduction(+ : result)
-        for (int i = 0; i < x->values.size(); i++) {
-            result += x->values[i] * y->values[i];
+    /* All PIPECG recurrences in one sweep, returns bytes read and written:
+     *   z = beta * z + n, q = beta * q + m, p = beta * p + u, s = beta * s + w,
+     *   x += alpha * p,   u -= alpha * q,   w -= alpha * z,   r -= alpha * s */
+    static size_t PipeCGUpdate(double alpha, double beta,
+        VSeq &z, VSeq &q, VSeq &p, VSeq &s, VSeq &x, VSeq &u, VSeq &w, VSeq &r,
+        const VSeq &n, const VSeq &m) {
+        const VSeq *all[10] = {&z, &q, &p, &s, &x, &u, &w, &r, &n, &m};
+        for (int k = 0; k < 10; k++) {
+            all[k]->guard.ensure();
+            ASSERT_EQ(all[k]->values.size(), r.values.size());
+        }
+        double *zv = z.values.data(), *qv = q.values.data(), *pv = p.values.data(), *sv = s.values.data();
+        double *xv = x.values.data(), *uv = u.values.data(), *wv = w.values.data(), *rv = r.values.data();
+        const double *nv = n.values.data(), *mv = m.values.data();
+        const size_t size = r.values.size();
+        #pragma omp parallel for
+        for (size_t i = 0; i < size; i++) {
+            const double zi = beta * zv[i] + nv[i];
+            const double qi = beta * qv[i] + mv[i];
+            const double pi = beta * pv[i] + uv[i];
+            const double si = beta * sv[i] + wv[i];
+            zv[i] = zi;
+            qv[i] = qi;
+            pv[i] = pi;
+            sv[i] = si;
+            xv[i] += alpha * pi;
+            uv[i] -= alpha * qi;
+            wv[i] -= alpha * zi;
+            rv[i] -= alpha * si;
         }
-        return result;
+        return 18 * size * sizeof(double);
     }
 
 };
@@ -0,0 +1,120 @@
+import heapq
+import json
+import struct
+import sys
+
+class TraceDumpper:
+    """ Dump binary trace files written by mys_trace_export() of libmys
+    Example:
+        from mys.TraceDumpper import TraceDumpper
+        dumper = TraceDumpper(["trace/rank.000000.bin", "trace/rank.000001.bin"])
+        for event in dumper.events():
+            print(event["rank"], event["tid"], event["time"], event["words"])
+        dumper.dumpchrome("trace.json", names={1: "send", 2: "recv"})
+    Command line:
+        python3 -m mys.TraceDumpper trace.json trace/rank.*.bin
+    """
+
+    MAGIC = b"MYSTRACE"
+    HEADER = struct.Struct("<8sIiiIQQdd64s64sQ")
+
+    def __init__(self, filenames):
+        if isinstance(filenames, str):
+            filenames = [filenames]
+        self.filenames = list(filenames)
+        self.headers = [self.readheader(filename) for filename in self.filenames]
+
+    @classmethod
+    def readheader(cls, filename):
+        with open(filename, "rb") as f:
+            data = f.read(cls.HEADER.size)
+        if len(data) != cls.HEADER.size or data[:8] != cls.MAGIC:
+            raise ValueError(f"{filename} is not a libmys trace file")
+        magic, version, rank, nranks, flags, nevents, tick0, time0, freq, clock, counter, dropped = cls.HEADER.unpack(data)
+        if version != 1:
+            raise ValueError(f"{filename} has unsupported version {version}")
+        return {
+            "rank": rank,
+            "nranks": nranks,
+            "ring": bool(flags & 1),
+            "nevents": nevents,
+            "dropped": dropped,
+            "tick0": tick0,
+            "time0": time0,
+            "freq": freq,
+            "clock": clock.split(b"\0", 1)[0].decode(),
+            "counter": counter.split(b"\0", 1)[0].decode(),
+        }
+
+    def fileevents(self, index):
+        """ Yield events of one file in time order """
+        header = self.headers[index]
+        with open(self.filenames[index], "rb") as f:
+            data = f.read()
+        rank, tick0, time0, freq = header["rank"], header["tick0"], header["time0"], header["freq"]
+        pos = self.HEADER.size
+        tick, tid = tick0, 0
+        for _ in range(header["nevents"]):
+            head = data[pos]
+            pos += 1
+            etype = head & 0x7
+            if head & 0x8:
+                tid, pos = self._varint(data, pos)
+            delta, pos = self._varint(data, pos)
+            tick += delta
+            words = struct.unpack_from(f"<{etype}Q", data, pos)
+            pos += 8 * etype
+            yield {"rank": rank, "tid": tid, "time": time0 + (tick - tick0) / freq, "words": words}
+
+    def events(self):
+        """ Yield events of all files in time order """
+        streams = [self.fileevents(i) for i in range(len(self.filenames))]
+        return heapq.merge(*streams, key=lambda event: event["time"])
+
+    def dumpchrome(self, filename, names=None):
+        """ Write Chrome trace-event JSON, viewable in chrome://tracing and ui.perfetto.dev
+        Every event becomes an instant event of process `rank` and thread `tid`. The first word
+        is the event name (or names[word] if given), the other words are its arguments.
+        """
+        names = names or {}
+        with open(filename, "w") as f:
+            f.write('{"displayTimeUnit":"ns","traceEvents":[\n')
+            first = True
+            for header in sorted(self.headers, key=lambda h: h["rank"]):
+                meta = {"name": "process_name", "ph": "M", "pid": header["rank"], "args": {"name": f"rank {header['rank']}"}}
+                f.write(("" if first else ",\n") + json.dumps(meta, separators=(",", ":")))
+                first = False
+            for event in self.events():
+                words = event["words"]
+                record = {
+                    "name": names.get(words[0], str(words[0])),
+                    "ph": "i",
+                    "s": "t",
+                    "ts": event["time"] * 1e6,
+                    "pid": event["rank"],
+                    "tid": event["tid"],
+                }
+                if len(words) > 1:
+                    record["args"] = {f"u{i + 1}": words[i] for i in range(1, len(words))}
+                f.write(",\n" + json.dumps(record, separators=(",", ":")))
+            f.write("\n]}\n")
+
+    @staticmethod
+    def _varint(data, pos):
+        value, shift = 0, 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7f) << shift
+            if byte < 0x80:
+                return value, pos
+            shift += 7
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print(f"Usage: python3 -m mys.TraceDumpper OUTPUT.json TRACE.bin [TRACE.bin ...]", file=sys.stderr)
+        sys.exit(1)
+    dumper = TraceDumpper(sys.argv[2:])
+    dumper.dumpchrome(sys.argv[1])
+    total = sum(header["nevents"] for header in dumper.headers)
+    print(f"Wrote {total} events of {len(dumper.filenames)} ranks to {sys.argv[1]}")
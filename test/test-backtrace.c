@@ -0,0 +1,57 @@
+// make test-backtrace.exe && ./test-backtrace.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define NLEAKS 2000
+
+MYS_ATTR_NOINLINE static void *leak_here(mys_arena_t *arena, int depth)
+{
+    if (depth > 0)
+        return leak_here(arena, depth - 1);
+    return mys_malloc2(arena, 32);
+}
+
+MYS_ATTR_NOINLINE static void *where_am_i()
+{
+    void *addrs[1];
+    AS_EQ_I32(backtrace(addrs, 1), 1);
+    return addrs[0];
+}
+
+int main()
+{
+    // Source and symbol of a known function
+    void *addr = where_am_i();
+    char source[512];
+    char symbol[512];
+    mys_backtrace_source(addr, source, sizeof(source));
+    mys_backtrace_symbol(addr, symbol, sizeof(symbol));
+    printf("%p: %s at %s\n", addr, symbol, source);
+    AS_NE_PTR(strstr(source, "test-backtrace.c"), NULL);
+    AS_NE_PTR(strstr(symbol, "where_am_i"), NULL);
+
+    // Leak report of many records sharing few distinct frames
+    mys_arena_t *arena = mys_arena_create("leaky");
+    mys_arena_set_debug(arena, true);
+    void **ptrs = (void **)malloc(sizeof(void *) * NLEAKS);
+    for (int i = 0; i < NLEAKS; i++)
+        ptrs[i] = leak_here(arena, i % 8);
+    mys_backtrace_cache_clear();
+    double t0 = mys_hrtime();
+    mys_arena_print_leaked(arena, NLEAKS);
+    double t1 = mys_hrtime();
+    mys_arena_print_leaked(arena, NLEAKS);
+    double t2 = mys_hrtime();
+    printf("print %d leaks: %.3f sec (cold cache), %.3f sec (warm cache)\n", NLEAKS, t1 - t0, t2 - t1);
+
+    for (int i = 0; i < NLEAKS; i++)
+        mys_free2(arena, ptrs[i], 32);
+    free(ptrs);
+    mys_arena_destroy(&arena);
+    return 0;
+}
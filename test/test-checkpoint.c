@@ -0,0 +1,193 @@
+// make test-checkpoint.exe && mpirun -np 4 ./test-checkpoint.exe
+// make test-checkpoint-stub.exe && ./test-checkpoint-stub.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <omp.h>
+#include <pthread.h>
+
+#define MYS_IMPL
+#include "mys.h"
+
+#define FOLDER "/tmp/mys-test-checkpoint"
+#define NTHREADS 4
+
+// Reads a CSV written by mys_checkpoint_dump(), checks that times do not decrease, and counts lines of `name`
+static int count_dumped(const char *file, const char *name, int *total)
+{
+    FILE *fd = fopen(file, "r");
+    AS_NE_PTR(fd, NULL);
+    char line[4096];
+    AS_NE_PTR(fgets(line, sizeof(line), fd), NULL);
+    ASX_TRUE(strcmp(line, "name,time\n") == 0, "got \"%s\"", line);
+    int count = 0;
+    double last = -1;
+    *total = 0;
+    while (fgets(line, sizeof(line), fd) != NULL) {
+        char *comma = strrchr(line, ',');
+        AS_NE_PTR(comma, NULL);
+        *comma = '\0';
+        double time = atof(comma + 1);
+        AS_GE_F64(time, last);
+        last = time;
+        count += (strcmp(line, name) == 0);
+        *total += 1;
+    }
+    fclose(fd);
+    return count;
+}
+
+// Returns the aggregated line of `name`, with its fields parsed
+static bool find_aggregated(const char *file, const char *name, int *ranks, int *count, double *min, double *mean, double *max)
+{
+    FILE *fd = fopen(file, "r");
+    AS_NE_PTR(fd, NULL);
+    char line[4096];
+    AS_NE_PTR(fgets(line, sizeof(line), fd), NULL);
+    ASX_TRUE(strcmp(line, "name,ranks,count,min,mean,max,loc_min,loc_max\n") == 0, "got \"%s\"", line);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), fd) != NULL) {
+        char *comma = strchr(line, ',');
+        AS_NE_PTR(comma, NULL);
+        *comma = '\0';
+        if (strcmp(line, name) == 0) {
+            AS_EQ_I32(sscanf(comma + 1, "%d,%d,%lf,%lf,%lf", ranks, count, min, mean, max), 5);
+            found = true;
+        }
+    }
+    fclose(fd);
+    return found;
+}
+
+static uint32_t last_tid = 0;
+
+static void *record_one(void *arg)
+{
+    last_tid = (uint32_t)mys_thread_id();
+    mys_checkpoint_at(*(int *)arg);
+    return NULL;
+}
+
+// Thread ids are never reused, so short-lived threads eventually share the buffer beyond the table
+static void check_many_threads(const char *file)
+{
+    int handle = mys_checkpoint_intern("short-lived");
+    mys_checkpoint_reset();
+    int nthreads = 0;
+    while (last_tid < 4096 + 16) {
+        pthread_t thread;
+        AS_EQ_I32(pthread_create(&thread, NULL, record_one, &handle), 0);
+        AS_EQ_I32(pthread_join(thread, NULL), 0);
+        nthreads += 1;
+    }
+    int total = 0;
+    AS_EQ_I32(mys_checkpoint_dump("%s", file), 0);
+    AS_EQ_I32(count_dumped(file, "short-lived", &total), nthreads);
+    AS_EQ_I32(total, nthreads);
+}
+
+// Nanoseconds per checkpoint recorded by each of nthreads
+static double bench(int kind, int nthreads, int niters)
+{
+    int handle = mys_checkpoint_intern("bench");
+    mys_checkpoint_reset();
+    double t0 = mys_hrtime();
+    #pragma omp parallel num_threads(nthreads)
+    {
+        for (int i = 0; i < niters; i++) {
+            if (kind == 0)
+                CHECKPOINT("bench");
+            else if (kind == 1)
+                CHECKPOINT_FAST("bench");
+            else
+                mys_checkpoint_at(handle);
+        }
+    }
+    double t1 = mys_hrtime();
+    return (t1 - t0) * 1e9 / niters;
+}
+
+int main(int argc, char **argv)
+{
+    mys_MPI_Init(&argc, &argv);
+    int myrank, nranks;
+    mys_MPI_Comm_rank(mys_MPI_COMM_WORLD, &myrank);
+    mys_MPI_Comm_size(mys_MPI_COMM_WORLD, &nranks);
+    if (myrank == 0)
+        AS_EQ_I32(system("rm -rf " FOLDER), 0);
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+
+    // A name is interned once
+    int a = mys_checkpoint_intern("name-%d", 1);
+    AS_EQ_I32(mys_checkpoint_intern("name-1"), a);
+    AS_NE_I32(mys_checkpoint_intern("name-2"), a);
+
+    // Records of all threads are dumped in time order
+    char file[256];
+    int total = 0;
+    mys_checkpoint_reset();
+    #pragma omp parallel num_threads(NTHREADS)
+    {
+        for (int i = 0; i < 10000; i++)
+            CHECKPOINT_FAST("loop");
+        CHECKPOINT("thread-%d", omp_get_thread_num());
+    }
+    snprintf(file, sizeof(file), FOLDER "/rank.%06d.csv", myrank);
+    AS_EQ_I32(mys_checkpoint_dump("%s", file), 0);
+    AS_EQ_I32(count_dumped(file, "loop", &total), NTHREADS * 10000);
+    AS_EQ_I32(count_dumped(file, "thread-1", &total), 1);
+    AS_EQ_I32(total, NTHREADS * 10001);
+
+    // Reset drops records but keeps handles
+    mys_checkpoint_reset();
+    mys_checkpoint_at(a);
+    AS_EQ_I32(mys_checkpoint_dump("%s", file), 0);
+    AS_EQ_I32(count_dumped(file, "name-1", &total), 1);
+    AS_EQ_I32(total, 1);
+
+    check_many_threads(file);
+
+    // min, mean and max over ranks, for names not reached by all ranks too
+    // Reset after the barrier, so the time a rank waits in it is not recorded
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    mys_checkpoint_reset();
+    mys_busysleep(20e-3 * myrank);
+    CHECKPOINT_FAST("common");
+    CHECKPOINT_FAST("common");
+    if (myrank % 2 == 0)
+        CHECKPOINT("even-%d", 0);
+    AS_EQ_I32(mys_checkpoint_dump_aggregate(FOLDER "/aggregate.csv"), 0);
+    if (myrank == 0) {
+        int ranks, count;
+        double min, mean, max;
+        AS_TRUE(find_aggregated(FOLDER "/aggregate.csv", "common", &ranks, &count, &min, &mean, &max));
+        AS_EQ_I32(ranks, nranks);
+        AS_EQ_I32(count, 2 * nranks);
+        AS_LE_F64(min, mean);
+        AS_LE_F64(mean, max);
+        AS_GE_F64(max - min, 10e-3 * (nranks - 1)); // slack for a rank descheduled by an oversubscribed run
+        AS_TRUE(find_aggregated(FOLDER "/aggregate.csv", "even-0", &ranks, &count, &min, &mean, &max));
+        AS_EQ_I32(ranks, (nranks + 1) / 2);
+        AS_EQ_I32(count, (nranks + 1) / 2);
+        AS_LE_F64(min, mean);
+        AS_LE_F64(mean, max);
+        AS_TRUE(find_aggregated(FOLDER "/aggregate.csv", "name-2", &ranks, &count, &min, &mean, &max));
+        AS_EQ_I32(ranks, 0);
+    }
+
+    // Cost per call of CHECKPOINT(), CHECKPOINT_FAST() and mys_checkpoint_at()
+    for (int nthreads = 1; nthreads <= NTHREADS; nthreads *= NTHREADS) {
+        double formatted_ns = bench(0, nthreads, 100000);
+        double fast_ns = bench(1, nthreads, 100000);
+        double handle_ns = bench(2, nthreads, 100000);
+        ILOG(0, "%d threads: CHECKPOINT %.1f ns/call, CHECKPOINT_FAST %.1f ns/call, mys_checkpoint_at %.1f ns/call",
+            nthreads, formatted_ns, fast_ns, handle_ns);
+    }
+    mys_checkpoint_reset();
+
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    if (myrank == 0)
+        AS_EQ_I32(system("rm -rf " FOLDER), 0);
+    mys_MPI_Finalize();
+    return 0;
+}
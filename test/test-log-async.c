@@ -0,0 +1,191 @@
+// make test-log-async.exe && ./test-log-async.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <omp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define MAX_THREADS 8
+
+typedef struct capture_t {
+    size_t count;
+    int last[MAX_THREADS]; // last sequence number of each thread
+    bool ordered;
+    double delay; // seconds spent in each handler call, to simulate a slow sink
+    char text[4096]; // last message
+} capture_t;
+
+static void capture_handler(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata)
+{
+    (void)logger;
+    capture_t *capture = (capture_t *)udata;
+    int thread = -1, seq = -1;
+    if (event->no_vargs)
+        snprintf(capture->text, sizeof(capture->text), "%s", fmt);
+    else
+        vsnprintf(capture->text, sizeof(capture->text), fmt, vargs);
+    if (sscanf(capture->text, "thread %d seq %d", &thread, &seq) == 2) {
+        capture->ordered = capture->ordered && (seq == capture->last[thread] + 1);
+        capture->last[thread] = seq;
+    }
+    capture->count += 1;
+    if (capture->delay > 0)
+        mys_busysleep(capture->delay);
+}
+
+static void reset_capture(capture_t *capture, double delay)
+{
+    capture->count = 0;
+    for (int i = 0; i < MAX_THREADS; i++)
+        capture->last[i] = -1;
+    capture->ordered = true;
+    capture->delay = delay;
+}
+
+// Logs nper messages from each of nthreads, returns nanoseconds per call seen by a logging thread
+static double log_burst(mys_log_t *logger, int nthreads, int nper)
+{
+    double t0 = mys_hrtime();
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int me = omp_get_thread_num();
+        for (int i = 0; i < nper; i++)
+            mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "thread %d seq %d value %f", me, i, i * 0.5);
+    }
+    double t1 = mys_hrtime();
+    return (t1 - t0) * 1e9 / nper;
+}
+
+// Nanoseconds per call of one thread logging through the async queue, formatted or deferred
+static double log_deferred_burst(mys_log_t *logger, int nper, bool deferred)
+{
+    double t0 = mys_hrtime();
+    for (int i = 0; i < nper; i++) {
+        if (deferred)
+            MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "step %d residual %.6e time %f %s", i, i * 1e-3, i * 0.5, "ok");
+        else
+            mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "step %d residual %.6e time %f %s", i, i * 1e-3, i * 0.5, "ok");
+    }
+    double t1 = mys_hrtime();
+    return (t1 - t0) * 1e9 / nper;
+}
+
+int main()
+{
+    mys_debug_init();
+    capture_t capture;
+    mys_log_t *logger = mys_log_create("async");
+    mys_log_add_handler(logger, capture_handler, &capture);
+
+    // Backpressure keeps every record and the order of each thread
+    reset_capture(&capture, 0);
+    AS_EQ_I32(mys_log_set_async(logger, 64, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL), 0);
+    log_burst(logger, MAX_THREADS, 10000);
+    mys_log_flush(logger);
+    AS_EQ_SIZET(capture.count, (size_t)MAX_THREADS * 10000);
+    AS_TRUE(capture.ordered);
+    AS_EQ_SIZET(mys_log_dropped(logger), 0);
+
+    // Records at flush_level are handled before the call returns
+    reset_capture(&capture, 0);
+    AS_EQ_I32(mys_log_set_async(logger, 1024, MYS_LOG_ASYNC_BLOCK, MYS_LOG_ERROR), 0);
+    mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "before the error");
+    mys_log_self(logger, MYS_LOG_ERROR, __FILE__, __LINE__, "the error");
+    AS_EQ_SIZET(capture.count, 2);
+
+    // A slow sink drops records instead of stalling the loggers
+    reset_capture(&capture, 10e-6);
+    AS_EQ_I32(mys_log_set_async(logger, 16, MYS_LOG_ASYNC_DROP, MYS_LOG_FATAL), 0);
+    log_burst(logger, 2, 5000);
+    mys_log_flush(logger);
+    size_t dropped = mys_log_dropped(logger);
+    AS_GT_SIZET(dropped, 0);
+    AS_EQ_SIZET(capture.count + dropped, 2 * 5000);
+    ILOG(0, "slow sink: handled %zu, dropped %zu", capture.count, dropped);
+
+    // Going back to synchronous mode flushes queued records
+    reset_capture(&capture, 0);
+    AS_EQ_I32(mys_log_set_async(logger, 1024, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL), 0);
+    log_burst(logger, 1, 100);
+    AS_EQ_I32(mys_log_set_async(logger, 0, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL), 0);
+    AS_EQ_SIZET(capture.count, 100);
+    AS_TRUE(capture.ordered);
+    AS_NE_I32(mys_log_set_async(logger, 16, 42, MYS_LOG_FATAL), 0);
+
+    // Deferred records render the same text as printf
+    char expect[4096];
+    char long_str[1000];
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+    long page = sysconf(_SC_PAGESIZE);
+    char *pages = (char *)mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    AS_NE_PTR(pages, MAP_FAILED);
+    AS_EQ_I32(mprotect(pages + page, page, PROT_NONE), 0);
+    char *guarded = pages + page - 3;
+    memcpy(guarded, "abc", 3);
+    AS_EQ_I32(mys_log_set_async(logger, 1024, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL), 0);
+    for (int round = 0; round < 2; round++) { // the first round parses the formats
+        void *ptr = &capture;
+        MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "%d %5.2f %s|%-8s| %llu %zu %p %c %% %*d %.*s %Lf %lx %hhd %jd %td %+.3e %#x",
+            -42, 3.14159, "str", "left", 1ULL << 40, (size_t)7, ptr, 'z', 6, 17, 3, "abcdef", (long double)2.5, 0xfeedL, (signed char)-3, (intmax_t)-9, (ptrdiff_t)11, 6.02e23, 255);
+        mys_log_flush(logger);
+        snprintf(expect, sizeof(expect), "%d %5.2f %s|%-8s| %llu %zu %p %c %% %*d %.*s %Lf %lx %hhd %jd %td %+.3e %#x",
+            -42, 3.14159, "str", "left", 1ULL << 40, (size_t)7, ptr, 'z', 6, 17, 3, "abcdef", (long double)2.5, 0xfeedL, (signed char)-3, (intmax_t)-9, (ptrdiff_t)11, 6.02e23, 255);
+        ASX_TRUE(strcmp(capture.text, expect) == 0, "got \"%s\"", capture.text);
+        // Long strings are truncated, later arguments are kept
+        MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "[%s] %d", long_str, 99);
+        mys_log_flush(logger);
+        AS_GT_SIZET(strlen(capture.text), 400);
+        AS_LT_SIZET(strlen(capture.text), 480);
+        ASX_TRUE(strcmp(capture.text + strlen(capture.text) - 4, "] 99") == 0, "got \"%s\"", capture.text + strlen(capture.text) - 4);
+        // Precision bounds the copy: a string that is not null-terminated ends at a guard page, and the
+        // 3 bytes kept of the first string leave the rest of the record to the second one
+        MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "%.3s %.*s %.3s %s", guarded, 2, guarded + 1, long_str, long_str);
+        mys_log_flush(logger);
+        ASX_TRUE(strncmp(capture.text, "abc bc xxx xxx", 14) == 0, "got \"%s\"", capture.text);
+        AS_GT_SIZET(strlen(capture.text), 400);
+        // Formats that cannot be deferred are formatted by the logging thread
+        MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "%2$s %1$d", 5, "five");
+        mys_log_flush(logger);
+        ASX_TRUE(strcmp(capture.text, "five 5") == 0, "got \"%s\"", capture.text);
+    }
+    munmap(pages, 2 * page);
+    AS_EQ_I32(mys_log_set_async(logger, 0, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL), 0);
+    MYS_LOG_DEFER(logger, 0, MYS_LOG_INFO, "sync %s %d", "mode", 1);
+    ASX_TRUE(strcmp(capture.text, "sync mode 1") == 0, "got \"%s\"", capture.text);
+    mys_log_destroy(&logger);
+
+    // Latency of logging to a file through the stdio handler
+    FILE *devnull = fopen("/dev/null", "w");
+    logger = mys_log_create("bench");
+    mys_log_add_handler(logger, mys_log_stdio_handler1, devnull);
+    for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= MAX_THREADS) {
+        double sync_ns = log_burst(logger, nthreads, 20000);
+        mys_log_set_async(logger, 4096, MYS_LOG_ASYNC_DROP, MYS_LOG_FATAL);
+        double drop_ns = log_burst(logger, nthreads, 20000);
+        mys_log_set_async(logger, 4096, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL);
+        double block_ns = log_burst(logger, nthreads, 20000);
+        mys_log_set_async(logger, 0, MYS_LOG_ASYNC_BLOCK, MYS_LOG_FATAL);
+        ILOG(0, "%d threads on %d cores: sync %.1f ns/call, async drop %.1f ns/call, async block %.1f ns/call",
+            nthreads, omp_get_num_procs(), sync_ns, drop_ns, block_ns);
+    }
+    mys_log_set_async(logger, 1 << 15, MYS_LOG_ASYNC_DROP, MYS_LOG_FATAL);
+    log_deferred_burst(logger, 20000, false); // touch the queue
+    mys_log_flush(logger);
+    double formatted_ns = log_deferred_burst(logger, 20000, false);
+    mys_log_flush(logger);
+    double deferred_ns = log_deferred_burst(logger, 20000, true);
+    mys_log_flush(logger);
+    ILOG(0, "async formatted %.1f ns/call, async deferred %.1f ns/call, dropped %zu", formatted_ns, deferred_ns, mys_log_dropped(logger));
+    mys_log_destroy(&logger);
+    fclose(devnull);
+
+    mys_arena_sync(MYS_ARENA_LOG);
+    ILOG(0, "arena log alive %zu", MYS_ARENA_LOG->alive);
+    return 0;
+}
@@ -0,0 +1,54 @@
+// make test-log-once.exe && ./test-log-once.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <omp.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+static void count_handler(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata)
+{
+    (void)logger; (void)event; (void)fmt; (void)vargs;
+    size_t *count = (size_t *)udata;
+    *count += 1; // handlers are called under the logger lock
+}
+
+int main()
+{
+    mys_debug_init();
+    size_t count = 0;
+    mys_log_t *logger = mys_log_create("once");
+    mys_log_add_handler(logger, count_handler, &count);
+
+    // Every call site logs once, whatever the number of threads and calls
+    #pragma omp parallel num_threads(8)
+    {
+        for (int i = 0; i < 1000; i++) {
+            MYS_LOG_ONCE(logger, MYS_LOG_INFO, "site A thread %d iter %d", omp_get_thread_num(), i);
+            MYS_LOG_ONCE(logger, MYS_LOG_INFO, "site B thread %d iter %d", omp_get_thread_num(), i);
+            mys_log_once(logger, MYS_LOG_INFO, __FILE__, __LINE__, "site C thread %d iter %d", omp_get_thread_num(), i);
+        }
+    }
+    AS_EQ_SIZET(count, 3);
+    mys_log_destroy(&logger);
+
+    // Cost of a call site that has already fired
+    const int niters = 1000000;
+    double t0, t1;
+    t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++)
+        ILOG_ONCE("fired %d", i);
+    t1 = mys_hrtime();
+    double site_ns = (t1 - t0) * 1e9 / niters;
+    mys_log_silent(MYS_LOGGER_G, true);
+    t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++)
+        mys_log_once(MYS_LOGGER_G, MYS_LOG_INFO, __FILE__, __LINE__, "fired %d", i);
+    t1 = mys_hrtime();
+    double map_ns = (t1 - t0) * 1e9 / niters;
+    mys_log_silent(MYS_LOGGER_G, false);
+    ILOG(0, "fired LOG_ONCE: call site flag %.2f ns/call, file:line map %.2f ns/call", site_ns, map_ns);
+    return 0;
+}
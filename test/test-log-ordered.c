@@ -0,0 +1,159 @@
+// make test-log-ordered.exe && mpirun -np 4 ./test-log-ordered.exe
+// make test-log-ordered-stub.exe && ./test-log-ordered-stub.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_LOG_ORDERED_ROUND 4096 // gather large batches in several rounds, as if beyond 2 GiB
+#include "mys.h"
+
+#define MAX_CAPTURE 4096
+
+typedef struct capture_t {
+    int count;
+    int ranks[MAX_CAPTURE];
+    int seqs[MAX_CAPTURE];
+} capture_t;
+
+static void capture_handler(mys_log_t *logger, mys_log_event_t *event, const char *fmt, va_list vargs, void *udata)
+{
+    (void)logger;
+    capture_t *capture = (capture_t *)udata;
+    char text[256];
+    if (event->no_vargs)
+        snprintf(text, sizeof(text), "%s", fmt);
+    else
+        vsnprintf(text, sizeof(text), fmt, vargs);
+    int rank = -1, seq = -1;
+    AS_EQ_I32(sscanf(text, "rank %d seq %d", &rank, &seq), 2);
+    AS_EQ_I32(rank, event->myrank);
+    AS_LT_I32(capture->count, MAX_CAPTURE);
+    capture->ranks[capture->count] = rank;
+    capture->seqs[capture->count] = seq;
+    capture->count += 1;
+}
+
+// The former implementation: rank 0 probes and receives every rank in turn
+static void legacy_ordered(mys_log_t *logger, mys_MPI_Comm comm, const char *fmt, ...)
+{
+    int myrank, nranks;
+    mys_MPI_Comm_rank(comm, &myrank);
+    mys_MPI_Comm_size(comm, &nranks);
+    const int tag = 2717;
+    char buffer[4096];
+    va_list vargs;
+    va_start(vargs, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, vargs);
+    va_end(vargs);
+    if (myrank == 0) {
+        mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "%s", buffer);
+        for (int rank = 1; rank < nranks; rank++) {
+            mys_MPI_Status status;
+            int needed = 0;
+            mys_MPI_Probe(rank, tag, comm, &status);
+            mys_MPI_Get_count(&status, mys_MPI_CHAR, &needed);
+            mys_MPI_Recv(buffer, needed, mys_MPI_CHAR, rank, tag, comm, mys_MPI_STATUS_IGNORE);
+            mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "%s", buffer);
+        }
+    } else {
+        mys_MPI_Send(buffer, (int)strlen(buffer) + 1, mys_MPI_CHAR, 0, tag, comm);
+    }
+    mys_MPI_Barrier(comm);
+}
+
+int main(int argc, char **argv)
+{
+    mys_MPI_Init(&argc, &argv);
+    int myrank, nranks;
+    mys_MPI_Comm_rank(mys_MPI_COMM_WORLD, &myrank);
+    mys_MPI_Comm_size(mys_MPI_COMM_WORLD, &nranks);
+
+    capture_t *capture = (capture_t *)calloc(1, sizeof(capture_t));
+    mys_log_t *logger = mys_log_create("ordered");
+    mys_log_add_handler(logger, capture_handler, capture);
+
+    // Each call prints one message per rank, in rank order
+    for (int seq = 0; seq < 3; seq++)
+        mys_log_ordered(logger, MYS_LOG_INFO, __FILE__, __LINE__, "rank %d seq %d", myrank, seq);
+    if (myrank == 0) {
+        AS_EQ_I32(capture->count, 3 * nranks);
+        for (int i = 0; i < capture->count; i++) {
+            AS_EQ_I32(capture->seqs[i], i / nranks);
+            AS_EQ_I32(capture->ranks[i], i % nranks);
+        }
+    }
+
+    // A batch prints all messages of rank 0, then of rank 1, ...
+    capture->count = 0;
+    mys_log_ordered_batch_begin(logger);
+    for (int seq = 0; seq <= myrank % 4; seq++)
+        mys_log_ordered(logger, MYS_LOG_INFO, __FILE__, __LINE__, "rank %d seq %d", myrank, seq);
+    mys_log_ordered_batch_end(logger);
+    if (myrank == 0) {
+        int i = 0;
+        for (int rank = 0; rank < nranks; rank++) {
+            for (int seq = 0; seq <= rank % 4; seq++, i++) {
+                AS_EQ_I32(capture->ranks[i], rank);
+                AS_EQ_I32(capture->seqs[i], seq);
+            }
+        }
+        AS_EQ_I32(capture->count, i);
+    }
+
+    // A batch larger than one round of the gather keeps the order
+    capture->count = 0;
+    mys_log_ordered_batch_begin(logger);
+    for (int seq = 0; seq < 100 + myrank; seq++)
+        mys_log_ordered(logger, MYS_LOG_INFO, __FILE__, __LINE__, "rank %d seq %d", myrank, seq);
+    mys_log_ordered_batch_end(logger);
+    if (myrank == 0) {
+        int i = 0;
+        for (int rank = 0; rank < nranks; rank++) {
+            for (int seq = 0; seq < 100 + rank; seq++, i++) {
+                AS_EQ_I32(capture->ranks[i], rank);
+                AS_EQ_I32(capture->seqs[i], seq);
+            }
+        }
+        AS_EQ_I32(capture->count, i);
+    }
+    mys_log_destroy(&logger);
+    free(capture);
+
+    // Latency of one ordered message on every rank, printed to /dev/null by rank 0
+    FILE *devnull = fopen("/dev/null", "w");
+    logger = mys_log_create("bench");
+    mys_log_add_handler(logger, mys_log_stdio_handler1, devnull);
+    const int niters = 200;
+    double t0, t1;
+
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++)
+        legacy_ordered(logger, mys_MPI_COMM_WORLD, "rank %d seq %d", myrank, i);
+    t1 = mys_hrtime();
+    double legacy_us = (t1 - t0) * 1e6 / niters;
+
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++)
+        mys_log_ordered(logger, MYS_LOG_INFO, __FILE__, __LINE__, "rank %d seq %d", myrank, i);
+    t1 = mys_hrtime();
+    double gather_us = (t1 - t0) * 1e6 / niters;
+
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    mys_log_ordered_batch_begin(logger);
+    for (int i = 0; i < niters; i++)
+        mys_log_ordered(logger, MYS_LOG_INFO, __FILE__, __LINE__, "rank %d seq %d", myrank, i);
+    mys_log_ordered_batch_end(logger);
+    t1 = mys_hrtime();
+    double batch_us = (t1 - t0) * 1e6 / niters;
+
+    mys_log_destroy(&logger);
+    fclose(devnull);
+    ILOG(0, "%d ranks (%s): probe loop %.2f us/call, gather %.2f us/call, batched %.2f us/call",
+        nranks, mys_hrname(), legacy_us, gather_us, batch_us);
+    mys_MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,138 @@
+// make test-memory-region.exe && ./test-memory-region.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define NTEMPS 64
+
+static void check_semantics()
+{
+    mys_arena_t *arena = mys_arena_create_region("region-check", 4096);
+    AS_NE_PTR(arena, NULL);
+    AS_EQ_I32(mys_arena_set_backend(arena, MYS_ARENA_BACKEND_LIBC), MYS_EBUSY);
+
+    // pop the most recent allocation
+    void *a = mys_malloc2(arena, 100);
+    mys_free2(arena, a, 100);
+    void *b = mys_malloc2(arena, 100);
+    AS_EQ_PTR(a, b);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->alive, 100);
+
+    // alignment and in-place realloc of the top allocation
+    void *c = mys_aligned_alloc2(arena, 256, 10);
+    AS_EQ_SIZET((uintptr_t)c % 256, 0);
+    void *d = mys_realloc2(arena, c, 1000, 10);
+    AS_EQ_PTR(c, d);
+
+    // rewind to a mark, including oversized and multiple chunks
+    mys_arena_mark_t mark = mys_arena_mark(arena);
+    mys_arena_sync(arena);
+    size_t alive = arena->alive;
+    void *e = mys_malloc2(arena, 64);
+    for (int i = 0; i < 100; i++)
+        memset(mys_malloc2(arena, 1000), 0xCC, 1000);
+    memset(mys_malloc2(arena, 100000), 0xCC, 100000);
+    mys_arena_rewind(arena, mark);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->alive, alive);
+    void *f = mys_malloc2(arena, 64);
+    AS_EQ_PTR(e, f);
+
+    // reset everything, leaving nothing leaked
+    mys_arena_reset(arena);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->alive, 0);
+    AS_EQ_SIZET(arena->freed, arena->total);
+    mys_arena_destroy(&arena);
+
+    // debug records are dropped by rewind, so leak reports stay accurate
+    arena = mys_arena_create_region("region-debug", 4096);
+    mys_arena_set_debug(arena, true);
+    void *kept = mys_malloc2(arena, 32);
+    mark = mys_arena_mark(arena);
+    for (int i = 0; i < 10; i++)
+        mys_malloc2(arena, 1000);
+    mys_arena_rewind(arena, mark);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->_alive_count, 1);
+    mys_free2(arena, kept, 32);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->_alive_count, 0);
+    mys_arena_destroy(&arena);
+}
+
+static double iteration_malloc(int niters)
+{
+    void *temps[NTEMPS];
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        for (int j = 0; j < NTEMPS; j++) {
+            temps[j] = malloc(16 + (size_t)j * 24);
+            ((volatile char *)temps[j])[0] = (char)j;
+        }
+        for (int j = 0; j < NTEMPS; j++)
+            free(temps[j]);
+    }
+    return mys_hrtime() - t0;
+}
+
+static double iteration_arena(mys_arena_t *arena, int niters)
+{
+    void *temps[NTEMPS];
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        for (int j = 0; j < NTEMPS; j++) {
+            temps[j] = mys_malloc2(arena, 16 + (size_t)j * 24);
+            ((volatile char *)temps[j])[0] = (char)j;
+        }
+        for (int j = 0; j < NTEMPS; j++)
+            mys_free2(arena, temps[j], 16 + (size_t)j * 24);
+    }
+    return mys_hrtime() - t0;
+}
+
+static double iteration_region(mys_arena_t *arena, int niters)
+{
+    void *temps[NTEMPS];
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        mys_arena_mark_t mark = mys_arena_mark(arena);
+        for (int j = 0; j < NTEMPS; j++) {
+            temps[j] = mys_malloc2(arena, 16 + (size_t)j * 24);
+            ((volatile char *)temps[j])[0] = (char)j;
+        }
+        mys_arena_rewind(arena, mark);
+    }
+    return mys_hrtime() - t0;
+}
+
+int main(int argc, char **argv)
+{
+    int niters = (argc > 1) ? atoi(argv[1]) : 100000;
+    check_semantics();
+
+    mys_arena_t *user = mys_arena_create("user");
+    mys_arena_t *region = mys_arena_create_region("region", 64 * 1024);
+    iteration_region(region, niters / 10); // warmup
+    double t_malloc = iteration_malloc(niters);
+    double t_arena = iteration_arena(user, niters);
+    double t_region = iteration_region(region, niters);
+    mys_arena_sync(user);
+    mys_arena_sync(region);
+    AS_EQ_SIZET(user->alive, 0);
+    AS_EQ_SIZET(region->alive, 0);
+    mys_arena_destroy(&user);
+    mys_arena_destroy(&region);
+
+    double nallocs = (double)niters * NTEMPS;
+    printf("%-20s %12s\n", "method", "ns/alloc");
+    printf("%-20s %12.2f\n", "malloc/free", t_malloc / nallocs * 1e9);
+    printf("%-20s %12.2f\n", "mys_malloc2/free2", t_arena / nallocs * 1e9);
+    printf("%-20s %12.2f\n", "region mark/rewind", t_region / nallocs * 1e9);
+    return 0;
+}
@@ -0,0 +1,89 @@
+// make test-memory-sampling.exe && ./test-memory-sampling.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define NOBJS 100000
+
+// Allocate NOBJS objects, free about half of them and compare the estimated leak with the truth.
+static void check_estimate(size_t sample_bytes, uint8_t **ptrs, size_t *sizes)
+{
+    mys_arena_t *arena = mys_arena_create("sampled");
+    mys_arena_set_debug(arena, true);
+    mys_arena_set_debug_sampling(arena, sample_bytes);
+    size_t leaked_count = 0;
+    size_t leaked_bytes = 0;
+    for (size_t i = 0; i < NOBJS; i++) {
+        sizes[i] = (size_t)mys_rand_i64(16, 1025);
+        ptrs[i] = (uint8_t *)mys_malloc2(arena, sizes[i]);
+    }
+    for (size_t i = 0; i < NOBJS; i++) {
+        if (mys_rand_i64(0, 2) == 0) {
+            mys_free2(arena, ptrs[i], sizes[i]);
+            ptrs[i] = NULL;
+        } else {
+            leaked_count += 1;
+            leaked_bytes += sizes[i];
+        }
+    }
+    size_t est_count = 0;
+    size_t est_bytes = 0;
+    mys_arena_debug_estimate(arena, &est_count, &est_bytes);
+    printf("sample %8zu: leaked %zu pointers (estimated %zu), %zu bytes (estimated %zu)\n",
+        sample_bytes, leaked_count, est_count, leaked_bytes, est_bytes);
+    AS_LT_F64(mys_math_fabs((double)est_bytes - (double)leaked_bytes) / (double)leaked_bytes, 0.15);
+    AS_LT_F64(mys_math_fabs((double)est_count - (double)leaked_count) / (double)leaked_count, 0.15);
+
+    for (size_t i = 0; i < NOBJS; i++) {
+        if (ptrs[i] != NULL)
+            mys_free2(arena, ptrs[i], sizes[i]);
+    }
+    mys_arena_debug_estimate(arena, &est_count, &est_bytes);
+    AS_EQ_SIZET(est_count, 0);
+    AS_EQ_SIZET(est_bytes, 0);
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->alive, 0);
+    AS_EQ_SIZET(arena->_alive_count, 0);
+    mys_arena_destroy(&arena);
+}
+
+static double bench(bool debug, size_t sample_bytes, int nrounds)
+{
+    void *objs[64];
+    mys_arena_t *arena = mys_arena_create("bench");
+    mys_arena_set_debug(arena, debug);
+    if (sample_bytes > 0)
+        mys_arena_set_debug_sampling(arena, sample_bytes);
+    double t0 = mys_hrtime();
+    for (int r = 0; r < nrounds; r++) {
+        for (int i = 0; i < 64; i++)
+            objs[i] = mys_malloc2(arena, 16 + (size_t)i * 8);
+        for (int i = 0; i < 64; i++)
+            mys_free2(arena, objs[i], 16 + (size_t)i * 8);
+    }
+    double t = mys_hrtime() - t0;
+    mys_arena_destroy(&arena);
+    return t / (64.0 * nrounds) * 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    int nrounds = (argc > 1) ? atoi(argv[1]) : 20000;
+    uint8_t **ptrs = (uint8_t **)calloc(sizeof(uint8_t *), NOBJS);
+    size_t *sizes = (size_t *)calloc(sizeof(size_t), NOBJS);
+    mys_rand_seed(20250101);
+    check_estimate(4 * 1024, ptrs, sizes);
+    check_estimate(16 * 1024, ptrs, sizes);
+
+    printf("%-24s %12s\n", "mode", "ns/alloc");
+    printf("%-24s %12.2f\n", "no debug", bench(false, 0, nrounds));
+    printf("%-24s %12.2f\n", "sampled (512 KiB)", bench(true, 512 * 1024, nrounds));
+    printf("%-24s %12.2f\n", "full debug", bench(true, 0, nrounds / 100 + 1));
+    free(ptrs);
+    free(sizes);
+    return 0;
+}
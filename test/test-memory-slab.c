@@ -0,0 +1,163 @@
+// make test-memory-slab.exe && ./test-memory-slab.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+static bool fpass_path(mys_string_t *buf, const char *pass_spec, void *pass_ctx)
+{
+    (void)pass_spec;
+    mys_string_append(buf, (const char *)pass_ctx);
+    return true;
+}
+
+static double workload_string(int niters)
+{
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        mys_string_t *str = mys_string_create();
+        for (int j = 0; j < 8; j++)
+            mys_string_fmt(str, "[%d:%d] value=%.3f name=%s;", i, j, i * 0.5, "libmys");
+        mys_string_t *copy = mys_string_create2("%s", str->text);
+        mys_string_destroy(&copy);
+        mys_string_destroy(&str);
+    }
+    return mys_hrtime() - t0;
+}
+
+static double workload_format(int niters)
+{
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        mys_fmter_t *fmter = mys_fmter_create();
+        mys_fmter_register_pass(fmter, "path", fpass_path);
+        mys_fmtex_t *fmtex = mys_fmter_compile(fmter, "[{path:s}] direct text {path:l} and more text\n");
+        for (int j = 0; j < 4; j++) {
+            mys_string_t *out = mys_fmtex_apply(fmtex, (void *)"/A/B/C/a.c");
+            mys_string_destroy(&out);
+        }
+        mys_fmtex_free(&fmtex);
+        mys_fmter_destroy(&fmter);
+    }
+    return mys_hrtime() - t0;
+}
+
+static double workload_random(mys_arena_t *arena, int niters, uint8_t **ptrs, size_t *sizes, size_t nslot)
+{
+    double t0 = mys_hrtime();
+    for (int i = 0; i < niters; i++) {
+        size_t k = (size_t)mys_rand_i64(0, (int64_t)nslot - 1);
+        if (ptrs[k] != NULL) {
+            AS_EQ_U32(ptrs[k][sizes[k] - 1], (uint32_t)(sizes[k] & 0xFF));
+            mys_free2(arena, ptrs[k], sizes[k]);
+            ptrs[k] = NULL;
+        } else {
+            sizes[k] = (size_t)mys_rand_i64(1, (k % 16 == 0) ? 64 * 1024 : 512);
+            ptrs[k] = (uint8_t *)mys_malloc2(arena, sizes[k]);
+            ptrs[k][sizes[k] - 1] = (uint8_t)(sizes[k] & 0xFF);
+        }
+    }
+    for (size_t k = 0; k < nslot; k++) {
+        if (ptrs[k] != NULL)
+            mys_free2(arena, ptrs[k], sizes[k]);
+        ptrs[k] = NULL;
+    }
+    return mys_hrtime() - t0;
+}
+
+#define NXTHREADS 8
+#define NXOBJS 1024
+
+typedef struct cross_t {
+    mys_arena_t *arena;
+    uint8_t *objs[NXTHREADS][NXOBJS];
+    pthread_barrier_t barrier;
+    int id;
+} cross_t;
+
+// Every thread fills its row, then frees the row of its neighbor, through the per-thread caches
+static void *cross_main(void *arg)
+{
+    cross_t *x = (cross_t *)arg;
+    int me = mys_atomic_fetch_add(&x->id, 1, MYS_ATOMIC_RELAXED);
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < NXOBJS; i++) {
+            size_t size = 16 + (size_t)(i % 64) * 24;
+            x->objs[me][i] = (uint8_t *)mys_malloc2(x->arena, size);
+            memset(x->objs[me][i], me + 1, size);
+        }
+        pthread_barrier_wait(&x->barrier);
+        int victim = (me + 1 + round) % NXTHREADS;
+        for (int i = 0; i < NXOBJS; i++) {
+            size_t size = 16 + (size_t)(i % 64) * 24;
+            AS_EQ_U32(x->objs[victim][i][0], (uint32_t)(victim + 1));
+            AS_EQ_U32(x->objs[victim][i][size - 1], (uint32_t)(victim + 1));
+            mys_free2(x->arena, x->objs[victim][i], size);
+        }
+        pthread_barrier_wait(&x->barrier);
+    }
+    return NULL;
+}
+
+static void check_cross_thread()
+{
+    cross_t *x = (cross_t *)calloc(1, sizeof(cross_t));
+    x->arena = mys_arena_create("slab-cross");
+    AS_EQ_I32(mys_arena_set_backend(x->arena, MYS_ARENA_BACKEND_SLAB), 0);
+    pthread_barrier_init(&x->barrier, NULL, NXTHREADS);
+    pthread_t threads[NXTHREADS];
+    for (int t = 0; t < NXTHREADS; t++)
+        AS_EQ_I32(pthread_create(&threads[t], NULL, cross_main, x), 0);
+    for (int t = 0; t < NXTHREADS; t++)
+        AS_EQ_I32(pthread_join(threads[t], NULL), 0);
+    pthread_barrier_destroy(&x->barrier);
+    mys_arena_sync(x->arena);
+    AS_EQ_SIZET(x->arena->alive, 0);
+    mys_arena_destroy(&x->arena);
+    free(x);
+}
+
+int main(int argc, char **argv)
+{
+    check_cross_thread();
+    mys_rand_seed_hardware();
+    int niters = (argc > 1) ? atoi(argv[1]) : 200000;
+    size_t nslot = 4096;
+    uint8_t **ptrs = (uint8_t **)calloc(sizeof(uint8_t *), nslot);
+    size_t *sizes = (size_t *)calloc(sizeof(size_t), nslot);
+    int backends[2] = {MYS_ARENA_BACKEND_LIBC, MYS_ARENA_BACKEND_SLAB};
+    const char *names[2] = {"glibc", "slab"};
+    double times[3][2];
+
+    for (int b = 0; b < 2; b++) {
+        AS_EQ_I32(mys_arena_set_backend(MYS_ARENA_STR, backends[b]), 0);
+        AS_EQ_I32(mys_arena_set_backend(MYS_ARENA_FORMAT, backends[b]), 0);
+        workload_string(niters / 10); // warmup
+        times[0][b] = workload_string(niters);
+        times[1][b] = workload_format(niters / 4);
+        mys_arena_t *arena = mys_arena_create(names[b]);
+        AS_EQ_I32(mys_arena_set_backend(arena, backends[b]), 0);
+        times[2][b] = workload_random(arena, niters * 4, ptrs, sizes, nslot);
+        mys_arena_sync(arena);
+        AS_EQ_SIZET(arena->alive, 0);
+        AS_EQ_SIZET(arena->freed, arena->total);
+        mys_arena_destroy(&arena);
+        mys_arena_sync(MYS_ARENA_STR);
+        mys_arena_sync(MYS_ARENA_FORMAT);
+        AS_EQ_SIZET(MYS_ARENA_STR->alive, 0);
+        AS_EQ_SIZET(MYS_ARENA_FORMAT->alive, 0);
+    }
+
+    const char *workloads[3] = {"string", "format", "random"};
+    printf("%-8s %14s %14s %8s\n", "workload", "glibc(ms)", "slab(ms)", "speedup");
+    for (int w = 0; w < 3; w++)
+        printf("%-8s %14.3f %14.3f %7.2fx\n", workloads[w], times[w][0] * 1e3, times[w][1] * 1e3, times[w][0] / times[w][1]);
+
+    free(ptrs);
+    free(sizes);
+    return 0;
+}
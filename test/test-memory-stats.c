@@ -0,0 +1,135 @@
+// make test-memory-stats.exe && ./test-memory-stats.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <omp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define NLIVE 64
+
+// Each thread allocates NLIVE small objects then frees them, with mys_malloc2/mys_free2 or libc directly.
+static double bench(mys_arena_t *arena, int nthreads, int nrounds)
+{
+    double t0 = mys_hrtime();
+    #pragma omp parallel num_threads(nthreads)
+    {
+        void *objs[NLIVE];
+        for (int round = 0; round < nrounds; round++) {
+            for (int i = 0; i < NLIVE; i++) {
+                size_t size = 16 + (size_t)i * 8;
+                objs[i] = (arena != NULL) ? mys_malloc2(arena, size) : malloc(size);
+                ((volatile char *)objs[i])[0] = (char)i;
+            }
+            for (int i = 0; i < NLIVE; i++) {
+                size_t size = 16 + (size_t)i * 8;
+                if (arena != NULL)
+                    mys_free2(arena, objs[i], size);
+                else
+                    free(objs[i]);
+            }
+        }
+    }
+    return mys_hrtime() - t0;
+}
+
+#define NWAVES 4
+#define NWAVE_THREADS 96 // more live threads than stat shards
+
+static void *churn_main(void *arg)
+{
+    mys_arena_t *arena = (mys_arena_t *)arg;
+    void *objs[NLIVE];
+    for (int round = 0; round < 200; round++) {
+        for (int i = 0; i < NLIVE; i++)
+            objs[i] = mys_malloc2(arena, 16 + (size_t)i * 8);
+        for (int i = 0; i < NLIVE; i++)
+            mys_free2(arena, objs[i], 16 + (size_t)i * 8);
+    }
+    // Leave one object to be freed by the main thread after this thread exited
+    return mys_malloc2(arena, 1024);
+}
+
+// Waves of short-lived threads, more than the shards at once, must keep counters exact
+static void check_churn(size_t bytes_per_round)
+{
+    mys_arena_t *arena = mys_arena_create("churn");
+    pthread_t threads[NWAVE_THREADS];
+    for (int wave = 0; wave < NWAVES; wave++) {
+        for (int t = 0; t < NWAVE_THREADS; t++)
+            AS_EQ_I32(pthread_create(&threads[t], NULL, churn_main, arena), 0);
+        for (int t = 0; t < NWAVE_THREADS; t++) {
+            void *left = NULL;
+            AS_EQ_I32(pthread_join(threads[t], &left), 0);
+            mys_free2(arena, left, 1024);
+        }
+    }
+    mys_arena_sync(arena);
+    AS_EQ_SIZET(arena->alive, 0);
+    AS_EQ_SIZET(arena->total, (bytes_per_round * 200 + 1024) * NWAVES * NWAVE_THREADS);
+    AS_EQ_SIZET(arena->freed, arena->total);
+    AS_LE_SIZET(arena->peak, (bytes_per_round + 1024) * NWAVE_THREADS + 65 * 64 * 1024); // 64 KiB error per shard
+    mys_arena_destroy(&arena);
+}
+
+// Counters clamp alive at 0 while threads run, but an over-free is reported once the arena is idle
+static void check_over_free()
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        mys_arena_t *arena = mys_arena_create("over-free");
+        void *ptr = mys_malloc2(arena, 64);
+        mys_free2(arena, ptr, 64);
+        mys_free_record(arena, 64); // as a second mys_free2() of ptr would
+        mys_arena_sync(arena);
+        AS_EQ_SIZET(arena->alive, 0);
+        mys_arena_destroy(&arena);
+        _exit(0);
+    }
+    int status = 0;
+    AS_EQ_I32(waitpid(pid, &status, 0), pid);
+    AS_TRUE(!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+}
+
+int main(int argc, char **argv)
+{
+    int nrounds = (argc > 1) ? atoi(argv[1]) : 20000;
+    int threads[2] = {1, 64};
+    size_t bytes_per_round = 0;
+    for (int i = 0; i < NLIVE; i++)
+        bytes_per_round += 16 + (size_t)i * 8;
+
+    check_churn(bytes_per_round);
+    check_over_free();
+
+    printf("%8s %14s %14s %14s\n", "threads", "malloc(ns)", "malloc2(ns)", "overhead(ns)");
+    for (int k = 0; k < 2; k++) {
+        int nthreads = threads[k];
+        int nr = nrounds / nthreads + 1;
+        mys_arena_t *arena = mys_arena_create("stats");
+        bench(NULL, nthreads, nr / 10 + 1); // warmup
+        double t_libc = bench(NULL, nthreads, nr);
+        double t_arena = bench(arena, nthreads, nr);
+
+        // Counters must be exact once all threads stopped
+        mys_arena_sync(arena);
+        AS_EQ_SIZET(arena->alive, 0);
+        AS_EQ_SIZET(arena->total, bytes_per_round * (size_t)nr * (size_t)nthreads);
+        AS_EQ_SIZET(arena->freed, arena->total);
+        AS_LE_SIZET(arena->peak, bytes_per_round * (size_t)nthreads);
+        mys_arena_destroy(&arena);
+
+        double nops = (double)NLIVE * nr * nthreads;
+        printf("%8d %14.2f %14.2f %14.2f\n", nthreads, t_libc / nops * 1e9, t_arena / nops * 1e9, (t_arena - t_libc) / nops * 1e9);
+    }
+    return 0;
+}
@@ -55,6 +55,7 @@ int main()
     }
 
     printf("alloc_count=%zu free_count=%zu cleanup_count=%zu\n", alloc_count, free_count, cleanup_count);
+    mys_arena_sync(arena);
     AS_EQ_SIZET(arena->alive, 0);
     AS_EQ_SIZET(arena->freed, arena->total);
     mys_arena_destroy(&arena);
@@ -0,0 +1,96 @@
+// make test-pool-batch.exe && ./test-pool-batch.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+static double bench_single(mys_pool_t *pool, void **objs, size_t nbatch, int nrounds)
+{
+    double t0 = mys_hrtime();
+    for (int round = 0; round < nrounds; round++) {
+        for (size_t i = 0; i < nbatch; i++) {
+            objs[i] = mys_pool_acquire(pool);
+            *(size_t *)objs[i] = i;
+        }
+        for (size_t i = 0; i < nbatch; i++)
+            mys_pool_release(pool, objs[i]);
+    }
+    return mys_hrtime() - t0;
+}
+
+static double bench_batch(mys_pool_t *pool, void **objs, size_t nbatch, int nrounds)
+{
+    double t0 = mys_hrtime();
+    for (int round = 0; round < nrounds; round++) {
+        size_t got = mys_pool_acquire_n(pool, objs, nbatch);
+        AS_EQ_SIZET(got, nbatch);
+        for (size_t i = 0; i < nbatch; i++)
+            *(size_t *)objs[i] = i;
+        mys_pool_release_n(pool, objs, nbatch);
+    }
+    return mys_hrtime() - t0;
+}
+
+int main()
+{
+    mys_rand_seed_hardware();
+    size_t max_batch = 4096;
+    void **objs = (void **)calloc(sizeof(void *), max_batch);
+
+    // Validate: batched objects are distinct and survive interleaving with single calls
+    int strategies[] = { MYS_POOL_DEFAULT, MYS_POOL_INTRUSIVE, MYS_POOL_CONCURRENT, MYS_POOL_CONCURRENT | MYS_POOL_INTRUSIVE };
+    for (size_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+        mys_pool_t *pool = mys_pool_create2(sizeof(size_t), 8, strategies[s]);
+        for (int iter = 0; iter < 100; iter++) {
+            size_t n = mys_rand_i32(1, (int)max_batch);
+            AS_EQ_SIZET(mys_pool_acquire_n(pool, objs, n), n);
+            for (size_t i = 0; i < n; i++)
+                *(size_t *)objs[i] = i;
+            void *single = mys_pool_acquire(pool);
+            for (size_t i = 0; i < n; i++)
+                AS_EQ_SIZET(*(size_t *)objs[i], i);
+            if (iter % 2 == 1) { // release objects of many blocks interleaved
+                for (size_t i = n - 1; i > 0; i--) {
+                    size_t j = mys_rand_i32(0, (int)i + 1);
+                    void *tmp = objs[i];
+                    objs[i] = objs[j];
+                    objs[j] = tmp;
+                }
+            }
+            mys_pool_release_n(pool, objs, n / 2);
+            mys_pool_release(pool, single);
+            mys_pool_release_n(pool, objs + n / 2, n - n / 2);
+        }
+        mys_pool_destroy(&pool);
+    }
+
+    printf("%8s %16s %16s %8s\n", "batch", "single(ops/s)", "batched(ops/s)", "speedup");
+    for (size_t nbatch = 16; nbatch <= max_batch; nbatch *= 4) {
+        int nrounds = (int)(8 * 1024 * 1024 / nbatch);
+        // Each trial uses a fresh pool, since blocks grow as a pool ages. Keep the best of a few trials.
+        double ts = 1e30, tb = 1e30;
+        for (int trial = 0; trial < 3; trial++) {
+            mys_pool_t *pool = mys_pool_create2(sizeof(size_t), 64, MYS_POOL_DEFAULT);
+            bench_single(pool, objs, nbatch, nrounds / 10 + 1); // warmup
+            double t = bench_single(pool, objs, nbatch, nrounds);
+            ts = t < ts ? t : ts;
+            mys_pool_destroy(&pool);
+            pool = mys_pool_create2(sizeof(size_t), 64, MYS_POOL_DEFAULT);
+            bench_batch(pool, objs, nbatch, nrounds / 10 + 1); // warmup
+            t = bench_batch(pool, objs, nbatch, nrounds);
+            tb = t < tb ? t : tb;
+            mys_pool_destroy(&pool);
+        }
+        double nops = 2.0 * nbatch * nrounds;
+        printf("%8zu %16.3e %16.3e %7.2fx\n", nbatch, nops / ts, nops / tb, ts / tb);
+    }
+
+    mys_arena_sync(MYS_ARENA_POOL);
+    AS_EQ_SIZET(MYS_ARENA_POOL->alive, 0);
+    AS_EQ_SIZET(MYS_ARENA_POOL->freed, MYS_ARENA_POOL->total);
+    free(objs);
+    return 0;
+}
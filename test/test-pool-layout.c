@@ -0,0 +1,69 @@
+// make test-pool-layout.exe && ./test-pool-layout.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+static void bench(const char *name, size_t object_size, int strategy, void **objs, size_t nobjs)
+{
+    mys_arena_sync(MYS_ARENA_POOL);
+    size_t alive_before = MYS_ARENA_POOL->alive;
+    mys_pool_t *pool = mys_pool_create2(object_size, 64, strategy);
+    mys_arena_sync(MYS_ARENA_POOL);
+    size_t pool_bytes = MYS_ARENA_POOL->alive - alive_before;
+
+    double t0 = mys_hrtime();
+    for (size_t i = 0; i < nobjs; i++)
+        objs[i] = mys_pool_acquire(pool);
+    double t1 = mys_hrtime();
+    for (size_t i = 0; i < nobjs; i++)
+        memset(objs[i], (int)(i & 0xFF), object_size);
+    for (size_t i = 0; i < nobjs; i++)
+        AS_EQ_U32(((uint8_t *)objs[i])[object_size - 1], (uint32_t)(i & 0xFF));
+    mys_arena_sync(MYS_ARENA_POOL);
+    size_t used = MYS_ARENA_POOL->alive - alive_before - pool_bytes;
+    // Release in shuffled order to defeat the trivial LIFO pattern
+    for (size_t i = nobjs - 1; i > 0; i--) {
+        size_t j = (size_t)mys_rand_i64(0, (int64_t)i);
+        void *tmp = objs[i]; objs[i] = objs[j]; objs[j] = tmp;
+    }
+    double t2 = mys_hrtime();
+    for (size_t i = 0; i < nobjs; i++)
+        mys_pool_release(pool, objs[i]);
+    double t3 = mys_hrtime();
+    // Steady state: objects come from free lists of existing blocks
+    double t4 = mys_hrtime();
+    for (size_t i = 0; i < nobjs; i++)
+        objs[i] = mys_pool_acquire(pool);
+    for (size_t i = 0; i < nobjs; i++)
+        mys_pool_release(pool, objs[i]);
+    double t5 = mys_hrtime();
+
+    printf("%-10s %6zu %12.2f %14.2f %14.2f %14.2f\n", name, object_size,
+        (double)used / (double)nobjs,
+        (t1 - t0) * 1e9 / nobjs, (t3 - t2) * 1e9 / nobjs, (t5 - t4) * 1e9 / nobjs / 2);
+    mys_pool_destroy(&pool);
+}
+
+int main(int argc, char **argv)
+{
+    mys_rand_seed_hardware();
+    size_t nobjs = (argc > 1) ? (size_t)atol(argv[1]) : 1024 * 1024;
+    void **objs = (void **)calloc(sizeof(void *), nobjs);
+    size_t sizes[] = {8, 16, 24, 64};
+
+    printf("%-10s %6s %12s %14s %14s %14s\n", "layout", "size", "bytes/obj", "acquire(ns)", "release(ns)", "steady(ns/op)");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench("default", sizes[i], MYS_POOL_DEFAULT, objs, nobjs);
+        bench("intrusive", sizes[i], MYS_POOL_INTRUSIVE, objs, nobjs);
+    }
+
+    mys_arena_sync(MYS_ARENA_POOL);
+    AS_EQ_SIZET(MYS_ARENA_POOL->alive, 0);
+    AS_EQ_SIZET(MYS_ARENA_POOL->freed, MYS_ARENA_POOL->total);
+    free(objs);
+    return 0;
+}
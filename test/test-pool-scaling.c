@@ -0,0 +1,144 @@
+// make test-pool-scaling.exe && OMP_NUM_THREADS=8 ./test-pool-scaling.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <omp.h>
+#include <pthread.h>
+
+#define MYS_IMPL
+#define MYS_NO_MPI
+#include "mys.h"
+
+#define NLIVE 256
+
+// Each thread repeatedly acquires NLIVE objects then releases them.
+// Every other round releases objects acquired by the neighbor thread to exercise cross-thread frees.
+static double bench(mys_pool_t *pool, int nthreads, int nrounds, void ***slots)
+{
+    double t0 = mys_hrtime();
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int tid = omp_get_thread_num();
+        for (int round = 0; round < nrounds; round++) {
+            void **mine = slots[tid];
+            for (int i = 0; i < NLIVE; i++) {
+                int *obj = (int *)mys_pool_acquire(pool);
+                AS_NE_PTR(obj, NULL);
+                *obj = tid;
+                mine[i] = obj;
+            }
+            #pragma omp barrier
+            void **victim = (round % 2 == 0) ? mine : slots[(tid + 1) % nthreads];
+            for (int i = 0; i < NLIVE; i++) {
+                mys_pool_release(pool, victim[i]);
+            }
+            #pragma omp barrier
+        }
+    }
+    double t1 = mys_hrtime();
+    return t1 - t0;
+}
+
+#define NCHURN 600 // more short-lived threads than any fixed per-thread table would hold
+#define NHAND 16
+
+typedef struct churn_t {
+    mys_pool_t *pool;
+    int *inuse; // [NCHURN * NLIVE] slot flags, indexed by the payload of an object
+    void *handoff[NHAND]; // acquired by the previous thread, released by the next one
+} churn_t;
+
+static void *churn_acquire(churn_t *c, int stamp)
+{
+    int *obj = (int *)mys_pool_acquire(c->pool);
+    AS_NE_PTR(obj, NULL);
+    *obj = stamp;
+    AS_EQ_I32(mys_atomic_exchange_n(&c->inuse[stamp], 1, MYS_ATOMIC_RELAXED), 0);
+    return obj;
+}
+
+static void churn_release(churn_t *c, void *obj)
+{
+    // An object handed out twice would have been overwritten by another stamp
+    int stamp = *(int *)obj;
+    AS_EQ_I32(mys_atomic_exchange_n(&c->inuse[stamp], 0, MYS_ATOMIC_RELAXED), 1);
+    mys_pool_release(c->pool, obj);
+}
+
+static void *churn_main(void *arg)
+{
+    churn_t *c = (churn_t *)arg;
+    int id = (int)mys_thread_id();
+    int base = (id % NCHURN) * NLIVE;
+    void *mine[NLIVE / 4];
+    for (int i = 0; i < NLIVE / 4; i++)
+        mine[i] = churn_acquire(c, base + i);
+    for (int i = 0; i < NHAND; i++) {
+        if (c->handoff[i] != NULL)
+            churn_release(c, c->handoff[i]);
+        c->handoff[i] = churn_acquire(c, base + NLIVE / 4 + i);
+    }
+    for (int i = 0; i < NLIVE / 4; i++)
+        churn_release(c, mine[i]);
+    return NULL;
+}
+
+// Threads come and go one by one. Each one releases objects acquired by its predecessor
+// and leaves its magazine behind on exit. The pool must not grow with the number of threads.
+static void check_churn()
+{
+    churn_t c;
+    c.pool = mys_pool_create2(sizeof(int), 64, MYS_POOL_CONCURRENT);
+    c.inuse = (int *)calloc(sizeof(int), NCHURN * NLIVE);
+    for (int i = 0; i < NHAND; i++)
+        c.handoff[i] = NULL;
+
+    size_t settled = 0;
+    for (int t = 0; t < NCHURN; t++) {
+        pthread_t thread;
+        AS_EQ_I32(pthread_create(&thread, NULL, churn_main, &c), 0);
+        AS_EQ_I32(pthread_join(thread, NULL), 0);
+        mys_arena_sync(MYS_ARENA_POOL);
+        if (t == 7)
+            settled = MYS_ARENA_POOL->alive;
+        if (t > 7)
+            AS_LE_SIZET(MYS_ARENA_POOL->alive, settled);
+    }
+    for (int i = 0; i < NHAND; i++)
+        churn_release(&c, c.handoff[i]);
+    for (int i = 0; i < NCHURN * NLIVE; i++)
+        AS_EQ_I32(c.inuse[i], 0);
+    mys_pool_destroy(&c.pool);
+    free(c.inuse);
+}
+
+int main(int argc, char **argv)
+{
+    check_churn();
+
+    int max_threads = omp_get_max_threads();
+    int nrounds = (argc > 1) ? atoi(argv[1]) : 2000;
+    void ***slots = (void ***)calloc(sizeof(void **), max_threads);
+    for (int t = 0; t < max_threads; t++)
+        slots[t] = (void **)calloc(sizeof(void *), NLIVE);
+
+    printf("%8s %16s %16s\n", "threads", "ops/sec", "ops/sec/thread");
+    for (int nthreads = 1; ; nthreads = (nthreads * 2 < max_threads) ? nthreads * 2 : max_threads) {
+        mys_pool_t *pool = mys_pool_create2(sizeof(int), 64, MYS_POOL_CONCURRENT);
+        bench(pool, nthreads, nrounds / 10 + 1, slots); // warmup
+        double t = bench(pool, nthreads, nrounds, slots);
+        double nops = 2.0 * NLIVE * nrounds * nthreads;
+        printf("%8d %16.3e %16.3e\n", nthreads, nops / t, nops / t / nthreads);
+        mys_pool_destroy(&pool);
+        if (nthreads == max_threads)
+            break;
+    }
+
+    mys_arena_sync(MYS_ARENA_POOL);
+    AS_EQ_SIZET(MYS_ARENA_POOL->alive, 0);
+    AS_EQ_SIZET(MYS_ARENA_POOL->freed, MYS_ARENA_POOL->total);
+    for (int t = 0; t < max_threads; t++)
+        free(slots[t]);
+    free(slots);
+    return 0;
+}
@@ -51,8 +51,9 @@ int main()
 
     printf("acquire_count=%d release_count=%d\n", acquire_count, release_count);
     mys_pool_destroy(&pool);
-    AS_EQ_SIZET(mys_arena_pool->alive, 0);
-    AS_EQ_SIZET(mys_arena_pool->freed, mys_arena_pool->total);
+    mys_arena_sync(MYS_ARENA_POOL);
+    AS_EQ_SIZET(MYS_ARENA_POOL->alive, 0);
+    AS_EQ_SIZET(MYS_ARENA_POOL->freed, MYS_ARENA_POOL->total);
     free(allocateds);
     free(operations);
 
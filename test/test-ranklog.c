@@ -0,0 +1,146 @@
+// make test-ranklog.exe && mpirun -np 4 ./test-ranklog.exe
+// make test-ranklog-stub.exe && ./test-ranklog-stub.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define MYS_IMPL
+#include "mys.h"
+
+#define FOLDER "/tmp/mys-test-ranklog"
+
+// Returns the number of lines of a file, and the sequence numbers of its first and last lines
+static int scan_file(const char *path, int *first, int *last)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    char line[1024];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *msg = strstr(line, "] seq ");
+        AS_NE_PTR(msg, NULL);
+        int seq = atoi(msg + 6);
+        if (count == 0)
+            *first = seq;
+        else
+            AS_EQ_I32(seq, *last + 1);
+        *last = seq;
+        count += 1;
+    }
+    fclose(file);
+    return count;
+}
+
+static size_t file_size(const char *path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) ? (size_t)st.st_size : 0;
+}
+
+// Rotation keeps max_files files below max_bytes, and the newest lines in the current file
+static void test_rotation(int myrank)
+{
+    const size_t max_bytes = 64 << 10;
+    mys_log_t *logger = mys_log_create("rotation");
+    mys_ranklog_sink_t *sink = mys_ranklog_sink_create(mys_MPI_COMM_WORLD, FOLDER, max_bytes, 3);
+    AS_NE_PTR(sink, NULL);
+    mys_ranklog_sink_set_buffer(sink, 4096, MYS_LOG_ERROR);
+    mys_log_add_handler(logger, mys_ranklog_handler, sink);
+    const char *path = mys_ranklog_sink_path(sink);
+    char expect[256];
+    snprintf(expect, sizeof(expect), "/rank.%06d.log", myrank);
+    ASX_TRUE(strstr(path, "/node.") != NULL && strstr(path, expect) != NULL, "got \"%s\"", path);
+
+    const int nlines = 10000; // about 450 KB, several rotations
+    for (int i = 0; i < nlines; i++)
+        mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "seq %d of rank %d", i, myrank);
+    mys_ranklog_sink_flush(sink);
+
+    char older[4200];
+    int first = -1, last = -1, next_first = nlines;
+    int count = scan_file(path, &first, &last);
+    AS_GT_I32(count, 0);
+    AS_EQ_I32(last, nlines - 1);
+    AS_LE_SIZET(file_size(path), max_bytes);
+    next_first = first;
+    for (int i = 1; i <= 2; i++) { // .1 holds the lines right before the current file, .2 before .1
+        snprintf(older, sizeof(older), "%s.%d", path, i);
+        AS_GT_I32(scan_file(older, &first, &last), 0);
+        AS_EQ_I32(last, next_first - 1);
+        AS_LE_SIZET(file_size(older), max_bytes);
+        next_first = first;
+    }
+    snprintf(older, sizeof(older), "%s.3", path);
+    AS_EQ_I32(mys_path_is_exists(older), false);
+
+    // An error line is written before the call returns
+    size_t size = file_size(path);
+    mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "seq %d buffered", nlines);
+    AS_EQ_SIZET(file_size(path), size);
+    mys_log_self(logger, MYS_LOG_ERROR, __FILE__, __LINE__, "seq %d flushed", nlines + 1);
+    AS_GT_SIZET(file_size(path), size);
+    mys_log_destroy(&logger);
+    mys_ranklog_sink_destroy(&sink);
+}
+
+int main(int argc, char **argv)
+{
+    mys_MPI_Init(&argc, &argv);
+    int myrank, nranks;
+    mys_MPI_Comm_rank(mys_MPI_COMM_WORLD, &myrank);
+    mys_MPI_Comm_size(mys_MPI_COMM_WORLD, &nranks);
+    if (myrank == 0)
+        AS_EQ_I32(system("rm -rf " FOLDER), 0);
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+
+    test_rotation(myrank);
+
+    // Lines per second per rank: the sink, a stdio handler on a per-rank FILE, and RANKLOG()
+    const int nlines = 200000;
+    double t0, t1;
+    mys_log_t *logger = mys_log_create("bench");
+    mys_ranklog_sink_t *sink = mys_ranklog_sink_create(mys_MPI_COMM_WORLD, FOLDER "/sink", 0, 1);
+    mys_log_add_handler(logger, mys_ranklog_handler, sink);
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    for (int i = 0; i < nlines; i++)
+        mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "step %d residual %.6e", i, i * 1e-3);
+    mys_ranklog_sink_destroy(&sink);
+    t1 = mys_hrtime();
+    double sink_rate = nlines / (t1 - t0);
+    mys_log_clear_handler(logger);
+
+    char name[256];
+    snprintf(name, sizeof(name), FOLDER "/stdio.%06d.log", myrank);
+    FILE *file = fopen(name, "w");
+    mys_log_add_handler(logger, mys_log_stdio_handler1, file);
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    for (int i = 0; i < nlines; i++)
+        mys_log_self(logger, MYS_LOG_INFO, __FILE__, __LINE__, "step %d residual %.6e", i, i * 1e-3);
+    fclose(file);
+    t1 = mys_hrtime();
+    double stdio_rate = nlines / (t1 - t0);
+    mys_log_destroy(&logger);
+
+    mys_log_silent(MYS_LOGGER_G, true); // RANKLOG_OPEN/CLOSE print a line each
+    RANKLOG_OPEN(FOLDER "/old");
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    t0 = mys_hrtime();
+    for (int i = 0; i < nlines; i++)
+        RANKLOG(FOLDER "/old", "step %d residual %.6e", i, i * 1e-3);
+    RANKLOG_CLOSE(FOLDER "/old");
+    t1 = mys_hrtime();
+    double old_rate = nlines / (t1 - t0);
+    mys_log_silent(MYS_LOGGER_G, false);
+
+    ILOG(0, "%d ranks, lines/s per rank: ranklog sink %.2fM, stdio handler %.2fM, RANKLOG %.2fM",
+        nranks, sink_rate * 1e-6, stdio_rate * 1e-6, old_rate * 1e-6);
+    mys_MPI_Barrier(mys_MPI_COMM_WORLD);
+    if (myrank == 0)
+        AS_EQ_I32(system("rm -rf " FOLDER), 0);
+    mys_MPI_Finalize();
+    return 0;
+}
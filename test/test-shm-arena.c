@@ -0,0 +1,84 @@
+// make test-shm-arena.exe && mpirun -n 4 ./test-shm-arena.exe
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <mpi.h>
+
+#define MYS_IMPL
+#define MYS_ENABLE_SHM
+#include "mys.h"
+
+#define NTABLE (1 << 20)
+#define NROUNDS 2000
+
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+    int myrank, nranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+    mys_commgroup_t *node = mys_commgroup_create_node(MPI_COMM_WORLD);
+
+    mys_shm_arena_t *shm = mys_shm_arena_create(MPI_COMM_WORLD, 64 * 1024 * 1024);
+    AS_NE_PTR(shm, NULL);
+
+    // One read-only table per node instead of one per rank
+    double *table = (double *)mys_shm_arena_alloc_shared(shm, NTABLE * sizeof(double));
+    AS_NE_PTR(table, NULL);
+    if (node->local_myrank == 0) {
+        for (int i = 0; i < NTABLE; i++)
+            table[i] = (double)i;
+    }
+    MPI_Barrier(node->local_comm);
+    for (int i = 0; i < NTABLE; i += 997)
+        AS_EQ_F64(table[i], (double)i);
+
+    // Concurrent independent allocations from all ranks of the node
+    void *objs[16] = {NULL};
+    for (int round = 0; round < NROUNDS; round++) {
+        int k = round % 16;
+        if (objs[k] != NULL) {
+            AS_EQ_I32(*(int *)objs[k], myrank);
+            mys_shm_arena_free(shm, objs[k]);
+        }
+        objs[k] = mys_shm_arena_alloc(shm, 8 + (size_t)(round % 7) * 1000);
+        AS_NE_PTR(objs[k], NULL);
+        AS_EQ_U64((uint64_t)objs[k] % 64, 0);
+        *(int *)objs[k] = myrank;
+    }
+
+    // Pass an object to the next rank of the node through its offset
+    size_t offset = mys_shm_arena_offset(shm, objs[0]);
+    size_t recv_offset = 0;
+    int next = (node->local_myrank + 1) % node->local_nranks;
+    int prev = (node->local_myrank - 1 + node->local_nranks) % node->local_nranks;
+    MPI_Sendrecv(&offset, sizeof(size_t), MPI_BYTE, next, 0, &recv_offset, sizeof(size_t), MPI_BYTE, prev, 0, node->local_comm, MPI_STATUS_IGNORE);
+    AS_EQ_I32(*(int *)mys_shm_arena_ptr(shm, recv_offset), mys_query_brother(node, prev));
+    MPI_Barrier(node->local_comm);
+
+    for (int k = 0; k < 16; k++)
+        mys_shm_arena_free(shm, objs[k]);
+    MPI_Barrier(node->local_comm);
+
+    size_t alive, peak;
+    mys_shm_arena_usage(shm, &alive, &peak);
+    AS_LT_SIZET(alive, NTABLE * sizeof(double) + 1024);
+    mys_shm_arena_free_shared(shm, table);
+    MPI_Barrier(node->local_comm);
+    mys_shm_arena_usage(shm, &alive, NULL);
+    AS_EQ_SIZET(alive, 0);
+    MPI_Barrier(node->local_comm);
+
+    // Everything coalesced back: the whole capacity is available again
+    void *all = mys_shm_arena_alloc_shared(shm, 64 * 1024 * 1024);
+    AS_NE_PTR(all, NULL);
+    mys_shm_arena_free_shared(shm, all);
+
+    if (myrank == 0)
+        printf("%d ranks/node: table %zu bytes per node instead of %zu, peak %zu bytes\n", node->local_nranks,
+               (size_t)NTABLE * sizeof(double), (size_t)NTABLE * sizeof(double) * node->local_nranks, peak);
+    mys_shm_arena_destroy(&shm);
+    mys_commgroup_release(node);
+    MPI_Finalize();
+    return 0;
+}
@@ -1,16 +1,285 @@
-// make test-trace && valgrind --leak-check=full --show-leak-kinds=all --track-fds=yes ./a.out
+// make test-trace.exe && valgrind --leak-check=full --show-leak-kinds=all --track-fds=yes ./test-trace.exe
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <omp.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #define MYS_IMPL
 #define MYS_NO_MPI
 #include "mys.h"
 
+#define MAX_THREADS 64
+
+// Every thread appends nper events cycling through 1~4 payload words, then the merged
+// stream is checked for global time order and per-thread, per-type sequence order.
+static void bench_threads(int nthreads, size_t nper)
+{
+    mys_trace_t *trace = mys_trace_create();
+    double t0 = mys_hrtime();
+    #pragma omp parallel num_threads(nthreads)
+    {
+        uint64_t me = (uint64_t)omp_get_thread_num();
+        for (uint64_t i = 0; i < nper; i += 4) {
+            mys_trace_1u(trace, (me << 32) | i);
+            mys_trace_2u(trace, (me << 32) | (i + 1), i);
+            mys_trace_3u(trace, (me << 32) | (i + 2), i, me);
+            mys_trace_4u(trace, (me << 32) | (i + 3), i, me, 4);
+        }
+    }
+    double t_wall = mys_hrtime() - t0;
+    size_t nevents = nper * (size_t)nthreads;
+    AS_EQ_SIZET(mys_trace_size(trace), nevents);
+
+    // Writers beyond the number of cores only time-share them
+    int ncores = (nthreads < omp_get_num_procs()) ? nthreads : omp_get_num_procs();
+
+    uint64_t last_seq[MAX_THREADS][5];
+    memset(last_seq, 0xff, sizeof(last_seq));
+    size_t niter = 0;
+    double last_time = 0;
+    double t1 = mys_hrtime();
+    mys_trace_iter_t *iter = mys_trace_start_iter(trace);
+    while (iter != NULL) {
+        AS_GE_F64(iter->e1->time, last_time);
+        last_time = iter->e1->time;
+        uint64_t thread = iter->e1->u1 >> 32;
+        uint64_t seq = iter->e1->u1 & 0xffffffff;
+        AS_LT_U64(thread, (uint64_t)nthreads);
+        AS_EQ_U64(seq % 4, (uint64_t)(iter->type - 1));
+        AS_TRUE(last_seq[thread][iter->type] == UINT64_MAX || last_seq[thread][iter->type] < seq);
+        last_seq[thread][iter->type] = seq;
+        if (iter->type >= MYS_TRACE_EVENT2) AS_EQ_U64(iter->e2->u2, seq - seq % 4);
+        if (iter->type >= MYS_TRACE_EVENT3) AS_EQ_U64(iter->e3->u3, thread);
+        if (iter->type == MYS_TRACE_EVENT4) AS_EQ_U64(iter->e4->u4, 4);
+        niter += 1;
+        iter = mys_trace_next_iter(trace, iter);
+    }
+    double t_merge = mys_hrtime() - t1;
+    AS_EQ_SIZET(niter, nevents);
+    ILOG(0, "%2d threads on %d cores: %.2f ns/event per writer, %.2f Mevent/s total, merge %.2f ns/event",
+        nthreads, ncores, t_wall * ncores * 1e9 / nevents, nevents / t_wall / 1e6, t_merge * 1e9 / nevents);
+    mys_trace_destroy(&trace);
+}
+
+// A flight recorder keeps the latest `cap` events of each thread and type with constant memory
+static void test_ring(size_t cap)
+{
+    mys_trace_t *trace = mys_trace_create_ring(cap);
+    size_t alive_after_first_lap = 0;
+    for (int round = 0; round < 20; round++) {
+        #pragma omp parallel num_threads(2)
+        {
+            uint64_t me = (uint64_t)omp_get_thread_num();
+            for (uint64_t i = round * cap; i < (round + 1) * cap; i++) {
+                mys_trace_1u(trace, (me << 32) | i);
+                mys_trace_3u(trace, (me << 32) | i, i, me);
+            }
+        }
+        mys_arena_sync(MYS_ARENA_TRACE);
+        if (round == 0)
+            alive_after_first_lap = MYS_ARENA_TRACE->alive;
+        AS_EQ_SIZET(MYS_ARENA_TRACE->alive, alive_after_first_lap);
+    }
+    size_t total = 20 * cap;
+    AS_EQ_SIZET(mys_trace_size(trace), 4 * cap);
+    AS_EQ_SIZET(mys_trace_dropped(trace), 4 * (total - cap));
+
+    uint64_t next_seq[2][5] = {{0}};
+    for (int t = 0; t < 2; t++)
+        for (int k = 0; k < 5; k++)
+            next_seq[t][k] = total - cap;
+    size_t niter = 0;
+    double last_time = 0;
+    mys_trace_iter_t *iter = mys_trace_start_iter(trace);
+    while (iter != NULL) {
+        AS_GE_F64(iter->e1->time, last_time);
+        last_time = iter->e1->time;
+        uint64_t thread = iter->e1->u1 >> 32;
+        uint64_t seq = iter->e1->u1 & 0xffffffff;
+        AS_EQ_U64(seq, next_seq[thread][iter->type]);
+        next_seq[thread][iter->type] += 1;
+        niter += 1;
+        iter = mys_trace_next_iter(trace, iter);
+    }
+    AS_EQ_SIZET(niter, 4 * cap);
+
+    // Dump the latest 10 events through a pipe, without allocating
+    int fds[2];
+    AS_EQ_I32(pipe(fds), 0);
+    mys_arena_sync(MYS_ARENA_TRACE);
+    size_t allocated = MYS_ARENA_TRACE->total;
+    AS_EQ_I32(mys_trace_dump(trace, fds[1], 10), 0);
+    mys_arena_sync(MYS_ARENA_TRACE);
+    AS_EQ_SIZET(MYS_ARENA_TRACE->total, allocated);
+    close(fds[1]);
+    char text[4096] = {0};
+    ssize_t len = read(fds[0], text, sizeof(text) - 1);
+    close(fds[0]);
+    AS_GT_I64((int64_t)len, 0);
+    int nlines = 0;
+    for (ssize_t i = 0; i < len; i++)
+        nlines += (text[i] == '\n') ? 1 : 0;
+    AS_EQ_I32(nlines, 1 + 10);
+    ILOG(0, "ring of %zu: kept %zu of %zu events, constant %zu bytes", cap, mys_trace_size(trace), 4 * total, alive_after_first_lap);
+    mys_trace_destroy(&trace);
+}
+
+// The debug signal handler dumps the registered flight recorder on crash
+static void test_crash_dump()
+{
+    int fds[2];
+    AS_EQ_I32(pipe(fds), 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDERR_FILENO);
+        mys_trace_t *trace = mys_trace_create_ring(64);
+        for (uint64_t i = 0; i < 1000; i++)
+            mys_trace_2u(trace, 0xdead0000 + i, i);
+        mys_debug_set_max_frames(1);
+        mys_debug_set_trace(trace, 5);
+        raise(SIGSEGV);
+        _exit(0);
+    }
+    close(fds[1]);
+    char text[65536] = {0};
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], text + len, sizeof(text) - 1 - len)) > 0)
+        len += (size_t)n;
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    AS_TRUE(strstr(text, "[mys_trace] 64 events (936 dropped), showing the last 5") != NULL);
+    AS_TRUE(strstr(text, "0xdead03e7") != NULL); // the last event
+    AS_TRUE(strstr(text, "0xdead03e2") == NULL); // older than the last 5
+}
+
+static uint32_t last_tid = 0;
+
+static void *append_one(void *arg)
+{
+    last_tid = (uint32_t)mys_thread_id();
+    mys_trace_1u((mys_trace_t *)arg, last_tid);
+    return NULL;
+}
+
+// Thread ids are never reused, so short-lived threads eventually run out of slots.
+// Their events are counted as dropped instead of aborting.
+static void test_many_threads()
+{
+    mys_trace_t *trace = mys_trace_create();
+    size_t nthreads = 0;
+    while (last_tid < 4096 + 16) {
+        pthread_t thread;
+        AS_EQ_I32(pthread_create(&thread, NULL, append_one, trace), 0);
+        AS_EQ_I32(pthread_join(thread, NULL), 0);
+        nthreads += 1;
+    }
+    size_t size = mys_trace_size(trace);
+    AS_GE_SIZET(size, 1);
+    AS_GE_SIZET(mys_trace_dropped(trace), 1);
+    AS_EQ_SIZET(size + mys_trace_dropped(trace), nthreads);
+    mys_trace_destroy(&trace);
+}
+
+static uint64_t read_varint(const uint8_t **pos)
+{
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *(*pos)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            return value;
+    }
+}
+
+// The binary export holds the same events in the same order as iteration
+static void test_export(size_t nevents)
+{
+    mys_trace_t *trace = mys_trace_create();
+    #pragma omp parallel num_threads(2)
+    {
+        uint64_t me = (uint64_t)omp_get_thread_num();
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < nevents; i++) {
+            switch (i % 4) {
+                case 0: mys_trace_1u(trace, i); break;
+                case 1: mys_trace_2u(trace, i, me); break;
+                case 2: mys_trace_3u(trace, i, me, ~i); break;
+                default: mys_trace_4u(trace, i, me, ~i, i * 3); break;
+            }
+        }
+    }
+
+    char file[256];
+    snprintf(file, sizeof(file), "/tmp/mys-test-trace.%d/rank.%06d.bin", (int)getpid(), 0);
+    double t0 = mys_hrtime();
+    AS_EQ_I32(mys_trace_export(trace, "/tmp/mys-test-trace.%d/rank.%06d.bin", (int)getpid(), 0), 0);
+    double t1 = mys_hrtime();
+
+    FILE *fp = fopen(file, "rb");
+    AS_NE_PTR(fp, NULL);
+    fseek(fp, 0, SEEK_END);
+    size_t len = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *content = (char *)malloc(len);
+    AS_EQ_SIZET(fread(content, 1, len, fp), len);
+    fclose(fp);
+    AS_GT_SIZET(len, 192);
+    AS_EQ_I32(memcmp(content, "MYSTRACE", 8), 0);
+    uint64_t nrecords, tick0;
+    double time0, freq;
+    memcpy(&nrecords, content + 24, sizeof(uint64_t));
+    memcpy(&tick0, content + 32, sizeof(uint64_t));
+    memcpy(&time0, content + 40, sizeof(double));
+    memcpy(&freq, content + 48, sizeof(double));
+    AS_EQ_U64(nrecords, nevents);
+
+    const uint8_t *pos = (const uint8_t *)content + 192;
+    uint64_t tick = tick0;
+    int tid = 0;
+    size_t niter = 0;
+    mys_trace_iter_t *iter = mys_trace_start_iter(trace);
+    while (iter != NULL) {
+        uint8_t head = *pos++;
+        AS_EQ_I32(head & 0x7, iter->type);
+        if (head & 0x8)
+            tid = (int)read_varint(&pos);
+        AS_EQ_I32(tid, iter->tid);
+        tick += read_varint(&pos);
+        AS_EQ_U64(tick, iter->tick);
+        uint64_t words[4];
+        memcpy(words, pos, sizeof(uint64_t) * iter->type);
+        pos += sizeof(uint64_t) * iter->type;
+        AS_EQ_I32(memcmp(words, &iter->e4->u1, sizeof(uint64_t) * iter->type), 0);
+        AS_EQ_DOUBLE(time0 + (double)(int64_t)(tick - tick0) / freq, iter->e1->time);
+        niter += 1;
+        iter = mys_trace_next_iter(trace, iter);
+    }
+    AS_EQ_SIZET(niter, nevents);
+    AS_EQ_SIZET((size_t)(pos - (const uint8_t *)content), len);
+    ILOG(0, "export %zu events took %fms -> %.2fns/event, %.2f bytes/event", nevents, (t1 - t0) * 1e3, (t1 - t0) * 1e9 / nevents, (double)(len - 192) / nevents);
+    free(content);
+    unlink(file);
+    *strrchr(file, '/') = '\0';
+    rmdir(file);
+    mys_trace_destroy(&trace);
+}
+
 int main()
 {
     mys_debug_init();
     mys_rand_seed_time();
+
+    mys_hrcalib_t calib = mys_hrcalibrate();
+    ILOG(0, "%s: %.3f MHz, resolution %.2f ns, read %.2f ns, skew %.2f ns over %d cores, drift %.2e",
+        mys_hrname_raw(), calib.freq / 1e6, calib.resolution * 1e9, calib.overhead * 1e9, calib.skew * 1e9, calib.ncpus, calib.drift);
+    AS_GT_U64(calib.freq, 0);
+    AS_GE_I32(calib.ncpus, 1);
     // uint64_t ndata = 512;
     // uint64_t ndata = 1 * 1024;
     // uint64_t ndata = 2 * 1024;
@@ -64,19 +333,25 @@ int main()
     }
 
     mys_trace_destroy(&trace);
-    char *alive_str = NULL;
-    char *freed_str = NULL;
-    char *total_str = NULL;
-    mys_readable_size(&alive_str, mys_arena_trace->alive, 2);
-    mys_readable_size(&freed_str, mys_arena_trace->freed, 2);
-    mys_readable_size(&total_str, mys_arena_trace->total, 2);
+
+    bench_threads(1, 1 << 22);
+    bench_threads(MAX_THREADS, 1 << 16);
+    test_ring(1000);
+    test_crash_dump();
+    test_export(1 << 22);
+    test_many_threads();
+
+    mys_arena_sync(MYS_ARENA_TRACE);
+    char alive_str[32];
+    char freed_str[32];
+    char total_str[32];
+    mys_to_readable_size(MYS_ARENA_TRACE->alive, 2, alive_str, sizeof(alive_str));
+    mys_to_readable_size(MYS_ARENA_TRACE->freed, 2, freed_str, sizeof(freed_str));
+    mys_to_readable_size(MYS_ARENA_TRACE->total, 2, total_str, sizeof(total_str));
     ILOG(0, "arena alive %s freed %s total %s", alive_str, freed_str, total_str);
-    AS_EQ_SIZET(mys_arena_trace->freed, mys_arena_trace->total);
+    AS_EQ_SIZET(MYS_ARENA_TRACE->freed, MYS_ARENA_TRACE->total);
     free(data);
     free(validate);
-    free(alive_str);
-    free(freed_str);
-    free(total_str);
     mys_debug_fini();
     return 0;
 }